@@ -0,0 +1,143 @@
+/*
+ * SHA1 block functions using the x86 SHA extensions and AVX2.  They
+ * are compiled for those instruction sets whatever the target of the
+ * rest of the build, and block-sha1/sha1.c only calls them after
+ * checking that the CPU supports them.
+ */
+
+#include "../git-compat-util.h"
+
+#include "sha1-x86.h"
+
+#ifdef BLK_SHA1_X86
+
+#include <immintrin.h>
+
+/*
+ * Four rounds with the SHA extensions.  The message words of round
+ * group g (of 20) are in MSG[g % 4], and E[g & 1] receives E for the
+ * group; the schedule for the groups to come is computed along the
+ * way (the extra steps in the last groups are harmless).
+ */
+#define SHANI_GROUP(g, f) do { \
+	if (g) \
+		E[(g) & 1] = _mm_sha1nexte_epu32(E[(g) & 1], MSG[(g) % 4]); \
+	else \
+		E[0] = _mm_add_epi32(E[0], MSG[0]); \
+	E[((g) + 1) & 1] = ABCD; \
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E[(g) & 1], f); \
+	if ((g) >= 3) \
+		MSG[((g) + 1) % 4] = _mm_sha1msg2_epu32(MSG[((g) + 1) % 4], MSG[(g) % 4]); \
+	if ((g) >= 1) \
+		MSG[((g) + 3) % 4] = _mm_sha1msg1_epu32(MSG[((g) + 3) % 4], MSG[(g) % 4]); \
+	if ((g) >= 2) \
+		MSG[((g) + 2) % 4] = _mm_xor_si128(MSG[((g) + 2) % 4], MSG[(g) % 4]); \
+} while (0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+void blk_SHA1_blocks_shani(unsigned int H[5], const void *data, unsigned long nr)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+					    0x08090a0b0c0d0e0fULL);
+	const unsigned char *p = data;
+	__m128i ABCD, ABCD_SAVE, E_SAVE, E[2], MSG[4];
+
+	ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)H), 0x1b);
+	E[0] = _mm_set_epi32(H[4], 0, 0, 0);
+
+	while (nr--) {
+		int i;
+
+		ABCD_SAVE = ABCD;
+		E_SAVE = E[0];
+		for (i = 0; i < 4; i++)
+			MSG[i] = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)(p + 16 * i)), mask);
+
+		SHANI_GROUP(0, 0); SHANI_GROUP(1, 0); SHANI_GROUP(2, 0);
+		SHANI_GROUP(3, 0); SHANI_GROUP(4, 0);
+		SHANI_GROUP(5, 1); SHANI_GROUP(6, 1); SHANI_GROUP(7, 1);
+		SHANI_GROUP(8, 1); SHANI_GROUP(9, 1);
+		SHANI_GROUP(10, 2); SHANI_GROUP(11, 2); SHANI_GROUP(12, 2);
+		SHANI_GROUP(13, 2); SHANI_GROUP(14, 2);
+		SHANI_GROUP(15, 3); SHANI_GROUP(16, 3); SHANI_GROUP(17, 3);
+		SHANI_GROUP(18, 3); SHANI_GROUP(19, 3);
+
+		E[0] = _mm_sha1nexte_epu32(E[0], E_SAVE);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+		p += 64;
+	}
+
+	_mm_storeu_si128((__m128i *)H, _mm_shuffle_epi32(ABCD, 0x1b));
+	H[4] = _mm_extract_epi32(E[0], 3);
+}
+
+#define ROL8(x, n) \
+	_mm256_or_si256(_mm256_slli_epi32((x), (n)), _mm256_srli_epi32((x), 32 - (n)))
+
+/*
+ * The usual SHA1 round, on eight independent lanes: W holds word t of
+ * the message schedule of every lane.
+ */
+#define ROUND8(t, fn, k) do { \
+	__m256i tmp; \
+	if ((t) >= 16) \
+		W[(t) & 15] = ROL8(_mm256_xor_si256( \
+			_mm256_xor_si256(W[((t) + 13) & 15], W[((t) + 8) & 15]), \
+			_mm256_xor_si256(W[((t) + 2) & 15], W[(t) & 15])), 1); \
+	tmp = _mm256_add_epi32(_mm256_add_epi32(ROL8(A, 5), (fn)), \
+			       _mm256_add_epi32(_mm256_add_epi32(E, (k)), W[(t) & 15])); \
+	E = D; D = C; C = ROL8(B, 30); B = A; A = tmp; \
+} while (0)
+
+#define F0(b, c, d) _mm256_xor_si256(_mm256_and_si256(_mm256_xor_si256((c), (d)), (b)), (d))
+#define F1(b, c, d) _mm256_xor_si256(_mm256_xor_si256((b), (c)), (d))
+#define F2(b, c, d) _mm256_or_si256(_mm256_and_si256((b), (c)), \
+				    _mm256_and_si256((d), _mm256_or_si256((b), (c))))
+
+__attribute__((target("avx2")))
+void blk_SHA1_x8_avx2(unsigned int H[5][8], const unsigned char *blocks[8])
+{
+	__m256i A, B, C, D, E, W[16];
+	const __m256i k0 = _mm256_set1_epi32(0x5a827999);
+	const __m256i k1 = _mm256_set1_epi32(0x6ed9eba1);
+	const __m256i k2 = _mm256_set1_epi32(0x8f1bbcdc);
+	const __m256i k3 = _mm256_set1_epi32(0xca62c1d6);
+	int t;
+
+	for (t = 0; t < 16; t++)
+		W[t] = _mm256_set_epi32(get_be32(blocks[7] + 4 * t),
+					get_be32(blocks[6] + 4 * t),
+					get_be32(blocks[5] + 4 * t),
+					get_be32(blocks[4] + 4 * t),
+					get_be32(blocks[3] + 4 * t),
+					get_be32(blocks[2] + 4 * t),
+					get_be32(blocks[1] + 4 * t),
+					get_be32(blocks[0] + 4 * t));
+
+	A = _mm256_loadu_si256((const __m256i *)H[0]);
+	B = _mm256_loadu_si256((const __m256i *)H[1]);
+	C = _mm256_loadu_si256((const __m256i *)H[2]);
+	D = _mm256_loadu_si256((const __m256i *)H[3]);
+	E = _mm256_loadu_si256((const __m256i *)H[4]);
+
+	for (t = 0; t < 20; t++)
+		ROUND8(t, F0(B, C, D), k0);
+	for (; t < 40; t++)
+		ROUND8(t, F1(B, C, D), k1);
+	for (; t < 60; t++)
+		ROUND8(t, F2(B, C, D), k2);
+	for (; t < 80; t++)
+		ROUND8(t, F1(B, C, D), k3);
+
+#define ADD_STATE(i, x) _mm256_storeu_si256((__m256i *)H[i], \
+	_mm256_add_epi32((x), _mm256_loadu_si256((const __m256i *)H[i])))
+	ADD_STATE(0, A);
+	ADD_STATE(1, B);
+	ADD_STATE(2, C);
+	ADD_STATE(3, D);
+	ADD_STATE(4, E);
+#undef ADD_STATE
+}
+
+#endif
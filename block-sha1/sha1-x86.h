@@ -0,0 +1,18 @@
+/*
+ * Block functions of block-sha1 that use x86 instruction set
+ * extensions; they are only called after the CPU was found to
+ * support them.
+ */
+
+#include "../cpu-features.h"
+
+#if defined(HAVE_X86_SIMD) && !defined(NO_BLK_SHA1_X86)
+#define BLK_SHA1_X86
+
+/* Hash nr 64-byte blocks into H with the SHA extensions. */
+void blk_SHA1_blocks_shani(unsigned int H[5], const void *data, unsigned long nr);
+
+/* Hash one 64-byte block for each of eight lanes of H with AVX2. */
+void blk_SHA1_x8_avx2(unsigned int H[5][8], const unsigned char *blocks[8]);
+
+#endif
@@ -10,6 +10,7 @@
 #include "../git-compat-util.h"
 
 #include "sha1.h"
+#include "sha1-x86.h"
 
 #if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 
@@ -83,16 +84,16 @@
 #define T_40_59(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, ((B&C)+(D&(B^C))) , 0x8f1bbcdc, A, B, C, D, E )
 #define T_60_79(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, (B^C^D) ,  0xca62c1d6, A, B, C, D, E )
 
-static void blk_SHA1_Block(blk_SHA_CTX *ctx, const void *block)
+static void blk_SHA1_Block(unsigned int H[5], const void *block)
 {
 	unsigned int A,B,C,D,E;
 	unsigned int array[16];
 
-	A = ctx->H[0];
-	B = ctx->H[1];
-	C = ctx->H[2];
-	D = ctx->H[3];
-	E = ctx->H[4];
+	A = H[0];
+	B = H[1];
+	C = H[2];
+	D = H[3];
+	E = H[4];
 
 	/* Round 1 - iterations 0-16 take their input from 'block' */
 	T_0_15( 0, A, B, C, D, E);
@@ -184,11 +185,42 @@ static void blk_SHA1_Block(blk_SHA_CTX *ctx, const void *block)
 	T_60_79(78, C, D, E, A, B);
 	T_60_79(79, B, C, D, E, A);
 
-	ctx->H[0] += A;
-	ctx->H[1] += B;
-	ctx->H[2] += C;
-	ctx->H[3] += D;
-	ctx->H[4] += E;
+	H[0] += A;
+	H[1] += B;
+	H[2] += C;
+	H[3] += D;
+	H[4] += E;
+}
+
+static void blk_SHA1_blocks_c(unsigned int H[5], const void *data, unsigned long nr)
+{
+	while (nr--) {
+		blk_SHA1_Block(H, data);
+		data = ((const char *)data + 64);
+	}
+}
+
+struct blk_SHA1_backend {
+	struct cpu_backend cpu;
+	/* hash nr consecutive 64-byte blocks into H */
+	void (*blocks)(unsigned int H[5], const void *data, unsigned long nr);
+	/* hash a block for each of 8 lanes; NULL if not multi-buffer */
+	void (*x8)(unsigned int H[5][8], const unsigned char *blocks[8]);
+};
+
+static const struct blk_SHA1_backend backends[] = {
+#ifdef BLK_SHA1_X86
+	{ { "sha-ni", x86_has_sha_ni }, blk_SHA1_blocks_shani, NULL },
+	{ { "avx2", x86_has_avx2 }, blk_SHA1_blocks_c, blk_SHA1_x8_avx2 },
+#endif
+	{ { "c", NULL }, blk_SHA1_blocks_c, NULL },
+};
+
+struct cpu_backends blk_SHA1_backends = CPU_BACKENDS_INIT(backends);
+
+static inline const struct blk_SHA1_backend *get_backend(void)
+{
+	return cpu_backend(&blk_SHA1_backends);
 }
 
 void blk_SHA1_Init(blk_SHA_CTX *ctx)
@@ -220,12 +252,12 @@ void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *data, unsigned long len)
 		data = ((const char *)data + left);
 		if (lenW)
 			return;
-		blk_SHA1_Block(ctx, ctx->W);
+		get_backend()->blocks(ctx->H, ctx->W, 1);
 	}
-	while (len >= 64) {
-		blk_SHA1_Block(ctx, data);
-		data = ((const char *)data + 64);
-		len -= 64;
+	if (len >= 64) {
+		get_backend()->blocks(ctx->H, data, len / 64);
+		data = ((const char *)data + (len & ~63UL));
+		len &= 63;
 	}
 	if (len)
 		memcpy(ctx->W, data, len);
@@ -249,3 +281,140 @@ void blk_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx)
 	for (i = 0; i < 5; i++)
 		put_be32(hashout + i * 4, ctx->H[i]);
 }
+
+/*
+ * A lane of blk_SHA1_Multi() goes through the message of its job one
+ * block at a time: the block that completes what the context had
+ * buffered, the whole blocks of the data, and one or two blocks with
+ * the rest of the data and the padding.
+ */
+struct sha1_lane {
+	struct blk_SHA1_multi_job *job;
+	int has_head;
+	unsigned char head[64];
+	const unsigned char *data;
+	unsigned long nr_blocks;
+	int nr_tail;
+	unsigned char tail[128];
+	const unsigned char *tail_pos;
+};
+
+static void start_lane(struct sha1_lane *lane, struct blk_SHA1_multi_job *job)
+{
+	blk_SHA_CTX *ctx = job->ctx;
+	const unsigned char *data = job->data;
+	unsigned long len = job->len;
+	unsigned long long size = ctx->size + len;
+	unsigned int lenW = ctx->size & 63;
+	unsigned int n;
+
+	lane->job = job;
+	lane->has_head = 0;
+	if (lenW && lenW + len >= 64) {
+		memcpy(lane->head, ctx->W, lenW);
+		memcpy(lane->head + lenW, data, 64 - lenW);
+		data += 64 - lenW;
+		len -= 64 - lenW;
+		lenW = 0;
+		lane->has_head = 1;
+	}
+	lane->data = data;
+	lane->nr_blocks = len / 64;
+	data += len & ~63UL;
+	len &= 63;
+
+	memcpy(lane->tail, ctx->W, lenW);
+	memcpy(lane->tail + lenW, data, len);
+	n = lenW + len;
+	lane->tail[n++] = 0x80;
+	lane->nr_tail = n <= 56 ? 1 : 2;
+	memset(lane->tail + n, 0, lane->nr_tail * 64 - 8 - n);
+	put_be32(lane->tail + lane->nr_tail * 64 - 8, (uint32_t)(size >> 29));
+	put_be32(lane->tail + lane->nr_tail * 64 - 4, (uint32_t)(size << 3));
+	lane->tail_pos = lane->tail;
+}
+
+/* Return the next block of the lane, and set *last if it is the last one. */
+static const unsigned char *next_block(struct sha1_lane *lane, int *last)
+{
+	const unsigned char *block;
+
+	*last = 0;
+	if (lane->has_head) {
+		lane->has_head = 0;
+		return lane->head;
+	}
+	if (lane->nr_blocks) {
+		block = lane->data;
+		lane->data += 64;
+		lane->nr_blocks--;
+		return block;
+	}
+	block = lane->tail_pos;
+	lane->tail_pos += 64;
+	*last = lane->tail_pos == lane->tail + lane->nr_tail * 64;
+	return block;
+}
+
+static void multi_x8(const struct blk_SHA1_backend *b,
+		     struct blk_SHA1_multi_job *jobs, int nr)
+{
+	static const unsigned char idle_block[64];
+	struct sha1_lane lane[8];
+	unsigned int H[5][8];
+	const unsigned char *blocks[8];
+	int last[8];
+	int i, j, next = 0, active = 0;
+
+	for (i = 0; i < 8; i++) {
+		lane[i].job = NULL;
+		if (next < nr) {
+			start_lane(&lane[i], &jobs[next++]);
+			for (j = 0; j < 5; j++)
+				H[j][i] = lane[i].job->ctx->H[j];
+			active++;
+		}
+	}
+
+	while (active) {
+		for (i = 0; i < 8; i++) {
+			last[i] = 0;
+			if (lane[i].job)
+				blocks[i] = next_block(&lane[i], &last[i]);
+			else
+				blocks[i] = idle_block;
+		}
+		b->x8(H, blocks);
+		for (i = 0; i < 8; i++) {
+			if (!last[i])
+				continue;
+			for (j = 0; j < 5; j++) {
+				lane[i].job->ctx->H[j] = H[j][i];
+				put_be32(lane[i].job->hash + j * 4, H[j][i]);
+			}
+			lane[i].job = NULL;
+			active--;
+			if (next < nr) {
+				start_lane(&lane[i], &jobs[next++]);
+				for (j = 0; j < 5; j++)
+					H[j][i] = lane[i].job->ctx->H[j];
+				active++;
+			}
+		}
+	}
+}
+
+void blk_SHA1_Multi(struct blk_SHA1_multi_job *jobs, int nr)
+{
+	const struct blk_SHA1_backend *b = get_backend();
+	int i;
+
+	if (b->x8 && nr > 1) {
+		multi_x8(b, jobs, nr);
+		return;
+	}
+	for (i = 0; i < nr; i++) {
+		blk_SHA1_Update(jobs[i].ctx, jobs[i].data, jobs[i].len);
+		blk_SHA1_Final(jobs[i].hash, jobs[i].ctx);
+	}
+}
@@ -16,7 +16,37 @@ void blk_SHA1_Init(blk_SHA_CTX *ctx);
 void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *dataIn, unsigned long len);
 void blk_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx);
 
+/*
+ * Hash the data of each job into its context and finalize it into
+ * hash, as blk_SHA1_Update() and blk_SHA1_Final() would, but hash
+ * several of them side by side when the CPU can.  The contexts must
+ * have been initialized (and may already have been updated with, say,
+ * an object header).
+ */
+struct blk_SHA1_multi_job {
+	blk_SHA_CTX *ctx;
+	const void *data;
+	unsigned long len;
+	unsigned char *hash;
+};
+
+void blk_SHA1_Multi(struct blk_SHA1_multi_job *jobs, int nr);
+
+/*
+ * The block functions are picked at runtime by what the CPU supports
+ * ("sha-ni", the x86 SHA extensions; "avx2", which hashes eight
+ * buffers at once in blk_SHA1_Multi(); or the portable "c").  Test
+ * programs can list and force them through blk_SHA1_backends with the
+ * functions of cpu-features.h.
+ */
+#define BLK_SHA1_BACKENDS
+
+struct cpu_backends;
+extern struct cpu_backends blk_SHA1_backends;
+
 #define git_SHA_CTX	blk_SHA_CTX
 #define git_SHA1_Init	blk_SHA1_Init
 #define git_SHA1_Update	blk_SHA1_Update
 #define git_SHA1_Final	blk_SHA1_Final
+#define git_SHA1_multi_job	blk_SHA1_multi_job
+#define git_SHA1_Multi	blk_SHA1_Multi
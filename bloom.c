@@ -0,0 +1,172 @@
+#include "cache.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "string-list.h"
+#include "bloom.h"
+
+#define BLOOM_SEED_1 0x293ae76f
+#define BLOOM_SEED_2 0x7e646e2c
+
+static inline uint32_t rotate_left(uint32_t value, int count)
+{
+	return (value << count) | (value >> ((sizeof(value) * 8) - count));
+}
+
+/*
+ * 32-bit MurmurHash3, as described at
+ * https://en.wikipedia.org/wiki/MurmurHash; the blocks are read in
+ * little-endian order regardless of the host, so that filters are
+ * portable.
+ */
+uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len)
+{
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	const uint32_t r1 = 15;
+	const uint32_t r2 = 13;
+	const uint32_t m = 5;
+	const uint32_t n = 0xe6546b64;
+	const unsigned char *p = (const unsigned char *)data;
+	uint32_t hash = seed, k;
+	size_t i, nblocks = len / 4;
+
+	for (i = 0; i < nblocks; i++, p += 4) {
+		k = (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+		k *= c1;
+		k = rotate_left(k, r1);
+		k *= c2;
+
+		hash ^= k;
+		hash = rotate_left(hash, r2) * m + n;
+	}
+
+	k = 0;
+	switch (len & 3) {
+	case 3:
+		k ^= (uint32_t)p[2] << 16;
+		/* fallthrough */
+	case 2:
+		k ^= (uint32_t)p[1] << 8;
+		/* fallthrough */
+	case 1:
+		k ^= p[0];
+		k *= c1;
+		k = rotate_left(k, r1);
+		k *= c2;
+		hash ^= k;
+	}
+
+	hash ^= (uint32_t)len;
+	hash ^= (hash >> 16);
+	hash *= 0x85ebca6b;
+	hash ^= (hash >> 13);
+	hash *= 0xc2b2ae35;
+	hash ^= (hash >> 16);
+
+	return hash;
+}
+
+/* Double hashing: the i-th position is h1 + i * h2 */
+void fill_bloom_key(const char *data, size_t len, struct bloom_key *key,
+		    const struct bloom_filter_settings *settings)
+{
+	uint32_t hash0 = murmur3_seeded(BLOOM_SEED_1, data, len);
+	uint32_t hash1 = murmur3_seeded(BLOOM_SEED_2, data, len);
+	uint32_t i;
+
+	key->hashes = xmalloc(settings->num_hashes * sizeof(*key->hashes));
+	for (i = 0; i < settings->num_hashes; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+void clear_bloom_key(struct bloom_key *key)
+{
+	free(key->hashes);
+	key->hashes = NULL;
+}
+
+void add_key_to_filter(const struct bloom_key *key, struct bloom_filter *filter,
+		       const struct bloom_filter_settings *settings)
+{
+	uint64_t mod = (uint64_t)filter->len * 8;
+	uint32_t i;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t pos = key->hashes[i] % mod;
+		filter->data[pos >> 3] |= 1 << (pos & 7);
+	}
+}
+
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	uint64_t mod = (uint64_t)filter->len * 8;
+	uint32_t i;
+
+	if (!mod)
+		return 1;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t pos = key->hashes[i] % mod;
+		if (!(filter->data[pos >> 3] & (1 << (pos & 7))))
+			return 0;
+	}
+	return 1;
+}
+
+void compute_bloom_filter(const unsigned char *old_tree,
+			  const unsigned char *new_tree,
+			  struct bloom_filter *filter,
+			  const struct bloom_filter_settings *settings)
+{
+	struct string_list paths = STRING_LIST_INIT_DUP;
+	struct diff_options opt;
+	int i, nr_changes;
+
+	diff_setup(&opt);
+	DIFF_OPT_SET(&opt, RECURSIVE);
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opt);
+	diff_tree_sha1(old_tree, new_tree, "", &opt);
+
+	nr_changes = diff_queued_diff.nr;
+	if (nr_changes <= BLOOM_MAX_CHANGED_PATHS) {
+		for (i = 0; i < diff_queued_diff.nr; i++) {
+			const char *path = diff_queued_diff.queue[i]->two->path;
+			const char *slash;
+
+			string_list_append(&paths, path);
+			for (slash = strchr(path, '/'); slash;
+			     slash = strchr(slash + 1, '/'))
+				string_list_append_nodup(&paths,
+					xmemdupz(path, slash - path));
+		}
+		string_list_sort(&paths);
+		string_list_remove_duplicates(&paths, 0);
+	}
+	diff_flush(&opt);
+
+	if (nr_changes > BLOOM_MAX_CHANGED_PATHS ||
+	    paths.nr > BLOOM_MAX_CHANGED_PATHS) {
+		filter->len = 1;
+		filter->data = xmalloc(1);
+		filter->data[0] = 0xff;
+	} else {
+		filter->len = (paths.nr * settings->bits_per_entry + 7) / 8;
+		if (!filter->len)
+			filter->len = 1;
+		filter->data = xcalloc(filter->len, 1);
+
+		for (i = 0; i < paths.nr; i++) {
+			struct bloom_key key;
+			const char *path = paths.items[i].string;
+
+			fill_bloom_key(path, strlen(path), &key, settings);
+			add_key_to_filter(&key, filter, settings);
+			clear_bloom_key(&key);
+		}
+	}
+	string_list_clear(&paths, 0);
+}
@@ -0,0 +1,80 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+/*
+ * Bloom filters of the paths changed by a commit, used to skip tree
+ * diffs for commits that certainly do not touch a pathspec.  The
+ * filters are stored in the commit-graph file; see
+ * Documentation/technical/commit-graph-format.txt.
+ */
+
+struct commit;
+
+#define BLOOM_HASH_VERSION 1 /* murmur3, 32-bit, seeds below */
+#define BLOOM_DEFAULT_NUM_HASHES 7
+#define BLOOM_DEFAULT_BITS_PER_ENTRY 10
+
+/*
+ * A commit that changes more paths than this gets a filter with every
+ * bit set, i.e. one that matches everything.
+ */
+#define BLOOM_MAX_CHANGED_PATHS 512
+
+struct bloom_filter_settings {
+	uint32_t hash_version;
+	uint32_t num_hashes;
+	uint32_t bits_per_entry;
+};
+
+#define BLOOM_FILTER_SETTINGS_INIT { \
+	BLOOM_HASH_VERSION, \
+	BLOOM_DEFAULT_NUM_HASHES, \
+	BLOOM_DEFAULT_BITS_PER_ENTRY \
+}
+
+/*
+ * A filter of "len" bytes.  An empty filter carries no information
+ * and is treated as containing everything.
+ */
+struct bloom_filter {
+	unsigned char *data;
+	size_t len;
+};
+
+/* The "num_hashes" bit positions (modulo the filter size) of a path */
+struct bloom_key {
+	uint32_t *hashes;
+};
+
+extern uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len);
+
+extern void fill_bloom_key(const char *data, size_t len,
+			   struct bloom_key *key,
+			   const struct bloom_filter_settings *settings);
+extern void clear_bloom_key(struct bloom_key *key);
+
+extern void add_key_to_filter(const struct bloom_key *key,
+			      struct bloom_filter *filter,
+			      const struct bloom_filter_settings *settings);
+
+/*
+ * Return 0 if the path behind "key" is certainly not in the filter,
+ * 1 if it may be.
+ */
+extern int bloom_filter_contains(const struct bloom_filter *filter,
+				 const struct bloom_key *key,
+				 const struct bloom_filter_settings *settings);
+
+/*
+ * Compute the filter of the paths that differ between the trees
+ * "old_tree" (or the empty tree if NULL) and "new_tree".  Every
+ * leading directory of a changed path is added as well, so that a
+ * directory pathspec can be tested with a single key.  The caller
+ * owns filter->data.
+ */
+extern void compute_bloom_filter(const unsigned char *old_tree,
+				 const unsigned char *new_tree,
+				 struct bloom_filter *filter,
+				 const struct bloom_filter_settings *settings);
+
+#endif
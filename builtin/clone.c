@@ -24,6 +24,7 @@
 #include "remote.h"
 #include "run-command.h"
 #include "connected.h"
+#include "list-objects-filter.h"
 
 /*
  * Overall FIXMEs:
@@ -50,6 +51,7 @@ static int option_progress = -1;
 static struct string_list option_config;
 static struct string_list option_reference;
 static int option_dissociate;
+static struct list_objects_filter_options filter_options;
 
 static struct option builtin_clone_options[] = {
 	OPT__VERBOSITY(&option_verbosity),
@@ -86,6 +88,7 @@ static struct option builtin_clone_options[] = {
 		   N_("path to git-upload-pack on the remote")),
 	OPT_STRING(0, "depth", &option_depth, N_("depth"),
 		    N_("create a shallow clone of that depth")),
+	OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
 	OPT_BOOL(0, "single-branch", &option_single_branch,
 		    N_("clone only one branch, HEAD or --branch")),
 	OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
@@ -966,6 +969,10 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	if (is_local) {
 		if (option_depth)
 			warning(_("--depth is ignored in local clones; use file:// instead."));
+		if (filter_options.choice) {
+			warning(_("--filter is ignored in local clones; use file:// instead."));
+			list_objects_filter_release(&filter_options);
+		}
 		if (!access(mkpath("%s/shallow", path), F_OK)) {
 			if (option_local > 0)
 				warning(_("source repository is shallow, ignoring --local"));
@@ -991,7 +998,25 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		transport_set_option(transport, TRANS_OPT_UPLOADPACK,
 				     option_upload_pack);
 
-	if (transport->smart_options && !option_depth)
+	if (filter_options.choice) {
+		/*
+		 * Make this a partial clone before fetching, so that the
+		 * connectivity check and the checkout know that objects
+		 * can be missing, and where to get them.
+		 */
+		git_config_set("core.repositoryformatversion", "1");
+		git_config_set("extensions.partialclone", option_origin);
+		strbuf_addf(&key, "remote.%s.partialclonefilter", option_origin);
+		git_config_set(key.buf, filter_options.filter_spec);
+		strbuf_reset(&key);
+		free(repository_format_partial_clone);
+		repository_format_partial_clone = xstrdup(option_origin);
+
+		transport_set_option(transport, TRANS_OPT_LIST_OBJECTS_FILTER,
+				     filter_options.filter_spec);
+	}
+
+	if (transport->smart_options && !option_depth && !filter_options.choice)
 		transport->smart_options->check_self_contained_and_connected = 1;
 
 	refs = transport_get_remote_refs(transport);
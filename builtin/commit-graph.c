@@ -0,0 +1,113 @@
+#include "builtin.h"
+#include "parse-options.h"
+#include "commit-graph.h"
+
+static const char * const builtin_commit_graph_usage[] = {
+	N_("git commit-graph read"),
+	N_("git commit-graph write [--reachable] [--[no-]changed-paths] [-q | --quiet]"),
+	NULL
+};
+
+static const char * const builtin_commit_graph_read_usage[] = {
+	N_("git commit-graph read"),
+	NULL
+};
+
+static const char * const builtin_commit_graph_write_usage[] = {
+	N_("git commit-graph write [--reachable] [--[no-]changed-paths] [-q | --quiet]"),
+	NULL
+};
+
+static int graph_read(int argc, const char **argv)
+{
+	struct commit_graph *graph;
+	char *graph_name;
+	struct option builtin_commit_graph_read_options[] = {
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, NULL,
+			     builtin_commit_graph_read_options,
+			     builtin_commit_graph_read_usage, 0);
+	if (argc)
+		usage_with_options(builtin_commit_graph_read_usage,
+				   builtin_commit_graph_read_options);
+
+	graph_name = get_commit_graph_filename(get_object_directory());
+	graph = load_commit_graph_one(graph_name);
+	if (!graph)
+		die(_("unable to read commit-graph file '%s'"), graph_name);
+	free(graph_name);
+
+	printf("header: %08x %d %d %d %d\n",
+	       get_be32(graph->data),
+	       *(unsigned char *)(graph->data + 4),
+	       *(unsigned char *)(graph->data + 5),
+	       *(unsigned char *)(graph->data + 6),
+	       *(unsigned char *)(graph->data + 7));
+	printf("num_commits: %u\n", graph->num_commits);
+	printf("chunks:");
+	if (graph->chunk_oid_fanout)
+		printf(" oid_fanout");
+	if (graph->chunk_oid_lookup)
+		printf(" oid_lookup");
+	if (graph->chunk_commit_data)
+		printf(" commit_metadata");
+	if (graph->chunk_extra_edges)
+		printf(" extra_edges");
+	if (graph->chunk_bloom_indexes)
+		printf(" bloom_indexes");
+	if (graph->chunk_bloom_data)
+		printf(" bloom_data");
+	printf("\n");
+
+	free_commit_graph(graph);
+	return 0;
+}
+
+static int graph_write(int argc, const char **argv)
+{
+	int reachable = 0;
+	int changed_paths = -1;
+	int quiet = 0;
+	struct option options[] = {
+		OPT_BOOL(0, "reachable", &reachable,
+			 N_("start the walk at all refs")),
+		OPT_BOOL(0, "changed-paths", &changed_paths,
+			 N_("write Bloom filters of the paths changed by each commit")),
+		OPT__QUIET(&quiet, N_("suppress progress output")),
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, NULL, options,
+			     builtin_commit_graph_write_usage, 0);
+	if (argc)
+		usage_with_options(builtin_commit_graph_write_usage, options);
+
+	if (!isatty(2))
+		quiet = 1;
+	return write_commit_graph(reachable, changed_paths, quiet);
+}
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	struct option builtin_commit_graph_options[] = {
+		OPT_END(),
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_commit_graph_usage,
+				   builtin_commit_graph_options);
+
+	git_config(git_default_config, NULL);
+
+	if (argc > 1) {
+		if (!strcmp(argv[1], "read"))
+			return graph_read(argc - 1, argv + 1);
+		if (!strcmp(argv[1], "write"))
+			return graph_write(argc - 1, argv + 1);
+	}
+
+	usage_with_options(builtin_commit_graph_usage,
+			   builtin_commit_graph_options);
+}
@@ -1351,6 +1351,7 @@ int cmd_status(int argc, const char **argv, const char *prefix)
 	argc = parse_options(argc, argv, prefix,
 			     builtin_status_options,
 			     builtin_status_usage, 0);
+	command_requires_full_index = 0;
 	finalize_colopts(&s.colopts, -1);
 	finalize_deferred_config(&s);
 
@@ -15,6 +15,7 @@
 #include "submodule.h"
 #include "connected.h"
 #include "argv-array.h"
+#include "list-objects-filter.h"
 
 static const char * const builtin_fetch_usage[] = {
 	N_("git fetch [<options>] [<repository> [<refspec>...]]"),
@@ -47,6 +48,10 @@ static const char *recurse_submodules_default;
 static int shown_url = 0;
 static int refmap_alloc, refmap_nr;
 static const char **refmap_array;
+/* 0: never, 1: not over ssh, 2: always; see "fetch.refPrefixes" */
+static int fetch_ref_prefixes = 1;
+static struct string_list ref_prefixes = STRING_LIST_INIT_DUP;
+static struct list_objects_filter_options filter_options;
 
 static int option_parse_recurse_submodules(const struct option *opt,
 				   const char *arg, int unset)
@@ -68,6 +73,13 @@ static int git_fetch_config(const char *k, const char *v, void *cb)
 		fetch_prune_config = git_config_bool(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "fetch.refprefixes")) {
+		if (v && !strcasecmp(v, "always"))
+			fetch_ref_prefixes = 2;
+		else
+			fetch_ref_prefixes = git_config_bool(k, v);
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -124,6 +136,7 @@ static struct option builtin_fetch_options[] = {
 		 N_("accept refs that update .git/shallow")),
 	{ OPTION_CALLBACK, 0, "refmap", NULL, N_("refmap"),
 	  N_("specify fetch refmap"), PARSE_OPT_NONEG, parse_refmap_arg },
+	OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
 	OPT_END()
 };
 
@@ -855,6 +868,37 @@ static void set_option(struct transport *transport, const char *name, const char
 			name, transport->url);
 }
 
+static int is_partial_clone_remote(struct remote *remote)
+{
+	return repository_format_partial_clone && remote->name &&
+	       !strcmp(remote->name, repository_format_partial_clone);
+}
+
+/*
+ * Fetches from the remote of a partial clone use the filter the clone
+ * was made with, unless --filter says otherwise.
+ */
+static void set_filter_option(struct transport *transport)
+{
+	const char *spec = filter_options.filter_spec;
+	char *key;
+
+	if (!is_partial_clone_remote(transport->remote)) {
+		if (spec)
+			die(_("--filter can only be used with the remote "
+			      "configured in extensions.partialClone"));
+		return;
+	}
+	if (!spec) {
+		key = xstrfmt("remote.%s.partialclonefilter",
+			      transport->remote->name);
+		git_config_get_string_const(key, &spec);
+		free(key);
+	}
+	if (spec)
+		set_option(transport, TRANS_OPT_LIST_OBJECTS_FILTER, spec);
+}
+
 static struct transport *prepare_transport(struct remote *remote)
 {
 	struct transport *transport;
@@ -868,13 +912,67 @@ static struct transport *prepare_transport(struct remote *remote)
 		set_option(transport, TRANS_OPT_DEPTH, depth);
 	if (update_shallow)
 		set_option(transport, TRANS_OPT_UPDATE_SHALLOW, "yes");
+	set_filter_option(transport);
 	return transport;
 }
 
+static int has_dst(struct refspec *refs, int ref_count)
+{
+	int i;
+
+	for (i = 0; i < ref_count; i++)
+		if (refs[i].dst && refs[i].dst[0])
+			return 1;
+	return 0;
+}
+
+/*
+ * Ask the remote to advertise only the refs get_ref_map() and the
+ * tag following can use, unless a refspec names an object.
+ */
+static void set_ref_prefixes(struct transport *transport,
+			     struct refspec *refs, int ref_count, int autotags)
+{
+	struct remote *remote = transport->remote;
+	struct branch *branch = branch_get(NULL);
+	int i;
+
+	string_list_clear(&ref_prefixes, 0);
+	if (!fetch_ref_prefixes)
+		return;
+
+	if (ref_count) {
+		if (refspec_ref_prefixes(ref_count, refs, &ref_prefixes))
+			return;
+		autotags |= has_dst(refs, ref_count);
+	} else {
+		int has_merge = branch_has_merge_config(branch) &&
+			!strcmp(branch->remote_name, remote->name);
+
+		if (refspec_ref_prefixes(remote->fetch_refspec_nr,
+					 remote->fetch, &ref_prefixes))
+			return;
+		autotags |= has_dst(remote->fetch, remote->fetch_refspec_nr);
+		if (has_merge)
+			for (i = 0; i < branch->merge_nr; i++)
+				expand_ref_prefix(&ref_prefixes,
+						  branch->merge[i]->src);
+		else if (!remote->fetch_refspec_nr)
+			string_list_append(&ref_prefixes, "HEAD");
+	}
+	if (tags == TAGS_SET || (tags == TAGS_DEFAULT && autotags))
+		string_list_append(&ref_prefixes, "refs/tags/");
+
+	transport->ref_prefixes = &ref_prefixes;
+	transport->ssh_ref_prefixes = fetch_ref_prefixes == 2;
+}
+
 static void backfill_tags(struct transport *transport, struct ref *ref_map)
 {
 	if (transport->cannot_reuse) {
 		gsecondary = prepare_transport(transport->remote);
+		gsecondary->ref_prefixes = transport->ref_prefixes;
+		gsecondary->ssh_ref_prefixes = transport->ssh_ref_prefixes;
 		transport = gsecondary;
 	}
 
@@ -916,6 +1014,7 @@ static int do_fetch(struct transport *transport,
 			goto cleanup;
 	}
 
+	set_ref_prefixes(transport, refs, ref_count, autotags);
 	ref_map = get_ref_map(transport, refs, ref_count, tags, &autotags);
 	if (!update_head_ok)
 		check_not_current_branch(ref_map);
@@ -1167,6 +1266,9 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 	if (depth && atoi(depth) < 1)
 		die(_("depth %s is not a positive number"), depth);
 
+	if (filter_options.choice && (all || multiple))
+		die(_("--filter can only be used with a single remote"));
+
 	if (recurse_submodules != RECURSE_SUBMODULES_OFF) {
 		if (recurse_submodules_default) {
 			int arg = parse_fetch_recurse_submodules_arg("--recurse-submodules-default", recurse_submodules_default);
@@ -92,6 +92,16 @@ static int fsck_error_func(struct object *obj, int type, const char *message)
 
 static struct object_array pending;
 
+/*
+ * A partial clone is missing the trees and blobs the filter of its
+ * clone omitted.
+ */
+static int missing_is_expected(struct object *obj)
+{
+	return repository_format_partial_clone &&
+	       (obj->type == OBJ_TREE || obj->type == OBJ_BLOB);
+}
+
 static int mark_object(struct object *obj, int type, void *data, struct fsck_options *options)
 {
 	struct object *parent = data;
@@ -119,7 +129,8 @@ static int mark_object(struct object *obj, int type, void *data, struct fsck_opt
 		return 0;
 	obj->flags |= REACHABLE;
 	if (!(obj->flags & HAS_OBJ)) {
-		if (parent && !has_sha1_file(obj->sha1)) {
+		if (parent && !has_sha1_file(obj->sha1) &&
+		    !missing_is_expected(obj)) {
 			printf("broken link from %7s %s\n",
 				 typename(parent->type), sha1_to_hex(parent->sha1));
 			printf("              to %7s %s\n",
@@ -197,6 +208,8 @@ static void check_reachable_object(struct object *obj)
 			return; /* it is in pack - forget about it */
 		if (connectivity_only && has_sha1_file(obj->sha1))
 			return;
+		if (missing_is_expected(obj))
+			return;
 		printf("missing %s %s\n", typename(obj->type), sha1_to_hex(obj->sha1));
 		errors_found |= ERROR_REACHABLE;
 		return;
@@ -656,6 +669,8 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 
 	errors_found = 0;
 	check_replace_refs = 0;
+	/* check what we have, not what the promisor remote has */
+	fetch_if_missing = 0;
 
 	argc = parse_options(argc, argv, prefix, fsck_opts, fsck_usage, 0);
 
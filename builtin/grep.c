@@ -18,21 +18,22 @@
 #include "quote.h"
 #include "dir.h"
 #include "pathspec.h"
+#include "trace-event.h"
 
 static char const * const grep_usage[] = {
 	N_("git grep [<options>] [-e] <pattern> [<rev>...] [[--] <path>...]"),
 	NULL
 };
 
+static int num_threads;
 static int use_threads = 1;
 
 #ifndef NO_PTHREADS
-#define THREADS 8
-static pthread_t threads[THREADS];
-
-/* We use one producer thread and THREADS consumer
- * threads. The producer adds struct work_items to 'todo' and the
- * consumers pick work items from the same array.
+/* We use one producer thread and num_threads consumer threads.  The
+ * producer adds struct work_items to 'todo', which keeps them in the
+ * order their results are written, and hands them to the consumers in
+ * turn.  A consumer that has nothing left to do takes work that was
+ * handed to another one.
  */
 struct work_item {
 	struct grep_source source;
@@ -40,18 +41,16 @@ struct work_item {
 	struct strbuf out;
 };
 
-/* In the range [todo_done, todo_start) in 'todo' we have work_items
- * that have been or are processed by a consumer thread. We haven't
- * written the result for these to stdout yet.
- *
- * The work_items in [todo_start, todo_end) are waiting to be picked
- * up by a consumer thread.
+/* In the range [todo_done, todo_end) in 'todo' we have work_items
+ * that are waiting for, or have been processed by, a consumer thread.
+ * We haven't written the result for these to stdout yet.
  *
- * The ranges are modulo TODO_SIZE.
+ * The range is modulo todo_size.
  */
 #define TODO_SIZE 128
-static struct work_item todo[TODO_SIZE];
-static int todo_start;
+#define TODO_PER_THREAD 16
+static struct work_item *todo;
+static int todo_size;
 static int todo_end;
 static int todo_done;
 
@@ -73,9 +72,6 @@ static inline void grep_unlock(void)
 		pthread_mutex_unlock(&grep_mutex);
 }
 
-/* Signalled when a new work_item is added to todo. */
-static pthread_cond_t cond_add;
-
 /* Signalled when the result from one work_item is written to
  * stdout.
  */
@@ -86,43 +82,108 @@ static pthread_cond_t cond_result;
 
 static int skip_first_line;
 
+/* A consumer thread, and the work_items handed to it. */
+struct grep_worker {
+	pthread_t thread;
+	struct grep_opt *opt;
+
+	/* This lock protects the variables below. */
+	pthread_mutex_t mutex;
+
+	/* Signalled when a work_item is added, or when closed is set. */
+	pthread_cond_t cond_add;
+
+	/* Indices in 'todo', oldest first; a ring of todo_size. */
+	int *item;
+	int first, nr;
+
+	/* No more work_items will be added. */
+	int closed;
+};
+
+static struct grep_worker *workers;
+
+/* The worker that gets the next work_item; used by the producer only. */
+static int next_worker;
+
 static void add_work(struct grep_opt *opt, enum grep_source_type type,
 		     const char *name, const char *path, const void *id)
 {
+	struct grep_worker *worker;
+	int item;
+
 	grep_lock();
 
-	while ((todo_end+1) % ARRAY_SIZE(todo) == todo_done) {
+	while ((todo_end+1) % todo_size == todo_done) {
 		pthread_cond_wait(&cond_write, &grep_mutex);
 	}
 
-	grep_source_init(&todo[todo_end].source, type, name, path, id);
+	item = todo_end;
+	grep_source_init(&todo[item].source, type, name, path, id);
 	if (opt->binary != GREP_BINARY_TEXT)
-		grep_source_load_driver(&todo[todo_end].source);
-	todo[todo_end].done = 0;
-	strbuf_reset(&todo[todo_end].out);
-	todo_end = (todo_end + 1) % ARRAY_SIZE(todo);
+		grep_source_load_driver(&todo[item].source);
+	todo[item].done = 0;
+	strbuf_reset(&todo[item].out);
+	todo_end = (todo_end + 1) % todo_size;
 
-	pthread_cond_signal(&cond_add);
 	grep_unlock();
+
+	worker = &workers[next_worker];
+	next_worker = (next_worker + 1) % num_threads;
+
+	pthread_mutex_lock(&worker->mutex);
+	worker->item[(worker->first + worker->nr++) % todo_size] = item;
+	pthread_cond_signal(&worker->cond_add);
+	pthread_mutex_unlock(&worker->mutex);
 }
 
-static struct work_item *get_work(void)
+/* Take the oldest work_item handed to the worker, if any. */
+static struct work_item *take_work(struct grep_worker *worker)
 {
-	struct work_item *ret;
+	struct work_item *ret = NULL;
 
-	grep_lock();
-	while (todo_start == todo_end && !all_work_added) {
-		pthread_cond_wait(&cond_add, &grep_mutex);
+	pthread_mutex_lock(&worker->mutex);
+	if (worker->nr) {
+		ret = &todo[worker->item[worker->first]];
+		worker->first = (worker->first + 1) % todo_size;
+		worker->nr--;
 	}
+	pthread_mutex_unlock(&worker->mutex);
+	return ret;
+}
 
-	if (todo_start == todo_end && all_work_added) {
-		ret = NULL;
-	} else {
-		ret = &todo[todo_start];
-		todo_start = (todo_start + 1) % ARRAY_SIZE(todo);
+static struct work_item *get_work(struct grep_worker *self)
+{
+	for (;;) {
+		struct work_item *ret = take_work(self);
+		int i, finished;
+
+		if (ret)
+			return ret;
+
+		/*
+		 * Help the others; their oldest work_item is the one
+		 * that holds up the output the longest.
+		 */
+		for (i = 1; i < num_threads; i++) {
+			int victim = (self - workers + i) % num_threads;
+			ret = take_work(&workers[victim]);
+			if (ret)
+				return ret;
+		}
+
+		/*
+		 * Once closed, the others empty their own queues before
+		 * they are done, so there is no need to look again.
+		 */
+		pthread_mutex_lock(&self->mutex);
+		while (!self->nr && !self->closed)
+			pthread_cond_wait(&self->cond_add, &self->mutex);
+		finished = !self->nr;
+		pthread_mutex_unlock(&self->mutex);
+		if (finished)
+			return NULL;
 	}
-	grep_unlock();
-	return ret;
 }
 
 static void work_done(struct work_item *w)
@@ -132,8 +193,8 @@ static void work_done(struct work_item *w)
 	grep_lock();
 	w->done = 1;
 	old_done = todo_done;
-	for(; todo[todo_done].done && todo_done != todo_start;
-	    todo_done = (todo_done+1) % ARRAY_SIZE(todo)) {
+	for(; todo_done != todo_end && todo[todo_done].done;
+	    todo_done = (todo_done+1) % todo_size) {
 		w = &todo[todo_done];
 		if (w->out.len) {
 			const char *p = w->out.buf;
@@ -166,10 +227,12 @@ static void work_done(struct work_item *w)
 static void *run(void *arg)
 {
 	int hit = 0;
-	struct grep_opt *opt = arg;
+	struct grep_worker *worker = arg;
+	struct grep_opt *opt = worker->opt;
 
+	trace_event_thread_start("grep");
 	while (1) {
-		struct work_item *w = get_work();
+		struct work_item *w = get_work(worker);
 		if (!w)
 			break;
 
@@ -178,9 +241,10 @@ static void *run(void *arg)
 		grep_source_clear_data(&w->source);
 		work_done(w);
 	}
-	free_grep_patterns(arg);
-	free(arg);
+	free_grep_patterns(opt);
+	free(opt);
 
+	trace_event_thread_exit();
 	return (void*) (intptr_t) hit;
 }
 
@@ -197,22 +261,35 @@ static void start_threads(struct grep_opt *opt)
 	pthread_mutex_init(&grep_mutex, NULL);
 	pthread_mutex_init(&grep_read_mutex, NULL);
 	pthread_mutex_init(&grep_attr_mutex, NULL);
-	pthread_cond_init(&cond_add, NULL);
 	pthread_cond_init(&cond_write, NULL);
 	pthread_cond_init(&cond_result, NULL);
 	grep_use_locks = 1;
+	enable_obj_read_lock();
 
-	for (i = 0; i < ARRAY_SIZE(todo); i++) {
+	todo_size = num_threads * TODO_PER_THREAD;
+	if (todo_size < TODO_SIZE)
+		todo_size = TODO_SIZE;
+	todo = xcalloc(todo_size, sizeof(*todo));
+	for (i = 0; i < todo_size; i++) {
 		strbuf_init(&todo[i].out, 0);
 	}
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	workers = xcalloc(num_threads, sizeof(*workers));
+	for (i = 0; i < num_threads; i++) {
+		struct grep_worker *worker = &workers[i];
+		pthread_mutex_init(&worker->mutex, NULL);
+		pthread_cond_init(&worker->cond_add, NULL);
+		worker->item = xcalloc(todo_size, sizeof(*worker->item));
+	}
+
+	for (i = 0; i < num_threads; i++) {
 		int err;
 		struct grep_opt *o = grep_opt_dup(opt);
 		o->output = strbuf_out;
 		o->debug = 0;
 		compile_grep_patterns(o);
-		err = pthread_create(&threads[i], NULL, run, o);
+		workers[i].opt = o;
+		err = pthread_create(&workers[i].thread, NULL, run, &workers[i]);
 
 		if (err)
 			die(_("grep: failed to create thread: %s"),
@@ -231,25 +308,44 @@ static int wait_all(void)
 	/* Wait until all work is done. */
 	while (todo_done != todo_end)
 		pthread_cond_wait(&cond_result, &grep_mutex);
+	grep_unlock();
 
 	/* Wake up all the consumer threads so they can see that there
 	 * is no more work to do.
 	 */
-	pthread_cond_broadcast(&cond_add);
-	grep_unlock();
+	for (i = 0; i < num_threads; i++) {
+		struct grep_worker *worker = &workers[i];
+		pthread_mutex_lock(&worker->mutex);
+		worker->closed = 1;
+		pthread_cond_signal(&worker->cond_add);
+		pthread_mutex_unlock(&worker->mutex);
+	}
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	for (i = 0; i < num_threads; i++) {
 		void *h;
-		pthread_join(threads[i], &h);
+		pthread_join(workers[i].thread, &h);
 		hit |= (int) (intptr_t) h;
 	}
 
+	/* Only now nobody looks into the queues of the others. */
+	for (i = 0; i < num_threads; i++) {
+		struct grep_worker *worker = &workers[i];
+		pthread_mutex_destroy(&worker->mutex);
+		pthread_cond_destroy(&worker->cond_add);
+		free(worker->item);
+	}
+	free(workers);
+
+	for (i = 0; i < todo_size; i++)
+		strbuf_release(&todo[i].out);
+	free(todo);
+
 	pthread_mutex_destroy(&grep_mutex);
 	pthread_mutex_destroy(&grep_read_mutex);
 	pthread_mutex_destroy(&grep_attr_mutex);
-	pthread_cond_destroy(&cond_add);
 	pthread_cond_destroy(&cond_write);
 	pthread_cond_destroy(&cond_result);
+	disable_obj_read_lock();
 	grep_use_locks = 0;
 
 	return hit;
@@ -267,17 +363,14 @@ static int grep_cmd_config(const char *var, const char *value, void *cb)
 	int st = grep_config(var, value, cb);
 	if (git_color_default_config(var, value, cb) < 0)
 		st = -1;
-	return st;
-}
-
-static void *lock_and_read_sha1_file(const unsigned char *sha1, enum object_type *type, unsigned long *size)
-{
-	void *data;
 
-	grep_read_lock();
-	data = read_sha1_file(sha1, type, size);
-	grep_read_unlock();
-	return data;
+	if (!strcmp(var, "grep.threads")) {
+		num_threads = git_config_int(var, value);
+		if (num_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    num_threads, var);
+	}
+	return st;
 }
 
 static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1,
@@ -436,7 +529,7 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 			void *data;
 			unsigned long size;
 
-			data = lock_and_read_sha1_file(entry.sha1, &type, &size);
+			data = read_sha1_file(entry.sha1, &type, &size);
 			if (!data)
 				die(_("unable to read tree (%s)"),
 				    sha1_to_hex(entry.sha1));
@@ -467,10 +560,8 @@ static int grep_object(struct grep_opt *opt, const struct pathspec *pathspec,
 		struct strbuf base;
 		int hit, len;
 
-		grep_read_lock();
 		data = read_object_with_reference(obj->sha1, tree_type,
 						  &size, NULL);
-		grep_read_unlock();
 
 		if (!data)
 			die(_("unable to read tree (%s)"), sha1_to_hex(obj->sha1));
@@ -659,6 +750,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		{ OPTION_INTEGER, 0, "max-depth", &opt.max_depth, N_("depth"),
 			N_("descend at most <depth> levels"), PARSE_OPT_NONEG,
 			NULL, 1 },
+		OPT_INTEGER(0, "threads", &num_threads,
+			N_("use <n> worker threads")),
 		OPT_GROUP(""),
 		OPT_SET_INT('E', "extended-regexp", &pattern_type_arg,
 			    N_("use extended POSIX regular expressions"),
@@ -831,10 +924,16 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		break;
 	}
 
+	if (num_threads < 0)
+		die(_("invalid number of threads specified (%d)"), num_threads);
 #ifndef NO_PTHREADS
-	if (list.nr || cached || online_cpus() == 1)
+	if (!num_threads)
+		num_threads = online_cpus();
+	if (num_threads == 1)
 		use_threads = 0;
 #else
+	if (num_threads)
+		warning(_("no threads support, ignoring --threads"));
 	use_threads = 0;
 #endif
 
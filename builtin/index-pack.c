@@ -11,9 +11,10 @@
 #include "exec_cmd.h"
 #include "streaming.h"
 #include "thread-utils.h"
+#include "trace-event.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--[no-]rev-index] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -92,12 +93,43 @@ static uint32_t input_crc32;
 static int input_fd, output_fd;
 static const char *curr_pack;
 
+/* Are the non-delta objects of the first pass checked by worker threads? */
+static int first_pass_threads;
+
 #ifndef NO_PTHREADS
 
 static struct thread_local *thread_data;
 static int nr_dispatched;
 static int threads_active;
 
+/*
+ * The first pass reads the pack in the main thread and hands the
+ * inflated non-delta objects to the worker threads in a ring of
+ * FIRST_PASS_QUEUE_SIZE entries, which compute their object names
+ * and check them.  The entries in [first_pass_start, first_pass_end)
+ * are waiting to be picked up; at most delta_base_cache_limit bytes
+ * of object data are queued or being worked on at any time.
+ *
+ * These are protected by work_mutex.
+ */
+struct first_pass_item {
+	struct object_entry *obj;
+	void *data;
+};
+
+#define FIRST_PASS_QUEUE_SIZE 256
+static struct first_pass_item first_pass_queue[FIRST_PASS_QUEUE_SIZE];
+static int first_pass_start;
+static int first_pass_end;
+static size_t first_pass_queued_bytes;
+static int first_pass_all_queued;
+
+/* Signalled when an object is queued, or when all of them are. */
+static pthread_cond_t first_pass_cond_add;
+
+/* Signalled when a worker is done with an object. */
+static pthread_cond_t first_pass_cond_done;
+
 static pthread_mutex_t read_mutex;
 #define read_lock()		lock_mutex(&read_mutex)
 #define read_unlock()		unlock_mutex(&read_mutex)
@@ -142,6 +174,8 @@ static void init_thread(void)
 	pthread_mutex_init(&counter_mutex, NULL);
 	pthread_mutex_init(&work_mutex, NULL);
 	pthread_mutex_init(&type_cas_mutex, NULL);
+	pthread_cond_init(&first_pass_cond_add, NULL);
+	pthread_cond_init(&first_pass_cond_done, NULL);
 	if (show_stat)
 		pthread_mutex_init(&deepest_delta_mutex, NULL);
 	pthread_key_create(&key, NULL);
@@ -165,6 +199,8 @@ static void cleanup_thread(void)
 	pthread_mutex_destroy(&counter_mutex);
 	pthread_mutex_destroy(&work_mutex);
 	pthread_mutex_destroy(&type_cas_mutex);
+	pthread_cond_destroy(&first_pass_cond_add);
+	pthread_cond_destroy(&first_pass_cond_done);
 	if (show_stat)
 		pthread_mutex_destroy(&deepest_delta_mutex);
 	for (i = 0; i < nr_threads; i++)
@@ -190,6 +226,10 @@ static void cleanup_thread(void)
 #define type_cas_lock()
 #define type_cas_unlock()
 
+#define start_first_pass_threads()
+#define queue_first_pass(obj, data)
+#define finish_first_pass_threads()
+
 #endif
 
 
@@ -218,6 +258,12 @@ static unsigned check_object(struct object *obj)
 	if (!(obj->flags & FLAG_CHECKED)) {
 		unsigned long size;
 		int type = sha1_object_info(obj->sha1, &size);
+		if (type <= 0 && repository_format_partial_clone &&
+		    (obj->type == OBJ_TREE || obj->type == OBJ_BLOB)) {
+			/* the filter of a partial fetch omitted it */
+			obj->flags |= FLAG_CHECKED;
+			return 1;
+		}
 		if (type <= 0)
 			die(_("did not receive expected object %s"),
 			      sha1_to_hex(obj->sha1));
@@ -440,17 +486,23 @@ static void *unpack_entry_data(unsigned long offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
-		hdrlen = sprintf(hdr, "%s %lu", typename(type), size) + 1;
-		git_SHA1_Init(&c);
-		git_SHA1_Update(&c, hdr, hdrlen);
-	} else
-		sha1 = NULL;
 	if (type == OBJ_BLOB && size > big_file_threshold)
 		buf = fixed_buf;
 	else
 		buf = xmallocz(size);
 
+	/*
+	 * Large blobs are not kept in memory, so they are hashed as they
+	 * stream by even when the worker threads hash the other objects.
+	 */
+	if (is_delta_type(type) || (first_pass_threads && buf != fixed_buf))
+		sha1 = NULL;
+	if (sha1) {
+		hdrlen = sprintf(hdr, "%s %lu", typename(type), size) + 1;
+		git_SHA1_Init(&c);
+		git_SHA1_Update(&c, hdr, hdrlen);
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
 	stream.next_out = buf;
@@ -1074,10 +1126,121 @@ static void resolve_base(struct object_entry *obj)
 	find_unresolved_deltas(base_obj);
 }
 
+#ifndef NO_PTHREADS
+static void queue_first_pass(struct object_entry *obj, void *data)
+{
+	work_lock();
+	while ((first_pass_end + 1) % FIRST_PASS_QUEUE_SIZE == first_pass_start ||
+	       (first_pass_queued_bytes &&
+		first_pass_queued_bytes + obj->size > delta_base_cache_limit))
+		pthread_cond_wait(&first_pass_cond_done, &work_mutex);
+	first_pass_queue[first_pass_end].obj = obj;
+	first_pass_queue[first_pass_end].data = data;
+	first_pass_end = (first_pass_end + 1) % FIRST_PASS_QUEUE_SIZE;
+	first_pass_queued_bytes += obj->size;
+	pthread_cond_signal(&first_pass_cond_add);
+	work_unlock();
+}
+
+/* Objects a worker takes at once, to hash them side by side. */
+#define FIRST_PASS_BATCH 8
+
+static void *threaded_first_pass(void *data)
+{
+	set_thread_data(data);
+	trace_event_thread_start("index-pack/first-pass");
+	for (;;) {
+		struct first_pass_item item[FIRST_PASS_BATCH];
+		struct git_SHA1_multi_job job[FIRST_PASS_BATCH];
+		git_SHA_CTX ctx[FIRST_PASS_BATCH];
+		size_t bytes = 0;
+		int i, nr = 0;
+
+		work_lock();
+		while (first_pass_start == first_pass_end && !first_pass_all_queued)
+			pthread_cond_wait(&first_pass_cond_add, &work_mutex);
+		while (nr < FIRST_PASS_BATCH && first_pass_start != first_pass_end) {
+			item[nr++] = first_pass_queue[first_pass_start];
+			first_pass_start = (first_pass_start + 1) % FIRST_PASS_QUEUE_SIZE;
+		}
+		work_unlock();
+		if (!nr)
+			break;
+
+		for (i = 0; i < nr; i++) {
+			struct object_entry *obj = item[i].obj;
+			char hdr[32];
+			int hdrlen = sprintf(hdr, "%s %lu",
+					     typename(obj->type), obj->size) + 1;
+
+			git_SHA1_Init(&ctx[i]);
+			git_SHA1_Update(&ctx[i], hdr, hdrlen);
+			job[i].ctx = &ctx[i];
+			job[i].data = item[i].data;
+			job[i].len = obj->size;
+			job[i].hash = obj->idx.sha1;
+		}
+		git_SHA1_Multi(job, nr);
+
+		for (i = 0; i < nr; i++) {
+			struct object_entry *obj = item[i].obj;
+
+			sha1_object(item[i].data, NULL, obj->size, obj->type,
+				    obj->idx.sha1);
+			free(item[i].data);
+			bytes += obj->size;
+		}
+
+		work_lock();
+		first_pass_queued_bytes -= bytes;
+		pthread_cond_signal(&first_pass_cond_done);
+		work_unlock();
+	}
+	trace_event_thread_exit();
+	return NULL;
+}
+
+static void start_first_pass_threads(void)
+{
+	int i;
+
+	if (nr_threads <= 1 && !getenv("GIT_FORCE_THREADS"))
+		return;
+	init_thread();
+	first_pass_start = first_pass_end = 0;
+	first_pass_queued_bytes = 0;
+	first_pass_all_queued = 0;
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 threaded_first_pass, thread_data + i);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	first_pass_threads = 1;
+}
+
+static void finish_first_pass_threads(void)
+{
+	int i;
+
+	if (!first_pass_threads)
+		return;
+	work_lock();
+	first_pass_all_queued = 1;
+	pthread_cond_broadcast(&first_pass_cond_add);
+	work_unlock();
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	cleanup_thread();
+	first_pass_threads = 0;
+}
+#endif
+
 #ifndef NO_PTHREADS
 static void *threaded_second_pass(void *data)
 {
 	set_thread_data(data);
+	trace_event_thread_start("index-pack/resolve");
 	for (;;) {
 		int i;
 		counter_lock();
@@ -1096,6 +1259,7 @@ static void *threaded_second_pass(void *data)
 
 		resolve_base(&objects[i]);
 	}
+	trace_event_thread_exit();
 	return NULL;
 }
 #endif
@@ -1105,6 +1269,11 @@ static void *threaded_second_pass(void *data)
  * - find locations of all objects;
  * - calculate SHA1 of all non-delta objects;
  * - remember base (SHA1 or offset) for all deltas.
+ *
+ * With threads, the pack is still read, checksummed and inflated in
+ * order by the main thread (the end of a deflated object is only known
+ * by inflating it), but the object names of the non-delta objects are
+ * computed and checked by the worker threads.
  */
 static void parse_pack_objects(unsigned char *sha1)
 {
@@ -1117,6 +1286,7 @@ static void parse_pack_objects(unsigned char *sha1)
 		progress = start_progress(
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+	start_first_pass_threads();
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &ofs_delta->offset,
@@ -1135,12 +1305,16 @@ static void parse_pack_objects(unsigned char *sha1)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
+		} else if (first_pass_threads) {
+			queue_first_pass(obj, data);
+			data = NULL;
 		} else
 			sha1_object(data, NULL, obj->size, obj->type, obj->idx.sha1);
 		free(data);
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+	finish_first_pass_threads();
 	stop_progress(&progress);
 
 	/* Check pack integrity */
@@ -1375,6 +1549,7 @@ static void fix_unresolved_deltas(struct sha1file *f)
 
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_name, const char *curr_rev_name,
 		  const char *keep_name, const char *keep_msg,
 		  unsigned char *sha1)
 {
@@ -1426,6 +1601,18 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else if (from_stdin)
 		chmod(final_pack_name, 0444);
 
+	/* the .rev goes in place first, as readers find packs by their .idx */
+	if (curr_rev_name && final_rev_name != curr_rev_name) {
+		if (!final_rev_name) {
+			snprintf(name, sizeof(name), "%s/pack/pack-%s.rev",
+				 get_object_directory(), sha1_to_hex(sha1));
+			final_rev_name = name;
+		}
+		if (finalize_object_file(curr_rev_name, final_rev_name))
+			die(_("cannot store reverse index file"));
+	} else if (curr_rev_name)
+		chmod(final_rev_name, 0444);
+
 	if (final_index_name != curr_index_name) {
 		if (!final_index_name) {
 			snprintf(name, sizeof(name), "%s/pack/pack-%s.idx",
@@ -1469,6 +1656,13 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 			die(_("bad pack.indexversion=%"PRIu32), opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_REV;
+		else
+			opts->flags &= ~WRITE_REV;
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		nr_threads = git_config_int(k, v);
 		if (nr_threads < 0)
@@ -1600,11 +1794,12 @@ static void show_pack_info(int stat_only)
 
 int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
-	int i, fix_thin_pack = 0, verify = 0, stat_only = 0;
-	const char *curr_index;
-	const char *index_name = NULL, *pack_name = NULL;
+	int i, fix_thin_pack = 0, verify = 0, stat_only = 0, rev_index = -1;
+	const char *curr_index, *curr_rev = NULL;
+	const char *index_name = NULL, *pack_name = NULL, *rev_name = NULL;
 	const char *keep_name = NULL, *keep_msg = NULL;
 	struct strbuf index_name_buf = STRBUF_INIT,
+		      rev_name_buf = STRBUF_INIT,
 		      keep_name_buf = STRBUF_INIT;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
@@ -1615,6 +1810,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		usage(index_pack_usage);
 
 	check_replace_refs = 0;
+	fetch_if_missing = 0;
 	fsck_options.walk = mark_link;
 
 	reset_pack_idx_option(&opts);
@@ -1653,6 +1849,10 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				keep_msg = "";
 			} else if (starts_with(arg, "--keep=")) {
 				keep_msg = arg + 7;
+			} else if (!strcmp(arg, "--rev-index")) {
+				rev_index = 1;
+			} else if (!strcmp(arg, "--no-rev-index")) {
+				rev_index = 0;
 			} else if (starts_with(arg, "--threads=")) {
 				char *end;
 				nr_threads = strtoul(arg+10, &end, 0);
@@ -1704,6 +1904,10 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 
 	if (!pack_name && !from_stdin)
 		usage(index_pack_usage);
+	if (rev_index > 0)
+		opts.flags |= WRITE_REV;
+	else if (!rev_index)
+		opts.flags &= ~WRITE_REV;
 	if (fix_thin_pack && !from_stdin)
 		die(_("--fix-thin cannot be used without --stdin"));
 	if (!index_name && pack_name) {
@@ -1729,6 +1933,23 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 			die(_("--verify with no packfile name given"));
 		read_idx_option(&opts, index_name);
 		opts.flags |= WRITE_IDX_VERIFY | WRITE_IDX_STRICT;
+		opts.flags &= ~WRITE_REV;
+	}
+	if ((opts.flags & WRITE_REV) && index_name) {
+		size_t len;
+		if (strip_suffix(index_name, ".idx", &len)) {
+			strbuf_add(&rev_name_buf, index_name, len);
+			strbuf_addstr(&rev_name_buf, ".rev");
+			rev_name = rev_name_buf.buf;
+		} else if (rev_index > 0) {
+			die(_("index file name '%s' does not end with '.idx'"),
+			    index_name);
+		} else {
+			/* only pack.writeReverseIndex asked for it */
+			warning(_("not writing a reverse index for '%s', "
+				  "which does not end with '.idx'"), index_name);
+			opts.flags &= ~WRITE_REV;
+		}
 	}
 	if (strict)
 		opts.flags |= WRITE_IDX_STRICT;
@@ -1748,9 +1969,15 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	if (show_stat)
 		obj_stat = xcalloc(nr_objects + 1, sizeof(struct object_stat));
 	ofs_deltas = xcalloc(nr_objects, sizeof(struct ofs_delta_entry));
+	trace_event_region_enter("index-pack", "parse pack");
 	parse_pack_objects(pack_sha1);
+	trace_event_region_leave("index-pack", "parse pack");
+	trace_event_region_enter("index-pack", "resolve deltas");
 	resolve_deltas();
+	trace_event_region_leave("index-pack", "resolve deltas");
 	conclude_pack(fix_thin_pack, curr_pack, pack_sha1);
+	trace_event_data("index-pack", "objects", nr_objects);
+	trace_event_data("index-pack", "deltas", nr_ofs_deltas + nr_ref_deltas);
 	free(ofs_deltas);
 	free(ref_deltas);
 	if (strict)
@@ -1763,22 +1990,28 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_sha1);
+	if (opts.flags & WRITE_REV)
+		curr_rev = write_rev_file(rev_name, idx_objects, nr_objects, pack_sha1);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
 		      index_name, curr_index,
+		      rev_name, curr_rev,
 		      keep_name, keep_msg,
 		      pack_sha1);
 	else
 		close(input_fd);
 	free(objects);
 	strbuf_release(&index_name_buf);
+	strbuf_release(&rev_name_buf);
 	strbuf_release(&keep_name_buf);
 	if (pack_name == NULL)
 		free((void *) curr_pack);
 	if (index_name == NULL)
 		free((void *) curr_index);
+	if (rev_name == NULL)
+		free((void *) curr_rev);
 
 	/*
 	 * Let the caller know this pack is not self contained
@@ -22,6 +22,7 @@
 static int init_is_bare_repository = 0;
 static int init_shared_repository = -1;
 static const char *init_db_template_dir;
+static const char *init_ref_storage;
 static const char *git_link;
 
 static void safe_create_dir(const char *dir, int share)
@@ -256,14 +257,30 @@ static int create_default_files(const char *template_path)
 	strcpy(path + len, "HEAD");
 	reinit = (!access(path, R_OK)
 		  || readlink(path, junk, sizeof(junk)-1) != -1);
-	if (!reinit) {
+	if (reinit) {
+		if (init_ref_storage &&
+		    strcmp(init_ref_storage, ref_storage_backend()))
+			die(_("attempt to reinitialize repository with different ref storage"));
+	} else {
+		struct strbuf err = STRBUF_INIT;
+
+		if (init_ref_storage)
+			set_ref_storage_backend(init_ref_storage);
+		if (refs_init_db(&err))
+			die("%s", err.buf);
 		if (create_symref("HEAD", "refs/heads/master", NULL) < 0)
 			exit(1);
 	}
 
 	/* This forces creation of new config file */
-	sprintf(repo_version_string, "%d", GIT_REPO_VERSION);
-	git_config_set("core.repositoryformatversion", repo_version_string);
+	if (strcmp(ref_storage_backend(), "files")) {
+		git_config_set("core.repositoryformatversion", "1");
+		git_config_set("extensions.refstorage", ref_storage_backend());
+	} else {
+		sprintf(repo_version_string, "%d", GIT_REPO_VERSION);
+		git_config_set("core.repositoryformatversion",
+			       repo_version_string);
+	}
 
 	path[len] = 0;
 	strcpy(path + len, "config");
@@ -480,7 +497,7 @@ static int shared_callback(const struct option *opt, const char *arg, int unset)
 }
 
 static const char *const init_db_usage[] = {
-	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [<directory>]"),
+	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [--ref-storage=<backend>] [<directory>]"),
 	NULL
 };
 
@@ -509,11 +526,16 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 		OPT_BIT('q', "quiet", &flags, N_("be quiet"), INIT_DB_QUIET),
 		OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 			   N_("separate git dir from working tree")),
+		OPT_STRING(0, "ref-storage", &init_ref_storage, N_("backend"),
+			   N_("how to store the refs of a new repository")),
 		OPT_END()
 	};
 
 	argc = parse_options(argc, argv, prefix, init_db_options, init_db_usage, 0);
 
+	if (init_ref_storage && !ref_storage_backend_exists(init_ref_storage))
+		die(_("unknown ref storage backend '%s'"), init_ref_storage);
+
 	if (real_git_dir && !is_absolute_path(real_git_dir))
 		real_git_dir = xstrdup(real_path(real_git_dir));
 
@@ -0,0 +1,104 @@
+#include "builtin.h"
+#include "parse-options.h"
+#include "midx.h"
+
+static const char * const builtin_multi_pack_index_usage[] = {
+	N_("git multi-pack-index read"),
+	N_("git multi-pack-index write"),
+	NULL
+};
+
+static const char * const builtin_multi_pack_index_read_usage[] = {
+	N_("git multi-pack-index read"),
+	NULL
+};
+
+static const char * const builtin_multi_pack_index_write_usage[] = {
+	N_("git multi-pack-index write"),
+	NULL
+};
+
+static int midx_read(int argc, const char **argv)
+{
+	struct multi_pack_index *m;
+	char *midx_name;
+	uint32_t i;
+	struct option options[] = {
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, NULL, options,
+			     builtin_multi_pack_index_read_usage, 0);
+	if (argc)
+		usage_with_options(builtin_multi_pack_index_read_usage, options);
+
+	midx_name = get_midx_filename(get_object_directory());
+	m = load_multi_pack_index(midx_name);
+	if (!m)
+		die(_("unable to read multi-pack-index file '%s'"), midx_name);
+	free(midx_name);
+
+	printf("header: %08x %d %d %d %d\n",
+	       get_be32(m->data),
+	       *(unsigned char *)(m->data + 4),
+	       *(unsigned char *)(m->data + 5),
+	       *(unsigned char *)(m->data + 6),
+	       *(unsigned char *)(m->data + 7));
+	printf("num_packs: %u\n", m->num_packs);
+	printf("num_objects: %u\n", m->num_objects);
+	printf("chunks:");
+	if (m->chunk_pack_names)
+		printf(" pack_names");
+	if (m->chunk_oid_fanout)
+		printf(" oid_fanout");
+	if (m->chunk_oid_lookup)
+		printf(" oid_lookup");
+	if (m->chunk_object_offsets)
+		printf(" object_offsets");
+	if (m->chunk_large_offsets)
+		printf(" large_offsets");
+	printf("\n");
+	printf("packs:\n");
+	for (i = 0; i < m->num_packs; i++)
+		printf("%s\n", m->pack_names[i]);
+
+	close_midx(m);
+	return 0;
+}
+
+static int midx_write(int argc, const char **argv)
+{
+	struct option options[] = {
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, NULL, options,
+			     builtin_multi_pack_index_write_usage, 0);
+	if (argc)
+		usage_with_options(builtin_multi_pack_index_write_usage, options);
+
+	return write_midx_file(get_object_directory());
+}
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	struct option builtin_multi_pack_index_options[] = {
+		OPT_END(),
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_multi_pack_index_usage,
+				   builtin_multi_pack_index_options);
+
+	git_config(git_default_config, NULL);
+
+	if (argc > 1) {
+		if (!strcmp(argv[1], "read"))
+			return midx_read(argc - 1, argv + 1);
+		if (!strcmp(argv[1], "write"))
+			return midx_write(argc - 1, argv + 1);
+	}
+
+	usage_with_options(builtin_multi_pack_index_usage,
+			   builtin_multi_pack_index_options);
+}
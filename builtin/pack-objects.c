@@ -14,11 +14,13 @@
 #include "diff.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "list-objects-filter.h"
 #include "pack-objects.h"
 #include "progress.h"
 #include "refs.h"
 #include "streaming.h"
 #include "thread-utils.h"
+#include "trace-event.h"
 #include "pack-bitmap.h"
 #include "reachable.h"
 #include "sha1-array.h"
@@ -65,6 +67,8 @@ static struct packed_git *reuse_packfile;
 static uint32_t reuse_packfile_objects;
 static off_t reuse_packfile_offset;
 
+static struct list_objects_filter_options filter_options;
+
 static int use_bitmap_index = 1;
 static int write_bitmap_index;
 static uint16_t write_bitmap_options;
@@ -232,6 +236,297 @@ static void copy_pack_data(struct sha1file *f,
 	}
 }
 
+#ifndef NO_PTHREADS
+
+/*
+ * While write_pack_file() writes the objects in write order, worker
+ * threads deflate the objects that are to be written afresh (and
+ * compute the deltas that were not cached) ahead of it.  The object
+ * store is not thread-safe, so the writing thread still reads the
+ * objects when it queues them; the workers only run diff_delta() and
+ * do_compress(), whose output does not depend on which thread runs
+ * them, so the pack is the same as the one written without them.
+ *
+ * The slots in [deflate_head, deflate_tail) of deflate_ring are in
+ * use, in write order; those from deflate_next on are waiting for a
+ * worker.  At most delta_base_cache_limit bytes of object data are
+ * held by the slots (but there is always room for one slot).
+ */
+struct deflate_slot {
+	struct object_entry *entry;
+	enum object_type type;
+	void *buf;		/* data to deflate, then deflated data */
+	unsigned long size;	/* size of the data before deflating */
+	void *base_buf;		/* base of a delta still to be computed */
+	unsigned long base_size;
+	unsigned long datalen;	/* size of the deflated data */
+	unsigned long mem;
+	int done;		/* set by the worker */
+	int taken;		/* set by the writing thread */
+};
+
+#define DEFLATE_RING_SIZE 256
+static struct deflate_slot deflate_ring[DEFLATE_RING_SIZE];
+static int deflate_head, deflate_next, deflate_tail;
+static int deflate_all_queued;
+static size_t deflate_mem;
+static uint32_t deflate_fill_pos;
+
+static int nr_deflate_threads;
+static pthread_t *deflate_threads;
+static try_to_free_t deflate_old_try_to_free_routine;
+
+/* deflate_mutex protects deflate_next, deflate_tail and the slots' done. */
+static pthread_mutex_t deflate_mutex;
+#define deflate_lock()		pthread_mutex_lock(&deflate_mutex)
+#define deflate_unlock()	pthread_mutex_unlock(&deflate_mutex)
+
+/* Signalled when a slot is queued, or when all of them are. */
+static pthread_cond_t deflate_cond_add;
+
+/* Signalled when a worker is done with a slot. */
+static pthread_cond_t deflate_cond_done;
+
+static void *threaded_deflate(void *arg)
+{
+	trace_event_thread_start("pack-objects/deflate");
+	for (;;) {
+		struct deflate_slot *slot;
+
+		deflate_lock();
+		while (deflate_next == deflate_tail && !deflate_all_queued)
+			pthread_cond_wait(&deflate_cond_add, &deflate_mutex);
+		if (deflate_next == deflate_tail) {
+			deflate_unlock();
+			break;
+		}
+		slot = &deflate_ring[deflate_next];
+		deflate_next = (deflate_next + 1) % DEFLATE_RING_SIZE;
+		deflate_unlock();
+
+		if (slot->base_buf) {
+			unsigned long delta_size;
+			void *delta_buf = diff_delta(slot->base_buf, slot->base_size,
+						     slot->buf, slot->size,
+						     &delta_size, 0);
+			if (!delta_buf || delta_size != slot->entry->delta_size)
+				die("delta size changed");
+			free(slot->buf);
+			free(slot->base_buf);
+			slot->base_buf = NULL;
+			slot->buf = delta_buf;
+			slot->size = delta_size;
+		}
+		slot->datalen = do_compress(&slot->buf, slot->size);
+
+		deflate_lock();
+		slot->done = 1;
+		pthread_cond_broadcast(&deflate_cond_done);
+		deflate_unlock();
+	}
+	trace_event_thread_exit();
+	return NULL;
+}
+
+static void wait_deflate_slot(struct deflate_slot *slot)
+{
+	deflate_lock();
+	while (!slot->done)
+		pthread_cond_wait(&deflate_cond_done, &deflate_mutex);
+	deflate_unlock();
+}
+
+static void start_deflate_threads(void)
+{
+	int i;
+
+	/*
+	 * A pack split decides whether to write an object as a delta
+	 * only when it gets to it.
+	 */
+	if (delta_search_threads <= 1 || pack_size_limit)
+		return;
+
+	pthread_mutex_init(&deflate_mutex, NULL);
+	pthread_cond_init(&deflate_cond_add, NULL);
+	pthread_cond_init(&deflate_cond_done, NULL);
+	deflate_head = deflate_next = deflate_tail = 0;
+	deflate_all_queued = 0;
+	deflate_mem = 0;
+	deflate_fill_pos = 0;
+
+	/*
+	 * Releasing pack windows from a worker would pull them from
+	 * under the writing thread.
+	 */
+	deflate_old_try_to_free_routine = set_try_to_free_routine(NULL);
+
+	nr_deflate_threads = delta_search_threads;
+	deflate_threads = xcalloc(nr_deflate_threads, sizeof(*deflate_threads));
+	for (i = 0; i < nr_deflate_threads; i++) {
+		int ret = pthread_create(&deflate_threads[i], NULL,
+					 threaded_deflate, NULL);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+}
+
+static void retire_deflate_slots(void)
+{
+	while (deflate_head != deflate_tail) {
+		struct deflate_slot *slot = &deflate_ring[deflate_head];
+
+		/* idx.offset is 1 while write_one() writes the bases first. */
+		if (!slot->taken &&
+		    (!slot->entry->idx.offset || slot->entry->idx.offset == 1))
+			break;
+		wait_deflate_slot(slot);
+		free(slot->buf);
+		deflate_mem -= slot->mem;
+		deflate_head = (deflate_head + 1) % DEFLATE_RING_SIZE;
+	}
+}
+
+static void finish_deflate_threads(void)
+{
+	int i;
+
+	if (!nr_deflate_threads)
+		return;
+
+	deflate_lock();
+	deflate_all_queued = 1;
+	pthread_cond_broadcast(&deflate_cond_add);
+	deflate_unlock();
+	for (i = 0; i < nr_deflate_threads; i++)
+		pthread_join(deflate_threads[i], NULL);
+	free(deflate_threads);
+	deflate_threads = NULL;
+	nr_deflate_threads = 0;
+
+	for (; deflate_head != deflate_tail;
+	     deflate_head = (deflate_head + 1) % DEFLATE_RING_SIZE)
+		free(deflate_ring[deflate_head].buf);
+
+	set_try_to_free_routine(deflate_old_try_to_free_routine);
+	pthread_cond_destroy(&deflate_cond_add);
+	pthread_cond_destroy(&deflate_cond_done);
+	pthread_mutex_destroy(&deflate_mutex);
+}
+
+static int want_reuse_object(struct object_entry *entry, int usable_delta);
+
+static void queue_deflate(struct object_entry *entry)
+{
+	struct deflate_slot *slot = &deflate_ring[deflate_tail];
+
+	memset(slot, 0, sizeof(*slot));
+	slot->entry = entry;
+	if (!entry->delta) {
+		/* large blobs are streamed by write_no_reuse_object() */
+		if (entry->type == OBJ_BLOB && entry->size > big_file_threshold)
+			return;
+		slot->buf = read_sha1_file(entry->idx.sha1, &slot->type,
+					   &slot->size);
+		if (!slot->buf)
+			die(_("unable to read %s"), sha1_to_hex(entry->idx.sha1));
+	} else if (entry->delta_data) {
+		/* a cached delta may have been deflated already */
+		if (entry->z_delta_size)
+			return;
+		slot->type = OBJ_REF_DELTA;
+		slot->buf = entry->delta_data;
+		slot->size = entry->delta_size;
+		entry->delta_data = NULL;
+	} else {
+		enum object_type type;
+
+		slot->type = OBJ_REF_DELTA;
+		slot->buf = read_sha1_file(entry->idx.sha1, &type, &slot->size);
+		if (!slot->buf)
+			die("unable to read %s", sha1_to_hex(entry->idx.sha1));
+		slot->base_buf = read_sha1_file(entry->delta->idx.sha1, &type,
+						&slot->base_size);
+		if (!slot->base_buf)
+			die("unable to read %s",
+			    sha1_to_hex(entry->delta->idx.sha1));
+	}
+	slot->mem = slot->size + slot->base_size;
+	deflate_mem += slot->mem;
+
+	deflate_lock();
+	deflate_tail = (deflate_tail + 1) % DEFLATE_RING_SIZE;
+	pthread_cond_signal(&deflate_cond_add);
+	deflate_unlock();
+}
+
+/*
+ * Queue the objects that follow the ones written so far in write order
+ * and are going to be written afresh, as far as the ring allows.
+ */
+static void fill_deflate_ring(struct object_entry **write_order)
+{
+	if (!nr_deflate_threads)
+		return;
+
+	retire_deflate_slots();
+	while (deflate_fill_pos < to_pack.nr_objects) {
+		struct object_entry *entry = write_order[deflate_fill_pos];
+
+		if ((deflate_tail + 1) % DEFLATE_RING_SIZE == deflate_head ||
+		    (deflate_head != deflate_tail &&
+		     deflate_mem >= delta_base_cache_limit))
+			break;
+		deflate_fill_pos++;
+		if (entry->idx.offset || entry->preferred_base ||
+		    want_reuse_object(entry, !!entry->delta))
+			continue;
+		queue_deflate(entry);
+	}
+}
+
+/*
+ * If a worker deflated the data of entry as we are about to write it,
+ * hand it over and return 1.
+ */
+static int take_deflated(struct object_entry *entry, int usable_delta,
+			 void **buf, enum object_type *type,
+			 unsigned long *size, unsigned long *datalen)
+{
+	int i;
+
+	if (!nr_deflate_threads)
+		return 0;
+
+	for (i = deflate_head; i != deflate_tail; i = (i + 1) % DEFLATE_RING_SIZE) {
+		struct deflate_slot *slot = &deflate_ring[i];
+
+		if (slot->entry != entry || slot->taken)
+			continue;
+		slot->taken = 1;
+		/* write_one() dropped a delta that would be recursive */
+		if (usable_delta != (slot->type == OBJ_REF_DELTA))
+			return 0;
+		wait_deflate_slot(slot);
+		*buf = slot->buf;
+		*type = slot->type;
+		*size = slot->size;
+		*datalen = slot->datalen;
+		slot->buf = NULL;
+		return 1;
+	}
+	return 0;
+}
+
+#else
+
+#define start_deflate_threads()
+#define fill_deflate_ring(write_order)
+#define take_deflated(entry, usable_delta, buf, type, size, datalen) 0
+#define finish_deflate_threads()
+
+#endif
+
 /* Return 0 if we will bust the pack-size limit */
 static unsigned long write_no_reuse_object(struct sha1file *f, struct object_entry *entry,
 					   unsigned long limit, int usable_delta)
@@ -242,8 +537,14 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	enum object_type type;
 	void *buf;
 	struct git_istream *st = NULL;
-
-	if (!usable_delta) {
+	int deflated = 0;
+
+	if (take_deflated(entry, usable_delta, &buf, &type, &size, &datalen)) {
+		deflated = 1;
+		if (usable_delta)
+			type = (allow_ofs_delta && entry->delta->idx.offset) ?
+				OBJ_OFS_DELTA : OBJ_REF_DELTA;
+	} else if (!usable_delta) {
 		if (entry->type == OBJ_BLOB &&
 		    entry->size > big_file_threshold &&
 		    (st = open_istream(entry->idx.sha1, &type, &size, NULL)) != NULL)
@@ -275,6 +576,8 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 
 	if (st)	/* large blob case, just assume we don't compress well */
 		datalen = size;
+	else if (deflated)
+		; /* a worker thread did it */
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
 	else
@@ -346,7 +649,7 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 {
 	struct packed_git *p = entry->in_pack;
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	off_t offset;
 	enum object_type type = entry->type;
 	unsigned long datalen;
@@ -359,10 +662,13 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 	hdrlen = encode_in_pack_object_header(type, entry->size, header);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	if (offset_to_pack_pos(p, offset, &pos) < 0)
+		die("cannot find the end of %s in %s",
+		    sha1_to_hex(entry->idx.sha1), p->pack_name);
+	datalen = pack_pos_to_offset(p, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen,
+			   pack_pos_to_index(p, pos))) {
 		error("bad packed object CRC for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
 		return write_no_reuse_object(f, entry, limit, usable_delta);
@@ -414,13 +720,33 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 	return hdrlen + datalen;
 }
 
+static int want_reuse_object(struct object_entry *entry, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!entry->in_pack)
+		return 0;	/* can't reuse what we don't have */
+	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (entry->type != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (entry->delta)
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
 /* Return 0 if we will bust the pack-size limit */
 static unsigned long write_object(struct sha1file *f,
 				  struct object_entry *entry,
 				  off_t write_offset)
 {
 	unsigned long limit, len;
-	int usable_delta, to_reuse;
+	int usable_delta;
 
 	if (!pack_to_stdout)
 		crc32_begin(f);
@@ -448,24 +774,7 @@ static unsigned long write_object(struct sha1file *f,
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!entry->in_pack)
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (entry->type != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (entry->delta)
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
-
-	if (!to_reuse)
+	if (!want_reuse_object(entry, usable_delta))
 		len = write_no_reuse_object(f, entry, limit, usable_delta);
 	else
 		len = write_reuse_object(f, entry, limit, usable_delta);
@@ -771,6 +1080,7 @@ static void write_pack_file(void)
 		progress_state = start_progress(_("Writing objects"), nr_result);
 	written_list = xmalloc(to_pack.nr_objects * sizeof(*written_list));
 	write_order = compute_write_order();
+	start_deflate_threads();
 
 	do {
 		unsigned char sha1[20];
@@ -794,10 +1104,12 @@ static void write_pack_file(void)
 		nr_written = 0;
 		for (; i < to_pack.nr_objects; i++) {
 			struct object_entry *e = write_order[i];
+			fill_deflate_ring(write_order);
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
 			display_progress(progress_state, written);
 		}
+		finish_deflate_threads();
 
 		/*
 		 * Did we write the wrong # entries in the header?
@@ -1390,11 +1702,11 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t pos;
+				if (offset_to_pack_pos(p, ofs, &pos) < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+						pack_pos_to_index(p, pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
@@ -1937,6 +2249,7 @@ static void *threaded_find_deltas(void *arg)
 {
 	struct thread_params *me = arg;
 
+	trace_event_thread_start("pack-objects/find-deltas");
 	while (me->remaining) {
 		find_deltas(me->list, &me->remaining,
 			    me->window, me->depth, me->processed);
@@ -1961,6 +2274,7 @@ static void *threaded_find_deltas(void *arg)
 		pthread_mutex_unlock(&me->mutex);
 	}
 	/* leave ->working 1 so that this doesn't get more work assigned */
+	trace_event_thread_exit();
 	return NULL;
 }
 
@@ -2217,6 +2531,13 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+		return 0;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index = git_config_bool(k, v);
 		return 0;
@@ -2239,6 +2560,13 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -2288,8 +2616,14 @@ static void show_object(struct object *obj,
 			const struct name_path *path, const char *last,
 			void *data)
 {
-	char *name = path_name(path, last);
+	char *name;
 
+	/* a partial clone may not have what the filter of its clone omitted */
+	if (repository_format_partial_clone &&
+	    obj->type == OBJ_BLOB && !has_sha1_file(obj->sha1))
+		return;
+
+	name = path_name(path, last);
 	add_preferred_base_object(name);
 	add_object_entry(obj->sha1, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
@@ -2462,7 +2796,7 @@ static int pack_options_allow_reuse(void)
 
 static int get_object_list_from_bitmap(struct rev_info *revs)
 {
-	if (prepare_bitmap_walk(revs) < 0)
+	if (prepare_bitmap_walk(revs, &filter_options) < 0)
 		return -1;
 
 	if (pack_options_allow_reuse() &&
@@ -2537,7 +2871,8 @@ static void get_object_list(int ac, const char **av)
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(&revs, show_edge);
-	traverse_commit_list(&revs, show_commit, show_object, NULL);
+	traverse_commit_list_filtered(&revs, show_commit, show_object, NULL,
+				      &filter_options);
 
 	if (unpack_unreachable_expiration) {
 		revs.ignore_missing_links = 1;
@@ -2669,10 +3004,13 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("use a bitmap index if available to speed up counting objects")),
 		OPT_BOOL(0, "write-bitmap-index", &write_bitmap_index,
 			 N_("write a bitmap index together with the pack index")),
+		OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
 		OPT_END(),
 	};
 
 	check_replace_refs = 0;
+	/* never ask the promisor remote for what we are about to pack */
+	fetch_if_missing = 0;
 
 	reset_pack_idx_option(&pack_idx_opts);
 	git_config(git_pack_config, NULL);
@@ -2742,6 +3080,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!pack_to_stdout && thin)
 		die("--thin cannot be used to build an indexable pack.");
 
+	if (filter_options.choice && !pack_to_stdout)
+		die("--filter can only be used to build a pack for transfer.");
+
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
 	if (!rev_list_all || !rev_list_reflog || !rev_list_index)
@@ -2773,9 +3114,18 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (non_empty && !nr_result)
 		return 0;
-	if (nr_result)
+	if (nr_result) {
+		trace_event_region_enter("pack-objects", "prepare pack");
 		prepare_pack(window, depth);
+		trace_event_region_leave("pack-objects", "prepare pack");
+	}
+	trace_event_region_enter("pack-objects", "write pack");
 	write_pack_file();
+	trace_event_region_leave("pack-objects", "write pack");
+	trace_event_data("pack-objects", "written", written);
+	trace_event_data("pack-objects", "written_delta", written_delta);
+	trace_event_data("pack-objects", "reused", reused);
+	trace_event_data("pack-objects", "reused_delta", reused_delta);
 	if (progress)
 		fprintf(stderr, "Total %"PRIu32" (delta %"PRIu32"),"
 			" reused %"PRIu32" (delta %"PRIu32")\n",
@@ -115,6 +115,8 @@ int cmd_prune(int argc, const char **argv, const char *prefix)
 	save_commit_buffer = 0;
 	check_replace_refs = 0;
 	ref_paranoia = 1;
+	/* what a partial clone does not have is not ours to prune */
+	fetch_if_missing = 0;
 	init_revisions(&revs, prefix);
 
 	argc = parse_options(argc, argv, prefix, options, prune_usage, 0);
@@ -7,6 +7,7 @@
 #include "strbuf.h"
 #include "string-list.h"
 #include "argv-array.h"
+#include "midx.h"
 
 static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
@@ -104,7 +105,7 @@ static void get_non_kept_pack_filenames(struct string_list *fname_list)
 
 static void remove_redundant_pack(const char *dir_name, const char *base_name)
 {
-	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap"};
+	const char *exts[] = {".pack", ".idx", ".rev", ".keep", ".bitmap"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -130,6 +131,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		unsigned optional:1;
 	} exts[] = {
 		{".pack"},
+		{".rev", 1},
 		{".idx"},
 		{".bitmap", 1},
 	};
@@ -145,6 +147,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	/* variables to be filled by option parsing */
 	int pack_everything = 0;
 	int delete_redundant = 0;
+	int use_midx;
 	const char *unpack_unreachable = NULL;
 	const char *window = NULL, *window_memory = NULL;
 	const char *depth = NULL;
@@ -399,6 +402,15 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		prune_packed_objects(opts);
 	}
 
+	/*
+	 * A multi-pack-index naming packs that are gone is ignored by
+	 * readers, so keep it up to date with what we just wrote.
+	 */
+	if (!git_config_get_bool("core.multipackindex", &use_midx) && use_midx)
+		write_midx_file(get_object_directory());
+	else
+		clear_midx_file(get_object_directory());
+
 	if (!no_update_server_info)
 		update_server_info(0);
 	remove_temporary_files();
@@ -3,6 +3,7 @@
 #include "diff.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "list-objects-filter.h"
 #include "pack.h"
 #include "pack-bitmap.h"
 #include "builtin.h"
@@ -46,9 +47,12 @@ static const char rev_list_usage[] =
 "  special purpose:\n"
 "    --bisect\n"
 "    --bisect-vars\n"
-"    --bisect-all"
+"    --bisect-all\n"
+"    --filter=<filter-spec>"
 ;
 
+static struct list_objects_filter_options filter_options;
+
 static void finish_commit(struct commit *commit, void *data);
 static void show_commit(struct commit *commit, void *data)
 {
@@ -107,7 +111,7 @@ static void show_commit(struct commit *commit, void *data)
 	else
 		putchar('\n');
 
-	if (revs->verbose_header && get_cached_commit_buffer(commit, NULL)) {
+	if (revs->verbose_header) {
 		struct strbuf buf = STRBUF_INIT;
 		struct pretty_print_context ctx = {0};
 		ctx.abbrev = revs->abbrev;
@@ -182,8 +186,12 @@ static void finish_object(struct object *obj,
 			  void *cb_data)
 {
 	struct rev_list_info *info = cb_data;
-	if (obj->type == OBJ_BLOB && !has_sha1_file(obj->sha1))
+	if (obj->type == OBJ_BLOB && !has_sha1_file(obj->sha1)) {
+		/* the clone of a partial clone may have omitted it */
+		if (repository_format_partial_clone)
+			return;
 		die("missing blob object '%s'", sha1_to_hex(obj->sha1));
+	}
 	if (info->revs->verify_objects && !obj->parsed && obj->type != OBJ_COMMIT)
 		parse_object(obj->sha1);
 }
@@ -282,6 +290,11 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	int use_bitmap_index = 0;
 
 	git_config(git_default_config, NULL);
+	/*
+	 * In a partial clone, list what we have instead of fetching
+	 * what its filter omitted.
+	 */
+	fetch_if_missing = 0;
 	init_revisions(&revs, prefix);
 	revs.abbrev = DEFAULT_ABBREV;
 	revs.commit_format = CMIT_FMT_UNSPECIFIED;
@@ -329,6 +342,15 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			test_bitmap_walk(&revs);
 			return 0;
 		}
+		if (skip_prefix(arg, "--filter=", &arg)) {
+			if (parse_list_objects_filter(&filter_options, arg))
+				usage(rev_list_usage);
+			continue;
+		}
+		if (!strcmp(arg, "--no-filter")) {
+			list_objects_filter_release(&filter_options);
+			continue;
+		}
 		usage(rev_list_usage);
 
 	}
@@ -362,13 +384,13 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (use_bitmap_index && !revs.prune) {
 		if (revs.count && !revs.left_right && !revs.cherry_mark) {
 			uint32_t commit_count;
-			if (!prepare_bitmap_walk(&revs)) {
+			if (!prepare_bitmap_walk(&revs, NULL)) {
 				count_bitmap_commit_list(&commit_count, NULL, NULL, NULL);
 				printf("%d\n", commit_count);
 				return 0;
 			}
 		} else if (revs.tag_objects && revs.tree_objects && revs.blob_objects) {
-			if (!prepare_bitmap_walk(&revs)) {
+			if (!prepare_bitmap_walk(&revs, &filter_options)) {
 				traverse_bitmap_commit_list(&show_object_fast);
 				return 0;
 			}
@@ -390,7 +412,8 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			return show_bisect_vars(&info, reaches, all);
 	}
 
-	traverse_commit_list(&revs, show_commit, show_object, &info);
+	traverse_commit_list_filtered(&revs, show_commit, show_object, &info,
+				      &filter_options);
 
 	if (revs.count) {
 		if (revs.left_right && revs.cherry_mark)
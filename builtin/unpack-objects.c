@@ -505,6 +505,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 	unsigned char sha1[20];
 
 	check_replace_refs = 0;
+	fetch_if_missing = 0;
 
 	git_config(git_default_config, NULL);
 
@@ -282,7 +282,8 @@ static int update_one(struct cache_tree *it,
 			break; /* at the end of this level */
 
 		slash = strchr(path + baselen, '/');
-		if (!slash) {
+		if (!slash || (S_ISSPARSEDIR(ce->ce_mode) && !slash[1])) {
+			/* a sparse directory is a leaf here */
 			i++;
 			continue;
 		}
@@ -334,7 +335,7 @@ static int update_one(struct cache_tree *it,
 			break; /* at the end of this level */
 
 		slash = strchr(path + baselen, '/');
-		if (slash) {
+		if (slash && !(S_ISSPARSEDIR(ce->ce_mode) && !slash[1])) {
 			entlen = slash - (path + baselen);
 			sub = find_subtree(it, path + baselen, entlen, 0);
 			if (!sub)
@@ -352,6 +353,8 @@ static int update_one(struct cache_tree *it,
 			sha1 = ce->sha1;
 			mode = ce->ce_mode;
 			entlen = pathlen - baselen;
+			if (S_ISSPARSEDIR(mode))
+				entlen--; /* drop the trailing slash */
 			i++;
 		}
 		if (mode != S_IFGITLINK && !missing_ok && !has_sha1_file(sha1)) {
@@ -685,6 +688,39 @@ void prime_cache_tree(struct index_state *istate, struct tree *tree)
 	istate->cache_changed |= CACHE_TREE_CHANGED;
 }
 
+static int expand_sparse_dir_rec(struct cache_tree *it, const char *path,
+				 struct tree *tree)
+{
+	const char *slash = strchr(path, '/');
+	struct cache_tree_sub *sub;
+	int added;
+
+	if (!slash)
+		die("BUG: sparse directory '%s' without a slash", path);
+	sub = find_subtree(it, path, slash - path, 1);
+	if (!slash[1]) {
+		cache_tree_free(&sub->cache_tree);
+		sub->cache_tree = cache_tree();
+		prime_cache_tree_rec(sub->cache_tree, tree);
+		added = sub->cache_tree->entry_count - 1;
+	} else {
+		if (!sub->cache_tree)
+			sub->cache_tree = cache_tree();
+		added = expand_sparse_dir_rec(sub->cache_tree, slash + 1, tree);
+	}
+
+	/* only valid nodes keep track of their entries */
+	if (0 <= it->entry_count)
+		it->entry_count += added;
+	return added;
+}
+
+void cache_tree_expand_sparse_dir(struct cache_tree *root, const char *path,
+				  struct tree *tree)
+{
+	expand_sparse_dir_rec(root, path, tree);
+}
+
 /*
  * find the cache_tree that corresponds to the current level without
  * exploding the full path into textual form.  The root of the
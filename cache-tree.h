@@ -50,6 +50,13 @@ int write_index_as_tree(unsigned char *sha1, struct index_state *index_state, co
 int write_cache_as_tree(unsigned char *sha1, int flags, const char *prefix);
 void prime_cache_tree(struct index_state *, struct tree *);
 
+/*
+ * The sparse directory entry "path" (with its trailing slash) has
+ * been replaced by the entries of "tree": describe them in the
+ * cache-tree, too.
+ */
+void cache_tree_expand_sparse_dir(struct cache_tree *, const char *path, struct tree *tree);
+
 extern int cache_tree_matches_traversal(struct cache_tree *, struct name_entry *ent, struct traverse_info *info);
 
 #endif
@@ -18,6 +18,30 @@
 #define git_SHA1_Final	SHA1_Final
 #endif
 
+#ifndef git_SHA1_Multi
+/*
+ * Update each job's context with its data and finalize it into hash;
+ * SHA-1 implementations that can hash several buffers at once provide
+ * their own.
+ */
+struct git_SHA1_multi_job {
+	git_SHA_CTX *ctx;
+	const void *data;
+	unsigned long len;
+	unsigned char *hash;
+};
+
+static inline void git_SHA1_Multi(struct git_SHA1_multi_job *jobs, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		git_SHA1_Update(jobs[i].ctx, jobs[i].data, jobs[i].len);
+		git_SHA1_Final(jobs[i].hash, jobs[i].ctx);
+	}
+}
+#endif
+
 #include <zlib.h>
 typedef struct git_zstream {
 	z_stream z;
@@ -77,6 +101,12 @@ struct object_id {
 #define S_IFGITLINK	0160000
 #define S_ISGITLINK(m)	(((m) & S_IFMT) == S_IFGITLINK)
 
+/*
+ * A "sparse directory" entry of a sparse index stands for a whole
+ * tree outside of the sparse checkout; its name ends with a slash.
+ */
+#define S_ISSPARSEDIR(m)	S_ISDIR(m)
+
 /*
  * Some mode bits are also used internally for computations.
  *
@@ -178,6 +208,7 @@ struct cache_entry {
 #define CE_ADDED             (1 << 19)
 
 #define CE_HASHED            (1 << 20)
+#define CE_FSMONITOR_VALID   (1 << 21)
 #define CE_WT_REMOVE         (1 << 22) /* remove in work directory */
 #define CE_CONFLICTED        (1 << 23)
 
@@ -298,9 +329,11 @@ static inline unsigned int canon_mode(unsigned int mode)
 #define CACHE_TREE_CHANGED	(1 << 5)
 #define SPLIT_INDEX_ORDERED	(1 << 6)
 #define UNTRACKED_CHANGED	(1 << 7)
+#define FSMONITOR_CHANGED	(1 << 8)
 
 struct split_index;
 struct untracked_cache;
+struct ewah_bitmap;
 
 struct index_state {
 	struct cache_entry **cache;
@@ -311,11 +344,15 @@ struct index_state {
 	struct split_index *split_index;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 fsmonitor_has_run_once : 1,
+		 sparse_index : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	unsigned char sha1[20];
 	struct untracked_cache *untracked;
+	uint64_t fsmonitor_last_update;
+	struct ewah_bitmap *fsmonitor_dirty;
 };
 
 extern struct index_state the_index;
@@ -410,6 +447,7 @@ static inline enum object_type object_type(unsigned int mode)
 #define GIT_GLOB_PATHSPECS_ENVIRONMENT "GIT_GLOB_PATHSPECS"
 #define GIT_NOGLOB_PATHSPECS_ENVIRONMENT "GIT_NOGLOB_PATHSPECS"
 #define GIT_ICASE_PATHSPECS_ENVIRONMENT "GIT_ICASE_PATHSPECS"
+#define NO_LAZY_FETCH_ENVIRONMENT "GIT_NO_LAZY_FETCH"
 
 /*
  * This environment variable is expected to contain a boolean indicating
@@ -635,7 +673,9 @@ extern char *git_replace_ref_base;
 
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_loose_object_cache;
 extern int core_apply_sparse_checkout;
+extern int command_requires_full_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
@@ -697,9 +737,16 @@ extern char *notes_ref_name;
 extern int grafts_replace_parents;
 
 #define GIT_REPO_VERSION 0
+#define GIT_REPO_VERSION_READ 1
 extern int repository_format_version;
 extern int check_repository_format(void);
 
+/*
+ * The remote named by "extensions.partialClone", which can provide
+ * the objects a partial clone omitted, or NULL.
+ */
+extern char *repository_format_partial_clone;
+
 #define MTIME_CHANGED	0x0001
 #define CTIME_CHANGED	0x0002
 #define OWNER_CHANGED	0x0004
@@ -939,6 +986,18 @@ static inline void *read_sha1_file(const unsigned char *sha1, enum object_type *
 	return read_sha1_file_extended(sha1, type, size, LOOKUP_REPLACE_OBJECT);
 }
 
+/*
+ * Objects may be read by several threads at once with read_sha1_file()
+ * and sha1_object_info_extended() between enable_obj_read_lock() and
+ * disable_obj_read_lock(); the rest of the object store is not
+ * thread-safe.  Code that reaches into the object store otherwise while
+ * other threads read objects must hold obj_read_lock().
+ */
+extern void enable_obj_read_lock(void);
+extern void disable_obj_read_lock(void);
+extern void obj_read_lock(void);
+extern void obj_read_unlock(void);
+
 /*
  * This internal function is only declared here for the benefit of
  * lookup_replace_object().  Please do not call it directly.
@@ -1002,6 +1061,22 @@ static inline int has_sha1_file(const unsigned char *sha1)
 	return has_sha1_file_with_flags(sha1, 0);
 }
 
+/*
+ * In a partial clone (see repository_format_partial_clone), reading an
+ * object we do not have fetches it from the remote the repository was
+ * cloned from, unless fetch_if_missing is unset or GIT_NO_LAZY_FETCH
+ * is set in the environment.  has_sha1_file() never fetches.
+ */
+extern int fetch_if_missing;
+
+/*
+ * Fetch the given objects from the remote of a partial clone in one
+ * request.  Objects that were asked for before are not asked for
+ * again.  Return 0 if a fetch ran successfully, -1 otherwise.
+ */
+struct sha1_array;
+extern int fetch_promisor_objects(const struct sha1_array *sha1s);
+
 /*
  * Return true iff an alternate object database has a loose object
  * with the specified name.  This function does not respect replace
@@ -1202,6 +1277,7 @@ extern void remove_scheduled_dirs(void);
 
 extern struct alternate_object_database {
 	struct alternate_object_database *next;
+	struct loose_object_cache *loose_cache;
 	char *name;
 	char base[FLEX_ARRAY]; /* more */
 } *alt_odb_list;
@@ -1211,6 +1287,18 @@ extern void add_to_alternates_file(const char *reference);
 typedef int alt_odb_fn(struct alternate_object_database *, void *);
 extern int foreach_alt_odb(alt_odb_fn, void*);
 
+/*
+ * With core.looseObjectCache, return the loose objects in the fan-out
+ * directory subdir_nr of alt (of our own object directory if alt is
+ * NULL), reading the directory on first use.  Return NULL if the
+ * cache is disabled.
+ */
+extern struct sha1_array *loose_object_cache_subdir(struct alternate_object_database *alt,
+						    int subdir_nr);
+
+/* Tell the cache about a loose object we have just written. */
+extern void loose_object_cache_add(const unsigned char *sha1);
+
 struct pack_window {
 	struct pack_window *next;
 	unsigned char *base;
@@ -1226,6 +1314,11 @@ extern struct packed_git {
 	off_t pack_size;
 	const void *index_data;
 	size_t index_size;
+	/* the reverse index, see pack-revindex.h */
+	struct revindex_entry *revindex;
+	const uint32_t *revindex_data;
+	void *revindex_map;
+	size_t revindex_map_size;
 	uint32_t num_objects;
 	uint32_t num_bad_objects;
 	unsigned char *bad_object_sha1;
@@ -1235,7 +1328,8 @@ extern struct packed_git {
 	unsigned pack_local:1,
 		 pack_keep:1,
 		 freshened:1,
-		 do_not_close:1;
+		 do_not_close:1,
+		 multi_pack_index:1;
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
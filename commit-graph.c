@@ -0,0 +1,892 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "refs.h"
+#include "progress.h"
+#include "csum-file.h"
+#include "commit-slab.h"
+#include "commit-graph.h"
+
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_CHUNKLOOKUP_WIDTH 12
+#define GRAPH_FANOUT_SIZE (4 * 256)
+#define GRAPH_MIN_SIZE (GRAPH_HEADER_SIZE + 4 * GRAPH_CHUNKLOOKUP_WIDTH + \
+			GRAPH_FANOUT_SIZE + GRAPH_OID_LEN)
+
+/* The commit-graph of the local object directory, if enabled and valid */
+static struct commit_graph *commit_graph;
+static int commit_graph_prepared;
+static int commit_graph_generations_ok;
+
+char *get_commit_graph_filename(const char *obj_dir)
+{
+	return xstrfmt("%s/info/commit-graph", obj_dir);
+}
+
+void free_commit_graph(struct commit_graph *g)
+{
+	if (!g)
+		return;
+	munmap(g->data, g->data_len);
+	free(g);
+}
+
+/*
+ * The Bloom filters are optional: if they look wrong or use a hash we
+ * do not know, ignore them rather than the whole file.
+ */
+static void load_bloom_chunks(struct commit_graph *g)
+{
+	const unsigned char *end = g->data + g->data_len - GRAPH_OID_LEN;
+	uint32_t hash_version;
+
+	if (g->chunk_bloom_indexes + 4 * (size_t)g->num_commits > end ||
+	    g->chunk_bloom_data + GRAPH_BLOOM_DATA_HEADER_SIZE > end) {
+		warning("ignoring truncated commit-graph Bloom filter chunks");
+		goto ignore;
+	}
+
+	hash_version = get_be32(g->chunk_bloom_data);
+	if (hash_version != BLOOM_HASH_VERSION)
+		goto ignore;
+	g->bloom_settings.hash_version = hash_version;
+	g->bloom_settings.num_hashes = get_be32(g->chunk_bloom_data + 4);
+	g->bloom_settings.bits_per_entry = get_be32(g->chunk_bloom_data + 8);
+	if (!g->bloom_settings.num_hashes)
+		goto ignore;
+	return;
+
+ignore:
+	g->chunk_bloom_indexes = g->chunk_bloom_data = NULL;
+}
+
+struct commit_graph *load_commit_graph_one(const char *graph_file)
+{
+	struct stat st;
+	int fd;
+	struct commit_graph *g;
+	unsigned char *data;
+	size_t data_len;
+	uint32_t signature;
+	unsigned char num_chunks;
+	const unsigned char *chunk_lookup;
+	uint32_t i;
+
+	fd = git_open_noatime(graph_file);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	data_len = xsize_t(st.st_size);
+	if (data_len < GRAPH_MIN_SIZE) {
+		close(fd);
+		error("commit-graph file %s is too small", graph_file);
+		return NULL;
+	}
+	data = xmmap(NULL, data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	signature = get_be32(data);
+	if (signature != GRAPH_SIGNATURE) {
+		error("commit-graph signature %X does not match signature %X",
+		      signature, GRAPH_SIGNATURE);
+		goto cleanup_fail;
+	}
+	if (data[4] != GRAPH_VERSION) {
+		error("commit-graph version %d does not match version %d",
+		      data[4], GRAPH_VERSION);
+		goto cleanup_fail;
+	}
+	if (data[5] != GRAPH_OID_VERSION) {
+		error("commit-graph hash version %d does not match version %d",
+		      data[5], GRAPH_OID_VERSION);
+		goto cleanup_fail;
+	}
+
+	g = xcalloc(1, sizeof(*g));
+	g->data = data;
+	g->data_len = data_len;
+
+	num_chunks = data[6];
+	chunk_lookup = data + GRAPH_HEADER_SIZE;
+	if (GRAPH_HEADER_SIZE + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH > data_len) {
+		error("commit-graph chunk lookup table is truncated");
+		goto cleanup_free;
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+
+		chunk_lookup += GRAPH_CHUNKLOOKUP_WIDTH;
+		if (chunk_offset > data_len - GRAPH_OID_LEN) {
+			error("commit-graph improper chunk offset %08x%08x",
+			      (uint32_t)(chunk_offset >> 32),
+			      (uint32_t)chunk_offset);
+			goto cleanup_free;
+		}
+
+		switch (chunk_id) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			g->chunk_oid_fanout = data + chunk_offset;
+			break;
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			g->chunk_oid_lookup = data + chunk_offset;
+			break;
+		case GRAPH_CHUNKID_DATA:
+			g->chunk_commit_data = data + chunk_offset;
+			break;
+		case GRAPH_CHUNKID_EXTRAEDGES:
+			g->chunk_extra_edges = data + chunk_offset;
+			break;
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			g->chunk_bloom_indexes = data + chunk_offset;
+			break;
+		case GRAPH_CHUNKID_BLOOMDATA:
+			g->chunk_bloom_data = data + chunk_offset;
+			break;
+		}
+	}
+
+	if (!g->chunk_oid_fanout || !g->chunk_oid_lookup || !g->chunk_commit_data) {
+		error("commit-graph is missing required chunks");
+		goto cleanup_free;
+	}
+	g->num_commits = get_be32(g->chunk_oid_fanout + 4 * 255);
+	if (g->chunk_commit_data + (size_t)g->num_commits * GRAPH_DATA_WIDTH >
+	    data + data_len - GRAPH_OID_LEN) {
+		error("commit-graph is truncated");
+		goto cleanup_free;
+	}
+
+	if (g->chunk_bloom_indexes && g->chunk_bloom_data)
+		load_bloom_chunks(g);
+	else
+		g->chunk_bloom_indexes = g->chunk_bloom_data = NULL;
+	return g;
+
+cleanup_free:
+	free(g);
+cleanup_fail:
+	munmap(data, data_len);
+	return NULL;
+}
+
+static int count_parent_graft(const struct commit_graft *graft, void *data)
+{
+	int *nr = data;
+	if (graft->nr_parent >= 0)
+		(*nr)++;
+	return 0;
+}
+
+/*
+ * Grafts and replace refs can give a commit parents that are not
+ * accounted for by the generation numbers in the graph, which would
+ * make walks that cut off on generation numbers miss commits.  Shallow
+ * boundaries only remove edges, so they are fine.
+ */
+static int generations_usable(void)
+{
+	int nr = 0;
+
+	/* make sure the graft file and the replace refs are read */
+	lookup_commit_graft(null_sha1);
+	lookup_replace_object(null_sha1);
+
+	for_each_commit_graft(count_parent_graft, &nr);
+	return !nr && !check_replace_refs;
+}
+
+static void prepare_commit_graph(void)
+{
+	char *graph_name;
+	int enabled;
+
+	if (commit_graph_prepared)
+		return;
+	commit_graph_prepared = 1;
+
+	if (git_config_get_bool("core.commitgraph", &enabled) || !enabled)
+		return;
+
+	graph_name = get_commit_graph_filename(get_object_directory());
+	commit_graph = load_commit_graph_one(graph_name);
+	free(graph_name);
+
+	if (commit_graph)
+		commit_graph_generations_ok = generations_usable();
+}
+
+static int bsearch_graph(struct commit_graph *g, const unsigned char *sha1,
+			 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? get_be32(g->chunk_oid_fanout + 4 * (sha1[0] - 1)) : 0;
+	hi = get_be32(g->chunk_oid_fanout + 4 * sha1[0]);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, g->chunk_oid_lookup + GRAPH_OID_LEN * mi);
+
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+static struct commit_list **insert_parent_or_die(struct commit_graph *g,
+						 uint32_t pos,
+						 struct commit_list **pptr)
+{
+	struct commit *c;
+
+	if (pos >= g->num_commits)
+		die("invalid parent position %"PRIu32" in commit-graph", pos);
+	c = lookup_commit(g->chunk_oid_lookup + GRAPH_OID_LEN * pos);
+	if (!c)
+		die("could not find commit %s",
+		    sha1_to_hex(g->chunk_oid_lookup + GRAPH_OID_LEN * pos));
+	c->graph_pos = pos;
+	return &commit_list_insert(c, pptr)->next;
+}
+
+static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
+				   uint32_t pos)
+{
+	const unsigned char *commit_data;
+	uint32_t generation;
+
+	commit_data = g->chunk_commit_data + (size_t)GRAPH_DATA_WIDTH * pos;
+	item->graph_pos = pos;
+
+	/* zero means the writer did not compute generation numbers */
+	generation = get_be32(commit_data + GRAPH_OID_LEN + 8) >> 2;
+	if (commit_graph_generations_ok && generation)
+		item->generation = generation;
+}
+
+static int fill_commit_in_graph(struct commit *item, struct commit_graph *g,
+				uint32_t pos)
+{
+	const unsigned char *commit_data;
+	uint32_t edge_value, date_high, date_low;
+	const unsigned char *extra_edge;
+	struct commit_list **pptr;
+
+	commit_data = g->chunk_commit_data + (size_t)GRAPH_DATA_WIDTH * pos;
+
+	item->object.parsed = 1;
+	item->tree = lookup_tree(commit_data);
+	fill_commit_graph_info(item, g, pos);
+
+	date_high = get_be32(commit_data + GRAPH_OID_LEN + 8) & 0x3;
+	date_low = get_be32(commit_data + GRAPH_OID_LEN + 12);
+	item->date = (unsigned long)(((uint64_t)date_high << 32) | date_low);
+
+	pptr = &item->parents;
+
+	edge_value = get_be32(commit_data + GRAPH_OID_LEN);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	pptr = insert_parent_or_die(g, edge_value, pptr);
+
+	edge_value = get_be32(commit_data + GRAPH_OID_LEN + 4);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	if (!(edge_value & GRAPH_EXTRA_EDGES_NEEDED)) {
+		insert_parent_or_die(g, edge_value, pptr);
+		return 1;
+	}
+
+	if (!g->chunk_extra_edges)
+		die("commit-graph is missing the extra edges chunk");
+	extra_edge = g->chunk_extra_edges +
+		     4 * (size_t)(edge_value & GRAPH_EDGE_LAST_MASK);
+	do {
+		edge_value = get_be32(extra_edge);
+		pptr = insert_parent_or_die(g, edge_value & GRAPH_EDGE_LAST_MASK,
+					    pptr);
+		extra_edge += 4;
+	} while (!(edge_value & GRAPH_LAST_EDGE));
+
+	return 1;
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	const unsigned char *sha1 = item->object.sha1;
+	struct commit_graft *graft;
+	uint32_t pos;
+
+	prepare_commit_graph();
+	if (!commit_graph)
+		return 0;
+	if (item->object.parsed)
+		return 1;
+
+	/*
+	 * The graph records the parents as written in the object;
+	 * grafted and replaced commits must be parsed the slow way so
+	 * that their rewritten parents are honored.  Shallow commits
+	 * simply lose their parents.
+	 */
+	if (lookup_replace_object(sha1) != sha1)
+		return 0;
+	graft = lookup_commit_graft(sha1);
+	if (graft && graft->nr_parent >= 0)
+		return 0;
+
+	if (item->graph_pos != COMMIT_NOT_FROM_GRAPH)
+		pos = item->graph_pos;
+	else if (!bsearch_graph(commit_graph, sha1, &pos))
+		return 0;
+	fill_commit_in_graph(item, commit_graph, pos);
+	if (graft) {
+		free_commit_list(item->parents);
+		item->parents = NULL;
+	}
+	return 1;
+}
+
+const struct bloom_filter_settings *commit_graph_bloom_settings(void)
+{
+	prepare_commit_graph();
+	if (!commit_graph || !commit_graph->chunk_bloom_data ||
+	    !commit_graph_generations_ok)
+		return NULL;
+	return &commit_graph->bloom_settings;
+}
+
+static int read_bloom_filter(struct commit_graph *g, uint32_t pos,
+			     struct bloom_filter *filter)
+{
+	const unsigned char *end = g->data + g->data_len - GRAPH_OID_LEN;
+	const unsigned char *filter_data;
+	uint32_t start_index, end_index;
+
+	start_index = pos ? get_be32(g->chunk_bloom_indexes + 4 * (pos - 1)) : 0;
+	end_index = get_be32(g->chunk_bloom_indexes + 4 * pos);
+	filter_data = g->chunk_bloom_data + GRAPH_BLOOM_DATA_HEADER_SIZE;
+	if (end_index < start_index ||
+	    end_index > end - filter_data)
+		return 0;
+
+	filter->data = (unsigned char *)filter_data + start_index;
+	filter->len = end_index - start_index;
+	return 1;
+}
+
+int get_commit_bloom_filter(struct commit *c, struct commit *parent,
+			    struct bloom_filter *filter)
+{
+	const unsigned char *commit_data;
+	uint32_t pos, first_parent;
+
+	if (!commit_graph_bloom_settings())
+		return 0;
+	if (c->graph_pos != COMMIT_NOT_FROM_GRAPH)
+		pos = c->graph_pos;
+	else if (!bsearch_graph(commit_graph, c->object.sha1, &pos))
+		return 0;
+
+	/* the filter is relative to the first parent as written */
+	commit_data = commit_graph->chunk_commit_data + (size_t)GRAPH_DATA_WIDTH * pos;
+	first_parent = get_be32(commit_data + GRAPH_OID_LEN);
+	if (first_parent == GRAPH_PARENT_NONE) {
+		if (parent)
+			return 0;
+	} else if (!parent || first_parent >= commit_graph->num_commits ||
+		   hashcmp(parent->object.sha1, commit_graph->chunk_oid_lookup +
+			   GRAPH_OID_LEN * first_parent))
+		return 0;
+
+	return read_bloom_filter(commit_graph, pos, filter);
+}
+
+void load_commit_graph_info(struct commit *item)
+{
+	uint32_t pos;
+
+	prepare_commit_graph();
+	if (!commit_graph || !commit_graph_generations_ok)
+		return;
+	if (item->graph_pos != COMMIT_NOT_FROM_GRAPH)
+		pos = item->graph_pos;
+	else if (!bsearch_graph(commit_graph, item->object.sha1, &pos))
+		return;
+	fill_commit_graph_info(item, commit_graph, pos);
+}
+
+/*
+ * Writing
+ */
+
+struct graph_entry {
+	struct commit *commit;
+	unsigned char tree[GRAPH_OID_LEN];
+	unsigned long date;
+	uint32_t generation;
+	struct bloom_filter bloom;
+	/* parents[parent_start..parent_start+parent_nr) in the writer */
+	uint32_t parent_start;
+	uint32_t parent_nr;
+};
+
+/* Position + 1 of a commit in the writer's entry list, 0 if absent */
+define_commit_slab(graph_pos_slab, uint32_t);
+
+struct graph_writer {
+	struct graph_entry *entries;
+	uint32_t nr, alloc;
+	struct commit **parents;
+	uint32_t parents_nr, parents_alloc;
+	uint32_t num_extra_edges;
+	uint64_t bloom_data_size;
+	struct bloom_filter_settings bloom_settings;
+	struct graph_pos_slab positions;
+	struct progress *progress;
+	unsigned progress_cnt;
+};
+
+static void add_graph_commit(struct graph_writer *w, struct commit *c)
+{
+	uint32_t *pos = graph_pos_slab_at(&w->positions, c);
+
+	if (*pos)
+		return;
+	ALLOC_GROW(w->entries, w->nr + 1, w->alloc);
+	memset(&w->entries[w->nr], 0, sizeof(w->entries[w->nr]));
+	w->entries[w->nr].commit = c;
+	*pos = ++w->nr;
+}
+
+static int add_packed_commit(const unsigned char *sha1,
+			     struct packed_git *pack, uint32_t pos,
+			     void *data)
+{
+	struct graph_writer *w = data;
+
+	display_progress(w->progress, ++w->progress_cnt);
+	if (sha1_object_info(sha1, NULL) == OBJ_COMMIT)
+		add_graph_commit(w, lookup_commit(sha1));
+	return 0;
+}
+
+static int add_loose_commit(const unsigned char *sha1, const char *path,
+			    void *data)
+{
+	return add_packed_commit(sha1, NULL, 0, data);
+}
+
+static int add_ref_commit(const char *refname, const struct object_id *oid,
+			  int flags, void *data)
+{
+	struct graph_writer *w = data;
+	struct object *o = deref_tag(parse_object(oid->hash), refname, 0);
+
+	display_progress(w->progress, ++w->progress_cnt);
+	if (o && o->type == OBJ_COMMIT)
+		add_graph_commit(w, (struct commit *)o);
+	return 0;
+}
+
+/*
+ * Read the raw commit object (ignoring grafts and replacements, which
+ * are applied at read time) and record its tree, parents and date.
+ * Parents not yet known to the writer are queued, so that the list
+ * ends up closed under the parent relation.
+ */
+static void read_graph_entry(struct graph_writer *w, uint32_t i)
+{
+	struct graph_entry *e = &w->entries[i];
+	const unsigned char *sha1 = e->commit->object.sha1;
+	enum object_type type;
+	unsigned long size;
+	char *buffer;
+	const char *tail, *p;
+	unsigned char parent[GRAPH_OID_LEN];
+
+	buffer = read_sha1_file_extended(sha1, &type, &size, 0);
+	if (!buffer)
+		die("unable to read commit %s", sha1_to_hex(sha1));
+	if (type != OBJ_COMMIT)
+		die("object %s is not a commit", sha1_to_hex(sha1));
+	tail = buffer + size;
+
+	if (size < 46 || !skip_prefix(buffer, "tree ", &p) ||
+	    get_sha1_hex(p, e->tree) || p[40] != '\n')
+		die("bad tree pointer in commit %s", sha1_to_hex(sha1));
+	p += 41;
+
+	e->parent_start = w->parents_nr;
+	while (p + 48 < tail && starts_with(p, "parent ")) {
+		struct commit *c;
+
+		if (get_sha1_hex(p + 7, parent) || p[47] != '\n')
+			die("bad parents in commit %s", sha1_to_hex(sha1));
+		p += 48;
+		c = lookup_commit(parent);
+		if (!c)
+			die("parent %s of commit %s is not a commit",
+			    sha1_to_hex(parent), sha1_to_hex(sha1));
+		ALLOC_GROW(w->parents, w->parents_nr + 1, w->parents_alloc);
+		w->parents[w->parents_nr++] = c;
+		add_graph_commit(w, c);
+		/* add_graph_commit() may have moved the entries */
+		e = &w->entries[i];
+	}
+	e->parent_nr = w->parents_nr - e->parent_start;
+	if (e->parent_nr > 2)
+		w->num_extra_edges += e->parent_nr - 1;
+	e->date = parse_commit_date(p, tail);
+	free(buffer);
+}
+
+static int graph_entry_cmp(const void *a_, const void *b_)
+{
+	const struct graph_entry *a = a_, *b = b_;
+	return hashcmp(a->commit->object.sha1, b->commit->object.sha1);
+}
+
+static uint32_t graph_position(struct graph_writer *w, struct commit *c)
+{
+	uint32_t pos = *graph_pos_slab_at(&w->positions, c);
+
+	if (!pos)
+		die("BUG: commit %s missing from commit-graph",
+		    sha1_to_hex(c->object.sha1));
+	return pos - 1;
+}
+
+static void write_graph_chunk_fanout(struct sha1file *f, struct graph_writer *w)
+{
+	uint32_t count = 0;
+	int byte;
+
+	for (byte = 0; byte < 256; byte++) {
+		while (count < w->nr &&
+		       w->entries[count].commit->object.sha1[0] == byte)
+			count++;
+		sha1write_be32(f, count);
+	}
+}
+
+static void write_graph_chunk_oids(struct sha1file *f, struct graph_writer *w)
+{
+	uint32_t i;
+
+	for (i = 0; i < w->nr; i++)
+		sha1write(f, w->entries[i].commit->object.sha1, GRAPH_OID_LEN);
+}
+
+static void write_graph_chunk_data(struct sha1file *f, struct graph_writer *w)
+{
+	uint32_t i, num_extra_edges = 0;
+
+	for (i = 0; i < w->nr; i++) {
+		struct graph_entry *e = &w->entries[i];
+		struct commit **parents = w->parents + e->parent_start;
+		uint64_t date = e->date;
+
+		sha1write(f, e->tree, GRAPH_OID_LEN);
+
+		if (!e->parent_nr)
+			sha1write_be32(f, GRAPH_PARENT_NONE);
+		else
+			sha1write_be32(f, graph_position(w, parents[0]));
+
+		if (e->parent_nr < 2)
+			sha1write_be32(f, GRAPH_PARENT_NONE);
+		else if (e->parent_nr == 2)
+			sha1write_be32(f, graph_position(w, parents[1]));
+		else {
+			sha1write_be32(f, GRAPH_EXTRA_EDGES_NEEDED | num_extra_edges);
+			num_extra_edges += e->parent_nr - 1;
+		}
+
+		sha1write_be32(f, (e->generation << 2) |
+				  ((uint32_t)(date >> 32) & 0x3));
+		sha1write_be32(f, (uint32_t)date);
+	}
+}
+
+static void write_graph_chunk_extra_edges(struct sha1file *f,
+					  struct graph_writer *w)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < w->nr; i++) {
+		struct graph_entry *e = &w->entries[i];
+		struct commit **parents = w->parents + e->parent_start;
+
+		if (e->parent_nr <= 2)
+			continue;
+		for (j = 1; j < e->parent_nr; j++) {
+			uint32_t edge = graph_position(w, parents[j]);
+			if (j == e->parent_nr - 1)
+				edge |= GRAPH_LAST_EDGE;
+			sha1write_be32(f, edge);
+		}
+	}
+}
+
+static void write_graph_chunk_bloom_indexes(struct sha1file *f,
+					    struct graph_writer *w)
+{
+	uint32_t i, end = 0;
+
+	for (i = 0; i < w->nr; i++) {
+		end += w->entries[i].bloom.len;
+		sha1write_be32(f, end);
+	}
+}
+
+static void write_graph_chunk_bloom_data(struct sha1file *f,
+					 struct graph_writer *w)
+{
+	uint32_t i;
+
+	sha1write_be32(f, w->bloom_settings.hash_version);
+	sha1write_be32(f, w->bloom_settings.num_hashes);
+	sha1write_be32(f, w->bloom_settings.bits_per_entry);
+	for (i = 0; i < w->nr; i++)
+		sha1write(f, w->entries[i].bloom.data, w->entries[i].bloom.len);
+}
+
+/*
+ * Compute the changed-path Bloom filter of every commit against its
+ * first parent.  Filters found in "old", a previous commit-graph with
+ * the same settings, are reused as diffing trees is what makes this
+ * expensive.
+ */
+static void compute_bloom_filters(struct graph_writer *w,
+				  struct commit_graph *old)
+{
+	struct bloom_filter_settings *settings = &w->bloom_settings;
+	uint32_t i, pos;
+
+	if (old && (!old->chunk_bloom_data ||
+		    old->bloom_settings.num_hashes != settings->num_hashes ||
+		    old->bloom_settings.bits_per_entry != settings->bits_per_entry))
+		old = NULL;
+
+	for (i = 0; i < w->nr; i++) {
+		struct graph_entry *e = &w->entries[i];
+		struct bloom_filter old_filter;
+		const unsigned char *parent_tree = NULL;
+
+		if (old && bsearch_graph(old, e->commit->object.sha1, &pos) &&
+		    read_bloom_filter(old, pos, &old_filter) && old_filter.len) {
+			e->bloom.len = old_filter.len;
+			e->bloom.data = xmemdupz(old_filter.data, old_filter.len);
+		} else {
+			if (e->parent_nr)
+				parent_tree = w->entries[graph_position(w,
+						w->parents[e->parent_start])].tree;
+			compute_bloom_filter(parent_tree, e->tree, &e->bloom,
+					     settings);
+		}
+		w->bloom_data_size += e->bloom.len;
+		display_progress(w->progress, i + 1);
+	}
+
+	if (w->bloom_data_size > 0xffffffff)
+		die("changed-path Bloom filters are too large for a commit-graph");
+}
+
+/*
+ * Assign generation numbers once the entries are sorted and every
+ * commit knows its position.  The walk uses an explicit stack, as
+ * histories are far too deep for recursion.
+ */
+static void compute_generation_numbers(struct graph_writer *w)
+{
+	uint32_t i, j, *stack = NULL;
+	uint32_t stack_nr = 0, stack_alloc = 0;
+
+	for (i = 0; i < w->nr; i++) {
+		if (w->entries[i].generation)
+			continue;
+
+		ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+		stack[stack_nr++] = i;
+		while (stack_nr) {
+			struct graph_entry *e = &w->entries[stack[stack_nr - 1]];
+			struct commit **parents = w->parents + e->parent_start;
+			uint32_t max_generation = 0;
+			int all_parents_computed = 1;
+
+			for (j = 0; j < e->parent_nr; j++) {
+				uint32_t pos = graph_position(w, parents[j]);
+				uint32_t generation = w->entries[pos].generation;
+
+				if (!generation) {
+					all_parents_computed = 0;
+					ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+					stack[stack_nr++] = pos;
+				} else if (generation > max_generation)
+					max_generation = generation;
+			}
+
+			if (all_parents_computed) {
+				if (max_generation >= GENERATION_NUMBER_MAX)
+					e->generation = GENERATION_NUMBER_MAX;
+				else
+					e->generation = max_generation + 1;
+				stack_nr--;
+			}
+		}
+	}
+	free(stack);
+}
+
+int write_commit_graph(int reachable, int changed_paths, int quiet)
+{
+	struct graph_writer w;
+	static char tmp_file[PATH_MAX];
+	struct bloom_filter_settings bloom_settings = BLOOM_FILTER_SETTINGS_INIT;
+	struct commit_graph *old_graph;
+	char *graph_name;
+	struct sha1file *f;
+	uint32_t i, num_chunks, chunk_ids[7];
+	uint64_t chunk_offsets[7];
+	int fd;
+
+	if (is_repository_shallow()) {
+		warning("not writing a commit-graph in a shallow repository");
+		return 0;
+	}
+
+	memset(&w, 0, sizeof(w));
+	init_graph_pos_slab(&w.positions);
+	w.bloom_settings = bloom_settings;
+
+	graph_name = get_commit_graph_filename(get_object_directory());
+	old_graph = load_commit_graph_one(graph_name);
+	if (changed_paths < 0)
+		changed_paths = old_graph && old_graph->chunk_bloom_data;
+
+	if (!quiet)
+		w.progress = start_progress_delay(reachable ?
+						  _("Finding commits from refs") :
+						  _("Finding commits in objects"),
+						  0, 0, 2);
+	if (reachable)
+		for_each_ref(add_ref_commit, &w);
+	else {
+		for_each_packed_object(add_packed_commit, &w,
+				       FOR_EACH_OBJECT_LOCAL_ONLY);
+		for_each_loose_object(add_loose_commit, &w,
+				      FOR_EACH_OBJECT_LOCAL_ONLY);
+	}
+	stop_progress(&w.progress);
+
+	if (!quiet)
+		w.progress = start_progress_delay(_("Reading commits for commit-graph"),
+						  0, 0, 2);
+	/* the list grows while we read: parents are appended as found */
+	for (i = 0; i < w.nr; i++) {
+		read_graph_entry(&w, i);
+		display_progress(w.progress, i + 1);
+	}
+	stop_progress(&w.progress);
+
+	if (w.nr >= GRAPH_PARENT_NONE)
+		die("too many commits to write a commit-graph");
+
+	qsort(w.entries, w.nr, sizeof(*w.entries), graph_entry_cmp);
+	for (i = 0; i < w.nr; i++)
+		*graph_pos_slab_at(&w.positions, w.entries[i].commit) = i + 1;
+	compute_generation_numbers(&w);
+
+	if (changed_paths) {
+		if (!quiet)
+			w.progress = start_progress_delay(_("Computing changed-path Bloom filters"),
+							  w.nr, 0, 2);
+		compute_bloom_filters(&w, old_graph);
+		stop_progress(&w.progress);
+	}
+	free_commit_graph(old_graph);
+
+	num_chunks = 0;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_offsets[num_chunks + 1] = GRAPH_FANOUT_SIZE;
+	num_chunks++;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_offsets[num_chunks + 1] = (uint64_t)GRAPH_OID_LEN * w.nr;
+	num_chunks++;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_DATA;
+	chunk_offsets[num_chunks + 1] = (uint64_t)GRAPH_DATA_WIDTH * w.nr;
+	num_chunks++;
+	if (w.num_extra_edges) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_EXTRAEDGES;
+		chunk_offsets[num_chunks + 1] = 4 * (uint64_t)w.num_extra_edges;
+		num_chunks++;
+	}
+	if (changed_paths) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMINDEXES;
+		chunk_offsets[num_chunks + 1] = 4 * (uint64_t)w.nr;
+		num_chunks++;
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMDATA;
+		chunk_offsets[num_chunks + 1] = GRAPH_BLOOM_DATA_HEADER_SIZE +
+						w.bloom_data_size;
+		num_chunks++;
+	}
+	chunk_ids[num_chunks] = 0;
+
+	/* turn the chunk sizes into offsets */
+	chunk_offsets[0] = GRAPH_HEADER_SIZE + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	for (i = 1; i <= num_chunks; i++)
+		chunk_offsets[i] += chunk_offsets[i - 1];
+
+	fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "info/tmp_graph_XXXXXX");
+	if (fd < 0)
+		die_errno("unable to create '%s'", tmp_file);
+	f = sha1fd(fd, tmp_file);
+
+	sha1write_be32(f, GRAPH_SIGNATURE);
+	sha1write_u8(f, GRAPH_VERSION);
+	sha1write_u8(f, GRAPH_OID_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* unused padding byte */
+
+	for (i = 0; i <= num_chunks; i++) {
+		sha1write_be32(f, chunk_ids[i]);
+		sha1write_be32(f, (uint32_t)(chunk_offsets[i] >> 32));
+		sha1write_be32(f, (uint32_t)chunk_offsets[i]);
+	}
+
+	write_graph_chunk_fanout(f, &w);
+	write_graph_chunk_oids(f, &w);
+	write_graph_chunk_data(f, &w);
+	write_graph_chunk_extra_edges(f, &w);
+	if (changed_paths) {
+		write_graph_chunk_bloom_indexes(f, &w);
+		write_graph_chunk_bloom_data(f, &w);
+	}
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	if (adjust_shared_perm(tmp_file))
+		die_errno("unable to make temporary commit-graph file readable");
+	if (rename(tmp_file, graph_name))
+		die_errno("unable to rename temporary commit-graph file to '%s'",
+			  graph_name);
+	free(graph_name);
+
+	for (i = 0; i < w.nr; i++)
+		free(w.entries[i].bloom.data);
+	free(w.entries);
+	free(w.parents);
+	clear_graph_pos_slab(&w.positions);
+	return 0;
+}
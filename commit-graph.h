@@ -0,0 +1,106 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+/*
+ * The commit-graph file ($GIT_OBJECT_DIRECTORY/info/commit-graph)
+ * stores, for every commit it knows about, the tree, the parents and
+ * the committer date in fixed-width rows, so that history walks can
+ * fill "struct commit" without inflating the commit object.  See
+ * Documentation/technical/commit-graph-format.txt for the layout.
+ */
+
+#include "bloom.h"
+
+struct commit;
+
+#define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GRAPH_VERSION 1
+#define GRAPH_OID_VERSION 1 /* SHA-1 */
+#define GRAPH_OID_LEN 20
+
+#define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
+#define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
+#define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+
+#define GRAPH_DATA_WIDTH (GRAPH_OID_LEN + 16)
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_EXTRA_EDGES_NEEDED 0x80000000
+#define GRAPH_EDGE_LAST_MASK 0x7fffffff
+#define GRAPH_LAST_EDGE 0x80000000
+#define GRAPH_BLOOM_DATA_HEADER_SIZE 12
+
+struct commit_graph {
+	unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_commits;
+
+	const unsigned char *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_extra_edges;
+	const unsigned char *chunk_bloom_indexes;
+	const unsigned char *chunk_bloom_data;
+
+	struct bloom_filter_settings bloom_settings;
+};
+
+/*
+ * Return the path of the commit-graph file for the given object
+ * directory.  The result must be freed by the caller.
+ */
+extern char *get_commit_graph_filename(const char *obj_dir);
+
+/*
+ * Map and validate the commit-graph file at "graph_file".  Returns
+ * NULL (after reporting an error, unless the file simply does not
+ * exist) if it cannot be used.
+ */
+extern struct commit_graph *load_commit_graph_one(const char *graph_file);
+extern void free_commit_graph(struct commit_graph *g);
+
+/*
+ * Fill "item" from the commit-graph, if core.commitGraph is enabled
+ * and the commit is found in it.  Returns 1 if the commit was parsed
+ * this way, 0 if the caller has to fall back to parsing the object.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Record the graph position and generation number of a commit that
+ * was parsed from its object, so that generation-based cutoffs also
+ * work for commits that did not go through parse_commit_in_graph().
+ */
+extern void load_commit_graph_info(struct commit *item);
+
+/*
+ * Return the settings of the changed-path Bloom filters of the
+ * commit-graph in use, or NULL if there are none or they cannot be
+ * trusted because grafts or replace refs change parents.
+ */
+extern const struct bloom_filter_settings *commit_graph_bloom_settings(void);
+
+/*
+ * Point "filter" at the Bloom filter of the paths changed between
+ * "parent" (NULL for a root commit) and "c".  Returns 0 if there is no
+ * such filter, in particular when "parent" is not the first parent
+ * recorded in the graph.  The filter data must not be modified.
+ */
+extern int get_commit_bloom_filter(struct commit *c, struct commit *parent,
+				   struct bloom_filter *filter);
+
+/*
+ * Write a commit-graph for the current repository.  Unless
+ * "reachable" is set, every commit found in the local packs and
+ * loose objects is included, otherwise only those reachable from
+ * the refs.  Parents are always added so that the graph is closed.
+ *
+ * Changed-path Bloom filters are written if "changed_paths" is
+ * positive, or if it is negative and the existing graph has them.
+ */
+extern int write_commit_graph(int reachable, int changed_paths, int quiet);
+
+#endif
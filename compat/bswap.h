@@ -177,3 +177,11 @@ static inline uint64_t git_bswap64(uint64_t x)
 	*((unsigned char *)(p) + 3) = __v >>  0; } while (0)
 
 #endif
+
+#define get_be64(p)	( \
+	((uint64_t)get_be32((unsigned char *)(p) + 0) << 32) | \
+	((uint64_t)get_be32((unsigned char *)(p) + 4) <<  0) )
+#define put_be64(p, v)	do { \
+	uint64_t __v64 = (v); \
+	put_be32((unsigned char *)(p) + 0, (uint32_t)(__v64 >> 32)); \
+	put_be32((unsigned char *)(p) + 4, (uint32_t)(__v64 >>  0)); } while (0)
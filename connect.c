@@ -663,8 +663,69 @@ static struct child_process no_fork = CHILD_PROCESS_INIT;
  * will hopefully be changed in a libification effort, to return NULL when
  * the connection failed).
  */
+/*
+ * Tell upload-pack which ref prefixes to advertise, as options on
+ * its command line.  upload-pack ignores options it does not know.
+ * Requests that would make the command line longer than a packet
+ * ask for all refs instead.
+ */
+static void add_ref_prefix_options(struct strbuf *cmd,
+				   const struct string_list *ref_prefixes)
+{
+	size_t orig_len = cmd->len;
+	struct strbuf opt = STRBUF_INIT;
+	struct string_list_item *item;
+
+	for_each_string_list_item(item, ref_prefixes) {
+		strbuf_reset(&opt);
+		strbuf_addf(&opt, "--ref-prefix=%s", item->string);
+		strbuf_addch(cmd, ' ');
+		sq_quote_buf(cmd, opt.buf);
+	}
+	if (cmd->len > LARGE_PACKET_MAX - 4)
+		strbuf_setlen(cmd, orig_len);
+	strbuf_release(&opt);
+}
+
+/*
+ * Send the initial request to git-daemon, with the ref prefixes as
+ * extra arguments after an empty one.  Older daemons stop parsing the
+ * extra arguments at the empty one and thus ignore the prefixes.
+ */
+static void send_daemon_request(int fd, const char *prog, const char *path,
+				const char *target_host,
+				const struct string_list *ref_prefixes)
+{
+	struct strbuf request = STRBUF_INIT;
+	struct strbuf pkt = STRBUF_INIT;
+
+	strbuf_addf(&request, "%s %s", prog, path);
+	strbuf_addch(&request, '\0');
+	strbuf_addf(&request, "host=%s", target_host);
+	strbuf_addch(&request, '\0');
+
+	if (ref_prefixes && ref_prefixes->nr) {
+		size_t orig_len = request.len;
+		struct string_list_item *item;
+
+		strbuf_addch(&request, '\0');
+		for_each_string_list_item(item, ref_prefixes) {
+			strbuf_addf(&request, "ref-prefix=%s", item->string);
+			strbuf_addch(&request, '\0');
+		}
+		if (request.len > LARGE_PACKET_MAX - 4)
+			strbuf_setlen(&request, orig_len);
+	}
+
+	packet_buf_write_len(&pkt, request.buf, request.len);
+	write_or_die(fd, pkt.buf, pkt.len);
+	strbuf_release(&request);
+	strbuf_release(&pkt);
+}
+
 struct child_process *git_connect(int fd[2], const char *url,
-				  const char *prog, int flags)
+				  const char *prog, int flags,
+				  const struct string_list *ref_prefixes)
 {
 	char *hostandport, *path;
 	struct child_process *conn = &no_fork;
@@ -708,19 +769,21 @@ struct child_process *git_connect(int fd[2], const char *url,
 		 * Separate original protocol components prog and path
 		 * from extended host header with a NUL byte.
 		 *
-		 * Note: Do not add any other headers here!  Doing so
-		 * will cause older git-daemon servers to crash.
+		 * Note: Do not add any other headers directly after the
+		 * host header!  Doing so will cause older git-daemon
+		 * servers to crash.
 		 */
-		packet_write(fd[1],
-			     "%s %s%chost=%s%c",
-			     prog, path, 0,
-			     target_host, 0);
+		send_daemon_request(fd[1], prog, path, target_host,
+				    ref_prefixes);
 		free(target_host);
 	} else {
 		conn = xmalloc(sizeof(*conn));
 		child_process_init(conn);
 
 		strbuf_addstr(&cmd, prog);
+		if (ref_prefixes &&
+		    (protocol != PROTO_SSH || (flags & CONNECT_SSH_REF_PREFIXES)))
+			add_ref_prefix_options(&cmd, ref_prefixes);
 		strbuf_addch(&cmd, ' ');
 		sq_quote_buf(&cmd, path);
 
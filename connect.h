@@ -3,7 +3,10 @@
 
 #define CONNECT_VERBOSE       (1u << 0)
 #define CONNECT_DIAG_URL      (1u << 1)
-extern struct child_process *git_connect(int fd[2], const char *url, const char *prog, int flags);
+#define CONNECT_SSH_REF_PREFIXES (1u << 2)
+struct string_list;
+extern struct child_process *git_connect(int fd[2], const char *url, const char *prog, int flags,
+					 const struct string_list *ref_prefixes);
 extern int finish_connect(struct child_process *conn);
 extern int git_connection_is_socket(struct child_process *conn);
 extern int server_supports(const char *feature);
@@ -33,11 +33,42 @@ enum eol {
 
 extern enum eol core_eol;
 
+enum crlf_action {
+	CRLF_GUESS = -1,
+	CRLF_BINARY = 0,
+	CRLF_TEXT,
+	CRLF_INPUT,
+	CRLF_CRLF,
+	CRLF_AUTO
+};
+
+struct convert_driver;
+
+/* The conversion attributes of a path, see convert_attrs() */
+struct conv_attrs {
+	struct convert_driver *drv;
+	enum crlf_action crlf_action;
+	enum eol eol_attr;
+	int ident;
+};
+
+/*
+ * Look up the attributes that decide how "path" is converted.  This
+ * consults the attribute stack and is not thread-safe; the converting
+ * functions taking a "struct conv_attrs" are, as long as no filter
+ * driver is involved (see convert_uses_driver()).
+ */
+extern void convert_attrs(struct conv_attrs *ca, const char *path);
+extern int convert_uses_driver(const struct conv_attrs *ca);
+
 /* returns 1 if *dst was used */
 extern int convert_to_git(const char *path, const char *src, size_t len,
 			  struct strbuf *dst, enum safe_crlf checksafe);
 extern int convert_to_working_tree(const char *path, const char *src,
 				   size_t len, struct strbuf *dst);
+extern int convert_to_working_tree_ca(const struct conv_attrs *ca,
+				      const char *path, const char *src,
+				      size_t len, struct strbuf *dst);
 extern int renormalize_buffer(const char *path, const char *src, size_t len,
 			      struct strbuf *dst);
 static inline int would_convert_to_git(const char *path)
@@ -0,0 +1,131 @@
+#include "git-compat-util.h"
+#include "cpu-features.h"
+
+#ifdef HAVE_X86_SIMD
+
+#include <cpuid.h>
+
+#define CPUID1_EDX_SSE2		(1U << 26)
+#define CPUID1_ECX_SSSE3	(1U << 9)
+#define CPUID1_ECX_SSE41	(1U << 19)
+#define CPUID1_ECX_POPCNT	(1U << 23)
+#define CPUID1_ECX_OSXSAVE	(1U << 27)
+#define CPUID1_ECX_AVX		(1U << 28)
+#define CPUID7_EBX_AVX2		(1U << 5)
+#define CPUID7_EBX_SHA		(1U << 29)
+
+static void cpuid1(unsigned int *ecx, unsigned int *edx)
+{
+	unsigned int eax, ebx;
+
+	if (!__get_cpuid(1, &eax, &ebx, ecx, edx))
+		*ecx = *edx = 0;
+}
+
+static unsigned int cpuid7_ebx(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return ebx;
+}
+
+int x86_has_sse2(void)
+{
+#ifdef __x86_64__
+	return 1;
+#else
+	unsigned int ecx, edx;
+
+	cpuid1(&ecx, &edx);
+	return !!(edx & CPUID1_EDX_SSE2);
+#endif
+}
+
+int x86_has_popcnt(void)
+{
+	unsigned int ecx, edx;
+
+	cpuid1(&ecx, &edx);
+	return !!(ecx & CPUID1_ECX_POPCNT);
+}
+
+int x86_has_avx2(void)
+{
+	unsigned int ecx, edx;
+	unsigned int xcr0_lo, xcr0_hi;
+
+	cpuid1(&ecx, &edx);
+	if (!(ecx & CPUID1_ECX_OSXSAVE) || !(ecx & CPUID1_ECX_AVX))
+		return 0;
+	/* the OS must save the YMM registers on context switches */
+	__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+	if ((xcr0_lo & 6) != 6)
+		return 0;
+	return !!(cpuid7_ebx() & CPUID7_EBX_AVX2);
+}
+
+int x86_has_sha_ni(void)
+{
+	unsigned int ecx, edx;
+
+	cpuid1(&ecx, &edx);
+	return (ecx & CPUID1_ECX_SSSE3) && (ecx & CPUID1_ECX_SSE41) &&
+		(cpuid7_ebx() & CPUID7_EBX_SHA);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static const struct cpu_backend *nth_backend(struct cpu_backends *b, int n)
+{
+	return (const struct cpu_backend *)
+		((const char *)b->list + n * b->size);
+}
+
+static const struct cpu_backend *find_backend(struct cpu_backends *b,
+					      const char *name)
+{
+	int i;
+
+	for (i = 0; i < b->nr; i++) {
+		const struct cpu_backend *cb = nth_backend(b, i);
+
+		if (name && strcmp(name, cb->name))
+			continue;
+		if (!cb->supported || cb->supported())
+			return cb;
+		if (name)
+			return NULL;
+	}
+	return NULL;
+}
+
+const void *cpu_backend(struct cpu_backends *b)
+{
+	/* racing threads all pick the same one */
+	if (!b->current)
+		b->current = find_backend(b, NULL);
+	return b->current;
+}
+
+const char *cpu_backend_name(struct cpu_backends *b, int n)
+{
+	return n < b->nr ? nth_backend(b, n)->name : NULL;
+}
+
+int cpu_backend_supported(struct cpu_backends *b, const char *name)
+{
+	return !!find_backend(b, name);
+}
+
+int cpu_backend_set(struct cpu_backends *b, const char *name)
+{
+	const struct cpu_backend *cb = find_backend(b, name);
+
+	if (!cb)
+		return -1;
+	b->current = cb;
+	return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+/*
+ * Code for x86 instruction set extensions is compiled with target
+ * attributes, whatever the target of the rest of the build, and must
+ * only be called after checking at runtime that the CPU supports the
+ * extension.  HAVE_X86_SIMD is defined when the compiler can do that;
+ * NO_X86_SIMD leaves all such code out.
+ */
+#if !defined(NO_X86_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ >= 5 || defined(__clang__))
+#define HAVE_X86_SIMD
+
+int x86_has_sse2(void);
+int x86_has_popcnt(void);
+int x86_has_avx2(void);
+/* the SHA extensions, and the SSSE3 and SSE4.1 code around them */
+int x86_has_sha_ni(void);
+
+#endif
+
+/*
+ * Code that has several implementations of the same functions picks
+ * one at runtime with a "struct cpu_backends".  Each implementation is
+ * described by a struct whose first member is a "struct cpu_backend";
+ * they are listed in an array in order of preference, ending with one
+ * that every CPU can use (no "supported" function):
+ *
+ *	static const struct foo_backend foo_list[] = {
+ *		{ { "avx2", x86_has_avx2 }, foo_avx2 },
+ *		{ { "c", NULL }, foo_c },
+ *	};
+ *	static struct cpu_backends foo_backends = CPU_BACKENDS_INIT(foo_list);
+ *
+ *	((const struct foo_backend *)cpu_backend(&foo_backends))->fn(...);
+ *
+ * cpu_backend_name(), cpu_backend_supported() and cpu_backend_set() let
+ * test programs list the backends and force one.
+ */
+struct cpu_backend {
+	const char *name;
+	int (*supported)(void);
+};
+
+struct cpu_backends {
+	const void *list;
+	size_t nr, size;
+	const struct cpu_backend *current;
+};
+
+#define CPU_BACKENDS_INIT(list) { (list), ARRAY_SIZE(list), sizeof(*(list)), NULL }
+
+/* The backend in use; the first supported one unless one was set. */
+const void *cpu_backend(struct cpu_backends *b);
+
+/* The name of the n-th backend compiled in, or NULL. */
+const char *cpu_backend_name(struct cpu_backends *b, int n);
+
+/* Whether the named backend is compiled in and the CPU supports it. */
+int cpu_backend_supported(struct cpu_backends *b, const char *name);
+
+/* Use the named backend; returns -1 if it is not supported. */
+int cpu_backend_set(struct cpu_backends *b, const char *name);
+
+#endif /* CPU_FEATURES_H */
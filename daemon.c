@@ -60,6 +60,7 @@ struct hostinfo {
 	struct strbuf tcp_port;
 	unsigned int hostname_lookup_done:1;
 	unsigned int saw_extended_args:1;
+	struct string_list ref_prefixes;
 };
 
 static void lookup_hostname(struct hostinfo *hi);
@@ -269,7 +270,7 @@ static const char *path_ok(const char *directory, struct hostinfo *hi)
 	return NULL;		/* Fallthrough. Deny by default */
 }
 
-typedef int (*daemon_service_fn)(void);
+typedef int (*daemon_service_fn)(const struct hostinfo *hi);
 struct daemon_service {
 	const char *name;
 	const char *config_name;
@@ -409,7 +410,7 @@ static int run_service(const char *dir, struct daemon_service *service,
 	 */
 	signal(SIGTERM, SIG_IGN);
 
-	return service->fn();
+	return service->fn(hi);
 }
 
 static void copy_to_log(int fd)
@@ -451,25 +452,29 @@ static int run_service_command(const char **argv)
 	return finish_command(&cld);
 }
 
-static int upload_pack(void)
+static int upload_pack(const struct hostinfo *hi)
 {
-	/* Timeout as string */
-	char timeout_buf[64];
-	const char *argv[] = { "upload-pack", "--strict", NULL, ".", NULL };
-
-	argv[2] = timeout_buf;
-
-	snprintf(timeout_buf, sizeof timeout_buf, "--timeout=%u", timeout);
-	return run_service_command(argv);
+	struct argv_array argv = ARGV_ARRAY_INIT;
+	struct string_list_item *item;
+	int ret;
+
+	argv_array_pushl(&argv, "upload-pack", "--strict", NULL);
+	argv_array_pushf(&argv, "--timeout=%u", timeout);
+	for_each_string_list_item(item, &hi->ref_prefixes)
+		argv_array_pushf(&argv, "--ref-prefix=%s", item->string);
+	argv_array_push(&argv, ".");
+	ret = run_service_command(argv.argv);
+	argv_array_clear(&argv);
+	return ret;
 }
 
-static int upload_archive(void)
+static int upload_archive(const struct hostinfo *hi)
 {
 	static const char *argv[] = { "upload-archive", ".", NULL };
 	return run_service_command(argv);
 }
 
-static int receive_pack(void)
+static int receive_pack(const struct hostinfo *hi)
 {
 	static const char *argv[] = { "receive-pack", ".", NULL };
 	return run_service_command(argv);
@@ -562,6 +567,23 @@ static void canonicalize_client(struct strbuf *out, const char *in)
 	strbuf_tolower(out);
 }
 
+/*
+ * Read the arguments after the empty one that follows the host
+ * argument.  Unknown ones are ignored, so that clients can send
+ * arguments newer daemons understand.
+ */
+static void parse_extra_args(struct hostinfo *hi, char *extra_args, char *end)
+{
+	while (extra_args < end) {
+		const char *arg = extra_args;
+		const char *prefix;
+
+		extra_args += strlen(arg) + 1;
+		if (skip_prefix(arg, "ref-prefix=", &prefix) && *prefix)
+			string_list_append(&hi->ref_prefixes, prefix);
+	}
+}
+
 /*
  * Read the host as supplied by the client connection.
  */
@@ -592,6 +614,8 @@ static void parse_host_arg(struct hostinfo *hi, char *extra_args, int buflen)
 		}
 		if (extra_args < end && *extra_args)
 			die("Invalid request");
+		if (extra_args < end)
+			parse_extra_args(hi, extra_args + 1, end);
 	}
 }
 
@@ -659,6 +683,7 @@ static void hostinfo_init(struct hostinfo *hi)
 	strbuf_init(&hi->canon_hostname, 0);
 	strbuf_init(&hi->ip_address, 0);
 	strbuf_init(&hi->tcp_port, 0);
+	string_list_init(&hi->ref_prefixes, 1);
 }
 
 static void hostinfo_clear(struct hostinfo *hi)
@@ -667,6 +692,7 @@ static void hostinfo_clear(struct hostinfo *hi)
 	strbuf_release(&hi->canon_hostname);
 	strbuf_release(&hi->ip_address);
 	strbuf_release(&hi->tcp_port);
+	string_list_clear(&hi->ref_prefixes, 0);
 }
 
 static int execute(void)
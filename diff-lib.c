@@ -363,6 +363,25 @@ static int show_modified(struct rev_info *revs,
 	return 0;
 }
 
+/*
+ * Diff the tree of the sparse directory entry "idx" against "tree",
+ * which is either the same directory of the other side, or NULL if it
+ * does not exist there.
+ */
+static void diff_sparse_directory(struct rev_info *revs,
+				  const struct cache_entry *idx,
+				  const struct cache_entry *tree)
+{
+	struct diff_options *opt = &revs->diffopt;
+	unsigned int flags = opt->flags;
+
+	if (tree && !hashcmp(tree->sha1, idx->sha1))
+		return;
+	DIFF_OPT_SET(opt, RECURSIVE);
+	diff_tree_sha1(tree ? tree->sha1 : NULL, idx->sha1, idx->name, opt);
+	opt->flags = flags;
+}
+
 /*
  * This gets a mix of an existing index and a tree, one pathname entry
  * at a time. The index entry may be a single stage-0 one, but it could
@@ -376,6 +395,15 @@ static void do_oneway_diff(struct unpack_trees_options *o,
 	struct rev_info *revs = o->unpack_data;
 	int match_missing, cached;
 
+	/*
+	 * A sparse directory of the index is compared with the tree
+	 * as a whole; it is not checked out, so it is always "cached".
+	 */
+	if (idx && S_ISSPARSEDIR(idx->ce_mode)) {
+		diff_sparse_directory(revs, idx, tree);
+		return;
+	}
+
 	/* if the entry is not checked out, don't examine work tree */
 	cached = o->index_only ||
 		(idx && ((idx->ce_flags & CE_VALID) || ce_skip_worktree(idx)));
@@ -447,7 +475,9 @@ static int oneway_diff(const struct cache_entry * const *src,
 	if (tree == o->df_conflict_entry)
 		tree = NULL;
 
-	if (ce_path_match(idx ? idx : tree, &revs->prune_data, NULL)) {
+	/* the pathspec is applied to what is inside a sparse directory */
+	if ((idx && S_ISSPARSEDIR(idx->ce_mode)) ||
+	    ce_path_match(idx ? idx : tree, &revs->prune_data, NULL)) {
 		do_oneway_diff(o, idx, tree);
 		if (diff_can_quit_early(&revs->diffopt)) {
 			o->exiting_early = 1;
@@ -476,6 +506,7 @@ static int diff_cache(struct rev_info *revs,
 	opts.index_only = cached;
 	opts.diff_index_cached = (cached &&
 				  !DIFF_OPT_TST(&revs->diffopt, FIND_COPIES_HARDER));
+	opts.sparse_directories = opts.diff_index_cached;
 	opts.merge = 1;
 	opts.fn = oneway_diff;
 	opts.unpack_data = revs;
@@ -134,6 +134,7 @@ struct diff_options {
 	int rename_score;
 	int rename_limit;
 	int needed_rename_limit;
+	int rename_basenames;
 	int degraded_cc_to_c;
 	int show_rename_progress;
 	int dirstat_permille;
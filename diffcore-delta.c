@@ -163,6 +163,12 @@ static struct spanhash_top *hash_chars(struct diff_filespec *one)
 	return hash;
 }
 
+void diffcore_count_prepare(struct diff_filespec *one, void **count_p)
+{
+	if (!*count_p)
+		*count_p = hash_chars(one);
+}
+
 int diffcore_count_changes(struct diff_filespec *src,
 			   struct diff_filespec *dst,
 			   void **src_count_p,
@@ -6,6 +6,8 @@
 #include "diffcore.h"
 #include "hashmap.h"
 #include "progress.h"
+#include "thread-utils.h"
+#include "trace-event.h"
 
 /* Table of rename/copy destinations */
 
@@ -208,6 +210,15 @@ static int estimate_similarity(struct diff_filespec *src,
 	return score;
 }
 
+static int sizes_compatible(unsigned long a, unsigned long b, int minimum_score)
+{
+	unsigned long max_size = a > b ? a : b;
+	unsigned long base_size = a < b ? a : b;
+
+	return max_size * (MAX_SCORE-minimum_score) >=
+		(max_size - base_size) * MAX_SCORE;
+}
+
 static void record_rename_pair(int dst_index, int src_index, int score)
 {
 	struct diff_filespec *src, *dst;
@@ -355,6 +366,124 @@ static int find_exact_renames(struct diff_options *options)
 	return renames;
 }
 
+/*
+ * Files that are moved to another directory usually keep their
+ * basename.  Before filling the similarity matrix, pair up each source
+ * with the destination of the same basename, when neither side has
+ * another candidate of that basename, if they are similar enough; the
+ * bar is set halfway between the minimum score and an exact match, as
+ * we do not look at the other candidates.  This takes one comparison
+ * per pair instead of one per source for every destination, and
+ * leaves fewer files for the matrix.
+ */
+struct basename_entry {
+	struct hashmap_entry entry;
+	const char *name;
+	int src, dst; /* index in rename_src and rename_dst */
+};
+
+#define BASENAME_NOT_UNIQUE -2
+
+static int basename_entry_cmp(const struct basename_entry *a,
+			      const struct basename_entry *b,
+			      const char *name)
+{
+	return strcmp(a->name, name ? name : b->name);
+}
+
+static const char *get_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+static int want_basename_renames(struct diff_options *options)
+{
+	static int want = -1;
+
+	if (options->rename_basenames >= 0)
+		return options->rename_basenames;
+	if (want < 0 && git_config_get_bool("diff.renamebasenames", &want))
+		want = 1;
+	return want;
+}
+
+static int find_basename_renames(int minimum_score)
+{
+	int basename_score = minimum_score + (MAX_SCORE - minimum_score) / 2;
+	struct hashmap basenames;
+	struct hashmap_iter iter;
+	struct basename_entry *e;
+	int i, renames = 0;
+
+	hashmap_init(&basenames, (hashmap_cmp_fn)basename_entry_cmp, rename_src_nr);
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+		const char *name = get_basename(one->path);
+		unsigned int hash = strhash(name);
+
+		if (one->rename_used)
+			continue;
+		e = hashmap_get_from_hash(&basenames, hash, name);
+		if (e) {
+			e->src = BASENAME_NOT_UNIQUE;
+			continue;
+		}
+		e = xmalloc(sizeof(*e));
+		hashmap_entry_init(e, hash);
+		e->name = name;
+		e->src = i;
+		e->dst = -1;
+		hashmap_add(&basenames, e);
+	}
+
+	for (i = 0; i < rename_dst_nr; i++) {
+		const char *name;
+
+		if (rename_dst[i].pair)
+			continue; /* dealt with exact match already. */
+		name = get_basename(rename_dst[i].two->path);
+		e = hashmap_get_from_hash(&basenames, strhash(name), name);
+		if (e)
+			e->dst = e->dst == -1 ? i : BASENAME_NOT_UNIQUE;
+	}
+
+	hashmap_iter_init(&basenames, &iter);
+	while ((e = hashmap_iter_next(&iter))) {
+		struct diff_filespec *one, *two;
+		int score;
+
+		if (e->src < 0 || e->dst < 0)
+			continue;
+		one = rename_src[e->src].p->one;
+		two = rename_dst[e->dst].two;
+		score = estimate_similarity(one, two, basename_score);
+		diff_free_filespec_blob(one);
+		diff_free_filespec_blob(two);
+		if (score < basename_score)
+			continue;
+		record_rename_pair(e->dst, e->src, score);
+		renames++;
+	}
+
+	hashmap_free(&basenames, 1);
+	return renames;
+}
+
+/*
+ * Sources that are renamed already cannot be renamed again, so there
+ * is no need to compare them when we are not looking for copies.
+ */
+static void drop_used_rename_src(void)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < rename_src_nr; i++)
+		if (!rename_src[i].p->one->rename_used)
+			rename_src[nr++] = rename_src[i];
+	rename_src_nr = nr;
+}
+
 #define NUM_CANDIDATE_PER_DST 4
 static void record_if_better(struct diff_score m[], struct diff_score *o)
 {
@@ -420,6 +549,366 @@ static int too_many_rename_candidates(int num_create,
 	return 1;
 }
 
+typedef int (*similarity_fn)(struct diff_filespec *src,
+			     struct diff_filespec *dst,
+			     int minimum_score);
+
+/* Record the best candidates for rename_dst[i] in m. */
+static void score_row(struct diff_score *m, int i, int minimum_score,
+		      int skip_unmodified, similarity_fn similarity)
+{
+	struct diff_filespec *two = rename_dst[i].two;
+	int j;
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+		struct diff_score this_src;
+
+		if (skip_unmodified &&
+		    diff_unmodified_pair(rename_src[j].p))
+			continue;
+
+		this_src.score = similarity(one, two, minimum_score);
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = i;
+		this_src.src = j;
+		record_if_better(m, &this_src);
+	}
+}
+
+static int estimate_similarity_and_free(struct diff_filespec *src,
+					struct diff_filespec *dst,
+					int minimum_score)
+{
+	int score = estimate_similarity(src, dst, minimum_score);
+
+	/*
+	 * Once we run estimate_similarity,
+	 * We do not need the text anymore.
+	 */
+	diff_free_filespec_blob(src);
+	diff_free_filespec_blob(dst);
+	return score;
+}
+
+static int score_matrix(struct diff_score *mx, int minimum_score,
+			int skip_unmodified, struct progress *progress)
+{
+	int i, dst_cnt;
+
+	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].pair)
+			continue; /* dealt with exact match already. */
+
+		score_row(&mx[dst_cnt * NUM_CANDIDATE_PER_DST], i,
+			  minimum_score, skip_unmodified,
+			  estimate_similarity_and_free);
+		dst_cnt++;
+		display_progress(progress, (i+1)*rename_src_nr);
+	}
+	return dst_cnt;
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * With threads, the similarity matrix is filled in two steps.  First
+ * the counts that diffcore_count_changes() compares are computed once
+ * for every file that has a partner of a compatible size; reading the
+ * files is serialized, as neither the object store nor the attributes
+ * (which decide whether a file is binary) are thread-safe.  Then the
+ * rows of the matrix, one per destination, are scored in parallel,
+ * which only compares counts and never touches the contents of the
+ * files, as the same file is in many rows.  The result is the same as
+ * without threads.
+ */
+
+/* Below this many pairs, starting threads is not worth it. */
+#define RENAME_THREAD_MIN_PAIRS 256
+
+struct rename_work {
+	int minimum_score;
+	int skip_unmodified;
+
+	/* files to count in the first step */
+	struct diff_filespec **count;
+	int count_nr, count_next;
+
+	/* rows of the matrix (an index into rename_dst each) to score */
+	int *row_dst;
+	struct diff_score *mx;
+	int row_nr, row_next, rows_done;
+	struct progress *progress;
+};
+
+static pthread_mutex_t rename_work_mutex;
+static pthread_mutex_t rename_read_mutex;
+
+static int rename_threads(void)
+{
+	static int threads = -1;
+
+	if (threads < 0) {
+		if (git_config_get_int("diff.renamethreads", &threads) ||
+		    threads <= 0)
+			threads = online_cpus();
+	}
+	return threads;
+}
+
+static void *count_files_thread(void *arg)
+{
+	struct rename_work *w = arg;
+
+	trace_event_thread_start("rename/count");
+	for (;;) {
+		struct diff_filespec *one = NULL;
+		int failed;
+
+		pthread_mutex_lock(&rename_work_mutex);
+		if (w->count_next < w->count_nr)
+			one = w->count[w->count_next++];
+		pthread_mutex_unlock(&rename_work_mutex);
+		if (!one)
+			break;
+
+		pthread_mutex_lock(&rename_read_mutex);
+		failed = diff_populate_filespec(one, 0);
+		if (!failed)
+			diff_filespec_is_binary(one);
+		pthread_mutex_unlock(&rename_read_mutex);
+
+		if (!failed)
+			diffcore_count_prepare(one, &one->cnt_data);
+		diff_free_filespec_blob(one);
+	}
+	trace_event_thread_exit();
+	return NULL;
+}
+
+/* estimate_similarity() for files whose counts are known, if any */
+static int counted_similarity(struct diff_filespec *src,
+			      struct diff_filespec *dst,
+			      int minimum_score)
+{
+	unsigned long max_size, base_size, src_copied, literal_added;
+
+	if (!src->cnt_data || !dst->cnt_data ||
+	    !sizes_compatible(src->size, dst->size, minimum_score))
+		return 0;
+
+	max_size = src->size > dst->size ? src->size : dst->size;
+	base_size = src->size < dst->size ? src->size : dst->size;
+	if (diffcore_count_changes(src, dst,
+				   &src->cnt_data, &dst->cnt_data,
+				   base_size * (MAX_SCORE-minimum_score) / MAX_SCORE,
+				   &src_copied, &literal_added))
+		return 0;
+	if (!dst->size)
+		return 0;
+	return (int)(src_copied * MAX_SCORE / max_size);
+}
+
+static void *score_rows_thread(void *arg)
+{
+	struct rename_work *w = arg;
+
+	trace_event_thread_start("rename/score");
+	for (;;) {
+		int row;
+
+		pthread_mutex_lock(&rename_work_mutex);
+		row = w->row_next < w->row_nr ? w->row_next++ : -1;
+		pthread_mutex_unlock(&rename_work_mutex);
+		if (row < 0)
+			break;
+
+		score_row(&w->mx[row * NUM_CANDIDATE_PER_DST], w->row_dst[row],
+			  w->minimum_score, w->skip_unmodified,
+			  counted_similarity);
+
+		pthread_mutex_lock(&rename_work_mutex);
+		w->rows_done++;
+		display_progress(w->progress, w->rows_done * rename_src_nr);
+		pthread_mutex_unlock(&rename_work_mutex);
+	}
+	trace_event_thread_exit();
+	return NULL;
+}
+
+static int unsigned_long_cmp(const void *a_, const void *b_)
+{
+	unsigned long a = *(const unsigned long *)a_;
+	unsigned long b = *(const unsigned long *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+static int pointer_cmp(const void *a_, const void *b_)
+{
+	const void *a = *(const void **)a_, *b = *(const void **)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Populate the size of a regular file that may be renamed, and return
+ * it in *size; return -1 if the file cannot take part.
+ */
+static int rename_candidate_size(struct diff_filespec *one, unsigned long *size)
+{
+	if (!S_ISREG(one->mode))
+		return -1;
+	if (!one->cnt_data && diff_populate_filespec(one, CHECK_SIZE_ONLY))
+		return -1;
+	*size = one->size;
+	return 0;
+}
+
+/* Is there a size in sizes[nr] (sorted) compatible with size? */
+static int has_compatible_size(unsigned long size, const unsigned long *sizes,
+			       int nr, int minimum_score)
+{
+	int lo = 0, hi = nr;
+
+	/* find the smallest size that is not too small */
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (sizes[mi] * MAX_SCORE < size * minimum_score)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo < nr && sizes_compatible(size, sizes[lo], minimum_score);
+}
+
+static void add_files_to_count(struct rename_work *w,
+			       struct diff_filespec **files, unsigned long *sizes, int nr,
+			       unsigned long *partner_sizes, int partner_nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (files[i]->cnt_data ||
+		    !has_compatible_size(sizes[i], partner_sizes, partner_nr,
+					 w->minimum_score))
+			continue;
+		w->count[w->count_nr++] = files[i];
+	}
+}
+
+static void run_rename_threads(int nr_threads, void *(*fn)(void *),
+			       struct rename_work *w)
+{
+	pthread_t *threads = xcalloc(nr_threads, sizeof(*threads));
+	int i;
+
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, fn, w))
+			die("unable to create rename detection thread");
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+/*
+ * Fill mx with the best candidates for each destination that is not
+ * matched yet, like the loop in diffcore_rename() does, using threads.
+ * Return the number of rows filled, or -1 if threads are not worth it.
+ */
+static int score_matrix_threaded(struct diff_score *mx, int num_create,
+				 int minimum_score, int skip_unmodified,
+				 struct progress *progress)
+{
+	struct rename_work w;
+	struct diff_filespec **src, **dst;
+	unsigned long *src_size, *dst_size, *sorted_src, *sorted_dst;
+	int nr_threads = rename_threads();
+	int i, src_nr = 0, dst_nr = 0, count_nr;
+
+	if (nr_threads <= 1 ||
+	    (uint64_t)num_create * rename_src_nr < RENAME_THREAD_MIN_PAIRS)
+		return -1;
+
+	memset(&w, 0, sizeof(w));
+	w.minimum_score = minimum_score;
+	w.skip_unmodified = skip_unmodified;
+	w.mx = mx;
+	w.progress = progress;
+	w.row_dst = xcalloc(num_create, sizeof(*w.row_dst));
+
+	/*
+	 * Drop the contents that finding exact renames may have read, also
+	 * of the files that will not be counted; the workers only free
+	 * the files they count.
+	 */
+	for (i = 0; i < rename_src_nr; i++)
+		diff_free_filespec_blob(rename_src[i].p->one);
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].pair)
+			diff_free_filespec_blob(rename_dst[i].two);
+
+	src = xcalloc(rename_src_nr, sizeof(*src));
+	src_size = xcalloc(rename_src_nr, sizeof(*src_size));
+	for (i = 0; i < rename_src_nr; i++) {
+		if (skip_unmodified && diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if (rename_candidate_size(rename_src[i].p->one, &src_size[src_nr]))
+			continue;
+		src[src_nr++] = rename_src[i].p->one;
+	}
+	dst = xcalloc(num_create, sizeof(*dst));
+	dst_size = xcalloc(num_create, sizeof(*dst_size));
+	for (i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].pair)
+			continue; /* dealt with exact match already. */
+		w.row_dst[w.row_nr++] = i;
+		if (rename_candidate_size(rename_dst[i].two, &dst_size[dst_nr]))
+			continue;
+		dst[dst_nr++] = rename_dst[i].two;
+	}
+
+	sorted_src = xmemdupz(src_size, src_nr * sizeof(*src_size));
+	qsort(sorted_src, src_nr, sizeof(*sorted_src), unsigned_long_cmp);
+	sorted_dst = xmemdupz(dst_size, dst_nr * sizeof(*dst_size));
+	qsort(sorted_dst, dst_nr, sizeof(*sorted_dst), unsigned_long_cmp);
+
+	w.count = xcalloc(src_nr + dst_nr, sizeof(*w.count));
+	add_files_to_count(&w, src, src_size, src_nr, sorted_dst, dst_nr);
+	add_files_to_count(&w, dst, dst_size, dst_nr, sorted_src, src_nr);
+
+	/* a file may be both a source and a destination with -C */
+	qsort(w.count, w.count_nr, sizeof(*w.count), pointer_cmp);
+	for (i = count_nr = 0; i < w.count_nr; i++)
+		if (!count_nr || w.count[i] != w.count[count_nr - 1])
+			w.count[count_nr++] = w.count[i];
+	w.count_nr = count_nr;
+
+	pthread_mutex_init(&rename_work_mutex, NULL);
+	pthread_mutex_init(&rename_read_mutex, NULL);
+	run_rename_threads(nr_threads, count_files_thread, &w);
+	run_rename_threads(nr_threads, score_rows_thread, &w);
+	pthread_mutex_destroy(&rename_read_mutex);
+	pthread_mutex_destroy(&rename_work_mutex);
+
+	free(w.count);
+	free(sorted_dst);
+	free(sorted_src);
+	free(dst_size);
+	free(dst);
+	free(src_size);
+	free(src);
+	free(w.row_dst);
+	return w.row_nr;
+}
+
+#else
+#define score_matrix_threaded(mx, num_create, minimum_score, skip_unmodified, progress) (-1)
+#endif
+
 static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, int copies)
 {
 	int count = 0, i;
@@ -448,7 +937,7 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
+	int i, rename_count, skip_unmodified = 0;
 	int num_create, dst_cnt;
 	struct progress *progress = NULL;
 
@@ -511,8 +1000,22 @@ void diffcore_rename(struct diff_options *options)
 		goto cleanup;
 
 	/*
-	 * Calculate how many renames are left (but all the source
-	 * files still remain as options for rename/copies!)
+	 * When only renames are wanted, pair the files that kept their
+	 * basename, and leave the rest for the similarity matrix.
+	 */
+	if (detect_rename != DIFF_DETECT_COPY && want_basename_renames(options)) {
+		trace_event_region_enter("diff", "basename rename detection");
+		rename_count += find_basename_renames(minimum_score);
+		drop_used_rename_src();
+		trace_event_region_leave("diff", "basename rename detection");
+		if (!rename_src_nr)
+			goto cleanup;
+	}
+
+	/*
+	 * Calculate how many renames are left.  When looking for copies,
+	 * all the source files still remain as options for rename/copies;
+	 * otherwise the ones already paired up have been dropped above.
 	 */
 	num_create = (rename_dst_nr - rename_count);
 
@@ -537,43 +1040,15 @@ void diffcore_rename(struct diff_options *options)
 				rename_dst_nr * rename_src_nr, 50, 1);
 	}
 
+	trace_event_region_enter("diff", "inexact rename detection");
 	mx = xcalloc(num_create * NUM_CANDIDATE_PER_DST, sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
-		if (rename_dst[i].pair)
-			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress, (i+1)*rename_src_nr);
-	}
+	dst_cnt = score_matrix_threaded(mx, num_create, minimum_score,
+					skip_unmodified, progress);
+	if (dst_cnt < 0)
+		dst_cnt = score_matrix(mx, minimum_score, skip_unmodified,
+				       progress);
 	stop_progress(&progress);
+	trace_event_region_leave("diff", "inexact rename detection");
 
 	/* cost matrix sorted by most to least similar pair */
 	qsort(mx, dst_cnt * NUM_CANDIDATE_PER_DST, sizeof(*mx), score_compare);
@@ -146,4 +146,12 @@ extern int diffcore_count_changes(struct diff_filespec *src,
 				  unsigned long *src_copied,
 				  unsigned long *literal_added);
 
+/*
+ * Compute the counts diffcore_count_changes() compares into *count_p,
+ * unless it has them already.  one must be populated, and its
+ * is_binary known.  Does not touch anything but one and *count_p, so
+ * that threads can prepare the counts of different files at once.
+ */
+extern void diffcore_count_prepare(struct diff_filespec *one, void **count_p);
+
 #endif
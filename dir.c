@@ -15,6 +15,8 @@
 #include "utf8.h"
 #include "varint.h"
 #include "ewah/ewok.h"
+#include "fsmonitor.h"
+#include "sparse-index.h"
 
 struct path_simplify {
 	int len;
@@ -1213,8 +1215,11 @@ static enum exist_status directory_exists_in_index_icase(const char *dirname, in
 	 * The cache_entry structure returned will contain this dirname
 	 * and possibly additional path components.
 	 */
-	if (endchar == '/')
+	if (endchar == '/') {
+		if (S_ISSPARSEDIR(ce->ce_mode))
+			ensure_full_index(&the_index);
 		return index_directory;
+	}
 
 	/*
 	 * If there are no additional path components, then this cache_entry
@@ -1254,8 +1259,12 @@ static enum exist_status directory_exists_in_index(const char *dirname, int len)
 		endchar = ce->name[len];
 		if (endchar > '/')
 			break;
-		if (endchar == '/')
+		if (endchar == '/') {
+			/* its files are looked up one by one, by name */
+			if (S_ISSPARSEDIR(ce->ce_mode))
+				ensure_full_index(&the_index);
 			return index_directory;
+		}
 		if (!endchar && S_ISGITLINK(ce->ce_mode))
 			return index_gitdir;
 	}
@@ -1581,17 +1590,21 @@ static int valid_cached_dir(struct dir_struct *dir,
 	if (!untracked)
 		return 0;
 
-	if (stat(path->len ? path->buf : ".", &st)) {
-		invalidate_directory(dir->untracked, untracked);
-		memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
-		return 0;
-	}
-	if (!untracked->valid ||
-	    match_stat_data_racy(&the_index, &untracked->stat_data, &st)) {
-		if (untracked->valid)
+	refresh_fsmonitor(&the_index);
+	if (!(dir->untracked->use_fsmonitor && untracked->valid)) {
+		if (stat(path->len ? path->buf : ".", &st)) {
 			invalidate_directory(dir->untracked, untracked);
-		fill_stat_data(&untracked->stat_data, &st);
-		return 0;
+			memset(&untracked->stat_data, 0,
+			       sizeof(untracked->stat_data));
+			return 0;
+		}
+		if (!untracked->valid ||
+		    match_stat_data_racy(&the_index, &untracked->stat_data, &st)) {
+			if (untracked->valid)
+				invalidate_directory(dir->untracked, untracked);
+			fill_stat_data(&untracked->stat_data, &st);
+			return 0;
+		}
 	}
 
 	if (untracked->check_only != !!check_only) {
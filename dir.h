@@ -134,6 +134,12 @@ struct untracked_cache {
 	 */
 	unsigned dir_flags;
 	struct untracked_cache_dir *root;
+	/*
+	 * Set when the file system monitor has invalidated every
+	 * directory changed since the cache was written, so that the
+	 * remaining ones need not be stat()ed.
+	 */
+	int use_fsmonitor;
 	/* Statistics */
 	int dir_created;
 	int gitignore_invalidated;
@@ -18,11 +18,222 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 #include "git-compat-util.h"
+#include "cpu-features.h"
 #include "ewok.h"
+#include "ewok_rlw.h"
 
 #define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
 #define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
 
+static void or_words_c(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; ++i)
+		dst[i] |= src[i];
+}
+
+static void and_not_words_c(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; ++i)
+		dst[i] &= ~src[i];
+}
+
+static size_t popcount_words_c(const eword_t *words, size_t nr)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < nr; ++i)
+		count += ewah_bit_popcount64(words[i]);
+	return count;
+}
+
+static size_t and_popcount_words_c(const eword_t *a, const eword_t *b,
+				   size_t nr)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < nr; ++i)
+		count += ewah_bit_popcount64(a[i] & b[i]);
+	return count;
+}
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static void or_words_sse2(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i + 2 <= nr; i += 2) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(a, b));
+	}
+	or_words_c(dst + i, src + i, nr - i);
+}
+
+__attribute__((target("sse2")))
+static void and_not_words_sse2(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i + 2 <= nr; i += 2) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_andnot_si128(b, a));
+	}
+	and_not_words_c(dst + i, src + i, nr - i);
+}
+
+/*
+ * The GCC builtin is only slow when it cannot use the instruction
+ * (see ewah_bit_popcount64()), which the target attribute allows.
+ */
+__attribute__((target("popcnt")))
+static size_t popcount_words_popcnt(const eword_t *words, size_t nr)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < nr; ++i)
+		count += __builtin_popcountll(words[i]);
+	return count;
+}
+
+__attribute__((target("popcnt")))
+static size_t and_popcount_words_popcnt(const eword_t *a, const eword_t *b,
+					size_t nr)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < nr; ++i)
+		count += __builtin_popcountll(a[i] & b[i]);
+	return count;
+}
+
+__attribute__((target("avx2")))
+static void or_words_avx2(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= nr; i += 4) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(a, b));
+	}
+	or_words_c(dst + i, src + i, nr - i);
+}
+
+__attribute__((target("avx2")))
+static void and_not_words_avx2(eword_t *dst, const eword_t *src, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= nr; i += 4) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    _mm256_andnot_si256(b, a));
+	}
+	and_not_words_c(dst + i, src + i, nr - i);
+}
+
+/*
+ * Count the bits of each byte with two table lookups of its nibbles,
+ * and sum them into the four 64-bit lanes.
+ */
+__attribute__((target("avx2")))
+static inline __m256i popcount_avx2(__m256i v)
+{
+	const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+					       1, 2, 2, 3, 2, 3, 3, 4,
+					       0, 1, 1, 2, 1, 2, 2, 3,
+					       1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low));
+	__m256i hi = _mm256_shuffle_epi8(table,
+		_mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+
+	return _mm256_sad_epu8(_mm256_add_epi8(lo, hi),
+			       _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline size_t sum_lanes_avx2(__m256i v)
+{
+	uint64_t lanes[4];
+
+	_mm256_storeu_si256((__m256i *)lanes, v);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t popcount_words_avx2(const eword_t *words, size_t nr)
+{
+	__m256i sum = _mm256_setzero_si256();
+	size_t i;
+
+	for (i = 0; i + 4 <= nr; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(words + i));
+		sum = _mm256_add_epi64(sum, popcount_avx2(v));
+	}
+	return sum_lanes_avx2(sum) + popcount_words_popcnt(words + i, nr - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t and_popcount_words_avx2(const eword_t *a, const eword_t *b,
+				      size_t nr)
+{
+	__m256i sum = _mm256_setzero_si256();
+	size_t i;
+
+	for (i = 0; i + 4 <= nr; i += 4) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+		sum = _mm256_add_epi64(sum,
+				       popcount_avx2(_mm256_and_si256(va, vb)));
+	}
+	return sum_lanes_avx2(sum) +
+		and_popcount_words_popcnt(a + i, b + i, nr - i);
+}
+
+static int x86_has_avx2_popcnt(void)
+{
+	return x86_has_avx2() && x86_has_popcnt();
+}
+#endif
+
+struct bitmap_backend {
+	struct cpu_backend cpu;
+	void (*or_words)(eword_t *dst, const eword_t *src, size_t nr);
+	void (*and_not_words)(eword_t *dst, const eword_t *src, size_t nr);
+	size_t (*popcount_words)(const eword_t *words, size_t nr);
+	size_t (*and_popcount_words)(const eword_t *a, const eword_t *b,
+				     size_t nr);
+};
+
+static const struct bitmap_backend backends[] = {
+#ifdef HAVE_X86_SIMD
+	{ { "avx2", x86_has_avx2_popcnt }, or_words_avx2, and_not_words_avx2,
+	  popcount_words_avx2, and_popcount_words_avx2 },
+	/* every CPU with POPCNT has SSE2 */
+	{ { "popcnt", x86_has_popcnt }, or_words_sse2, and_not_words_sse2,
+	  popcount_words_popcnt, and_popcount_words_popcnt },
+#endif
+	{ { "c", NULL }, or_words_c, and_not_words_c,
+	  popcount_words_c, and_popcount_words_c },
+};
+
+struct cpu_backends bitmap_backends = CPU_BACKENDS_INIT(backends);
+
+static inline const struct bitmap_backend *get_backend(void)
+{
+	return cpu_backend(&bitmap_backends);
+}
+
 struct bitmap *bitmap_new(void)
 {
 	struct bitmap *bitmap = ewah_malloc(sizeof(struct bitmap));
@@ -118,19 +329,15 @@ void bitmap_and_not(struct bitmap *self, struct bitmap *other)
 	const size_t count = (self->word_alloc < other->word_alloc) ?
 		self->word_alloc : other->word_alloc;
 
-	size_t i;
-
-	for (i = 0; i < count; ++i)
-		self->words[i] &= ~other->words[i];
+	get_backend()->and_not_words(self->words, other->words, count);
 }
 
 void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
 	size_t original_size = self->word_alloc;
 	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
-	size_t i = 0;
-	struct ewah_iterator it;
-	eword_t word;
+	const struct bitmap_backend *ops = get_backend();
+	size_t pointer = 0, pos = 0;
 
 	if (self->word_alloc < other_final) {
 		self->word_alloc = other_final;
@@ -140,10 +347,56 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 			(self->word_alloc - original_size) * sizeof(eword_t));
 	}
 
-	ewah_iterator_init(&it, other);
+	/*
+	 * Rather than expanding "other" word by word, skip its runs of
+	 * zeroes, fill its runs of ones, and OR its literal words in bulk.
+	 */
+	while (pointer < other->buffer_size) {
+		const eword_t *rlw = other->buffer + pointer;
+		size_t run = rlw_get_running_len(rlw);
+		size_t literals = rlw_get_literal_words(rlw);
+
+		if (literals > other->buffer_size - pointer - 1)
+			literals = other->buffer_size - pointer - 1;
+		if (run > self->word_alloc - pos)
+			run = self->word_alloc - pos;
+		if (rlw_get_run_bit(rlw))
+			memset(self->words + pos, 0xff, run * sizeof(eword_t));
+		pos += run;
+		if (literals > self->word_alloc - pos)
+			literals = self->word_alloc - pos;
+		ops->or_words(self->words + pos, rlw + 1, literals);
+		pos += literals;
+		pointer += 1 + literals;
+	}
+}
+
+size_t bitmap_popcount_and_ewah(struct bitmap *self, struct ewah_bitmap *other)
+{
+	const struct bitmap_backend *ops = get_backend();
+	size_t pointer = 0, pos = 0, count = 0;
+
+	while (pointer < other->buffer_size && pos < self->word_alloc) {
+		const eword_t *rlw = other->buffer + pointer;
+		size_t run = rlw_get_running_len(rlw);
+		size_t literals = rlw_get_literal_words(rlw);
+
+		if (literals > other->buffer_size - pointer - 1)
+			literals = other->buffer_size - pointer - 1;
+		if (run > self->word_alloc - pos)
+			run = self->word_alloc - pos;
+		if (rlw_get_run_bit(rlw))
+			count += ops->popcount_words(self->words + pos, run);
+		pos += run;
+		if (literals > self->word_alloc - pos)
+			literals = self->word_alloc - pos;
+		count += ops->and_popcount_words(self->words + pos, rlw + 1,
+						 literals);
+		pos += literals;
+		pointer += 1 + literals;
+	}
 
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+	return count;
 }
 
 void bitmap_each_bit(struct bitmap *self, ewah_callback callback, void *data)
@@ -172,12 +425,7 @@ void bitmap_each_bit(struct bitmap *self, ewah_callback callback, void *data)
 
 size_t bitmap_popcount(struct bitmap *self)
 {
-	size_t i, count = 0;
-
-	for (i = 0; i < self->word_alloc; ++i)
-		count += ewah_bit_popcount64(self->words[i]);
-
-	return count;
+	return get_backend()->popcount_words(self->words, self->word_alloc);
 }
 
 int bitmap_equals(struct bitmap *self, struct bitmap *other)
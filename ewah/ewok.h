@@ -232,4 +232,17 @@ void bitmap_or(struct bitmap *self, const struct bitmap *other);
 void bitmap_each_bit(struct bitmap *self, ewah_callback callback, void *data);
 size_t bitmap_popcount(struct bitmap *self);
 
+/* The number of bits set both in `self` and in `other` */
+size_t bitmap_popcount_and_ewah(struct bitmap *self, struct ewah_bitmap *other);
+
+/*
+ * The loops over the words of uncompressed bitmaps (bitmap_and_not(),
+ * bitmap_or_ewah() and the popcounts) are picked at runtime by what the
+ * CPU supports ("avx2"; "popcnt", SSE2 and the POPCNT instruction; or
+ * the portable "c").  Test programs can list and force them through
+ * bitmap_backends with the functions of cpu-features.h.
+ */
+struct cpu_backends;
+extern struct cpu_backends bitmap_backends;
+
 #endif
@@ -15,6 +15,7 @@
 #include "version.h"
 #include "prio-queue.h"
 #include "sha1-array.h"
+#include "list-objects-filter.h"
 
 static int transfer_unpack_limit = -1;
 static int fetch_unpack_limit = -1;
@@ -275,8 +276,10 @@ static int find_common(struct fetch_pack_args *args,
 		for_each_ref(clear_marks, NULL);
 	marked = 1;
 
-	for_each_ref(rev_list_insert_ref_oid, NULL);
-	for_each_alternate_ref(insert_one_alternate_ref, NULL);
+	if (!args->no_haves) {
+		for_each_ref(rev_list_insert_ref_oid, NULL);
+		for_each_alternate_ref(insert_one_alternate_ref, NULL);
+	}
 
 	fetching = 0;
 	for ( ; refs ; refs = refs->next) {
@@ -330,6 +333,9 @@ static int find_common(struct fetch_pack_args *args,
 		write_shallow_commits(&req_buf, 1, NULL);
 	if (args->depth > 0)
 		packet_buf_write(&req_buf, "deepen %d", args->depth);
+	if (args->filter_options.choice)
+		packet_buf_write(&req_buf, "filter %s",
+				 args->filter_options.filter_spec);
 	packet_buf_flush(&req_buf);
 	state_len = req_buf.len;
 
@@ -853,6 +859,17 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 		args->no_progress = 0;
 	if (!server_supports("include-tag"))
 		args->include_tag = 0;
+	if (server_supports("ref-prefix")) {
+		if (args->verbose)
+			fprintf(stderr, "Server supports ref-prefix\n");
+	}
+	if (server_supports("filter")) {
+		if (args->verbose)
+			fprintf(stderr, "Server supports filter\n");
+	} else if (args->filter_options.choice) {
+		warning("filtering not recognized by server, ignoring");
+		args->filter_options.choice = LOFC_DISABLED;
+	}
 	if (server_supports("ofs-delta")) {
 		if (args->verbose)
 			fprintf(stderr, "Server supports ofs-delta\n");
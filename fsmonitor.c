@@ -0,0 +1,213 @@
+#include "cache.h"
+#include "dir.h"
+#include "ewah/ewok.h"
+#include "fsmonitor.h"
+#include "run-command.h"
+
+#define INDEX_EXTENSION_VERSION 1
+#define HOOK_INTERFACE_VERSION 1
+
+const char *fsmonitor_hook(void)
+{
+	static const char *hook;
+	static int initialized;
+
+	if (!initialized) {
+		if (git_config_get_pathname("core.fsmonitor", &hook) ||
+		    !*hook)
+			hook = NULL;
+		initialized = 1;
+	}
+	return hook;
+}
+
+int read_fsmonitor_extension(struct index_state *istate, const void *data,
+			     unsigned long sz)
+{
+	const char *index = data;
+	uint32_t hdr_version;
+	uint32_t ewah_size;
+	struct ewah_bitmap *fsmonitor_dirty;
+	int ret;
+
+	if (sz < sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t))
+		return error("corrupt fsmonitor extension (too short)");
+
+	hdr_version = get_be32(index);
+	index += sizeof(uint32_t);
+	if (hdr_version != INDEX_EXTENSION_VERSION)
+		return error("bad fsmonitor version %d", hdr_version);
+
+	istate->fsmonitor_last_update = get_be64(index);
+	index += sizeof(uint64_t);
+
+	ewah_size = get_be32(index);
+	index += sizeof(uint32_t);
+
+	fsmonitor_dirty = ewah_new();
+	ret = ewah_read_mmap(fsmonitor_dirty, index, ewah_size);
+	if (ret != ewah_size) {
+		ewah_free(fsmonitor_dirty);
+		return error("failed to parse ewah bitmap reading fsmonitor index extension");
+	}
+	istate->fsmonitor_dirty = fsmonitor_dirty;
+	return 0;
+}
+
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
+{
+	struct ewah_bitmap *dirty = ewah_new();
+	unsigned char buf[8];
+	size_t ewah_size_offset;
+	int i, pos;
+
+	put_be32(buf, INDEX_EXTENSION_VERSION);
+	strbuf_add(sb, buf, sizeof(uint32_t));
+
+	put_be64(buf, istate->fsmonitor_last_update);
+	strbuf_add(sb, buf, sizeof(uint64_t));
+
+	/* the positions must match the entries that are written out */
+	for (i = pos = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (!(ce->ce_flags & CE_FSMONITOR_VALID))
+			ewah_set(dirty, pos);
+		pos++;
+	}
+
+	ewah_size_offset = sb->len;
+	strbuf_addchars(sb, 0, sizeof(uint32_t)); /* fixed up below */
+	put_be32(sb->buf + ewah_size_offset, ewah_serialize_strbuf(dirty, sb));
+	ewah_free(dirty);
+}
+
+static void fsmonitor_ewah_callback(size_t pos, void *is)
+{
+	struct index_state *istate = is;
+
+	if (pos < istate->cache_nr)
+		istate->cache[pos]->ce_flags &= ~CE_FSMONITOR_VALID;
+}
+
+void tweak_fsmonitor(struct index_state *istate)
+{
+	int i;
+
+	if (fsmonitor_hook() && istate->fsmonitor_dirty &&
+	    !istate->split_index) {
+		/* everything is clean but what the bitmap says */
+		for (i = 0; i < istate->cache_nr; i++)
+			istate->cache[i]->ce_flags |= CE_FSMONITOR_VALID;
+		ewah_each_bit(istate->fsmonitor_dirty,
+			      fsmonitor_ewah_callback, istate);
+	} else if (istate->fsmonitor_last_update) {
+		/* drop data we cannot (or were told not to) use */
+		istate->fsmonitor_last_update = 0;
+		istate->cache_changed |= FSMONITOR_CHANGED;
+	}
+
+	if (istate->fsmonitor_dirty) {
+		ewah_free(istate->fsmonitor_dirty);
+		istate->fsmonitor_dirty = NULL;
+	}
+}
+
+/*
+ * Run the hook, asking for the paths changed since "last_update", in
+ * nanoseconds since the epoch.  Returns 0 on success.
+ */
+static int query_fsmonitor(int version, uint64_t last_update,
+			   struct strbuf *query_result)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+
+	argv_array_push(&cp.args, fsmonitor_hook());
+	argv_array_pushf(&cp.args, "%d", version);
+	argv_array_pushf(&cp.args, "%"PRIuMAX, (uintmax_t)last_update);
+	cp.use_shell = 1;
+	cp.dir = get_git_work_tree();
+
+	return capture_command(&cp, query_result, 1024);
+}
+
+static void fsmonitor_refresh_callback(struct index_state *istate, char *name)
+{
+	int len = strlen(name);
+	int pos;
+
+	if (len && name[len - 1] == '/')
+		name[--len] = '\0';
+
+	pos = index_name_pos(istate, name, len);
+	if (pos >= 0) {
+		mark_fsmonitor_invalid(istate, istate->cache[pos]);
+	} else {
+		/* a directory, or a path we do not track: check below it */
+		for (pos = -pos - 1; pos < istate->cache_nr; pos++) {
+			struct cache_entry *ce = istate->cache[pos];
+
+			if (ce_namelen(ce) <= len ||
+			    strncmp(ce->name, name, len) ||
+			    ce->name[len] != '/')
+				break;
+			mark_fsmonitor_invalid(istate, ce);
+		}
+	}
+
+	/* the directory containing it has changed, too */
+	untracked_cache_invalidate_path(istate, name);
+}
+
+void refresh_fsmonitor(struct index_state *istate)
+{
+	struct strbuf query_result = STRBUF_INIT;
+	int query_success = 0;
+	uint64_t last_update;
+	size_t bol, i;
+
+	if (!fsmonitor_hook() || istate->fsmonitor_has_run_once ||
+	    istate->split_index)
+		return;
+	istate->fsmonitor_has_run_once = 1;
+
+	/*
+	 * Take the time before querying, so that nothing that changes
+	 * while the hook runs can be missed by the next query.
+	 */
+	last_update = getnanotime();
+
+	if (istate->fsmonitor_last_update)
+		query_success = !query_fsmonitor(HOOK_INTERFACE_VERSION,
+						 istate->fsmonitor_last_update,
+						 &query_result);
+
+	if (query_success && strcmp(query_result.buf, "/")) {
+		/*
+		 * A NUL separated list of changed paths; the strbuf is
+		 * NUL terminated, so a missing final NUL is fine.
+		 */
+		for (i = bol = 0; i <= query_result.len; i++) {
+			if (query_result.buf[i] != '\0')
+				continue;
+			if (i > bol)
+				fsmonitor_refresh_callback(istate,
+							   query_result.buf + bol);
+			bol = i + 1;
+		}
+	} else {
+		/* the hook failed or said "everything": trust nothing */
+		for (i = 0; i < istate->cache_nr; i++)
+			mark_fsmonitor_invalid(istate, istate->cache[i]);
+		query_success = 0;
+	}
+	strbuf_release(&query_result);
+
+	if (istate->untracked)
+		istate->untracked->use_fsmonitor = query_success;
+
+	istate->fsmonitor_last_update = last_update;
+	istate->cache_changed |= FSMONITOR_CHANGED;
+}
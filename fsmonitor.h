@@ -0,0 +1,59 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+/*
+ * Integration with a file system monitor, configured as a hook command
+ * in "core.fsmonitor".  The index records, in the FSMN extension, the
+ * time of the last query and which entries were not known to be clean
+ * at that point.  The next process asks the hook what changed since
+ * then and can trust every other entry, and every directory of the
+ * untracked cache, without touching the file system.
+ *
+ * See Documentation/githooks.txt for the hook protocol.
+ */
+
+/* The command configured in "core.fsmonitor", or NULL */
+extern const char *fsmonitor_hook(void);
+
+/*
+ * Read and write the FSMN index extension.  read_fsmonitor_extension()
+ * only stores the data; tweak_fsmonitor() applies it to the entries
+ * once they are all loaded.
+ */
+extern int read_fsmonitor_extension(struct index_state *istate,
+				    const void *data, unsigned long sz);
+extern void write_fsmonitor_extension(struct strbuf *sb,
+				      struct index_state *istate);
+extern void tweak_fsmonitor(struct index_state *istate);
+
+/*
+ * Ask the hook, once per process, which paths changed since the last
+ * query and invalidate their entries and untracked cache directories.
+ * If the hook fails, nothing is trusted.
+ */
+extern void refresh_fsmonitor(struct index_state *istate);
+
+/*
+ * Record that "ce" has just been found to match the file system, so
+ * that it need not be checked again until the monitor reports it.
+ */
+static inline void mark_fsmonitor_valid(struct index_state *istate,
+					struct cache_entry *ce)
+{
+	if (istate->fsmonitor_last_update &&
+	    !(ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce->ce_flags |= CE_FSMONITOR_VALID;
+		istate->cache_changed |= FSMONITOR_CHANGED;
+	}
+}
+
+static inline void mark_fsmonitor_invalid(struct index_state *istate,
+					  struct cache_entry *ce)
+{
+	if (ce->ce_flags & CE_FSMONITOR_VALID) {
+		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		istate->cache_changed |= FSMONITOR_CHANGED;
+	}
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include "exec_cmd.h"
 #include "help.h"
 #include "run-command.h"
+#include "trace-event.h"
 
 const char git_usage_string[] =
 	"git [--version] [--help] [-C <path>] [-c name=value]\n"
@@ -392,6 +393,7 @@ static struct cmd_struct commands[] = {
 	{ "clone", cmd_clone, NO_SETUP },
 	{ "column", cmd_column, RUN_SETUP_GENTLY },
 	{ "commit", cmd_commit, RUN_SETUP | NEED_WORK_TREE },
+	{ "commit-graph", cmd_commit_graph, RUN_SETUP },
 	{ "commit-tree", cmd_commit_tree, RUN_SETUP },
 	{ "config", cmd_config, RUN_SETUP_GENTLY },
 	{ "count-objects", cmd_count_objects, RUN_SETUP },
@@ -436,6 +438,7 @@ static struct cmd_struct commands[] = {
 	{ "merge-tree", cmd_merge_tree, RUN_SETUP },
 	{ "mktag", cmd_mktag, RUN_SETUP },
 	{ "mktree", cmd_mktree, RUN_SETUP },
+	{ "multi-pack-index", cmd_multi_pack_index, RUN_SETUP },
 	{ "mv", cmd_mv, RUN_SETUP | NEED_WORK_TREE },
 	{ "name-rev", cmd_name_rev, RUN_SETUP },
 	{ "notes", cmd_notes, RUN_SETUP },
@@ -533,7 +536,7 @@ static void handle_builtin(int argc, const char **argv)
 		if (saved_environment && (builtin->option & NO_SETUP))
 			restore_env();
 		else
-			exit(run_builtin(builtin, argc, argv));
+			exit(trace_event_exit(run_builtin(builtin, argc, argv)));
 	}
 }
 
@@ -566,7 +569,7 @@ static void execv_dashed_external(const char **argv)
 	 */
 	status = run_command_v_opt(argv, RUN_SILENT_EXEC_FAILURE | RUN_CLEAN_ON_EXIT);
 	if (status >= 0 || errno != ENOENT)
-		exit(status);
+		exit(trace_event_exit(status));
 
 	argv[0] = tmp;
 
@@ -644,6 +647,7 @@ int main(int argc, char **av)
 	git_setup_gettext();
 
 	trace_command_performance(argv);
+	trace_event_start(argv);
 
 	/*
 	 * "git-xxxx" is the same as "git xxxx", but we obviously:
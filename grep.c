@@ -286,6 +286,7 @@ struct grep_opt *grep_opt_dup(const struct grep_opt *opt)
 
 	ret->pattern_list = NULL;
 	ret->pattern_tail = &ret->pattern_list;
+	ret->kws = NULL;
 
 	for(pat = opt->pattern_list; pat != NULL; pat = pat->next)
 	{
@@ -695,6 +696,30 @@ static struct grep_expr *grep_splice_or(struct grep_expr *x, struct grep_expr *y
 	return z;
 }
 
+/*
+ * When a line matches if any of several fixed strings is in it, look
+ * for all of them at once.
+ */
+static void compile_fixed_alternatives(struct grep_opt *opt)
+{
+	struct grep_pat *p;
+	int nr = 0;
+
+	for (p = opt->pattern_list; p; p = p->next, nr++)
+		if (p->token != GREP_PATTERN || !p->fixed || p->word_regexp)
+			return;
+	if (nr < 2)
+		return;
+
+	if (opt->regflags & REG_ICASE || opt->ignore_case)
+		opt->kws = kwsalloc(tolower_trans_tbl);
+	else
+		opt->kws = kwsalloc(NULL);
+	for (p = opt->pattern_list; p; p = p->next)
+		kwsincr(opt->kws, p->pattern, p->patternlen);
+	kwsprep(opt->kws);
+}
+
 static void compile_grep_patterns_real(struct grep_opt *opt)
 {
 	struct grep_pat *p;
@@ -715,8 +740,11 @@ static void compile_grep_patterns_real(struct grep_opt *opt)
 
 	if (opt->all_match || header_expr)
 		opt->extended = 1;
-	else if (!opt->extended && !opt->debug)
-		return;
+	else if (!opt->extended) {
+		compile_fixed_alternatives(opt);
+		if (!opt->debug)
+			return;
+	}
 
 	p = opt->pattern_list;
 	if (p)
@@ -787,6 +815,8 @@ void free_grep_patterns(struct grep_opt *opt)
 		free(p);
 	}
 
+	if (opt->kws)
+		kwsfree(opt->kws);
 	if (!opt->extended)
 		return;
 	free_pattern_expr(opt->pattern_expression);
@@ -1040,6 +1070,8 @@ static int match_line(struct grep_opt *opt, char *bol, char *eol,
 		return match_expr(opt, bol, eol, ctx, collect_hits);
 
 	/* we do not call with collect_hits without being extended */
+	if (opt->kws)
+		return kwsexec(opt->kws, bol, eol - bol, NULL) != -1;
 	for (p = opt->pattern_list; p; p = p->next) {
 		if (match_one_pattern(p, bol, eol, ctx, &match, 0))
 			return 1;
@@ -1184,7 +1216,8 @@ static inline void grep_attr_unlock(void)
 }
 
 /*
- * Same as git_attr_mutex, but protecting the thread-unsafe object db access.
+ * Same as git_attr_mutex, but protecting textconv, which is not
+ * thread-safe; reading objects is, see enable_obj_read_lock().
  */
 pthread_mutex_t grep_read_mutex;
 
@@ -1309,15 +1342,21 @@ static int look_ahead(struct grep_opt *opt,
 	char *sp, *last_bol;
 	regoff_t earliest = -1;
 
-	for (p = opt->pattern_list; p; p = p->next) {
-		int hit;
-		regmatch_t m;
-
-		hit = patmatch(p, bol, bol + *left_p, &m, 0);
-		if (!hit || m.rm_so < 0 || m.rm_eo < 0)
-			continue;
-		if (earliest < 0 || m.rm_so < earliest)
-			earliest = m.rm_so;
+	if (opt->kws) {
+		size_t offset = kwsexec(opt->kws, bol, *left_p, NULL);
+		if (offset != -1)
+			earliest = offset;
+	} else {
+		for (p = opt->pattern_list; p; p = p->next) {
+			int hit;
+			regmatch_t m;
+
+			hit = patmatch(p, bol, bol + *left_p, &m, 0);
+			if (!hit || m.rm_so < 0 || m.rm_eo < 0)
+				continue;
+			if (earliest < 0 || m.rm_so < earliest)
+				earliest = m.rm_so;
+		}
 	}
 
 	if (earliest < 0) {
@@ -1710,9 +1749,7 @@ static int grep_source_load_sha1(struct grep_source *gs)
 {
 	enum object_type type;
 
-	grep_read_lock();
 	gs->buf = read_sha1_file(gs->identifier, &type, &gs->size);
-	grep_read_unlock();
 
 	if (!gs->buf)
 		return error(_("'%s': unable to read %s"),
@@ -89,6 +89,8 @@ struct grep_opt {
 	struct grep_pat *header_list;
 	struct grep_pat **header_tail;
 	struct grep_expr *pattern_expression;
+	/* all the patterns, if a line matches when any fixed string does */
+	kwset_t kws;
 	const char *prefix;
 	int prefix_length;
 	regex_t regexp;
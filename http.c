@@ -1832,6 +1832,8 @@ int finish_http_object_request(struct http_object_request *freq)
 	}
 	freq->rename =
 		finalize_object_file(freq->tmpfile, sha1_file_name(freq->sha1));
+	if (!freq->rename)
+		loose_object_cache_add(freq->sha1);
 
 	return freq->rename;
 }
@@ -38,6 +38,7 @@
 
 #include "kwset.h"
 #include "compat/obstack.h"
+#include "cpu-features.h"
 
 #define NCHAR (UCHAR_MAX + 1)
 #define obstack_chunk_alloc xmalloc
@@ -68,6 +69,16 @@ struct trie
   int maxshift;			/* Max shift of self and descendants. */
 };
 
+/* A keyword as it was given to kwsincr(). */
+struct keyword
+{
+  char *text;
+  size_t len;
+};
+
+/* The most bytes of each kind the prefilter looks for; see kwsprep(). */
+#define PREFILTER_MAX 8
+
 /* Structure returned opaquely to the caller, containing everything. */
 struct kwset
 {
@@ -81,6 +92,12 @@ struct kwset
   char *target;			/* Target string if there's only one. */
   int mind2;			/* Used in Boyer-Moore search for one string. */
   unsigned char const *trans;  /* Character translation table. */
+  struct keyword *keywords;	/* The keywords, for the prefilter. */
+  int keywords_alloc;
+  int prefilter;		/* Nonzero if pfexec() is used. */
+  int pf_nfirst, pf_nlast;	/* Bytes the prefilter looks for. */
+  unsigned char pf_first[PREFILTER_MAX];
+  unsigned char pf_last[PREFILTER_MAX];
 };
 
 /* Allocate and initialize a keyword set object, returning an opaque
@@ -112,6 +129,9 @@ kwsalloc (unsigned char const *trans)
   kwset->maxd = -1;
   kwset->target = NULL;
   kwset->trans = trans;
+  kwset->keywords = NULL;
+  kwset->keywords_alloc = 0;
+  kwset->prefilter = 0;
 
   return (kwset_t) kwset;
 }
@@ -136,6 +156,11 @@ kwsincr (kwset_t kws, char const *text, size_t len)
 
   kwset = (struct kwset *) kws;
   trie = kwset->trie;
+
+  ALLOC_GROW(kwset->keywords, kwset->words + 1, kwset->keywords_alloc);
+  kwset->keywords[kwset->words].text = obstack_copy(&kwset->obstack, text, len);
+  kwset->keywords[kwset->words].len = len;
+
   text += len;
 
   /* Descend the trie (built of reversed keywords) character-by-character,
@@ -373,6 +398,182 @@ treenext (struct tree const *tree, struct trie *next[])
   next[tree->label] = tree->trie;
 }
 
+/* The prefilter looks for the places where a keyword may start, that is
+   where the first byte of some keyword is followed, mind - 1 bytes later,
+   by the byte some keyword has there, with SIMD instructions that test
+   16 or 32 places at once; each such place is then checked in full.  It
+   is used when there are few such bytes, counting all the bytes that the
+   translation table maps to them; otherwise too many places would pass.
+   The next_candidate function returns the first place at or after FROM,
+   or -1 if there is none. */
+typedef size_t (*next_candidate_fn) (struct kwset const *,
+				     unsigned char const *, size_t, size_t);
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+
+/* The tail of the text, shorter than a vector. */
+static size_t
+next_candidate_scalar (struct kwset const *kwset, unsigned char const *text,
+		       size_t size, size_t from)
+{
+  size_t off = kwset->mind - 1;
+  int i, j;
+
+  for (; from + off < size; ++from)
+    for (i = 0; i < kwset->pf_nfirst; ++i)
+      if (text[from] == kwset->pf_first[i])
+	for (j = 0; j < kwset->pf_nlast; ++j)
+	  if (text[from + off] == kwset->pf_last[j])
+	    return from;
+  return -1;
+}
+
+__attribute__((target("sse2")))
+static size_t
+next_candidate_sse2 (struct kwset const *kwset, unsigned char const *text,
+		     size_t size, size_t from)
+{
+  size_t off = kwset->mind - 1;
+  __m128i first[PREFILTER_MAX], last[PREFILTER_MAX];
+  int i;
+
+  for (i = 0; i < kwset->pf_nfirst; ++i)
+    first[i] = _mm_set1_epi8(kwset->pf_first[i]);
+  for (i = 0; i < kwset->pf_nlast; ++i)
+    last[i] = _mm_set1_epi8(kwset->pf_last[i]);
+
+  for (; from + off + 16 <= size; from += 16)
+    {
+      __m128i a = _mm_loadu_si128((__m128i const *) (text + from));
+      __m128i b = _mm_loadu_si128((__m128i const *) (text + from + off));
+      __m128i ma = _mm_cmpeq_epi8(a, first[0]);
+      __m128i mb = _mm_cmpeq_epi8(b, last[0]);
+      unsigned int mask;
+
+      for (i = 1; i < kwset->pf_nfirst; ++i)
+	ma = _mm_or_si128(ma, _mm_cmpeq_epi8(a, first[i]));
+      for (i = 1; i < kwset->pf_nlast; ++i)
+	mb = _mm_or_si128(mb, _mm_cmpeq_epi8(b, last[i]));
+      mask = _mm_movemask_epi8(_mm_and_si128(ma, mb));
+      if (mask)
+	return from + __builtin_ctz(mask);
+    }
+  return next_candidate_scalar(kwset, text, size, from);
+}
+
+__attribute__((target("avx2")))
+static size_t
+next_candidate_avx2 (struct kwset const *kwset, unsigned char const *text,
+		     size_t size, size_t from)
+{
+  size_t off = kwset->mind - 1;
+  __m256i first[PREFILTER_MAX], last[PREFILTER_MAX];
+  int i;
+
+  for (i = 0; i < kwset->pf_nfirst; ++i)
+    first[i] = _mm256_set1_epi8(kwset->pf_first[i]);
+  for (i = 0; i < kwset->pf_nlast; ++i)
+    last[i] = _mm256_set1_epi8(kwset->pf_last[i]);
+
+  for (; from + off + 32 <= size; from += 32)
+    {
+      __m256i a = _mm256_loadu_si256((__m256i const *) (text + from));
+      __m256i b = _mm256_loadu_si256((__m256i const *) (text + from + off));
+      __m256i ma = _mm256_cmpeq_epi8(a, first[0]);
+      __m256i mb = _mm256_cmpeq_epi8(b, last[0]);
+      unsigned int mask;
+
+      for (i = 1; i < kwset->pf_nfirst; ++i)
+	ma = _mm256_or_si256(ma, _mm256_cmpeq_epi8(a, first[i]));
+      for (i = 1; i < kwset->pf_nlast; ++i)
+	mb = _mm256_or_si256(mb, _mm256_cmpeq_epi8(b, last[i]));
+      mask = _mm256_movemask_epi8(_mm256_and_si256(ma, mb));
+      if (mask)
+	return from + __builtin_ctz(mask);
+    }
+  return next_candidate_sse2(kwset, text, size, from);
+}
+#endif
+
+struct prefilter_backend {
+  struct cpu_backend cpu;
+  next_candidate_fn next_candidate;
+};
+
+/* There is no portable code for the prefilter; on its own it is no
+   faster than the searches below. */
+static const struct prefilter_backend prefilter_list[] = {
+#ifdef HAVE_X86_SIMD
+  { { "avx2", x86_has_avx2 }, next_candidate_avx2 },
+  { { "sse2", x86_has_sse2 }, next_candidate_sse2 },
+#endif
+  { { "none", NULL }, NULL },
+};
+
+static struct cpu_backends prefilter_backends
+  = CPU_BACKENDS_INIT(prefilter_list);
+
+/* The SIMD code for the prefilter, or NULL if there is none for this
+   CPU. */
+static next_candidate_fn
+get_next_candidate (void)
+{
+  const struct prefilter_backend *b = cpu_backend(&prefilter_backends);
+  return b->next_candidate;
+}
+
+/* Add to SET every byte that the translation table maps to the same
+   byte as C.  Return -1 if that makes more than PREFILTER_MAX. */
+static int
+add_prefilter_byte (struct kwset *kwset, unsigned char *set, int *nr,
+		    unsigned char c)
+{
+  unsigned char const *trans = kwset->trans;
+  int i, j;
+
+  for (i = 0; i < NCHAR; ++i)
+    {
+      if ((trans ? trans[i] : i) != (trans ? trans[c] : c))
+	continue;
+      for (j = 0; j < *nr; ++j)
+	if (set[j] == i)
+	  break;
+      if (j < *nr)
+	continue;
+      if (*nr == PREFILTER_MAX)
+	return -1;
+      set[(*nr)++] = i;
+    }
+  return 0;
+}
+
+static void
+prep_prefilter (struct kwset *kwset)
+{
+  int i;
+
+  kwset->prefilter = 0;
+  if (!get_next_candidate() || !kwset->words || !kwset->mind)
+    return;
+  /* memchr() is as good as it gets. */
+  if (kwset->target && kwset->mind == 1)
+    return;
+
+  kwset->pf_nfirst = kwset->pf_nlast = 0;
+  for (i = 0; i < kwset->words; ++i)
+    {
+      struct keyword const *kw = &kwset->keywords[i];
+
+      if (add_prefilter_byte(kwset, kwset->pf_first, &kwset->pf_nfirst,
+			     U(kw->text[0])) ||
+	  add_prefilter_byte(kwset, kwset->pf_last, &kwset->pf_nlast,
+			     U(kw->text[kwset->mind - 1])))
+	return;
+    }
+  kwset->prefilter = 1;
+}
+
 /* Compute the shift for each trie node, as well as the delta
    table and next cache for the given keyword set. */
 const char *
@@ -487,6 +688,8 @@ kwsprep (kwset_t kws)
   else
     memcpy(kwset->delta, delta, NCHAR);
 
+  prep_prefilter(kwset);
+
   return NULL;
 }
 
@@ -732,6 +935,50 @@ cwexec (kwset_t kws, char const *text, size_t len, struct kwsmatch *kwsmatch)
   return mch - text;
 }
 
+/* Search with the prefilter: check the places it finds in turn, the
+   first one where a keyword starts has the leftmost match. */
+static size_t
+pfexec (kwset_t kws, char const *text, size_t size, struct kwsmatch *kwsmatch)
+{
+  struct kwset const *kwset = (struct kwset const *) kws;
+  next_candidate_fn next_candidate = get_next_candidate();
+  size_t pos = 0;
+
+  while ((pos = next_candidate(kwset, (unsigned char const *) text,
+			       size, pos)) != (size_t) -1)
+    {
+      if (kwset->target)
+	{
+	  if (!memcmp(text + pos, kwset->target, kwset->mind))
+	    {
+	      if (kwsmatch)
+		{
+		  kwsmatch->index = 0;
+		  kwsmatch->offset[0] = pos;
+		  kwsmatch->size[0] = kwset->mind;
+		}
+	      return pos;
+	    }
+	}
+      else
+	{
+	  /* Every keyword that starts here fits in the window. */
+	  size_t len = size - pos;
+
+	  if (len > (size_t) kwset->maxd)
+	    len = kwset->maxd;
+	  if (!cwexec(kws, text + pos, len, kwsmatch))
+	    {
+	      if (kwsmatch)
+		kwsmatch->offset[0] += pos;
+	      return pos;
+	    }
+	}
+      ++pos;
+    }
+  return -1;
+}
+
 /* Search through the given text for a match of any member of the
    given keyword set.  Return a pointer to the first character of
    the matching substring, or NULL if no match is found.  If FOUNDLEN
@@ -744,6 +991,8 @@ kwsexec (kwset_t kws, char const *text, size_t size,
 	 struct kwsmatch *kwsmatch)
 {
   struct kwset const *kwset = (struct kwset *) kws;
+  if (kwset->prefilter)
+    return pfexec(kws, text, size, kwsmatch);
   if (kwset->words == 1 && kwset->trans == NULL)
     {
       size_t ret = bmexec (kws, text, size);
@@ -767,5 +1016,6 @@ kwsfree (kwset_t kws)
 
   kwset = (struct kwset *) kws;
   obstack_free(&kwset->obstack, NULL);
+  free(kwset->keywords);
   free(kws);
 }
@@ -0,0 +1,83 @@
+#include "cache.h"
+#include "parse-options.h"
+#include "list-objects-filter.h"
+
+int parse_list_objects_filter(struct list_objects_filter_options *filter_options,
+			      const char *arg)
+{
+	const char *v0;
+	char *end;
+
+	if (filter_options->choice)
+		return error(_("multiple filter-specs cannot be combined"));
+
+	if (!strcmp(arg, "blob:none")) {
+		filter_options->choice = LOFC_BLOB_NONE;
+	} else if (skip_prefix(arg, "blob:limit=", &v0)) {
+		if (!git_parse_ulong(v0, &filter_options->blob_limit_value))
+			goto invalid;
+		filter_options->choice = LOFC_BLOB_LIMIT;
+	} else if (skip_prefix(arg, "tree:", &v0)) {
+		if (!isdigit(*v0))
+			goto invalid;
+		filter_options->tree_depth_value = strtoul(v0, &end, 10);
+		if (*end)
+			goto invalid;
+		filter_options->choice = LOFC_TREE_DEPTH;
+	} else {
+		goto invalid;
+	}
+
+	filter_options->filter_spec = xstrdup(arg);
+	return 0;
+
+invalid:
+	return error(_("invalid filter-spec '%s'"), arg);
+}
+
+int opt_parse_list_objects_filter(const struct option *opt,
+				  const char *arg, int unset)
+{
+	struct list_objects_filter_options *filter_options = opt->value;
+
+	if (unset || !arg) {
+		list_objects_filter_release(filter_options);
+		return 0;
+	}
+	return parse_list_objects_filter(filter_options, arg);
+}
+
+void list_objects_filter_release(struct list_objects_filter_options *filter_options)
+{
+	free(filter_options->filter_spec);
+	memset(filter_options, 0, sizeof(*filter_options));
+}
+
+int list_objects_filter_omits_blob(const struct list_objects_filter_options *filter_options,
+				   const unsigned char *sha1,
+				   unsigned long depth)
+{
+	unsigned long size;
+
+	switch (filter_options->choice) {
+	case LOFC_DISABLED:
+		return 0;
+	case LOFC_BLOB_NONE:
+		return 1;
+	case LOFC_BLOB_LIMIT:
+		if (sha1_object_info(sha1, &size) != OBJ_BLOB)
+			return 0;
+		return size >= filter_options->blob_limit_value;
+	case LOFC_TREE_DEPTH:
+		return depth >= filter_options->tree_depth_value;
+	}
+	die("BUG: unknown filter choice %d", filter_options->choice);
+}
+
+int list_objects_filter_omits_tree(const struct list_objects_filter_options *filter_options,
+				   unsigned long depth)
+{
+	if (filter_options->choice != LOFC_TREE_DEPTH)
+		return 0;
+	return depth >= filter_options->tree_depth_value;
+}
@@ -0,0 +1,68 @@
+#ifndef LIST_OBJECTS_FILTER_H
+#define LIST_OBJECTS_FILTER_H
+
+struct option;
+
+/*
+ * Filters that omit objects from the objects a traversal of the
+ * commit graph shows (see traverse_commit_list_filtered()), as given
+ * to "--filter=<spec>":
+ *
+ *   blob:none        omit all blobs
+ *   blob:limit=<n>   omit blobs of <n> bytes or more (<n> can have a
+ *                    k, m or g suffix)
+ *   tree:<depth>     omit trees and blobs <depth> or more levels below
+ *                    the root tree of a commit (tree:0 omits all
+ *                    trees, tree:1 all blobs and trees but the roots)
+ *
+ * Objects named explicitly (as opposed to reached through a commit or
+ * a tree) are never omitted.
+ */
+enum list_objects_filter_choice {
+	LOFC_DISABLED = 0,
+	LOFC_BLOB_NONE,
+	LOFC_BLOB_LIMIT,
+	LOFC_TREE_DEPTH
+};
+
+struct list_objects_filter_options {
+	/* The filter as given, to pass it on to other processes. */
+	char *filter_spec;
+
+	enum list_objects_filter_choice choice;
+	unsigned long blob_limit_value;
+	unsigned long tree_depth_value;
+};
+
+/*
+ * Parse arg into filter_options.  Return 0 on success, or -1 with an
+ * error message.  A filter can only be given once.
+ */
+int parse_list_objects_filter(struct list_objects_filter_options *filter_options,
+			      const char *arg);
+
+/* parse-options callback for "--filter=<spec>"; "--no-filter" resets. */
+int opt_parse_list_objects_filter(const struct option *opt,
+				  const char *arg, int unset);
+
+#define OPT_PARSE_LIST_OBJECTS_FILTER(fo) \
+	{ OPTION_CALLBACK, 0, "filter", (fo), N_("args"), \
+	  N_("object filtering"), 0, opt_parse_list_objects_filter }
+
+void list_objects_filter_release(struct list_objects_filter_options *filter_options);
+
+/*
+ * Return true if the filter omits the blob, which is found depth
+ * levels below the root tree (1 for the entries of the root tree).
+ * blob:limit looks up the size of the blob; a blob whose size cannot
+ * be found is not omitted.
+ */
+int list_objects_filter_omits_blob(const struct list_objects_filter_options *filter_options,
+				   const unsigned char *sha1,
+				   unsigned long depth);
+
+/* Return true if the filter omits a tree depth levels below the root. */
+int list_objects_filter_omits_tree(const struct list_objects_filter_options *filter_options,
+				   unsigned long depth);
+
+#endif
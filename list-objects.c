@@ -7,13 +7,24 @@
 #include "tree-walk.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "list-objects-filter.h"
+#include "decorate.h"
+
+/*
+ * With a tree:<depth> filter, the depth (plus one) at which each tree
+ * was walked; a tree that is reached again closer to the root is
+ * walked again, as the filter may have omitted some of its entries.
+ */
+static struct decoration tree_depths;
 
 static void process_blob(struct rev_info *revs,
 			 struct blob *blob,
 			 show_object_fn show,
 			 struct name_path *path,
 			 const char *name,
-			 void *cb_data)
+			 void *cb_data,
+			 const struct list_objects_filter_options *filter,
+			 unsigned long depth)
 {
 	struct object *obj = &blob->object;
 
@@ -23,6 +34,8 @@ static void process_blob(struct rev_info *revs,
 		die("bad blob object");
 	if (obj->flags & (UNINTERESTING | SEEN))
 		return;
+	if (filter && list_objects_filter_omits_blob(filter, obj->sha1, depth))
+		return;
 	obj->flags |= SEEN;
 	show(obj, path, name, cb_data);
 }
@@ -65,7 +78,9 @@ static void process_tree(struct rev_info *revs,
 			 struct name_path *path,
 			 struct strbuf *base,
 			 const char *name,
-			 void *cb_data)
+			 void *cb_data,
+			 const struct list_objects_filter_options *filter,
+			 unsigned long depth)
 {
 	struct object *obj = &tree->object;
 	struct tree_desc desc;
@@ -79,15 +94,34 @@ static void process_tree(struct rev_info *revs,
 		return;
 	if (!obj)
 		die("bad tree object");
-	if (obj->flags & (UNINTERESTING | SEEN))
+	if (obj->flags & UNINTERESTING)
 		return;
-	if (parse_tree_gently(tree, revs->ignore_missing_links) < 0) {
-		if (revs->ignore_missing_links)
+	if (filter && list_objects_filter_omits_tree(filter, depth))
+		return;
+	if (filter && filter->choice == LOFC_TREE_DEPTH) {
+		uintptr_t seen_at = (uintptr_t)lookup_decoration(&tree_depths, obj);
+
+		if (seen_at && seen_at <= depth + 1)
+			return;
+		add_decoration(&tree_depths, obj, (void *)(uintptr_t)(depth + 1));
+	} else if (obj->flags & SEEN) {
+		return;
+	}
+	/*
+	 * A partial clone may not have the trees the filter of its
+	 * clone omitted.
+	 */
+	if (parse_tree_gently(tree, revs->ignore_missing_links ||
+			      repository_format_partial_clone) < 0) {
+		if (revs->ignore_missing_links ||
+		    repository_format_partial_clone)
 			return;
 		die("bad tree object %s", sha1_to_hex(obj->sha1));
 	}
-	obj->flags |= SEEN;
-	show(obj, path, name, cb_data);
+	if (!(obj->flags & SEEN)) {
+		obj->flags |= SEEN;
+		show(obj, path, name, cb_data);
+	}
 	me.up = path;
 	me.elem = name;
 	me.elem_len = strlen(name);
@@ -114,7 +148,7 @@ static void process_tree(struct rev_info *revs,
 			process_tree(revs,
 				     lookup_tree(entry.sha1),
 				     show, &me, base, entry.path,
-				     cb_data);
+				     cb_data, filter, depth + 1);
 		else if (S_ISGITLINK(entry.mode))
 			process_gitlink(revs, entry.sha1,
 					show, &me, entry.path,
@@ -123,7 +157,7 @@ static void process_tree(struct rev_info *revs,
 			process_blob(revs,
 				     lookup_blob(entry.sha1),
 				     show, &me, entry.path,
-				     cb_data);
+				     cb_data, filter, depth + 1);
 	}
 	strbuf_setlen(base, baselen);
 	free_tree_buffer(tree);
@@ -189,10 +223,24 @@ void traverse_commit_list(struct rev_info *revs,
 			  show_commit_fn show_commit,
 			  show_object_fn show_object,
 			  void *data)
+{
+	traverse_commit_list_filtered(revs, show_commit, show_object, data, NULL);
+}
+
+void traverse_commit_list_filtered(struct rev_info *revs,
+				   show_commit_fn show_commit,
+				   show_object_fn show_object,
+				   void *data,
+				   const struct list_objects_filter_options *filter_options)
 {
 	int i;
 	struct commit *commit;
 	struct strbuf base;
+	/* the objects pending before the walk were named explicitly */
+	int explicit_nr = revs->pending.nr;
+
+	if (filter_options && !filter_options->choice)
+		filter_options = NULL;
 
 	strbuf_init(&base, PATH_MAX);
 	while ((commit = get_revision(revs)) != NULL) {
@@ -209,6 +257,8 @@ void traverse_commit_list(struct rev_info *revs,
 		struct object *obj = pending->item;
 		const char *name = pending->name;
 		const char *path = pending->path;
+		const struct list_objects_filter_options *filter =
+			i < explicit_nr ? NULL : filter_options;
 		if (obj->flags & (UNINTERESTING | SEEN))
 			continue;
 		if (obj->type == OBJ_TAG) {
@@ -220,12 +270,12 @@ void traverse_commit_list(struct rev_info *revs,
 			path = "";
 		if (obj->type == OBJ_TREE) {
 			process_tree(revs, (struct tree *)obj, show_object,
-				     NULL, &base, path, data);
+				     NULL, &base, path, data, filter, 0);
 			continue;
 		}
 		if (obj->type == OBJ_BLOB) {
 			process_blob(revs, (struct blob *)obj, show_object,
-				     NULL, path, data);
+				     NULL, path, data, NULL, 0);
 			continue;
 		}
 		die("unknown pending object %s (%s)",
@@ -233,4 +283,6 @@ void traverse_commit_list(struct rev_info *revs,
 	}
 	object_array_clear(&revs->pending);
 	strbuf_release(&base);
+	free(tree_depths.hash);
+	memset(&tree_depths, 0, sizeof(tree_depths));
 }
@@ -5,6 +5,15 @@ typedef void (*show_commit_fn)(struct commit *, void *);
 typedef void (*show_object_fn)(struct object *, const struct name_path *, const char *, void *);
 void traverse_commit_list(struct rev_info *, show_commit_fn, show_object_fn, void *);
 
+/*
+ * Like traverse_commit_list(), but do not show the trees and blobs
+ * the filter omits (see list-objects-filter.h); filter_options may be
+ * NULL.
+ */
+struct list_objects_filter_options;
+void traverse_commit_list_filtered(struct rev_info *, show_commit_fn, show_object_fn,
+				   void *, const struct list_objects_filter_options *filter_options);
+
 typedef void (*show_edge_fn)(struct commit *);
 void mark_edges_uninteresting(struct rev_info *, show_edge_fn);
 
@@ -0,0 +1,540 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "dir.h"
+#include "progress.h"
+#include "midx.h"
+
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH 12
+#define MIDX_FANOUT_SIZE (4 * 256)
+#define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + MIDX_OID_LEN)
+#define MIDX_MAX_CHUNKS 5
+
+/* The multi-pack-index of the local object directory, if in use */
+static struct multi_pack_index *midx;
+static int midx_prepared;
+
+char *get_midx_filename(const char *obj_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index", obj_dir);
+}
+
+void close_midx(struct multi_pack_index *m)
+{
+	if (!m)
+		return;
+	munmap(m->data, m->data_len);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *midx_file)
+{
+	struct multi_pack_index *m;
+	struct stat st;
+	unsigned char *data;
+	size_t data_len;
+	const unsigned char *chunk_lookup;
+	const char *cur_pack_name;
+	uint32_t signature, i;
+	unsigned char num_chunks;
+	int fd;
+
+	fd = git_open_noatime(midx_file);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	data_len = xsize_t(st.st_size);
+	if (data_len < MIDX_MIN_SIZE) {
+		close(fd);
+		error("multi-pack-index file %s is too small", midx_file);
+		return NULL;
+	}
+	data = xmmap(NULL, data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	signature = get_be32(data);
+	if (signature != MIDX_SIGNATURE) {
+		error("multi-pack-index signature 0x%08x does not match signature 0x%08x",
+		      signature, MIDX_SIGNATURE);
+		goto cleanup_fail;
+	}
+	if (data[4] != MIDX_VERSION) {
+		error("multi-pack-index version %d not recognized", data[4]);
+		goto cleanup_fail;
+	}
+	if (data[5] != MIDX_OID_VERSION) {
+		error("multi-pack-index hash version %d not recognized", data[5]);
+		goto cleanup_fail;
+	}
+
+	m = xcalloc(1, sizeof(*m));
+	m->data = data;
+	m->data_len = data_len;
+
+	num_chunks = data[6];
+	/* data[7] is the number of base multi-pack-index files, always 0 */
+	m->num_packs = get_be32(data + 8);
+
+	chunk_lookup = data + MIDX_HEADER_SIZE;
+	if (MIDX_HEADER_SIZE + (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH >
+	    data_len - MIDX_OID_LEN) {
+		error("multi-pack-index chunk lookup table is truncated");
+		goto cleanup_free;
+	}
+	for (i = 0; i < num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+
+		chunk_lookup += MIDX_CHUNKLOOKUP_WIDTH;
+		if (chunk_offset > data_len - MIDX_OID_LEN) {
+			error("multi-pack-index improper chunk offset %08x%08x",
+			      (uint32_t)(chunk_offset >> 32),
+			      (uint32_t)chunk_offset);
+			goto cleanup_free;
+		}
+
+		switch (chunk_id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			m->chunk_pack_names = data + chunk_offset;
+			break;
+		case MIDX_CHUNKID_OIDFANOUT:
+			m->chunk_oid_fanout = data + chunk_offset;
+			break;
+		case MIDX_CHUNKID_OIDLOOKUP:
+			m->chunk_oid_lookup = data + chunk_offset;
+			break;
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			m->chunk_object_offsets = data + chunk_offset;
+			break;
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			m->chunk_large_offsets = data + chunk_offset;
+			break;
+		}
+	}
+
+	if (!m->chunk_pack_names || !m->chunk_oid_fanout ||
+	    !m->chunk_oid_lookup || !m->chunk_object_offsets) {
+		error("multi-pack-index is missing required chunks");
+		goto cleanup_free;
+	}
+	if (m->chunk_oid_fanout + MIDX_FANOUT_SIZE > data + data_len) {
+		error("multi-pack-index is truncated");
+		goto cleanup_free;
+	}
+	m->num_objects = get_be32(m->chunk_oid_fanout + 4 * 255);
+	if (m->chunk_object_offsets + (size_t)m->num_objects * MIDX_OFFSET_WIDTH >
+	    data + data_len - MIDX_OID_LEN) {
+		error("multi-pack-index is truncated");
+		goto cleanup_free;
+	}
+
+	m->pack_names = xcalloc(m->num_packs, sizeof(*m->pack_names));
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+	cur_pack_name = (const char *)m->chunk_pack_names;
+	for (i = 0; i < m->num_packs; i++) {
+		const char *end = memchr(cur_pack_name, '\0',
+					 (const char *)data + data_len - cur_pack_name);
+		if (!end) {
+			error("multi-pack-index pack names are truncated");
+			goto cleanup_free;
+		}
+		m->pack_names[i] = cur_pack_name;
+		if (i && strcmp(m->pack_names[i - 1], cur_pack_name) >= 0) {
+			error("multi-pack-index pack names out of order: '%s' before '%s'",
+			      m->pack_names[i - 1], cur_pack_name);
+			goto cleanup_free;
+		}
+		cur_pack_name = end + 1;
+	}
+
+	return m;
+
+cleanup_free:
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+cleanup_fail:
+	munmap(data, data_len);
+	return NULL;
+}
+
+static int pack_matches_midx_name(struct packed_git *p, const char *idx_name)
+{
+	const char *base = strrchr(p->pack_name, '/');
+	size_t len;
+
+	base = base ? base + 1 : p->pack_name;
+	if (!strip_suffix(base, ".pack", &len))
+		return 0;
+	return !strncmp(base, idx_name, len) && !strcmp(idx_name + len, ".idx");
+}
+
+void prepare_multi_pack_index(void)
+{
+	struct multi_pack_index *m;
+	char *midx_name;
+	int enabled;
+	uint32_t i;
+
+	if (midx_prepared)
+		return;
+	midx_prepared = 1;
+
+	if (git_config_get_bool("core.multipackindex", &enabled) || !enabled)
+		return;
+
+	midx_name = get_midx_filename(get_object_directory());
+	m = load_multi_pack_index(midx_name);
+	free(midx_name);
+	if (!m)
+		return;
+
+	for (i = 0; i < m->num_packs; i++) {
+		struct packed_git *p;
+
+		for (p = packed_git; p; p = p->next)
+			if (p->pack_local && pack_matches_midx_name(p, m->pack_names[i]))
+				break;
+		if (!p) {
+			/* a pack went away since it was written; ignore it */
+			close_midx(m);
+			return;
+		}
+		m->packs[i] = p;
+	}
+
+	for (i = 0; i < m->num_packs; i++)
+		m->packs[i]->multi_pack_index = 1;
+	midx = m;
+}
+
+static int bsearch_midx(struct multi_pack_index *m, const unsigned char *sha1,
+			uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? get_be32(m->chunk_oid_fanout + 4 * (sha1[0] - 1)) : 0;
+	hi = get_be32(m->chunk_oid_fanout + 4 * sha1[0]);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, m->chunk_oid_lookup + MIDX_OID_LEN * mi);
+
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+{
+	const unsigned char *offset_data;
+	uint32_t offset32;
+
+	offset_data = m->chunk_object_offsets + (size_t)pos * MIDX_OFFSET_WIDTH;
+	offset32 = get_be32(offset_data + 4);
+
+	if (m->chunk_large_offsets && offset32 & MIDX_LARGE_OFFSET_NEEDED) {
+		if (sizeof(off_t) < sizeof(uint64_t))
+			die(_("multi-pack-index stores a 64-bit offset, but off_t is too small"));
+
+		offset32 ^= MIDX_LARGE_OFFSET_NEEDED;
+		return get_be64(m->chunk_large_offsets + sizeof(uint64_t) * offset32);
+	}
+
+	return offset32;
+}
+
+int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e)
+{
+	struct packed_git *p;
+	uint32_t pos, pack_int_id;
+
+	if (!midx || !bsearch_midx(midx, sha1, &pos))
+		return 0;
+
+	pack_int_id = get_be32(midx->chunk_object_offsets +
+			       (size_t)pos * MIDX_OFFSET_WIDTH);
+	if (pack_int_id >= midx->num_packs)
+		die(_("bad pack-int-id: %u (%u total packs)"),
+		    pack_int_id, midx->num_packs);
+	p = midx->packs[pack_int_id];
+
+	if (p->num_bad_objects) {
+		uint32_t i;
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+				return -1;
+	}
+
+	/*
+	 * As in fill_pack_entry(), make sure the pack is still there
+	 * before telling the caller to look in it.
+	 */
+	if (!is_pack_valid(p))
+		return -1;
+
+	e->offset = nth_midxed_offset(midx, pos);
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
+/*
+ * Writing
+ */
+
+struct midx_pack {
+	struct packed_git *p;
+	char *idx_name;
+};
+
+struct midx_entry {
+	unsigned char sha1[MIDX_OID_LEN];
+	uint32_t pack_int_id;
+	time_t pack_mtime;
+	off_t offset;
+};
+
+static int midx_pack_cmp(const void *a_, const void *b_)
+{
+	const struct midx_pack *a = a_, *b = b_;
+	return strcmp(a->idx_name, b->idx_name);
+}
+
+/*
+ * Sort by object name; among duplicates, prefer the youngest pack as
+ * find_pack_entry() would (see sort_pack() in sha1_file.c).
+ */
+static int midx_entry_cmp(const void *a_, const void *b_)
+{
+	const struct midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	if (a->pack_mtime > b->pack_mtime)
+		return -1;
+	if (a->pack_mtime < b->pack_mtime)
+		return 1;
+	return a->pack_int_id < b->pack_int_id ? -1 :
+	       a->pack_int_id > b->pack_int_id;
+}
+
+static void collect_packs(const char *obj_dir, struct midx_pack **packs_p,
+			  uint32_t *nr_p)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct midx_pack *packs = NULL;
+	uint32_t nr = 0, alloc = 0;
+	size_t dirlen;
+	struct dirent *de;
+	DIR *dir;
+
+	strbuf_addf(&path, "%s/pack", obj_dir);
+	dir = opendir(path.buf);
+	if (!dir) {
+		if (errno != ENOENT)
+			error("unable to open object pack directory: %s: %s",
+			      path.buf, strerror(errno));
+		strbuf_release(&path);
+		*packs_p = NULL;
+		*nr_p = 0;
+		return;
+	}
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+
+	while ((de = readdir(dir)) != NULL) {
+		struct packed_git *p;
+
+		if (!ends_with(de->d_name, ".idx"))
+			continue;
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+
+		p = add_packed_git(path.buf, path.len, 1);
+		if (!p)
+			continue;
+		if (open_pack_index(p)) {
+			warning("failed to open pack-index '%s'", path.buf);
+			free(p);
+			continue;
+		}
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr].p = p;
+		packs[nr].idx_name = xstrdup(de->d_name);
+		nr++;
+	}
+	closedir(dir);
+	strbuf_release(&path);
+
+	qsort(packs, nr, sizeof(*packs), midx_pack_cmp);
+	*packs_p = packs;
+	*nr_p = nr;
+}
+
+static void write_midx_chunk_pack_names(struct sha1file *f,
+					struct midx_pack *packs, uint32_t nr,
+					size_t padding)
+{
+	static const unsigned char zeroes[4];
+	uint32_t i;
+
+	for (i = 0; i < nr; i++)
+		sha1write(f, packs[i].idx_name, strlen(packs[i].idx_name) + 1);
+	sha1write(f, zeroes, padding);
+}
+
+static void write_midx_chunk_fanout(struct sha1file *f,
+				    struct midx_entry *entries, uint32_t nr)
+{
+	uint32_t count = 0;
+	int byte;
+
+	for (byte = 0; byte < 256; byte++) {
+		while (count < nr && entries[count].sha1[0] == byte)
+			count++;
+		sha1write_be32(f, count);
+	}
+}
+
+int write_midx_file(const char *obj_dir)
+{
+	static char tmp_file[PATH_MAX];
+	struct midx_pack *packs;
+	struct midx_entry *entries;
+	uint32_t nr_packs, nr_entries, nr_large_offsets = 0, i, j;
+	uint32_t chunk_ids[MIDX_MAX_CHUNKS + 1];
+	uint64_t chunk_offsets[MIDX_MAX_CHUNKS + 1];
+	size_t pack_names_len = 0, padding;
+	unsigned num_chunks;
+	struct sha1file *f;
+	char *midx_name;
+	int fd;
+
+	collect_packs(obj_dir, &packs, &nr_packs);
+
+	for (i = nr_entries = 0; i < nr_packs; i++) {
+		if (nr_entries + packs[i].p->num_objects < nr_entries)
+			die(_("too many objects for a multi-pack-index"));
+		nr_entries += packs[i].p->num_objects;
+		pack_names_len += strlen(packs[i].idx_name) + 1;
+	}
+	padding = (4 - pack_names_len % 4) % 4;
+
+	entries = xcalloc(nr_entries ? nr_entries : 1, sizeof(*entries));
+	for (i = nr_entries = 0; i < nr_packs; i++) {
+		struct packed_git *p = packs[i].p;
+		for (j = 0; j < p->num_objects; j++) {
+			struct midx_entry *e = &entries[nr_entries++];
+			hashcpy(e->sha1, nth_packed_object_sha1(p, j));
+			e->offset = nth_packed_object_offset(p, j);
+			e->pack_int_id = i;
+			e->pack_mtime = p->mtime;
+		}
+	}
+	qsort(entries, nr_entries, sizeof(*entries), midx_entry_cmp);
+
+	/* keep only the preferred copy of each object */
+	for (i = j = 0; i < nr_entries; i++) {
+		if (j && !hashcmp(entries[j - 1].sha1, entries[i].sha1))
+			continue;
+		entries[j++] = entries[i];
+	}
+	nr_entries = j;
+
+	for (i = 0; i < nr_entries; i++)
+		if (entries[i].offset > 0x7fffffff)
+			nr_large_offsets++;
+
+	num_chunks = nr_large_offsets ? 5 : 4;
+	chunk_ids[0] = MIDX_CHUNKID_PACKNAMES;
+	chunk_ids[1] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_ids[2] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_ids[3] = MIDX_CHUNKID_OBJECTOFFSETS;
+	chunk_ids[4] = MIDX_CHUNKID_LARGEOFFSETS;
+	chunk_ids[num_chunks] = 0;
+
+	chunk_offsets[0] = MIDX_HEADER_SIZE + (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + pack_names_len + padding;
+	chunk_offsets[2] = chunk_offsets[1] + MIDX_FANOUT_SIZE;
+	chunk_offsets[3] = chunk_offsets[2] + (uint64_t)nr_entries * MIDX_OID_LEN;
+	chunk_offsets[4] = chunk_offsets[3] + (uint64_t)nr_entries * MIDX_OFFSET_WIDTH;
+	chunk_offsets[5] = chunk_offsets[4] + (uint64_t)nr_large_offsets * 8;
+
+	fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_midx_XXXXXX");
+	if (fd < 0)
+		die_errno("unable to create '%s'", tmp_file);
+	f = sha1fd(fd, tmp_file);
+
+	sha1write_be32(f, MIDX_SIGNATURE);
+	sha1write_u8(f, MIDX_VERSION);
+	sha1write_u8(f, MIDX_OID_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* number of base multi-pack-index files */
+	sha1write_be32(f, nr_packs);
+
+	for (i = 0; i <= num_chunks; i++) {
+		sha1write_be32(f, chunk_ids[i]);
+		sha1write_be32(f, (uint32_t)(chunk_offsets[i] >> 32));
+		sha1write_be32(f, (uint32_t)chunk_offsets[i]);
+	}
+
+	write_midx_chunk_pack_names(f, packs, nr_packs, padding);
+	write_midx_chunk_fanout(f, entries, nr_entries);
+	for (i = 0; i < nr_entries; i++)
+		sha1write(f, entries[i].sha1, MIDX_OID_LEN);
+	for (i = j = 0; i < nr_entries; i++) {
+		sha1write_be32(f, entries[i].pack_int_id);
+		if (entries[i].offset > 0x7fffffff)
+			sha1write_be32(f, MIDX_LARGE_OFFSET_NEEDED | j++);
+		else
+			sha1write_be32(f, (uint32_t)entries[i].offset);
+	}
+	for (i = 0; i < nr_entries; i++) {
+		uint64_t offset = entries[i].offset;
+		if (offset <= 0x7fffffff)
+			continue;
+		sha1write_be32(f, (uint32_t)(offset >> 32));
+		sha1write_be32(f, (uint32_t)offset);
+	}
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	midx_name = get_midx_filename(obj_dir);
+	if (adjust_shared_perm(tmp_file))
+		die_errno("unable to make temporary multi-pack-index readable");
+	if (rename(tmp_file, midx_name))
+		die_errno("unable to rename temporary multi-pack-index to '%s'",
+			  midx_name);
+	free(midx_name);
+
+	for (i = 0; i < nr_packs; i++) {
+		close_pack_index(packs[i].p);
+		free(packs[i].p);
+		free(packs[i].idx_name);
+	}
+	free(packs);
+	free(entries);
+	return 0;
+}
+
+void clear_midx_file(const char *obj_dir)
+{
+	char *midx_name = get_midx_filename(obj_dir);
+
+	if (unlink(midx_name) && errno != ENOENT)
+		warning("failed to remove %s: %s", midx_name, strerror(errno));
+	free(midx_name);
+}
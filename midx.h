@@ -0,0 +1,84 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+/*
+ * The multi-pack-index ($GIT_OBJECT_DIRECTORY/pack/multi-pack-index)
+ * maps every object in the local packs to the pack holding it and
+ * its offset there, so that a lookup is a single binary search no
+ * matter how many packs there are.  See
+ * Documentation/technical/multi-pack-index.txt for the layout.
+ */
+
+struct pack_entry;
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_OID_VERSION 1 /* SHA-1 */
+#define MIDX_OID_LEN 20
+
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+struct multi_pack_index {
+	unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	const unsigned char *chunk_pack_names;
+	const unsigned char *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+
+	const char **pack_names;
+	struct packed_git **packs;
+};
+
+/*
+ * Return the path of the multi-pack-index for the given object
+ * directory.  The result must be freed by the caller.
+ */
+extern char *get_midx_filename(const char *obj_dir);
+
+/*
+ * Map and validate the multi-pack-index at "midx_file".  Returns NULL
+ * (after reporting an error, unless the file does not exist) if it
+ * cannot be used.
+ */
+extern struct multi_pack_index *load_multi_pack_index(const char *midx_file);
+extern void close_midx(struct multi_pack_index *m);
+
+/*
+ * Called by prepare_packed_git() once the local packs are known.  If
+ * core.multiPackIndex is enabled and every pack named by the
+ * multi-pack-index is present, the packs are marked with
+ * "multi_pack_index" so that lookups skip their own .idx files.
+ */
+extern void prepare_multi_pack_index(void);
+
+/*
+ * Look up "sha1" in the multi-pack-index.  Returns 1 and fills "e" if
+ * it was found in a usable pack, 0 if the object is not covered by
+ * the multi-pack-index, and -1 if it is but its pack cannot be used,
+ * in which case the caller must search every pack.
+ */
+extern int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e);
+
+/*
+ * Write a multi-pack-index covering every pack in the object directory
+ * "obj_dir", replacing any existing one.
+ */
+extern int write_midx_file(const char *obj_dir);
+
+/* Remove the multi-pack-index of "obj_dir", if any. */
+extern void clear_midx_file(const char *obj_dir);
+
+#endif
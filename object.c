@@ -160,8 +160,11 @@ void *object_as_type(struct object *obj, enum object_type type, int quiet)
 	if (obj->type == type)
 		return obj;
 	else if (obj->type == OBJ_NONE) {
-		if (type == OBJ_COMMIT)
+		if (type == OBJ_COMMIT) {
 			((struct commit *)obj)->index = alloc_commit_index();
+			((struct commit *)obj)->graph_pos = COMMIT_NOT_FROM_GRAPH;
+			((struct commit *)obj)->generation = GENERATION_NUMBER_INFINITY;
+		}
 		obj->type = type;
 		return obj;
 	}
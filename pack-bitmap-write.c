@@ -18,6 +18,7 @@ struct bitmapped_commit {
 	int flags;
 	int xor_offset;
 	uint32_t commit_pos;
+	off_t offset; /* of its entry in the .bitmap */
 };
 
 struct bitmap_writer {
@@ -479,6 +480,8 @@ static void write_selected_commits_v1(struct sha1file *f,
 		if (commit_pos < 0)
 			die("BUG: trying to write commit not in index");
 
+		stored->commit_pos = commit_pos;
+		stored->offset = f->total + f->offset;
 		sha1write_be32(f, commit_pos);
 		sha1write_u8(f, stored->xor_offset);
 		sha1write_u8(f, stored->flags);
@@ -487,6 +490,49 @@ static void write_selected_commits_v1(struct sha1file *f,
 	}
 }
 
+static int lookup_table_cmp(const void *a_, const void *b_)
+{
+	uint32_t a = writer.selected[*(const uint32_t *)a_].commit_pos;
+	uint32_t b = writer.selected[*(const uint32_t *)b_].commit_pos;
+
+	return (a < b) ? -1 : (a != b);
+}
+
+/*
+ * Write a row for each selected commit, in the order of the commits in
+ * the .idx, so that readers can find a bitmap without reading all
+ * of them; see BITMAP_LOOKUP_ROW_SIZE.
+ */
+static void write_lookup_table(struct sha1file *f)
+{
+	uint32_t *entry_at_row = xmalloc(writer.selected_nr * sizeof(uint32_t));
+	uint32_t *row_of_entry = xmalloc(writer.selected_nr * sizeof(uint32_t));
+	uint32_t i;
+
+	for (i = 0; i < writer.selected_nr; i++)
+		entry_at_row[i] = i;
+	qsort(entry_at_row, writer.selected_nr, sizeof(uint32_t),
+	      lookup_table_cmp);
+	for (i = 0; i < writer.selected_nr; i++)
+		row_of_entry[entry_at_row[i]] = i;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		uint32_t entry = entry_at_row[i];
+		struct bitmapped_commit *stored = &writer.selected[entry];
+		unsigned char offset[8];
+
+		put_be64(offset, stored->offset);
+		sha1write_be32(f, stored->commit_pos);
+		sha1write(f, offset, sizeof(offset));
+		sha1write_be32(f, stored->xor_offset ?
+			       row_of_entry[entry - stored->xor_offset] :
+			       BITMAP_LOOKUP_NO_XOR);
+	}
+
+	free(entry_at_row);
+	free(row_of_entry);
+}
+
 static void write_hash_cache(struct sha1file *f,
 			     struct pack_idx_entry **index,
 			     uint32_t index_nr)
@@ -536,6 +582,9 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	dump_bitmap(f, writer.tags);
 	write_selected_commits_v1(f, index, index_nr);
 
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f);
+
 	if (options & BITMAP_OPT_HASH_CACHE)
 		write_hash_cache(f, index, index_nr);
 
@@ -5,6 +5,7 @@
 #include "revision.h"
 #include "progress.h"
 #include "list-objects.h"
+#include "list-objects-filter.h"
 #include "pack.h"
 #include "pack-bitmap.h"
 #include "pack-revindex.h"
@@ -33,9 +34,6 @@ static struct bitmap_index {
 	/* Packfile to which this bitmap index belongs to */
 	struct packed_git *pack;
 
-	/* reverse index for the packfile */
-	struct pack_revindex *reverse_index;
-
 	/*
 	 * Mark the first `reuse_objects` in the packfile as reused:
 	 * they will be sent as-is without using them for repacking
@@ -60,9 +58,15 @@ static struct bitmap_index {
 	struct ewah_bitmap *blobs;
 	struct ewah_bitmap *tags;
 
-	/* Map from SHA1 -> `stored_bitmap` for all the bitmapped commits */
+	/*
+	 * Map from SHA1 -> `stored_bitmap` for the bitmapped commits: all
+	 * of them, or with a lookup table, those read so far
+	 */
 	khash_sha1 *bitmaps;
 
+	/* The lookup table (BITMAP_OPT_LOOKUP_TABLE), or NULL */
+	const unsigned char *table;
+
 	/* Number of bitmapped commits */
 	uint32_t entry_count;
 
@@ -156,13 +160,27 @@ static int load_bitmap_header(struct bitmap_index *index)
 			return error("Unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
+		index->entry_count = ntohl(header->entry_count);
+
 		if (flags & BITMAP_OPT_HASH_CACHE) {
 			unsigned char *end = index->map + index->map_size - 20;
 			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
 		}
+
+		if (flags & BITMAP_OPT_LOOKUP_TABLE) {
+			size_t table_size = (size_t)index->entry_count *
+					    BITMAP_LOOKUP_ROW_SIZE;
+			size_t end = index->map_size - 20;
+
+			if (flags & BITMAP_OPT_HASH_CACHE)
+				end -= (size_t)index->pack->num_objects * 4;
+			if (end < sizeof(*header) + table_size ||
+			    end > index->map_size)
+				return error("Corrupted bitmap index file (lookup table too large)");
+			index->table = index->map + end - table_size;
+		}
 	}
 
-	index->entry_count = ntohl(header->entry_count);
 	index->map_pos += sizeof(*header);
 	return 0;
 }
@@ -250,6 +268,161 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	return 0;
 }
 
+/*
+ * With a lookup table, the bitmaps of the commits are not read when
+ * the index is loaded, but the first time they are asked for.  The
+ * rows of the table are sorted by the .idx position of their commits,
+ * that is by object name.
+ */
+static const unsigned char *lookup_table_row(struct bitmap_index *index,
+					     uint32_t row)
+{
+	return index->table + (size_t)row * BITMAP_LOOKUP_ROW_SIZE;
+}
+
+static const unsigned char *lookup_table_sha1(struct bitmap_index *index,
+					      uint32_t row)
+{
+	uint32_t commit_idx_pos = get_be32(lookup_table_row(index, row));
+
+	if (commit_idx_pos >= index->pack->num_objects) {
+		error("Corrupted bitmap lookup table");
+		return NULL;
+	}
+	return nth_packed_object_sha1(index->pack, commit_idx_pos);
+}
+
+static int find_lookup_table_row(struct bitmap_index *index,
+				 const unsigned char *sha1, uint32_t *row)
+{
+	uint32_t lo = 0, hi = index->entry_count;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *mi_sha1 = lookup_table_sha1(index, mi);
+		int cmp;
+
+		if (!mi_sha1)
+			return -1;
+		cmp = hashcmp(sha1, mi_sha1);
+		if (!cmp) {
+			*row = mi;
+			return 0;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+/*
+ * Read the bitmap in the given row of the lookup table, and the ones
+ * it is xor'ed with that have not been read yet.
+ */
+static struct stored_bitmap *load_lookup_table_row(struct bitmap_index *index,
+						   uint32_t row)
+{
+	uint32_t *chain = NULL;
+	int nr = 0, alloc = 0;
+	struct stored_bitmap *xor_bitmap = NULL;
+
+	/* follow the xor chain down to a bitmap we have or a plain one */
+	for (;;) {
+		const unsigned char *sha1 = lookup_table_sha1(index, row);
+		khiter_t hash_pos;
+		uint32_t xor_row;
+
+		if (!sha1)
+			goto fail;
+		hash_pos = kh_get_sha1(index->bitmaps, sha1);
+		if (hash_pos < kh_end(index->bitmaps)) {
+			xor_bitmap = kh_value(index->bitmaps, hash_pos);
+			break;
+		}
+
+		ALLOC_GROW(chain, nr + 1, alloc);
+		chain[nr++] = row;
+
+		xor_row = get_be32(lookup_table_row(index, row) + 12);
+		if (xor_row == BITMAP_LOOKUP_NO_XOR)
+			break;
+		if (xor_row >= index->entry_count || nr > index->entry_count) {
+			error("Corrupted bitmap lookup table");
+			goto fail;
+		}
+		row = xor_row;
+	}
+
+	while (nr) {
+		const unsigned char *r = lookup_table_row(index, chain[--nr]);
+		uint64_t offset = get_be64(r + 4);
+		struct ewah_bitmap *bitmap;
+		int flags;
+
+		if (offset > index->map_size - 6) {
+			error("Corrupted bitmap lookup table");
+			goto fail;
+		}
+		index->map_pos = offset;
+		if (read_be32(index->map, &index->map_pos) != get_be32(r)) {
+			error("Corrupted bitmap lookup table");
+			goto fail;
+		}
+		read_u8(index->map, &index->map_pos); /* xor offset */
+		flags = read_u8(index->map, &index->map_pos);
+
+		bitmap = read_bitmap_1(index);
+		if (!bitmap)
+			goto fail;
+		xor_bitmap = store_bitmap(index, bitmap,
+					  lookup_table_sha1(index, chain[nr]),
+					  xor_bitmap, flags);
+		if (!xor_bitmap)
+			goto fail;
+	}
+
+	free(chain);
+	return xor_bitmap;
+
+fail:
+	free(chain);
+	return NULL;
+}
+
+/* Read every bitmap that is still only in the lookup table. */
+static int load_all_lookup_table_rows(struct bitmap_index *index)
+{
+	uint32_t row;
+
+	for (row = 0; row < index->entry_count; row++) {
+		const unsigned char *sha1 = lookup_table_sha1(index, row);
+
+		if (!sha1)
+			return -1;
+		if (kh_get_sha1(index->bitmaps, sha1) < kh_end(index->bitmaps))
+			continue;
+		if (!load_lookup_table_row(index, row))
+			return -1;
+	}
+	return 0;
+}
+
+/* The stored bitmap of a commit, or NULL if it has none. */
+static struct stored_bitmap *find_stored_bitmap(const unsigned char *sha1)
+{
+	khiter_t hash_pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
+	uint32_t row;
+
+	if (hash_pos < kh_end(bitmap_git.bitmaps))
+		return kh_value(bitmap_git.bitmaps, hash_pos);
+	if (!bitmap_git.table ||
+	    find_lookup_table_row(&bitmap_git, sha1, &row))
+		return NULL;
+	return load_lookup_table_row(&bitmap_git, row);
+}
+
 static char *pack_bitmap_filename(struct packed_git *p)
 {
 	char *idx_name;
@@ -313,7 +486,8 @@ static int load_pack_bitmap(void)
 
 	bitmap_git.bitmaps = kh_init_sha1();
 	bitmap_git.ext_index.positions = kh_init_sha1_pos();
-	bitmap_git.reverse_index = revindex_for_pack(bitmap_git.pack);
+	if (load_pack_revindex(bitmap_git.pack))
+		goto failed;
 
 	if (!(bitmap_git.commits = read_bitmap_1(&bitmap_git)) ||
 		!(bitmap_git.trees = read_bitmap_1(&bitmap_git)) ||
@@ -321,7 +495,7 @@ static int load_pack_bitmap(void)
 		!(bitmap_git.tags = read_bitmap_1(&bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(&bitmap_git) < 0)
+	if (!bitmap_git.table && load_bitmap_entries_v1(&bitmap_git) < 0)
 		goto failed;
 
 	bitmap_git.loaded = 1;
@@ -382,10 +556,12 @@ static inline int bitmap_position_extended(const unsigned char *sha1)
 static inline int bitmap_position_packfile(const unsigned char *sha1)
 {
 	off_t offset = find_pack_entry_one(sha1, bitmap_git.pack);
-	if (!offset)
+	uint32_t pos;
+
+	if (!offset || offset_to_pack_pos(bitmap_git.pack, offset, &pos) < 0)
 		return -1;
 
-	return find_revindex_position(bitmap_git.reverse_index, offset);
+	return pos;
 }
 
 static int bitmap_position(const unsigned char *sha1)
@@ -447,7 +623,7 @@ static int add_to_include_set(struct include_data *data,
 			      const unsigned char *sha1,
 			      int bitmap_pos)
 {
-	khiter_t hash_pos;
+	struct stored_bitmap *st;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -455,9 +631,8 @@ static int add_to_include_set(struct include_data *data,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	hash_pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
-	if (hash_pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, hash_pos);
+	st = find_stored_bitmap(sha1);
+	if (st) {
 		bitmap_or_ewah(data->base, lookup_stored_bitmap(st));
 		return 0;
 	}
@@ -511,10 +686,9 @@ static struct bitmap *find_objects(struct rev_info *revs,
 		roots = roots->next;
 
 		if (object->type == OBJ_COMMIT) {
-			khiter_t pos = kh_get_sha1(bitmap_git.bitmaps, object->sha1);
+			struct stored_bitmap *st = find_stored_bitmap(object->sha1);
 
-			if (pos < kh_end(bitmap_git.bitmaps)) {
-				struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
+			if (st) {
 				struct ewah_bitmap *or_with = lookup_stored_bitmap(st);
 
 				if (base == NULL)
@@ -624,7 +798,7 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			const unsigned char *sha1;
-			struct revindex_entry *entry;
+			uint32_t index_pos;
 			uint32_t hash = 0;
 
 			if ((word >> offset) == 0)
@@ -635,13 +809,14 @@ static void show_objects_for_type(
 			if (pos + offset < bitmap_git.reuse_objects)
 				continue;
 
-			entry = &bitmap_git.reverse_index->revindex[pos + offset];
-			sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+			index_pos = pack_pos_to_index(bitmap_git.pack, pos + offset);
+			sha1 = nth_packed_object_sha1(bitmap_git.pack, index_pos);
 
 			if (bitmap_git.hashes)
-				hash = ntohl(bitmap_git.hashes[entry->nr]);
+				hash = ntohl(bitmap_git.hashes[index_pos]);
 
-			show_reach(sha1, object_type, 0, hash, bitmap_git.pack, entry->offset);
+			show_reach(sha1, object_type, 0, hash, bitmap_git.pack,
+				   pack_pos_to_offset(bitmap_git.pack, pos + offset));
 		}
 
 		pos += BITS_IN_EWORD;
@@ -662,7 +837,63 @@ static int in_bitmapped_pack(struct object_list *roots)
 	return 0;
 }
 
-int prepare_bitmap_walk(struct rev_info *revs)
+/*
+ * Clear the bits of the blobs the filter omits from the result, but
+ * keep the blobs that were asked for by name.
+ */
+static void filter_bitmap_blobs(struct bitmap *objects,
+				const struct list_objects_filter_options *filter,
+				struct object_list *wants)
+{
+	struct eindex *eindex = &bitmap_git.ext_index;
+	struct ewah_iterator it;
+	eword_t mask;
+	size_t pos = 0, i = 0;
+	uint32_t offset;
+
+	ewah_iterator_init(&it, bitmap_git.blobs);
+
+	while (i < objects->word_alloc && ewah_iterator_next(&mask, &it)) {
+		eword_t word = objects->words[i] & mask;
+
+		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
+			uint32_t index_pos;
+
+			if ((word >> offset) == 0)
+				break;
+
+			offset += ewah_bit_ctz64(word >> offset);
+
+			index_pos = pack_pos_to_index(bitmap_git.pack, pos + offset);
+			if (list_objects_filter_omits_blob(filter,
+					nth_packed_object_sha1(bitmap_git.pack, index_pos), 1))
+				bitmap_clear(objects, pos + offset);
+		}
+
+		pos += BITS_IN_EWORD;
+		i++;
+	}
+
+	for (i = 0; i < eindex->count; ++i) {
+		struct object *obj = eindex->objects[i];
+
+		if (obj->type == OBJ_BLOB &&
+		    list_objects_filter_omits_blob(filter, obj->sha1, 1))
+			bitmap_clear(objects, bitmap_git.pack->num_objects + i);
+	}
+
+	for (; wants; wants = wants->next) {
+		if (wants->item->type == OBJ_BLOB) {
+			int bitmap_pos = bitmap_position(wants->item->sha1);
+
+			if (bitmap_pos >= 0)
+				bitmap_set(objects, bitmap_pos);
+		}
+	}
+}
+
+int prepare_bitmap_walk(struct rev_info *revs,
+			const struct list_objects_filter_options *filter)
 {
 	unsigned int i;
 	unsigned int pending_nr = revs->pending.nr;
@@ -681,6 +912,10 @@ int prepare_bitmap_walk(struct rev_info *revs)
 			return -1;
 	}
 
+	/* the bitmaps do not know how deep in a tree an object is */
+	if (filter && filter->choice == LOFC_TREE_DEPTH)
+		return -1;
+
 	for (i = 0; i < pending_nr; ++i) {
 		struct object *object = pending_e[i].item;
 
@@ -748,6 +983,9 @@ int prepare_bitmap_walk(struct rev_info *revs)
 	if (haves_bitmap)
 		bitmap_and_not(wants_bitmap, haves_bitmap);
 
+	if (filter && filter->choice)
+		filter_bitmap_blobs(wants_bitmap, filter, wants);
+
 	bitmap_git.result = wants_bitmap;
 
 	bitmap_free(haves_bitmap);
@@ -782,10 +1020,9 @@ int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
 #ifdef GIT_BITMAP_DEBUG
 	{
 		const unsigned char *sha1;
-		struct revindex_entry *entry;
 
-		entry = &bitmap_git.reverse_index->revindex[reuse_objects];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		sha1 = nth_packed_object_sha1(bitmap_git.pack,
+				pack_pos_to_index(bitmap_git.pack, reuse_objects));
 
 		fprintf(stderr, "Failed to reuse at %d (%016llx)\n",
 			reuse_objects, result->words[i]);
@@ -809,7 +1046,7 @@ int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
 		return -1;
 
 	bitmap_git.reuse_objects = *entries = reuse_objects;
-	*up_to = bitmap_git.reverse_index->revindex[reuse_objects].offset;
+	*up_to = pack_pos_to_offset(bitmap_git.pack, reuse_objects);
 	*packfile = bitmap_git.pack;
 
 	return 0;
@@ -839,35 +1076,31 @@ static uint32_t count_object_type(struct bitmap *objects,
 {
 	struct eindex *eindex = &bitmap_git.ext_index;
 
-	uint32_t i = 0, count = 0;
-	struct ewah_iterator it;
-	eword_t filter;
+	uint32_t i, count;
+	struct ewah_bitmap *filter;
 
 	switch (type) {
 	case OBJ_COMMIT:
-		ewah_iterator_init(&it, bitmap_git.commits);
+		filter = bitmap_git.commits;
 		break;
 
 	case OBJ_TREE:
-		ewah_iterator_init(&it, bitmap_git.trees);
+		filter = bitmap_git.trees;
 		break;
 
 	case OBJ_BLOB:
-		ewah_iterator_init(&it, bitmap_git.blobs);
+		filter = bitmap_git.blobs;
 		break;
 
 	case OBJ_TAG:
-		ewah_iterator_init(&it, bitmap_git.tags);
+		filter = bitmap_git.tags;
 		break;
 
 	default:
 		return 0;
 	}
 
-	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
-		eword_t word = objects->words[i++] & filter;
-		count += ewah_bit_popcount64(word);
-	}
+	count = bitmap_popcount_and_ewah(objects, filter);
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
@@ -934,7 +1167,7 @@ void test_bitmap_walk(struct rev_info *revs)
 {
 	struct object *root;
 	struct bitmap *result = NULL;
-	khiter_t pos;
+	struct stored_bitmap *st;
 	size_t result_popcnt;
 	struct bitmap_test_data tdata;
 
@@ -948,10 +1181,9 @@ void test_bitmap_walk(struct rev_info *revs)
 		bitmap_git.version, bitmap_git.entry_count);
 
 	root = revs->pending.objects[0].item;
-	pos = kh_get_sha1(bitmap_git.bitmaps, root->sha1);
+	st = find_stored_bitmap(root->sha1);
 
-	if (pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
+	if (st) {
 		struct ewah_bitmap *bm = lookup_stored_bitmap(st);
 
 		fprintf(stderr, "Found bitmap for %s. %d bits / %08x checksum\n",
@@ -1034,17 +1266,18 @@ int rebuild_existing_bitmaps(struct packing_data *mapping,
 
 	if (prepare_bitmap_git() < 0)
 		return -1;
+	if (bitmap_git.table && load_all_lookup_table_rows(&bitmap_git) < 0)
+		return -1;
 
 	num_objects = bitmap_git.pack->num_objects;
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		const unsigned char *sha1;
-		struct revindex_entry *entry;
 		struct object_entry *oe;
 
-		entry = &bitmap_git.reverse_index->revindex[i];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		sha1 = nth_packed_object_sha1(bitmap_git.pack,
+				pack_pos_to_index(bitmap_git.pack, i));
 		oe = packlist_find(mapping, sha1, NULL);
 
 		if (oe)
@@ -20,8 +20,17 @@ static const char BITMAP_IDX_SIGNATURE[] = {'B', 'I', 'T', 'M'};
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_LOOKUP_TABLE = 16,
 };
 
+/*
+ * A row of the lookup table: the .idx position of the commit, the
+ * offset of its entry in the .bitmap and the row of the bitmap it is
+ * xor'ed with (or BITMAP_LOOKUP_NO_XOR).
+ */
+#define BITMAP_LOOKUP_ROW_SIZE (4 + 8 + 4)
+#define BITMAP_LOOKUP_NO_XOR 0xffffffff
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
@@ -38,7 +47,9 @@ int prepare_bitmap_git(void);
 void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees, uint32_t *blobs, uint32_t *tags);
 void traverse_bitmap_commit_list(show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
-int prepare_bitmap_walk(struct rev_info *revs);
+struct list_objects_filter_options;
+int prepare_bitmap_walk(struct rev_info *revs,
+			const struct list_objects_filter_options *filter);
 int reuse_partial_packfile_from_bitmap(struct packed_git **packfile, uint32_t *entries, off_t *up_to);
 int rebuild_existing_bitmaps(struct packing_data *mapping, khash_sha1 *reused_bitmaps, int show_progress);
 
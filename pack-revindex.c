@@ -8,52 +8,15 @@
  * size is easily available by examining the pack entry header).  It is
  * also rather expensive to find the sha1 for an object given its offset.
  *
- * We build a hashtable of existing packs (pack_revindex), and keep reverse
- * index here -- pack index file is sorted by object name mapping to offset;
- * this pack_revindex[].revindex array is a list of offset/index_nr pairs
- * ordered by offset, so if you know the offset of an object, next offset
- * is where its packed representation ends and the index_nr can be used to
- * get the object sha1 from the main index.
+ * The reverse index is the list of objects ordered by offset, so if you
+ * know the offset of an object, next offset is where its packed
+ * representation ends and the index_nr can be used to get the object
+ * sha1 from the main index.  It is either read from the ".rev" file
+ * that pack-objects and index-pack write next to the pack, which lists
+ * the index_nr of each object, or built in memory (p->revindex) as a
+ * list of offset/index_nr pairs.
  */
 
-static struct pack_revindex *pack_revindex;
-static int pack_revindex_hashsz;
-
-static int pack_revindex_ix(struct packed_git *p)
-{
-	unsigned long ui = (unsigned long)p;
-	int i;
-
-	ui = ui ^ (ui >> 16); /* defeat structure alignment */
-	i = (int)(ui % pack_revindex_hashsz);
-	while (pack_revindex[i].p) {
-		if (pack_revindex[i].p == p)
-			return i;
-		if (++i == pack_revindex_hashsz)
-			i = 0;
-	}
-	return -1 - i;
-}
-
-static void init_pack_revindex(void)
-{
-	int num;
-	struct packed_git *p;
-
-	for (num = 0, p = packed_git; p; p = p->next)
-		num++;
-	if (!num)
-		return;
-	pack_revindex_hashsz = num * 11;
-	pack_revindex = xcalloc(pack_revindex_hashsz, sizeof(*pack_revindex));
-	for (p = packed_git; p; p = p->next) {
-		num = pack_revindex_ix(p);
-		num = - 1 - num;
-		pack_revindex[num].p = p;
-	}
-	/* revindex elements are lazily initialized */
-}
-
 /*
  * This is a least-significant-digit radix sort.
  *
@@ -154,14 +117,13 @@ static void sort_revindex(struct revindex_entry *entries, unsigned n, off_t max)
 /*
  * Ordered list of offsets of objects in the pack.
  */
-static void create_pack_revindex(struct pack_revindex *rix)
+static void create_pack_revindex(struct packed_git *p)
 {
-	struct packed_git *p = rix->p;
 	unsigned num_ent = p->num_objects;
 	unsigned i;
 	const char *index = p->index_data;
 
-	rix->revindex = xmalloc(sizeof(*rix->revindex) * (num_ent + 1));
+	p->revindex = xmalloc(sizeof(*p->revindex) * (num_ent + 1));
 	index += 4 * 256;
 
 	if (p->index_version > 1) {
@@ -171,77 +133,168 @@ static void create_pack_revindex(struct pack_revindex *rix)
 		for (i = 0; i < num_ent; i++) {
 			uint32_t off = ntohl(*off_32++);
 			if (!(off & 0x80000000)) {
-				rix->revindex[i].offset = off;
+				p->revindex[i].offset = off;
 			} else {
-				rix->revindex[i].offset =
+				p->revindex[i].offset =
 					((uint64_t)ntohl(*off_64++)) << 32;
-				rix->revindex[i].offset |=
+				p->revindex[i].offset |=
 					ntohl(*off_64++);
 			}
-			rix->revindex[i].nr = i;
+			p->revindex[i].nr = i;
 		}
 	} else {
 		for (i = 0; i < num_ent; i++) {
 			uint32_t hl = *((uint32_t *)(index + 24 * i));
-			rix->revindex[i].offset = ntohl(hl);
-			rix->revindex[i].nr = i;
+			p->revindex[i].offset = ntohl(hl);
+			p->revindex[i].nr = i;
 		}
 	}
 
 	/* This knows the pack format -- the 20-byte trailer
 	 * follows immediately after the last object data.
 	 */
-	rix->revindex[num_ent].offset = p->pack_size - 20;
-	rix->revindex[num_ent].nr = -1;
-	sort_revindex(rix->revindex, num_ent, p->pack_size);
+	p->revindex[num_ent].offset = p->pack_size - 20;
+	p->revindex[num_ent].nr = -1;
+	sort_revindex(p->revindex, num_ent, p->pack_size);
 }
 
-struct pack_revindex *revindex_for_pack(struct packed_git *p)
+/*
+ * Map the ".rev" file of the pack, if there is one and pack.readReverseIndex
+ * does not say otherwise.  Returns 0 when it is used, 1 when there is
+ * none, and -1 (with an error) when it is unusable.
+ */
+static int load_revindex_from_disk(struct packed_git *p)
 {
-	int num;
-	struct pack_revindex *rix;
+	static int read_rev = -1;
+	struct strbuf name = STRBUF_INIT;
+	const uint32_t *hdr;
+	const unsigned char *pack_sha1;
+	void *map;
+	size_t len, map_size;
+	struct stat st;
+	int fd, ret = -1;
 
-	if (!pack_revindex_hashsz)
-		init_pack_revindex();
+	if (read_rev < 0 &&
+	    git_config_get_bool("pack.readreverseindex", &read_rev))
+		read_rev = 1;
+	if (!read_rev)
+		return 1;
 
-	num = pack_revindex_ix(p);
-	if (num < 0)
-		die("internal error: pack revindex fubar");
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		return 1;
+	strbuf_add(&name, p->pack_name, len);
+	strbuf_addstr(&name, ".rev");
 
-	rix = &pack_revindex[num];
-	if (!rix->revindex)
-		create_pack_revindex(rix);
+	fd = git_open_noatime(name.buf);
+	if (fd < 0) {
+		strbuf_release(&name);
+		return 1;
+	}
+	if (fstat(fd, &st)) {
+		error("cannot stat reverse index %s", name.buf);
+		close(fd);
+		goto out;
+	}
+	map_size = xsize_t(st.st_size);
+	if (map_size != 12 + (size_t)p->num_objects * 4 + 20 + 20) {
+		error("reverse index %s has the wrong size", name.buf);
+		close(fd);
+		goto out;
+	}
+	map = xmmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
 
-	return rix;
+	hdr = map;
+	pack_sha1 = (const unsigned char *)map + map_size - 40;
+	if (ntohl(hdr[0]) != RIDX_SIGNATURE) {
+		error("reverse index %s has a bad signature", name.buf);
+	} else if (ntohl(hdr[1]) != RIDX_VERSION || ntohl(hdr[2]) != 1) {
+		error("reverse index %s is version %"PRIu32
+		      " and is not supported by this binary",
+		      name.buf, ntohl(hdr[1]));
+	} else if (hashcmp(pack_sha1, (const unsigned char *)p->index_data +
+				      p->index_size - 40)) {
+		error("reverse index %s does not match its pack", name.buf);
+	} else {
+		p->revindex_map = map;
+		p->revindex_map_size = map_size;
+		p->revindex_data = hdr + 3;
+		ret = 0;
+	}
+	if (ret)
+		munmap(map, map_size);
+out:
+	strbuf_release(&name);
+	return ret;
 }
 
-int find_revindex_position(struct pack_revindex *pridx, off_t ofs)
+int load_pack_revindex(struct packed_git *p)
 {
-	int lo = 0;
-	int hi = pridx->p->num_objects + 1;
-	struct revindex_entry *revindex = pridx->revindex;
+	if (p->revindex || p->revindex_data)
+		return 0;
+	if (open_pack_index(p))
+		return -1;
+	if (load_revindex_from_disk(p))
+		create_pack_revindex(p);
+	return 0;
+}
 
-	do {
-		unsigned mi = lo + (hi - lo) / 2;
-		if (revindex[mi].offset == ofs) {
-			return mi;
-		} else if (ofs < revindex[mi].offset)
-			hi = mi;
-		else
-			lo = mi + 1;
-	} while (lo < hi);
+void close_pack_revindex(struct packed_git *p)
+{
+	free(p->revindex);
+	p->revindex = NULL;
+	if (p->revindex_map) {
+		munmap(p->revindex_map, p->revindex_map_size);
+		p->revindex_map = NULL;
+		p->revindex_data = NULL;
+	}
+}
+
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
+{
+	uint32_t nr;
+
+	if (load_pack_revindex(p))
+		die("cannot read the index of %s", p->pack_name);
+	if (p->revindex)
+		return p->revindex[pos].nr;
+	nr = ntohl(p->revindex_data[pos]);
+	if (nr >= p->num_objects)
+		die("reverse index of %s is corrupt", p->pack_name);
+	return nr;
+}
 
-	error("bad offset for revindex");
-	return -1;
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	if (load_pack_revindex(p))
+		die("cannot read the index of %s", p->pack_name);
+	if (p->revindex)
+		return p->revindex[pos].offset;
+	if (pos == p->num_objects)
+		return p->pack_size - 20;
+	return nth_packed_object_offset(p, pack_pos_to_index(p, pos));
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos)
 {
-	struct pack_revindex *pridx = revindex_for_pack(p);
-	int pos = find_revindex_position(pridx, ofs);
+	uint32_t lo = 0;
+	uint32_t hi = p->num_objects + 1;
+
+	if (load_pack_revindex(p))
+		return -1;
+
+	do {
+		uint32_t mi = lo + (hi - lo) / 2;
+		off_t mi_ofs = pack_pos_to_offset(p, mi);
 
-	if (pos < 0)
-		return NULL;
+		if (mi_ofs == ofs) {
+			*pos = mi;
+			return 0;
+		} else if (ofs < mi_ofs)
+			hi = mi;
+		else
+			lo = mi + 1;
+	} while (lo < hi);
 
-	return pridx->revindex + pos;
+	return error("bad offset for revindex");
 }
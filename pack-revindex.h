@@ -1,19 +1,53 @@
 #ifndef PACK_REVINDEX_H
 #define PACK_REVINDEX_H
 
+/*
+ * A pack's reverse index lists its objects in the order of their
+ * offsets in the pack.  The position of an object in that list is its
+ * "pack position"; the next position tells where its data ends.
+ *
+ * It is read from the ".rev" file next to the pack if there is one
+ * (see Documentation/technical/pack-format.txt), and otherwise built
+ * in memory the first time it is needed.
+ */
+
+#define RIDX_SIGNATURE 0x52494458 /* "RIDX" */
+#define RIDX_VERSION 1
+
+struct packed_git;
+
 struct revindex_entry {
 	off_t offset;
 	unsigned int nr;
 };
 
-struct pack_revindex {
-	struct packed_git *p;
-	struct revindex_entry *revindex;
-};
+/*
+ * Make the reverse index of the pack available.  Returns 0 on success,
+ * or -1 if the pack's index cannot be opened.
+ */
+int load_pack_revindex(struct packed_git *p);
+
+/* Release the reverse index; it is loaded again when needed. */
+void close_pack_revindex(struct packed_git *p);
+
+/*
+ * Find the pack position of the object at "ofs", which must be the
+ * start of an object, or the pack's trailer (position num_objects).
+ * Returns 0 and stores it in *pos, or -1 with an error.
+ */
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos);
 
-struct pack_revindex *revindex_for_pack(struct packed_git *p);
-int find_revindex_position(struct pack_revindex *pridx, off_t ofs);
+/*
+ * The position in the .idx of the object at pack position "pos",
+ * for nth_packed_object_sha1() and friends.  "pos" must be less than
+ * num_objects.
+ */
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * The offset of the object at pack position "pos"; position
+ * num_objects gives the offset of the pack's trailer.
+ */
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
 
 #endif
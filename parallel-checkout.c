@@ -0,0 +1,261 @@
+#include "cache.h"
+#include "parallel-checkout.h"
+#include "thread-utils.h"
+
+#ifdef NO_PTHREADS
+void init_parallel_checkout(unsigned int nr_entries)
+{
+	; /* nothing */
+}
+
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state)
+{
+	return -1;
+}
+
+int run_parallel_checkout(const struct checkout *state)
+{
+	return 0;
+}
+#else
+
+#include <pthread.h>
+
+#define DEFAULT_THRESHOLD_FOR_PARALLELISM 100
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/* the file appeared behind our back, e.g. a case collision */
+	PC_ITEM_COLLIDED,
+	PC_ITEM_READ_FAILED,
+	PC_ITEM_CREATE_FAILED,
+	PC_ITEM_WRITE_FAILED
+};
+
+struct pc_item {
+	struct cache_entry *ce;
+	struct conv_attrs ca;
+	enum pc_item_status status;
+	int saved_errno;
+	int st_valid;
+	struct stat st;
+};
+
+static struct parallel_checkout {
+	int active;
+	int num_workers;
+	struct pc_item *items;
+	int nr, alloc;
+	int next; /* the next item to hand out to a worker */
+} parallel_checkout;
+
+static pthread_mutex_t pc_next_mutex;
+static pthread_mutex_t pc_read_mutex;
+
+void init_parallel_checkout(unsigned int nr_entries)
+{
+	int num_workers = 1;
+	int threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+
+	if (parallel_checkout.active)
+		die("BUG: parallel checkout already initialized");
+
+	git_config_get_int("checkout.workers", &num_workers);
+	git_config_get_int("checkout.thresholdForParallelism", &threshold);
+	if (num_workers < 1)
+		num_workers = online_cpus();
+
+	if (num_workers < 2 || nr_entries < threshold)
+		return;
+
+	parallel_checkout.active = 1;
+	parallel_checkout.num_workers = num_workers;
+}
+
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state)
+{
+	struct pc_item *item;
+	struct conv_attrs ca;
+	unsigned long size;
+
+	if (!parallel_checkout.active)
+		return -1;
+
+	/*
+	 * The workers only write regular files under their own name,
+	 * slurping them in-core; anything else is done right away.
+	 */
+	if (!S_ISREG(ce->ce_mode) || state->base_dir_len)
+		return -1;
+	if (sha1_object_info(ce->sha1, &size) != OBJ_BLOB ||
+	    size > big_file_threshold)
+		return -1;
+
+	/*
+	 * Attribute lookup is not thread-safe, so it is done here;
+	 * filter drivers are run by the caller, too.
+	 */
+	convert_attrs(&ca, ce->name);
+	if (convert_uses_driver(&ca))
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+	item = &parallel_checkout.items[parallel_checkout.nr++];
+	memset(item, 0, sizeof(*item));
+	item->ce = ce;
+	item->ca = ca;
+	return 0;
+}
+
+static void write_pc_item(struct pc_item *item)
+{
+	struct cache_entry *ce = item->ce;
+	struct strbuf buf = STRBUF_INIT;
+	enum object_type type;
+	unsigned long size;
+	size_t newsize;
+	char *new;
+	int fd;
+
+	/* the object store is not thread-safe */
+	pthread_mutex_lock(&pc_read_mutex);
+	new = read_sha1_file(ce->sha1, &type, &size);
+	pthread_mutex_unlock(&pc_read_mutex);
+	if (!new || type != OBJ_BLOB) {
+		free(new);
+		item->status = PC_ITEM_READ_FAILED;
+		return;
+	}
+
+	if (convert_to_working_tree_ca(&item->ca, ce->name, new, size, &buf)) {
+		free(new);
+		new = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	fd = open(ce->name, O_WRONLY | O_CREAT | O_EXCL,
+		  (ce->ce_mode & 0100) ? 0777 : 0666);
+	if (fd < 0) {
+		item->saved_errno = errno;
+		item->status = errno == EEXIST ?
+			PC_ITEM_COLLIDED : PC_ITEM_CREATE_FAILED;
+		free(new);
+		return;
+	}
+
+	if (write_in_full(fd, new, size) != size) {
+		item->saved_errno = errno;
+		item->status = PC_ITEM_WRITE_FAILED;
+	} else {
+		item->status = PC_ITEM_WRITTEN;
+		item->st_valid = fstat_is_reliable() && !fstat(fd, &item->st);
+	}
+	close(fd);
+	free(new);
+
+	if (item->status == PC_ITEM_WRITTEN && !item->st_valid)
+		item->st_valid = !lstat(ce->name, &item->st);
+}
+
+static void *checkout_worker(void *unused)
+{
+	for (;;) {
+		struct pc_item *item;
+
+		pthread_mutex_lock(&pc_next_mutex);
+		if (parallel_checkout.next < parallel_checkout.nr)
+			item = &parallel_checkout.items[parallel_checkout.next++];
+		else
+			item = NULL;
+		pthread_mutex_unlock(&pc_next_mutex);
+
+		if (!item)
+			break;
+		write_pc_item(item);
+	}
+	return NULL;
+}
+
+static void run_workers(void)
+{
+	int i, nr_workers = parallel_checkout.num_workers;
+	pthread_t *workers;
+
+	if (nr_workers > parallel_checkout.nr)
+		nr_workers = parallel_checkout.nr;
+
+	pthread_mutex_init(&pc_next_mutex, NULL);
+	pthread_mutex_init(&pc_read_mutex, NULL);
+	workers = xcalloc(nr_workers, sizeof(*workers));
+	for (i = 0; i < nr_workers; i++) {
+		int err = pthread_create(&workers[i], NULL, checkout_worker, NULL);
+		if (err)
+			die(_("unable to create checkout thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < nr_workers; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	pthread_mutex_destroy(&pc_read_mutex);
+	pthread_mutex_destroy(&pc_next_mutex);
+}
+
+int run_parallel_checkout(const struct checkout *state)
+{
+	int i, errs = 0;
+
+	if (!parallel_checkout.active)
+		return 0;
+
+	if (parallel_checkout.nr)
+		run_workers();
+
+	/* anything that still needs writing is done serially */
+	parallel_checkout.active = 0;
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct pc_item *item = &parallel_checkout.items[i];
+		struct cache_entry *ce = item->ce;
+
+		switch (item->status) {
+		case PC_ITEM_WRITTEN:
+			if (!state->refresh_cache || !item->st_valid)
+				break;
+			fill_stat_cache_info(ce, &item->st);
+			ce->ce_flags |= CE_UPDATE_IN_BASE;
+			state->istate->cache_changed |= CE_ENTRY_CHANGED;
+			break;
+		case PC_ITEM_COLLIDED:
+			/*
+			 * Another entry was written to the same file
+			 * (e.g. on a case-insensitive filesystem); let
+			 * checkout_entry() sort it out, like it would
+			 * have without parallel checkout.
+			 */
+			errs |= checkout_entry(ce, state, NULL);
+			break;
+		case PC_ITEM_READ_FAILED:
+			errs |= error("unable to read sha1 file of %s (%s)",
+				      ce->name, sha1_to_hex(ce->sha1));
+			break;
+		case PC_ITEM_CREATE_FAILED:
+			errs |= error("unable to create file %s (%s)",
+				      ce->name, strerror(item->saved_errno));
+			break;
+		case PC_ITEM_WRITE_FAILED:
+			errs |= error("unable to write file %s", ce->name);
+			break;
+		default:
+			die("BUG: parallel checkout item %s was not processed",
+			    ce->name);
+		}
+	}
+
+	free(parallel_checkout.items);
+	memset(&parallel_checkout, 0, sizeof(parallel_checkout));
+	return errs != 0;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+/*
+ * Parallel checkout: instead of writing each regular file as soon as
+ * checkout_entry() has cleared its path, the entries are queued and
+ * handed to a pool of threads that read, convert and write them
+ * concurrently.  Directories are still created, and existing files
+ * removed, by the caller in index order, so the workers only ever
+ * create new files.
+ *
+ * The pool size is read from "checkout.workers" and parallel checkout
+ * is only used for at least "checkout.thresholdForParallelism"
+ * entries.
+ */
+
+struct cache_entry;
+struct checkout;
+
+/*
+ * Start queueing entries, if parallel checkout is configured and
+ * "nr_entries" entries are about to be checked out.
+ */
+extern void init_parallel_checkout(unsigned int nr_entries);
+
+/*
+ * Queue "ce" to be written by run_parallel_checkout().  Returns 0 if
+ * it was queued, -1 if the caller has to write it itself, e.g.
+ * because parallel checkout is not active or the entry needs a filter
+ * driver.  Only called by checkout_entry().
+ */
+extern int enqueue_checkout(struct cache_entry *ce,
+			    const struct checkout *state);
+
+/*
+ * Write out all queued entries and stop queueing.  The stat data of
+ * the written files is recorded in their cache entries if
+ * state->refresh_cache is set.  Returns non-zero if any entry could
+ * not be checked out.
+ */
+extern int run_parallel_checkout(const struct checkout *state);
+
+#endif
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "dir.h"
 #include "pathspec.h"
+#include "sparse-index.h"
 
 /*
  * Finds which of the given pathspecs match items in the index.
@@ -35,6 +36,20 @@ void add_pathspec_matches_against_index(const struct pathspec *pathspec,
 		const struct cache_entry *ce = active_cache[i];
 		ce_path_match(ce, pathspec, seen);
 	}
+
+	/*
+	 * What is left may match paths hidden in sparse directories;
+	 * look again with all of them expanded.
+	 */
+	if (the_index.sparse_index) {
+		for (i = 0; i < pathspec->nr; i++)
+			if (!seen[i])
+				break;
+		if (i < pathspec->nr) {
+			ensure_full_index(&the_index);
+			add_pathspec_matches_against_index(pathspec, seen);
+		}
+	}
 }
 
 /*
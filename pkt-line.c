@@ -98,15 +98,10 @@ void packet_buf_flush(struct strbuf *buf)
 }
 
 #define hex(a) (hexchar[(a) & 15])
-static void format_packet(struct strbuf *out, const char *fmt, va_list args)
+static void set_packet_header(struct strbuf *out, size_t orig_len)
 {
 	static char hexchar[] = "0123456789abcdef";
-	size_t orig_len, n;
-
-	orig_len = out->len;
-	strbuf_addstr(out, "0000");
-	strbuf_vaddf(out, fmt, args);
-	n = out->len - orig_len;
+	size_t n = out->len - orig_len;
 
 	if (n > LARGE_PACKET_MAX)
 		die("protocol error: impossibly long line");
@@ -118,6 +113,15 @@ static void format_packet(struct strbuf *out, const char *fmt, va_list args)
 	packet_trace(out->buf + orig_len + 4, n - 4, 1);
 }
 
+static void format_packet(struct strbuf *out, const char *fmt, va_list args)
+{
+	size_t orig_len = out->len;
+
+	strbuf_addstr(out, "0000");
+	strbuf_vaddf(out, fmt, args);
+	set_packet_header(out, orig_len);
+}
+
 void packet_write(int fd, const char *fmt, ...)
 {
 	static struct strbuf buf = STRBUF_INIT;
@@ -139,6 +143,15 @@ void packet_buf_write(struct strbuf *buf, const char *fmt, ...)
 	va_end(args);
 }
 
+void packet_buf_write_len(struct strbuf *buf, const char *data, size_t len)
+{
+	size_t orig_len = buf->len;
+
+	strbuf_addstr(buf, "0000");
+	strbuf_add(buf, data, len);
+	set_packet_header(buf, orig_len);
+}
+
 static int get_packet_data(int fd, char **src_buf, size_t *src_size,
 			   void *dst, unsigned size, int options)
 {
@@ -4,6 +4,8 @@
 #include "cache.h"
 #include "pathspec.h"
 #include "dir.h"
+#include "fsmonitor.h"
+#include "trace-event.h"
 
 #ifdef NO_PTHREADS
 static void preload_index(struct index_state *index,
@@ -29,6 +31,7 @@ struct thread_data {
 	struct index_state *index;
 	struct pathspec pathspec;
 	int offset, nr;
+	int fsmonitor_marked;
 };
 
 static void *preload_thread(void *_data)
@@ -39,6 +42,7 @@ static void *preload_thread(void *_data)
 	struct cache_entry **cep = index->cache + p->offset;
 	struct cache_def cache = CACHE_DEF_INIT;
 
+	trace_event_thread_start("preload");
 	nr = p->nr;
 	if (nr + p->offset > index->cache_nr)
 		nr = index->cache_nr - p->offset;
@@ -53,6 +57,11 @@ static void *preload_thread(void *_data)
 			continue;
 		if (ce_uptodate(ce))
 			continue;
+		if ((ce->ce_flags & CE_FSMONITOR_VALID) &&
+		    index->fsmonitor_has_run_once) {
+			ce_mark_uptodate(ce);
+			continue;
+		}
 		if (!ce_path_match(ce, &p->pathspec, NULL))
 			continue;
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
@@ -62,8 +71,15 @@ static void *preload_thread(void *_data)
 		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY))
 			continue;
 		ce_mark_uptodate(ce);
+		/* see mark_fsmonitor_valid(); the caller flags the index */
+		if (index->fsmonitor_last_update &&
+		    !(ce->ce_flags & CE_FSMONITOR_VALID)) {
+			ce->ce_flags |= CE_FSMONITOR_VALID;
+			p->fsmonitor_marked = 1;
+		}
 	} while (--nr > 0);
 	cache_def_clear(&cache);
+	trace_event_thread_exit();
 	return NULL;
 }
 
@@ -81,6 +97,8 @@ static void preload_index(struct index_state *index,
 		return;
 	if (threads > MAX_PARALLEL)
 		threads = MAX_PARALLEL;
+	refresh_fsmonitor(index);
+	trace_event_region_enter("index", "preload");
 	offset = 0;
 	work = DIV_ROUND_UP(index->cache_nr, threads);
 	memset(&data, 0, sizeof(data));
@@ -99,7 +117,11 @@ static void preload_index(struct index_state *index,
 		struct thread_data *p = data+i;
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
+		if (p->fsmonitor_marked)
+			index->cache_changed |= FSMONITOR_CHANGED;
 	}
+	trace_event_region_leave("index", "preload");
+	trace_event_data("index", "preload_threads", threads);
 }
 #endif
 
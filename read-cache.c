@@ -19,6 +19,9 @@
 #include "split-index.h"
 #include "sigchain.h"
 #include "utf8.h"
+#include "thread-utils.h"
+#include "fsmonitor.h"
+#include "sparse-index.h"
 
 static struct cache_entry *refresh_cache_entry(struct cache_entry *ce,
 					       unsigned int options);
@@ -41,11 +44,26 @@ static struct cache_entry *refresh_cache_entry(struct cache_entry *ce,
 #define CACHE_EXT_RESOLVE_UNDO 0x52455543 /* "REUC" */
 #define CACHE_EXT_LINK 0x6c696e6b	  /* "link" */
 #define CACHE_EXT_UNTRACKED 0x554E5452	  /* "UNTR" */
+#define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
+#define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
+#define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
+#define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
+
+/*
+ * Large indexes are written in blocks of at least this many entries,
+ * recorded in the IEOT extension, so that readers can parse the blocks
+ * in parallel.  Smaller indexes are not worth a thread.
+ */
+#define INDEX_BLOCK_ENTRIES 10000
+#define INDEX_MAX_BLOCKS 64
+#define IEOT_VERSION 1
+#define EOIE_SIZE (4 + 20)
+#define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE)
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
 		 CE_ENTRY_ADDED | CE_ENTRY_REMOVED | CE_ENTRY_CHANGED | \
-		 SPLIT_INDEX_ORDERED | UNTRACKED_CHANGED)
+		 SPLIT_INDEX_ORDERED | UNTRACKED_CHANGED | FSMONITOR_CHANGED)
 
 struct index_state the_index;
 static const char *alternate_index_output;
@@ -499,6 +517,20 @@ static int index_name_stage_pos(const struct index_state *istate, const char *na
 		}
 		first = next+1;
 	}
+
+	/*
+	 * The path may be hidden in a sparse directory entry, which
+	 * sorts right before everything that would be inside it.
+	 */
+	if (istate->sparse_index && first > 0) {
+		const struct cache_entry *ce = istate->cache[first - 1];
+
+		if (S_ISSPARSEDIR(ce->ce_mode) && ce_namelen(ce) < namelen &&
+		    !memcmp(name, ce->name, ce_namelen(ce))) {
+			ensure_full_index((struct index_state *)istate);
+			return index_name_stage_pos(istate, name, namelen, stage);
+		}
+	}
 	return -first-1;
 }
 
@@ -1099,6 +1131,15 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 		ce_mark_uptodate(ce);
 		return ce;
 	}
+	/*
+	 * Likewise if the file system monitor has been asked and did
+	 * not report the path.
+	 */
+	if (!ignore_valid && istate->fsmonitor_has_run_once &&
+	    (ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce_mark_uptodate(ce);
+		return ce;
+	}
 
 	if (has_symlink_leading_path(ce->name, ce_namelen(ce))) {
 		if (ignore_missing)
@@ -1136,8 +1177,10 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 			 * because CE_UPTODATE flag is in-core only;
 			 * we are not going to write this change out.
 			 */
-			if (!S_ISGITLINK(ce->ce_mode))
+			if (!S_ISGITLINK(ce->ce_mode)) {
 				ce_mark_uptodate(ce);
+				mark_fsmonitor_valid(istate, ce);
+			}
 			return ce;
 		}
 	}
@@ -1161,6 +1204,8 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 	if (!ignore_valid && assume_unchanged &&
 	    !(ce->ce_flags & CE_VALID))
 		updated->ce_flags &= ~CE_VALID;
+	if (istate->fsmonitor_last_update && !S_ISGITLINK(ce->ce_mode))
+		updated->ce_flags |= CE_FSMONITOR_VALID;
 
 	/* istate->cache_changed is updated in the caller */
 	return updated;
@@ -1203,6 +1248,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 	typechange_fmt = (in_porcelain ? "T\t%s\n" : "%s needs update\n");
 	added_fmt = (in_porcelain ? "A\t%s\n" : "%s needs update\n");
 	unmerged_fmt = (in_porcelain ? "U\t%s\n" : "%s: needs merge\n");
+	refresh_fsmonitor(istate);
 	for (i = 0; i < istate->cache_nr; i++) {
 		struct cache_entry *ce, *new;
 		int cache_errno = 0;
@@ -1396,6 +1442,17 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_UNTRACKED:
 		istate->untracked = read_untracked_extension(data, sz);
 		break;
+	case CACHE_EXT_FSMONITOR:
+		read_fsmonitor_extension(istate, data, sz);
+		break;
+	case CACHE_EXT_SPARSE_DIRECTORIES:
+		/* no content, only an indication that this is a sparse index */
+		istate->sparse_index = 1;
+		break;
+	case CACHE_EXT_ENDOFINDEXENTRIES:
+	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
+		/* already handled in do_read_index() */
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1534,16 +1591,319 @@ static void check_ce_order(struct index_state *istate)
 	}
 }
 
+/*
+ * Parse "nr" entries starting at "src_offset" into istate->cache[pos..].
+ * For a v4 index, "previous_name" holds the name of the entry before
+ * the first one, as the names are prefix-compressed; it is NULL for
+ * earlier versions.  Returns the offset just past the last entry.
+ */
+static unsigned long load_cache_entry_block(struct index_state *istate,
+					    const char *mmap,
+					    unsigned long src_offset,
+					    int pos, int nr,
+					    struct strbuf *previous_name)
+{
+	int i;
+
+	for (i = pos; i < pos + nr; i++) {
+		struct ondisk_cache_entry *disk_ce;
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		disk_ce = (struct ondisk_cache_entry *)(mmap + src_offset);
+		ce = create_from_disk(disk_ce, &consumed, previous_name);
+		set_index_entry(istate, i, ce);
+
+		src_offset += consumed;
+	}
+	return src_offset;
+}
+
+/*
+ * After an array of cache_nr index entries, there can be an arbitrary
+ * number of extended sections, each of which is prefixed with
+ * extension name (4-byte) and section length in 4-byte network byte
+ * order.
+ */
+static int load_index_extensions(struct index_state *istate,
+				 const char *mmap, size_t mmap_size,
+				 unsigned long src_offset)
+{
+	while (src_offset <= mmap_size - 20 - 8) {
+		uint32_t extsize;
+		memcpy(&extsize, mmap + src_offset + 4, 4);
+		extsize = ntohl(extsize);
+		if (read_index_extension(istate,
+					 mmap + src_offset,
+					 (char *)mmap + src_offset + 8,
+					 extsize) < 0)
+			return -1;
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	return 0;
+}
+
+/*
+ * The EOIE extension, always the last one, records where the entries
+ * end and the extensions start, so that the extensions can be found
+ * (and loaded) without parsing the entries first.  A hash of the
+ * extension headers guards against a stray match.  Returns the offset
+ * of the first extension, or 0 if there is no usable EOIE.
+ */
+static unsigned long read_eoie_extension(const char *mmap, size_t mmap_size)
+{
+	const char *index, *eoie;
+	uint32_t extsize;
+	unsigned long offset, src_offset;
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + 20)
+		return 0;
+
+	index = eoie = mmap + mmap_size - EOIE_SIZE_WITH_HEADER - 20;
+	if (CACHE_EXT(index) != CACHE_EXT_ENDOFINDEXENTRIES)
+		return 0;
+	index += 4;
+	extsize = get_be32(index);
+	if (extsize != EOIE_SIZE)
+		return 0;
+	index += 4;
+
+	offset = get_be32(index);
+	index += 4;
+	if (offset < sizeof(struct cache_header) || offset > eoie - mmap)
+		return 0;
+
+	/* the hash covers the header of every extension before EOIE */
+	git_SHA1_Init(&c);
+	src_offset = offset;
+	while (src_offset < eoie - mmap) {
+		if (src_offset + 8 > eoie - mmap)
+			return 0;
+		extsize = get_be32(mmap + src_offset + 4);
+		git_SHA1_Update(&c, mmap + src_offset, 8);
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	git_SHA1_Final(sha1, &c);
+	if (src_offset != eoie - mmap || hashcmp(sha1, (const unsigned char *)index))
+		return 0;
+
+	return offset;
+}
+
+struct index_entry_offset {
+	/* starting byte offset and number of entries of the block */
+	uint32_t offset;
+	uint32_t nr;
+	/* position of its first entry in istate->cache */
+	int pos;
+	/* v4 only: the name of the entry preceding the block */
+	const char *previous_name;
+};
+
+struct index_entry_offset_table {
+	int nr;
+	struct index_entry_offset *entries;
+};
+
+/*
+ * Find and parse the IEOT extension among the extensions starting at
+ * "ext_offset".  Returns NULL unless it is present and consistent with
+ * the header, in which case the entries are read serially.
+ */
+static struct index_entry_offset_table *read_ieot_extension(
+		struct index_state *istate, const char *mmap, size_t mmap_size,
+		unsigned long ext_offset)
+{
+	struct index_entry_offset_table *ieot;
+	const char *index, *end;
+	uint32_t extsize, prev_end = sizeof(struct cache_header);
+	unsigned long entries_end = ext_offset;
+	int alloc = 0, pos = 0;
+
+	while (ext_offset <= mmap_size - 20 - 8) {
+		const char *ext = mmap + ext_offset;
+
+		extsize = get_be32(ext + 4);
+		if (CACHE_EXT(ext) == CACHE_EXT_INDEXENTRYOFFSETTABLE)
+			break;
+		ext_offset += 8;
+		ext_offset += extsize;
+	}
+	if (ext_offset > mmap_size - 20 - 8)
+		return NULL;
+
+	index = mmap + ext_offset + 8;
+	end = index + extsize;
+	if (end > mmap + mmap_size - 20 || extsize < 4 ||
+	    get_be32(index) != IEOT_VERSION)
+		return NULL;
+	index += 4;
+
+	ieot = xcalloc(1, sizeof(*ieot));
+	while (index < end) {
+		struct index_entry_offset *e;
+
+		ALLOC_GROW(ieot->entries, ieot->nr + 1, alloc);
+		e = &ieot->entries[ieot->nr++];
+		if (end - index < 8)
+			goto invalid;
+		e->offset = get_be32(index);
+		e->nr = get_be32(index + 4);
+		e->pos = pos;
+		index += 8;
+		if (istate->version == 4) {
+			const char *nul = memchr(index, '\0', end - index);
+			if (!nul)
+				goto invalid;
+			e->previous_name = index;
+			index = nul + 1;
+		}
+
+		if (e->offset < prev_end || e->offset >= entries_end ||
+		    e->nr > (uint32_t)(istate->cache_nr - pos))
+			goto invalid;
+		prev_end = e->offset;
+		pos += e->nr;
+	}
+	if (pos != istate->cache_nr || !ieot->nr ||
+	    ieot->entries[0].offset != sizeof(struct cache_header))
+		goto invalid;
+	return ieot;
+
+invalid:
+	free(ieot->entries);
+	free(ieot);
+	return NULL;
+}
+
+/*
+ * index.threads: a boolean (true meaning one thread per CPU) or a
+ * thread count, 0 also meaning one per CPU.  GIT_TEST_INDEX_THREADS
+ * overrides it, and also makes small indexes use threads.
+ */
+static int index_threads(int *forced)
+{
+	int is_bool, val;
+	const char *env = getenv("GIT_TEST_INDEX_THREADS");
+
+	*forced = 0;
+	if (env) {
+		*forced = 1;
+		return atoi(env);
+	}
+	if (!git_config_get_bool_or_int("index.threads", &is_bool, &val)) {
+		if (is_bool)
+			return val ? 0 : 1;
+		return val;
+	}
+	return 0;
+}
+
+#ifndef NO_PTHREADS
+struct load_index_extensions_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	size_t mmap_size;
+	unsigned long src_offset;
+};
+
+static void *load_index_extensions_thread(void *_data)
+{
+	struct load_index_extensions_data *p = _data;
+
+	if (load_index_extensions(p->istate, p->mmap, p->mmap_size,
+				  p->src_offset) < 0)
+		die("index file corrupt");
+	return NULL;
+}
+
+struct load_cache_entries_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	struct index_entry_offset *blocks;
+	int nr_blocks;
+};
+
+static void *load_cache_entries_thread(void *_data)
+{
+	struct load_cache_entries_data *p = _data;
+	struct strbuf previous_name = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < p->nr_blocks; i++) {
+		struct index_entry_offset *e = &p->blocks[i];
+
+		if (p->istate->version == 4) {
+			strbuf_reset(&previous_name);
+			strbuf_addstr(&previous_name, e->previous_name);
+		}
+		load_cache_entry_block(p->istate, p->mmap, e->offset,
+				       e->pos, e->nr,
+				       p->istate->version == 4 ?
+				       &previous_name : NULL);
+	}
+	strbuf_release(&previous_name);
+	return NULL;
+}
+
+/*
+ * Parse the entries with "nr_threads" threads, each taking a run of
+ * consecutive blocks, while another thread loads the extensions.
+ */
+static void load_index_threaded(struct index_state *istate,
+				const char *mmap, size_t mmap_size,
+				struct index_entry_offset_table *ieot,
+				unsigned long ext_offset, int nr_threads)
+{
+	struct load_index_extensions_data ext;
+	struct load_cache_entries_data *data;
+	int i, block = 0;
+
+	ext.istate = istate;
+	ext.mmap = mmap;
+	ext.mmap_size = mmap_size;
+	ext.src_offset = ext_offset;
+	if (pthread_create(&ext.pthread, NULL, load_index_extensions_thread, &ext))
+		die("unable to create load_index_extensions thread");
+
+	data = xcalloc(nr_threads, sizeof(*data));
+	for (i = 0; i < nr_threads; i++) {
+		struct load_cache_entries_data *p = &data[i];
+
+		p->istate = istate;
+		p->mmap = mmap;
+		p->blocks = ieot->entries + block;
+		p->nr_blocks = (ieot->nr - block) / (nr_threads - i);
+		block += p->nr_blocks;
+		if (pthread_create(&p->pthread, NULL, load_cache_entries_thread, p))
+			die("unable to create load_cache_entries thread");
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join load_cache_entries thread");
+	if (pthread_join(ext.pthread, NULL))
+		die("unable to join load_index_extensions thread");
+	free(data);
+}
+#endif
+
 /* remember to discard_cache() before reading a different cache! */
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
-	int fd, i;
+	int fd;
 	struct stat st;
 	unsigned long src_offset;
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	int nr_threads, forced;
 
 	if (istate->initialized)
 		return istate->cache_nr;
@@ -1580,45 +1940,49 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(*istate->cache));
 	istate->initialized = 1;
 
+	istate->timestamp.sec = st.st_mtime;
+	istate->timestamp.nsec = ST_MTIME_NSEC(st);
+
+	nr_threads = index_threads(&forced);
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > 1 &&
+	    (forced || istate->cache_nr >= 2 * INDEX_BLOCK_ENTRIES)) {
+		struct index_entry_offset_table *ieot = NULL;
+		unsigned long ext_offset;
+
+		ext_offset = read_eoie_extension(mmap, mmap_size);
+		if (ext_offset)
+			ieot = read_ieot_extension(istate, mmap, mmap_size,
+						   ext_offset);
+		if (ieot) {
+#ifndef NO_PTHREADS
+			if (nr_threads > ieot->nr)
+				nr_threads = ieot->nr;
+			load_index_threaded(istate, mmap, mmap_size, ieot,
+					    ext_offset, nr_threads);
+			free(ieot->entries);
+			free(ieot);
+			munmap(mmap, mmap_size);
+			return istate->cache_nr;
+#else
+			free(ieot->entries);
+			free(ieot);
+#endif
+		}
+	}
+
 	if (istate->version == 4)
 		previous_name = &previous_name_buf;
 	else
 		previous_name = NULL;
 
-	src_offset = sizeof(*hdr);
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
-		unsigned long consumed;
-
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = create_from_disk(disk_ce, &consumed, previous_name);
-		set_index_entry(istate, i, ce);
-
-		src_offset += consumed;
-	}
+	src_offset = load_cache_entry_block(istate, mmap, sizeof(*hdr),
+					    0, istate->cache_nr, previous_name);
 	strbuf_release(&previous_name_buf);
-	istate->timestamp.sec = st.st_mtime;
-	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
-	while (src_offset <= mmap_size - 20 - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
-		 */
-		uint32_t extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
-			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
-	}
+	if (load_index_extensions(istate, mmap, mmap_size, src_offset) < 0)
+		goto unmap;
 	munmap(mmap, mmap_size);
 	return istate->cache_nr;
 
@@ -1637,6 +2001,8 @@ int read_index_from(struct index_state *istate, const char *path)
 		return istate->cache_nr;
 
 	ret = do_read_index(istate, path, 0);
+	tweak_fsmonitor(istate);
+	tweak_sparse_index(istate);
 	split_index = istate->split_index;
 	if (!split_index || is_null_sha1(split_index->base_sha1)) {
 		check_ce_order(istate);
@@ -1693,6 +2059,9 @@ int discard_index(struct index_state *istate)
 	discard_split_index(istate);
 	free_untracked_cache(istate->untracked);
 	istate->untracked = NULL;
+	istate->fsmonitor_last_update = 0;
+	istate->fsmonitor_has_run_once = 0;
+	istate->sparse_index = 0;
 	return 0;
 }
 
@@ -1744,15 +2113,67 @@ static int ce_write(git_SHA_CTX *context, int fd, void *data, unsigned int len)
 	return 0;
 }
 
-static int write_index_ext_header(git_SHA_CTX *context, int fd,
+/*
+ * "eoie_context", if not NULL, accumulates the hash of the extension
+ * headers recorded in the EOIE extension.
+ */
+static int write_index_ext_header(git_SHA_CTX *context,
+				  git_SHA_CTX *eoie_context, int fd,
 				  unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
+	if (eoie_context) {
+		git_SHA1_Update(eoie_context, &ext, 4);
+		git_SHA1_Update(eoie_context, &sz, 4);
+	}
 	return ((ce_write(context, fd, &ext, 4) < 0) ||
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
 
+/* The current offset in the index file being written */
+static off_t index_write_offset(int fd)
+{
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+
+	if (offset < 0)
+		return offset;
+	return offset + write_buffer_len;
+}
+
+static void add_be32(struct strbuf *sb, uint32_t value)
+{
+	value = htonl(value);
+	strbuf_add(sb, &value, sizeof(value));
+}
+
+static void add_ieot_block(struct strbuf *ieot, off_t offset, int nr,
+			   const struct strbuf *previous_name)
+{
+	add_be32(ieot, (uint32_t)offset);
+	add_be32(ieot, nr);
+	if (previous_name) {
+		strbuf_addbuf(ieot, previous_name);
+		strbuf_addch(ieot, '\0');
+	}
+}
+
+/*
+ * Number of entries per block in the IEOT extension, or 0 if the index
+ * is too small for one to be worth writing.
+ */
+static int index_block_entries(int entries)
+{
+	int forced, nr = index_threads(&forced);
+
+	if (forced)
+		return nr > 1 ? DIV_ROUND_UP(entries, nr) : 0;
+	if (entries < 2 * INDEX_BLOCK_ENTRIES)
+		return 0;
+	return DIV_ROUND_UP(entries, INDEX_MAX_BLOCKS) > INDEX_BLOCK_ENTRIES ?
+		DIV_ROUND_UP(entries, INDEX_MAX_BLOCKS) : INDEX_BLOCK_ENTRIES;
+}
+
 static int ce_flush(git_SHA_CTX *context, int fd, unsigned char *sha1)
 {
 	unsigned int left = write_buffer_len;
@@ -1990,6 +2411,10 @@ static int do_write_index(struct index_state *istate, int newfd,
 	int entries = istate->cache_nr;
 	struct stat st;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	struct strbuf ieot = STRBUF_INIT, block_name = STRBUF_INIT;
+	git_SHA_CTX eoie_context, *eoie_c = NULL;
+	int block_entries, nr_written = 0;
+	off_t block_offset = 0, ext_offset = 0;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -2024,10 +2449,27 @@ static int do_write_index(struct index_state *istate, int newfd,
 		return -1;
 
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
+	block_entries = strip_extensions ? 0 : index_block_entries(entries - removed);
+	if (block_entries)
+		add_be32(&ieot, IEOT_VERSION);
 	for (i = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
+		if (block_entries && !(nr_written % block_entries)) {
+			if (nr_written)
+				add_ieot_block(&ieot, block_offset, block_entries,
+					       previous_name ? &block_name : NULL);
+			block_offset = index_write_offset(newfd);
+			if (block_offset < 0)
+				return -1;
+			if (block_offset > 0xffffffff)
+				block_entries = 0; /* give up on the table */
+			if (previous_name) {
+				strbuf_reset(&block_name);
+				strbuf_addbuf(&block_name, previous_name);
+			}
+		}
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
 		if (is_null_sha1(ce->sha1)) {
@@ -2043,15 +2485,40 @@ static int do_write_index(struct index_state *istate, int newfd,
 		}
 		if (ce_write_entry(&c, newfd, ce, previous_name) < 0)
 			return -1;
+		nr_written++;
 	}
 	strbuf_release(&previous_name_buf);
 
+	/*
+	 * Record the blocks only if there are several; EOIE then tells
+	 * readers where the extensions (starting with IEOT) are.
+	 */
+	if (block_entries && nr_written > block_entries) {
+		add_ieot_block(&ieot, block_offset,
+			       nr_written - (nr_written - 1) / block_entries * block_entries,
+			       previous_name ? &block_name : NULL);
+		ext_offset = index_write_offset(newfd);
+		if (ext_offset < 0)
+			return -1;
+		git_SHA1_Init(&eoie_context);
+		eoie_c = &eoie_context;
+
+		err = write_index_ext_header(&c, eoie_c, newfd,
+					     CACHE_EXT_INDEXENTRYOFFSETTABLE,
+					     ieot.len) < 0 ||
+			ce_write(&c, newfd, ieot.buf, ieot.len) < 0;
+		if (err)
+			return -1;
+	}
+	strbuf_release(&ieot);
+	strbuf_release(&block_name);
+
 	/* Write extension data here */
 	if (!strip_extensions && istate->split_index) {
 		struct strbuf sb = STRBUF_INIT;
 
 		err = write_link_extension(&sb, istate) < 0 ||
-			write_index_ext_header(&c, newfd, CACHE_EXT_LINK,
+			write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_LINK,
 					       sb.len) < 0 ||
 			ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2062,7 +2529,7 @@ static int do_write_index(struct index_state *istate, int newfd,
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_TREE, sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
@@ -2072,7 +2539,7 @@ static int do_write_index(struct index_state *istate, int newfd,
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_RESOLVE_UNDO,
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
 					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2083,7 +2550,23 @@ static int do_write_index(struct index_state *istate, int newfd,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_untracked_extension(&sb, istate->untracked);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_UNTRACKED,
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_UNTRACKED,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	/*
+	 * The bitmap of the FSMN extension is indexed by position, which
+	 * does not survive the split into shared and split index.
+	 */
+	if (!strip_extensions && istate->fsmonitor_last_update &&
+	    !istate->split_index && fsmonitor_hook()) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_fsmonitor_extension(&sb, istate);
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_FSMONITOR,
 					     sb.len) < 0 ||
 			ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2091,6 +2574,26 @@ static int do_write_index(struct index_state *istate, int newfd,
 			return -1;
 	}
 
+	if (istate->sparse_index) {
+		err = write_index_ext_header(&c, eoie_c, newfd,
+					     CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0;
+		if (err)
+			return -1;
+	}
+
+	if (eoie_c) {
+		unsigned char eoie[EOIE_SIZE];
+
+		put_be32(eoie, (uint32_t)ext_offset);
+		git_SHA1_Final(eoie + 4, eoie_c);
+		err = write_index_ext_header(&c, NULL, newfd,
+					     CACHE_EXT_ENDOFINDEXENTRIES,
+					     sizeof(eoie)) < 0 ||
+			ce_write(&c, newfd, eoie, sizeof(eoie)) < 0;
+		if (err)
+			return -1;
+	}
+
 	if (ce_flush(&c, newfd, istate->sha1) || fstat(newfd, &st))
 		return -1;
 	istate->timestamp.sec = (unsigned int)st.st_mtime;
@@ -2114,7 +2617,15 @@ static int commit_locked_index(struct lock_file *lk)
 static int do_write_locked_index(struct index_state *istate, struct lock_file *lock,
 				 unsigned flags)
 {
-	int ret = do_write_index(istate, get_lock_file_fd(lock), 0);
+	int was_full = !istate->sparse_index;
+	int ret;
+
+	ret = convert_to_sparse(istate);
+	if (ret)
+		return ret;
+	ret = do_write_index(istate, get_lock_file_fd(lock), 0);
+	if (was_full)
+		ensure_full_index(istate);
 	if (ret)
 		return ret;
 	assert((flags & (COMMIT_LOCK | CLOSE_LOCK)) !=
@@ -1083,9 +1083,12 @@ static int in_commit_list(const struct commit_list *want, struct commit *c)
 /*
  * Test whether the candidate or one of its parents is contained in the list.
  * Do not recurse to find out, though, but return -1 if inconclusive.
+ * Commits with a generation number below "cutoff" cannot reach any of
+ * the wanted commits.
  */
 static enum contains_result contains_test(struct commit *candidate,
-			    const struct commit_list *want)
+			    const struct commit_list *want,
+			    uint32_t cutoff)
 {
 	/* was it previously marked as containing a want commit? */
 	if (candidate->object.flags & TMP_MARK)
@@ -1102,6 +1105,11 @@ static enum contains_result contains_test(struct commit *candidate,
 	if (parse_commit(candidate) < 0)
 		return 0;
 
+	if (candidate->generation < cutoff) {
+		candidate->object.flags |= UNINTERESTING;
+		return 0;
+	}
+
 	return -1;
 }
 
@@ -1116,7 +1124,19 @@ static enum contains_result contains_tag_algo(struct commit *candidate,
 		const struct commit_list *want)
 {
 	struct contains_stack contains_stack = { 0, 0, NULL };
-	int result = contains_test(candidate, want);
+	const struct commit_list *p;
+	uint32_t cutoff = GENERATION_NUMBER_INFINITY;
+	int result;
+
+	for (p = want; p; p = p->next) {
+		struct commit *c = p->item;
+		if (parse_commit(c) < 0)
+			continue;
+		if (c->generation < cutoff)
+			cutoff = c->generation;
+	}
+
+	result = contains_test(candidate, want, cutoff);
 
 	if (result != CONTAINS_UNKNOWN)
 		return result;
@@ -1135,7 +1155,7 @@ static enum contains_result contains_tag_algo(struct commit *candidate,
 		 * If we just popped the stack, parents->item has been marked,
 		 * therefore contains_test will return a meaningful 0 or 1.
 		 */
-		else switch (contains_test(parents->item, want)) {
+		else switch (contains_test(parents->item, want, cutoff)) {
 		case CONTAINS_YES:
 			commit->object.flags |= TMP_MARK;
 			contains_stack.nr--;
@@ -1149,7 +1169,7 @@ static enum contains_result contains_tag_algo(struct commit *candidate,
 		}
 	}
 	free(contains_stack.contains_stack);
-	return contains_test(candidate, want);
+	return contains_test(candidate, want, cutoff);
 }
 
 static int commit_contains(struct ref_filter *filter, struct commit *commit)
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "lockfile.h"
 #include "refs.h"
+#include "refs/refs-internal.h"
 #include "object.h"
 #include "tag.h"
 #include "dir.h"
@@ -34,41 +35,6 @@ static unsigned char refname_disposition[256] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 4, 4
 };
 
-/*
- * Flag passed to lock_ref_sha1_basic() telling it to tolerate broken
- * refs (i.e., because the reference is about to be deleted anyway).
- */
-#define REF_DELETING	0x02
-
-/*
- * Used as a flag in ref_update::flags when a loose ref is being
- * pruned.
- */
-#define REF_ISPRUNING	0x04
-
-/*
- * Used as a flag in ref_update::flags when the reference should be
- * updated to new_sha1.
- */
-#define REF_HAVE_NEW	0x08
-
-/*
- * Used as a flag in ref_update::flags when old_sha1 should be
- * checked.
- */
-#define REF_HAVE_OLD	0x10
-
-/*
- * Used as a flag in ref_update::flags when the lockfile needs to be
- * committed.
- */
-#define REF_NEEDS_COMMIT 0x20
-
-/*
- * 0x40 is REF_FORCE_CREATE_REFLOG, so skip it if you're adding a
- * value to ref_update::flags
- */
-
 /*
  * Try to read one refname component from the front of refname.
  * Return the length of the component found, or -1 if the component is
@@ -349,7 +315,7 @@ static struct ref_dir *get_ref_dir(struct ref_entry *entry)
  * upper case characters and '_' (like "HEAD" AND "MERGE_HEAD", and not like
  * "config").
  */
-static int refname_is_safe(const char *refname)
+int refname_is_safe(const char *refname)
 {
 	if (starts_with(refname, "refs/")) {
 		char *buf;
@@ -696,23 +662,28 @@ static void sort_ref_dir(struct ref_dir *dir)
 	dir->sorted = dir->nr = i;
 }
 
-/* Include broken references in a do_for_each_ref*() iteration: */
-#define DO_FOR_EACH_INCLUDE_BROKEN 0x01
+int ref_resolves_to_object(const char *refname,
+			   const struct object_id *oid,
+			   unsigned int flags)
+{
+	if (flags & REF_ISBROKEN)
+		return 0;
+	if (!has_sha1_file(oid->hash)) {
+		error("%s does not point to a valid object!", refname);
+		return 0;
+	}
+	return 1;
+}
 
 /*
  * Return true iff the reference described by entry can be resolved to
  * an object in the database.  Emit a warning if the referred-to
  * object does not exist.
  */
-static int ref_resolves_to_object(struct ref_entry *entry)
+static int entry_resolves_to_object(struct ref_entry *entry)
 {
-	if (entry->flag & REF_ISBROKEN)
-		return 0;
-	if (!has_sha1_file(entry->u.value.oid.hash)) {
-		error("%s does not point to a valid object!", entry->name);
-		return 0;
-	}
-	return 1;
+	return ref_resolves_to_object(entry->name, &entry->u.value.oid,
+				      entry->flag);
 }
 
 /*
@@ -750,7 +721,7 @@ static int do_one_ref(struct ref_entry *entry, void *cb_data)
 		return 0;
 
 	if (!(data->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
-	      !ref_resolves_to_object(entry))
+	      !entry_resolves_to_object(entry))
 		return 0;
 
 	/* Store the old value, in case this is a recursive call: */
@@ -1055,9 +1026,51 @@ cleanup:
 	return ret;
 }
 
+enum packed_peeled {
+	PEELED_NONE,
+	PEELED_TAGS,
+	PEELED_FULLY
+};
+
+/*
+ * The packed references under one directory, read from the mmapped
+ * packed-refs file by an iteration over that directory.
+ */
+struct packed_ref_prefix {
+	struct packed_ref_prefix *next;
+	struct ref_entry *root;
+	char prefix[FLEX_ARRAY];
+};
+
 struct packed_ref_cache {
+	/*
+	 * The references, once they have been read into memory.  This
+	 * is NULL as long as lookups are answered from "buf" instead.
+	 */
 	struct ref_entry *root;
 
+	/* The ref_cache this belongs to */
+	struct ref_cache *ref_cache;
+
+	/*
+	 * The packed-refs file mmapped, if its records are sorted and
+	 * can be searched in place; "records" points after the header.
+	 */
+	char *buf;
+	size_t size;
+	const char *records;
+	enum packed_peeled peeled;
+
+	/* The entry returned by the last lookup in "buf" */
+	struct ref_entry *lookup;
+
+	/*
+	 * The directories read from "buf" so far.  They are kept until
+	 * this instance is freed, as an iteration over one of them may
+	 * still be running.
+	 */
+	struct packed_ref_prefix *prefixes;
+
 	/*
 	 * Count of references to the data structure in this instance,
 	 * including the pointer from ref_cache::packed if any.  The
@@ -1113,7 +1126,18 @@ static void acquire_packed_ref_cache(struct packed_ref_cache *packed_refs)
 static int release_packed_ref_cache(struct packed_ref_cache *packed_refs)
 {
 	if (!--packed_refs->referrers) {
-		free_ref_entry(packed_refs->root);
+		if (packed_refs->root)
+			free_ref_entry(packed_refs->root);
+		free(packed_refs->lookup);
+		while (packed_refs->prefixes) {
+			struct packed_ref_prefix *p = packed_refs->prefixes;
+
+			packed_refs->prefixes = p->next;
+			free_ref_entry(p->root);
+			free(p);
+		}
+		if (packed_refs->buf)
+			munmap(packed_refs->buf, packed_refs->size);
 		stat_validity_clear(&packed_refs->validity);
 		free(packed_refs);
 		return 1;
@@ -1185,17 +1209,24 @@ static struct ref_cache *get_ref_cache(const char *submodule)
  * traits will be added later.  The trailing space is required.
  */
 static const char PACKED_REFS_HEADER[] =
-	"# pack-refs with: peeled fully-peeled \n";
+	"# pack-refs with: peeled fully-peeled sorted \n";
+
+/* Return the start of the line following the one at p */
+static const char *find_end_of_line(const char *p, const char *eof)
+{
+	const char *eol = memchr(p, '\n', eof - p);
+	return eol ? eol + 1 : eof;
+}
 
 /*
- * Parse one line from a packed-refs file.  Write the SHA1 to sha1.
- * Return a pointer to the refname within the line (null-terminated),
- * or NULL if there was a problem.
+ * Parse the line [line, eol), which includes its LF, as a reference
+ * record.  Write the SHA1 to sha1 and return a pointer to the refname
+ * within the line, storing its length in *len, or return NULL if the
+ * line is not a reference record.
  */
-static const char *parse_ref_line(struct strbuf *line, unsigned char *sha1)
+static const char *parse_ref_line(const char *line, const char *eol,
+				  unsigned char *sha1, size_t *len)
 {
-	const char *ref;
-
 	/*
 	 * 42: the answer to everything.
 	 *
@@ -1204,30 +1235,205 @@ static const char *parse_ref_line(struct strbuf *line, unsigned char *sha1)
 	 *  +1 (space in between hex and name)
 	 *  +1 (newline at the end of the line)
 	 */
-	if (line->len <= 42)
+	if (eol - line <= 42 || eol[-1] != '\n')
 		return NULL;
 
-	if (get_sha1_hex(line->buf, sha1) < 0)
+	if (get_sha1_hex(line, sha1) < 0)
+		return NULL;
+	if (!isspace(line[40]))
 		return NULL;
-	if (!isspace(line->buf[40]))
+	if (isspace(line[41]))
 		return NULL;
 
-	ref = line->buf + 41;
-	if (isspace(*ref))
+	*len = eol - line - 42;
+	return line + 41;
+}
+
+/*
+ * If [line, eol) is the peeled line of the reference before it, write
+ * the peeled SHA1 to sha1 and return 1.
+ */
+static int parse_peeled_line(const char *line, const char *eol,
+			     unsigned char *sha1)
+{
+	return eol - line == PEELED_LINE_LENGTH &&
+		line[0] == '^' &&
+		eol[-1] == '\n' &&
+		!get_sha1_hex(line + 1, sha1);
+}
+
+static struct ref_entry *create_packed_ref_entry(const char *refname,
+						 unsigned char *sha1,
+						 enum packed_peeled peeled)
+{
+	struct ref_entry *ref;
+	int flag = REF_ISPACKED;
+
+	if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+		if (!refname_is_safe(refname))
+			die("packed refname is dangerous: %s", refname);
+		hashclr(sha1);
+		flag |= REF_BAD_NAME | REF_ISBROKEN;
+	}
+	ref = create_ref_entry(refname, sha1, flag, 0);
+	if (peeled == PEELED_FULLY ||
+	    (peeled == PEELED_TAGS && starts_with(refname, "refs/tags/")))
+		ref->flag |= REF_KNOWS_PEELED;
+	return ref;
+}
+
+/*
+ * Parse the reference record at "pos", along with the peeled line
+ * following it, if any, into a new ref_entry.  Set *next to the line
+ * after them.  Return NULL if there is no record at "pos".
+ */
+static struct ref_entry *read_packed_record(const char *pos, const char *eof,
+					    enum packed_peeled peeled,
+					    struct strbuf *refname,
+					    const char **next)
+{
+	const char *eol = find_end_of_line(pos, eof);
+	struct ref_entry *ref;
+	unsigned char sha1[20];
+	const char *name;
+	size_t len;
+
+	*next = eol;
+	name = parse_ref_line(pos, eol, sha1, &len);
+	if (!name)
 		return NULL;
+	strbuf_reset(refname);
+	strbuf_add(refname, name, len);
+	ref = create_packed_ref_entry(refname->buf, sha1, peeled);
+
+	pos = eol;
+	eol = find_end_of_line(pos, eof);
+	if (pos < eof && parse_peeled_line(pos, eol, sha1)) {
+		hashcpy(ref->u.value.peeled.hash, sha1);
+		/*
+		 * Regardless of what the file header said,
+		 * we definitely know the value of *this*
+		 * reference:
+		 */
+		ref->flag |= REF_KNOWS_PEELED;
+		*next = eol;
+	}
+	return ref;
+}
+
+/*
+ * Read the records [pos, eof) of a packed-refs file into dir.  If
+ * "prefix" is not NULL, the records are sorted and reading stops at
+ * the first reference that does not start with it.
+ */
+static void read_packed_refs(const char *pos, const char *eof,
+			     enum packed_peeled peeled, const char *prefix,
+			     struct ref_dir *dir)
+{
+	struct strbuf refname = STRBUF_INIT;
 
-	if (line->buf[line->len - 1] != '\n')
+	while (pos < eof) {
+		struct ref_entry *ref;
+
+		ref = read_packed_record(pos, eof, peeled, &refname, &pos);
+		if (!ref)
+			continue;
+		if (prefix && !starts_with(ref->name, prefix)) {
+			free(ref);
+			break;
+		}
+		add_ref(dir, ref);
+	}
+
+	strbuf_release(&refname);
+}
+
+/*
+ * Compare the refname of the record at "rec" with the first "len"
+ * bytes of "refname" (which are then a prefix, unless "len" is the
+ * full length).
+ */
+static int cmp_packed_record(const char *rec, const char *eof,
+			     const char *refname, size_t len)
+{
+	const char *eol = find_end_of_line(rec, eof);
+	unsigned char sha1[20];
+	const char *name;
+	size_t namelen;
+	int cmp;
+
+	name = parse_ref_line(rec, eol, sha1, &namelen);
+	if (!name)
+		die("corrupt record in packed-refs file: %.*s",
+		    (int)(eol - rec), rec);
+	cmp = memcmp(name, refname, namelen < len ? namelen : len);
+	if (cmp)
+		return cmp;
+	return namelen < len ? -1 : namelen > len;
+}
+
+/*
+ * Binary search the sorted records of the mmapped packed-refs file for
+ * the first one whose refname is not smaller than the first "len"
+ * bytes of "refname".  Return the start of that record, or the end of
+ * the file.
+ */
+static const char *find_packed_record(struct packed_ref_cache *packed_refs,
+				      const char *refname, size_t len)
+{
+	const char *eof = packed_refs->buf + packed_refs->size;
+	const char *lo = packed_refs->records, *hi = eof;
+
+	while (lo < hi) {
+		const char *mid = lo + (hi - lo) / 2;
+
+		/* back up to the start of the record containing mid */
+		while (mid > lo && mid[-1] != '\n')
+			mid--;
+		if (*mid == '^' && mid > lo) {
+			mid--;
+			while (mid > lo && mid[-1] != '\n')
+				mid--;
+		}
+
+		if (cmp_packed_record(mid, eof, refname, len) < 0) {
+			/* skip the record and its peeled line, if any */
+			lo = find_end_of_line(mid, eof);
+			if (lo < eof && *lo == '^')
+				lo = find_end_of_line(lo, eof);
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/*
+ * Look up refname in the mmapped packed-refs file.  The entry returned
+ * is only valid until the next lookup.
+ */
+static struct ref_entry *lookup_packed_ref(struct packed_ref_cache *packed_refs,
+					   const char *refname)
+{
+	const char *eof = packed_refs->buf + packed_refs->size;
+	size_t len = strlen(refname);
+	const char *rec = find_packed_record(packed_refs, refname, len);
+	struct strbuf name = STRBUF_INIT;
+
+	if (rec == eof || cmp_packed_record(rec, eof, refname, len))
 		return NULL;
-	line->buf[--line->len] = 0;
 
-	return ref;
+	free(packed_refs->lookup);
+	packed_refs->lookup = read_packed_record(rec, eof, packed_refs->peeled,
+						 &name, &rec);
+	strbuf_release(&name);
+	return packed_refs->lookup;
 }
 
 /*
- * Read f, which is a packed-refs file, into dir.
- *
- * A comment line of the form "# pack-refs with: " may contain zero or
- * more traits. We interpret the traits as follows:
+ * Read the packed-refs file at path.  A comment line of the form
+ * "# pack-refs with: " at its top may contain zero or more traits. We
+ * interpret the traits as follows:
  *
  *   No traits:
  *
@@ -1249,60 +1455,65 @@ static const char *parse_ref_line(struct strbuf *line, unsigned char *sha1)
  *      trait should typically be written alongside "peeled" for
  *      compatibility with older clients, but we do not require it
  *      (i.e., "peeled" is a no-op if "fully-peeled" is set).
+ *
+ *   sorted:
+ *
+ *      The references are sorted by refname.  The file is then kept
+ *      mmapped and searched in place; only callers that iterate over
+ *      the references have them read into memory.
  */
-static void read_packed_refs(FILE *f, struct ref_dir *dir)
+static void load_packed_refs(struct packed_ref_cache *packed_refs,
+			     const char *path)
 {
-	struct ref_entry *last = NULL;
-	struct strbuf line = STRBUF_INIT;
-	enum { PEELED_NONE, PEELED_TAGS, PEELED_FULLY } peeled = PEELED_NONE;
-
-	while (strbuf_getwholeline(&line, f, '\n') != EOF) {
-		unsigned char sha1[20];
-		const char *refname;
-		const char *traits;
-
-		if (skip_prefix(line.buf, "# pack-refs with:", &traits)) {
-			if (strstr(traits, " fully-peeled "))
-				peeled = PEELED_FULLY;
-			else if (strstr(traits, " peeled "))
-				peeled = PEELED_TAGS;
-			/* perhaps other traits later as well */
-			continue;
-		}
-
-		refname = parse_ref_line(&line, sha1);
-		if (refname) {
-			int flag = REF_ISPACKED;
+	const char *pos, *eof, *traits;
+	int sorted = 0;
+	struct stat st;
+	int fd;
 
-			if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
-				if (!refname_is_safe(refname))
-					die("packed refname is dangerous: %s", refname);
-				hashclr(sha1);
-				flag |= REF_BAD_NAME | REF_ISBROKEN;
-			}
-			last = create_ref_entry(refname, sha1, flag, 0);
-			if (peeled == PEELED_FULLY ||
-			    (peeled == PEELED_TAGS && starts_with(refname, "refs/tags/")))
-				last->flag |= REF_KNOWS_PEELED;
-			add_ref(dir, last);
-			continue;
-		}
-		if (last &&
-		    line.buf[0] == '^' &&
-		    line.len == PEELED_LINE_LENGTH &&
-		    line.buf[PEELED_LINE_LENGTH - 1] == '\n' &&
-		    !get_sha1_hex(line.buf + 1, sha1)) {
-			hashcpy(last->u.value.peeled.hash, sha1);
-			/*
-			 * Regardless of what the file header said,
-			 * we definitely know the value of *this*
-			 * reference:
-			 */
-			last->flag |= REF_KNOWS_PEELED;
-		}
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		packed_refs->root = create_dir_entry(packed_refs->ref_cache,
+						     "", 0, 0);
+		return;
 	}
+	stat_validity_update(&packed_refs->validity, fd);
+	if (fstat(fd, &st) < 0)
+		die_errno("unable to stat '%s'", path);
+	packed_refs->size = xsize_t(st.st_size);
+	if (packed_refs->size)
+		packed_refs->buf = xmmap(NULL, packed_refs->size, PROT_READ,
+					 MAP_PRIVATE, fd, 0);
+	close(fd);
 
-	strbuf_release(&line);
+	pos = packed_refs->buf;
+	eof = pos + packed_refs->size;
+	if (pos && skip_prefix(pos, "# pack-refs with:", &traits)) {
+		const char *eol = find_end_of_line(pos, eof);
+		struct strbuf header = STRBUF_INIT;
+
+		strbuf_add(&header, traits, eol - traits);
+		if (strstr(header.buf, " fully-peeled "))
+			packed_refs->peeled = PEELED_FULLY;
+		else if (strstr(header.buf, " peeled "))
+			packed_refs->peeled = PEELED_TAGS;
+		sorted = !!strstr(header.buf, " sorted ");
+		/* perhaps other traits later as well */
+		strbuf_release(&header);
+		pos = eol;
+	}
+	packed_refs->records = pos;
+
+	/* Files written by older versions have to be read in full */
+	if (!sorted) {
+		packed_refs->root = create_dir_entry(packed_refs->ref_cache,
+						     "", 0, 0);
+		read_packed_refs(pos, eof, packed_refs->peeled, NULL,
+				 get_ref_dir(packed_refs->root));
+		if (packed_refs->buf)
+			munmap(packed_refs->buf, packed_refs->size);
+		packed_refs->buf = NULL;
+		packed_refs->records = NULL;
+	}
 }
 
 /*
@@ -1323,24 +1534,32 @@ static struct packed_ref_cache *get_packed_ref_cache(struct ref_cache *refs)
 		clear_packed_ref_cache(refs);
 
 	if (!refs->packed) {
-		FILE *f;
-
 		refs->packed = xcalloc(1, sizeof(*refs->packed));
 		acquire_packed_ref_cache(refs->packed);
-		refs->packed->root = create_dir_entry(refs, "", 0, 0);
-		f = fopen(packed_refs_file, "r");
-		if (f) {
-			stat_validity_update(&refs->packed->validity, fileno(f));
-			read_packed_refs(f, get_ref_dir(refs->packed->root));
-			fclose(f);
-		}
+		refs->packed->ref_cache = refs;
+		load_packed_refs(refs->packed, packed_refs_file);
 	}
 	free(packed_refs_file);
 	return refs->packed;
 }
 
+/*
+ * Return the packed references as a ref_dir, reading all of them
+ * into memory if they are still only mmapped.
+ */
 static struct ref_dir *get_packed_ref_dir(struct packed_ref_cache *packed_ref_cache)
 {
+	if (!packed_ref_cache->root) {
+		packed_ref_cache->root =
+			create_dir_entry(packed_ref_cache->ref_cache, "", 0, 0);
+		read_packed_refs(packed_ref_cache->records,
+				 packed_ref_cache->buf + packed_ref_cache->size,
+				 packed_ref_cache->peeled, NULL,
+				 get_ref_dir(packed_ref_cache->root));
+		munmap(packed_ref_cache->buf, packed_ref_cache->size);
+		packed_ref_cache->buf = NULL;
+		packed_ref_cache->records = NULL;
+	}
 	return get_ref_dir(packed_ref_cache->root);
 }
 
@@ -1349,6 +1568,33 @@ static struct ref_dir *get_packed_refs(struct ref_cache *refs)
 	return get_packed_ref_dir(get_packed_ref_cache(refs));
 }
 
+/*
+ * Return the packed references whose names start with "prefix", as a
+ * top-level ref_dir.  This only reads the part of a sorted packed-refs
+ * file that matters, and only the first time a prefix is asked for;
+ * the result lives as long as packed_refs.
+ */
+static struct ref_dir *get_packed_refs_prefix(struct packed_ref_cache *packed_refs,
+					      const char *prefix)
+{
+	struct packed_ref_prefix *p;
+	size_t len = strlen(prefix);
+
+	for (p = packed_refs->prefixes; p; p = p->next)
+		if (!strcmp(p->prefix, prefix))
+			return get_ref_dir(p->root);
+
+	p = xcalloc(1, sizeof(*p) + len + 1);
+	memcpy(p->prefix, prefix, len);
+	p->root = create_dir_entry(packed_refs->ref_cache, "", 0, 0);
+	read_packed_refs(find_packed_record(packed_refs, prefix, len),
+			 packed_refs->buf + packed_refs->size,
+			 packed_refs->peeled, prefix, get_ref_dir(p->root));
+	p->next = packed_refs->prefixes;
+	packed_refs->prefixes = p;
+	return get_ref_dir(p->root);
+}
+
 /*
  * Add a reference to the in-memory packed reference cache.  This may
  * only be called while the packed-refs file is locked (see
@@ -1480,7 +1726,6 @@ static struct ref_dir *get_loose_refs(struct ref_cache *refs)
 }
 
 /* We allow "recursive" symbolic refs. Only within reason, though */
-#define MAXDEPTH 5
 #define MAXREFLEN (1024)
 
 /*
@@ -1488,13 +1733,15 @@ static struct ref_dir *get_loose_refs(struct ref_cache *refs)
  * from the loose refs in ref_cache refs. Find <refname> in the
  * packed-refs file for the submodule.
  */
+static struct ref_entry *get_packed_ref(struct ref_cache *refs,
+				       const char *refname);
+
 static int resolve_gitlink_packed_ref(struct ref_cache *refs,
 				      const char *refname, unsigned char *sha1)
 {
 	struct ref_entry *ref;
-	struct ref_dir *dir = get_packed_refs(refs);
 
-	ref = find_ref(dir, refname);
+	ref = get_packed_ref(refs, refname);
 	if (ref == NULL)
 		return -1;
 
@@ -1510,7 +1757,7 @@ static int resolve_gitlink_ref_recursive(struct ref_cache *refs,
 	char buffer[128], *p;
 	char *path;
 
-	if (recursion > MAXDEPTH || strlen(refname) > MAXREFLEN)
+	if (recursion > SYMREF_MAXDEPTH || strlen(refname) > MAXREFLEN)
 		return -1;
 	path = *refs->name
 		? git_pathdup_submodule(refs->name, "%s", refname)
@@ -1542,31 +1789,26 @@ static int resolve_gitlink_ref_recursive(struct ref_cache *refs,
 	return resolve_gitlink_ref_recursive(refs, p, sha1, recursion+1);
 }
 
-int resolve_gitlink_ref(const char *path, const char *refname, unsigned char *sha1)
+static int files_resolve_gitlink_ref(const char *submodule,
+				     const char *refname, unsigned char *sha1)
 {
-	int len = strlen(path), retval;
-	char *submodule;
-	struct ref_cache *refs;
-
-	while (len && path[len-1] == '/')
-		len--;
-	if (!len)
-		return -1;
-	submodule = xstrndup(path, len);
-	refs = get_ref_cache(submodule);
-	free(submodule);
-
-	retval = resolve_gitlink_ref_recursive(refs, refname, sha1, 0);
-	return retval;
+	return resolve_gitlink_ref_recursive(get_ref_cache(submodule),
+					     refname, sha1, 0);
 }
 
 /*
  * Return the ref_entry for the given refname from the packed
- * references.  If it does not exist, return NULL.
+ * references.  If it does not exist, return NULL.  The entry may only
+ * be valid until the next call.
  */
-static struct ref_entry *get_packed_ref(const char *refname)
+static struct ref_entry *get_packed_ref(struct ref_cache *refs,
+				       const char *refname)
 {
-	return find_ref(get_packed_refs(&ref_cache), refname);
+	struct packed_ref_cache *packed_ref_cache = get_packed_ref_cache(refs);
+
+	if (!packed_ref_cache->root)
+		return lookup_packed_ref(packed_ref_cache, refname);
+	return find_ref(get_packed_ref_dir(packed_ref_cache), refname);
 }
 
 /*
@@ -1584,7 +1826,7 @@ static int resolve_missing_loose_ref(const char *refname,
 	 * The loose reference file does not exist; check for a packed
 	 * reference.
 	 */
-	entry = get_packed_ref(refname);
+	entry = get_packed_ref(&ref_cache, refname);
 	if (entry) {
 		hashcpy(sha1, entry->u.value.oid.hash);
 		if (flags)
@@ -1608,7 +1850,7 @@ static const char *resolve_ref_unsafe_1(const char *refname,
 					int *flags,
 					struct strbuf *sb_path)
 {
-	int depth = MAXDEPTH;
+	int depth = SYMREF_MAXDEPTH;
 	ssize_t len;
 	char buffer[256];
 	static char refname_buffer[256];
@@ -1776,8 +2018,9 @@ static const char *resolve_ref_unsafe_1(const char *refname,
 	}
 }
 
-const char *resolve_ref_unsafe(const char *refname, int resolve_flags,
-			       unsigned char *sha1, int *flags)
+static const char *files_resolve_ref_unsafe(const char *refname,
+					    int resolve_flags,
+					    unsigned char *sha1, int *flags)
 {
 	struct strbuf sb_path = STRBUF_INIT;
 	const char *ret = resolve_ref_unsafe_1(refname, resolve_flags,
@@ -1828,31 +2071,6 @@ static int filter_refs(const char *refname, const struct object_id *oid,
 	return filter->fn(refname, oid, flags, filter->cb_data);
 }
 
-enum peel_status {
-	/* object was peeled successfully: */
-	PEEL_PEELED = 0,
-
-	/*
-	 * object cannot be peeled because the named object (or an
-	 * object referred to by a tag in the peel chain), does not
-	 * exist.
-	 */
-	PEEL_INVALID = -1,
-
-	/* object cannot be peeled because it is not a tag: */
-	PEEL_NON_TAG = -2,
-
-	/* ref_entry contains no peeled value because it is a symref: */
-	PEEL_IS_SYMREF = -3,
-
-	/*
-	 * ref_entry cannot be peeled because it is broken (i.e., the
-	 * symbolic reference cannot even be resolved to an object
-	 * name):
-	 */
-	PEEL_BROKEN = -4
-};
-
 /*
  * Peel the named object; i.e., if the object is a tag, resolve the
  * tag recursively until a non-tag is found.  If successful, store the
@@ -1860,7 +2078,7 @@ enum peel_status {
  * or is not valid, return PEEL_NON_TAG or PEEL_INVALID, respectively,
  * and leave sha1 unchanged.
  */
-static enum peel_status peel_object(const unsigned char *name, unsigned char *sha1)
+enum peel_status peel_object(const unsigned char *name, unsigned char *sha1)
 {
 	struct object *o = lookup_unknown_object(name);
 
@@ -1916,7 +2134,7 @@ static enum peel_status peel_entry(struct ref_entry *entry, int repeel)
 	return status;
 }
 
-int peel_ref(const char *refname, unsigned char *sha1)
+static int files_peel_ref(const char *refname, unsigned char *sha1)
 {
 	int flag;
 	unsigned char base[20];
@@ -1941,7 +2159,7 @@ int peel_ref(const char *refname, unsigned char *sha1)
 	 * have REF_KNOWS_PEELED.
 	 */
 	if (flag & REF_ISPACKED) {
-		struct ref_entry *r = get_packed_ref(refname);
+		struct ref_entry *r = get_packed_ref(&ref_cache, refname);
 		if (r) {
 			if (peel_entry(r, 0))
 				return -1;
@@ -2037,9 +2255,24 @@ static int do_for_each_entry(struct ref_cache *refs, const char *base,
 
 	packed_ref_cache = get_packed_ref_cache(refs);
 	acquire_packed_ref_cache(packed_ref_cache);
-	packed_dir = get_packed_ref_dir(packed_ref_cache);
 	if (base && *base) {
+		const char *slash = strrchr(base, '/');
+
+		/*
+		 * Only read the references of the directory that is
+		 * iterated over, if they are not in memory already.
+		 */
+		if (!packed_ref_cache->root && slash) {
+			char *dirname = xmemdupz(base, slash - base + 1);
+			packed_dir = get_packed_refs_prefix(packed_ref_cache,
+							    dirname);
+			free(dirname);
+		} else {
+			packed_dir = get_packed_ref_dir(packed_ref_cache);
+		}
 		packed_dir = find_containing_dir(packed_dir, base, 0);
+	} else {
+		packed_dir = get_packed_ref_dir(packed_ref_cache);
 	}
 
 	if (packed_dir && loose_dir) {
@@ -2070,8 +2303,9 @@ static int do_for_each_entry(struct ref_cache *refs, const char *base,
  * value, stop the iteration and return that value; otherwise, return
  * 0.
  */
-static int do_for_each_ref(struct ref_cache *refs, const char *base,
-			   each_ref_fn fn, int trim, int flags, void *cb_data)
+static int files_do_for_each_ref(const char *submodule, const char *base,
+				 each_ref_fn fn, int trim, int flags,
+				 void *cb_data)
 {
 	struct ref_entry_cb data;
 	data.base = base;
@@ -2080,12 +2314,27 @@ static int do_for_each_ref(struct ref_cache *refs, const char *base,
 	data.fn = fn;
 	data.cb_data = cb_data;
 
+	return do_for_each_entry(get_ref_cache(submodule), base,
+				 do_one_ref, &data);
+}
+
+static struct ref_storage_be *submodule_ref_storage(const char *submodule);
+
+/*
+ * Call fn for each reference of the submodule (or of the main
+ * repository, if submodule is NULL) for which the refname begins
+ * with base.  See files_do_for_each_ref() for the other parameters.
+ */
+static int do_for_each_ref(const char *submodule, const char *base,
+			   each_ref_fn fn, int trim, int flags, void *cb_data)
+{
 	if (ref_paranoia < 0)
 		ref_paranoia = git_env_bool("GIT_REF_PARANOIA", 0);
 	if (ref_paranoia)
-		data.flags |= DO_FOR_EACH_INCLUDE_BROKEN;
+		flags |= DO_FOR_EACH_INCLUDE_BROKEN;
 
-	return do_for_each_entry(refs, base, do_one_ref, &data);
+	return submodule_ref_storage(submodule)->do_for_each_ref(submodule,
+				base, fn, trim, flags, cb_data);
 }
 
 static int do_head_ref(const char *submodule, each_ref_fn fn, void *cb_data)
@@ -2118,17 +2367,17 @@ int head_ref_submodule(const char *submodule, each_ref_fn fn, void *cb_data)
 
 int for_each_ref(each_ref_fn fn, void *cb_data)
 {
-	return do_for_each_ref(&ref_cache, "", fn, 0, 0, cb_data);
+	return do_for_each_ref(NULL, "", fn, 0, 0, cb_data);
 }
 
 int for_each_ref_submodule(const char *submodule, each_ref_fn fn, void *cb_data)
 {
-	return do_for_each_ref(get_ref_cache(submodule), "", fn, 0, 0, cb_data);
+	return do_for_each_ref(submodule, "", fn, 0, 0, cb_data);
 }
 
 int for_each_ref_in(const char *prefix, each_ref_fn fn, void *cb_data)
 {
-	return do_for_each_ref(&ref_cache, prefix, fn, strlen(prefix), 0, cb_data);
+	return do_for_each_ref(NULL, prefix, fn, strlen(prefix), 0, cb_data);
 }
 
 int for_each_fullref_in(const char *prefix, each_ref_fn fn, void *cb_data, unsigned int broken)
@@ -2137,13 +2386,13 @@ int for_each_fullref_in(const char *prefix, each_ref_fn fn, void *cb_data, unsig
 
 	if (broken)
 		flag = DO_FOR_EACH_INCLUDE_BROKEN;
-	return do_for_each_ref(&ref_cache, prefix, fn, 0, flag, cb_data);
+	return do_for_each_ref(NULL, prefix, fn, 0, flag, cb_data);
 }
 
 int for_each_ref_in_submodule(const char *submodule, const char *prefix,
 		each_ref_fn fn, void *cb_data)
 {
-	return do_for_each_ref(get_ref_cache(submodule), prefix, fn, strlen(prefix), 0, cb_data);
+	return do_for_each_ref(submodule, prefix, fn, strlen(prefix), 0, cb_data);
 }
 
 int for_each_tag_ref(each_ref_fn fn, void *cb_data)
@@ -2178,7 +2427,7 @@ int for_each_remote_ref_submodule(const char *submodule, each_ref_fn fn, void *c
 
 int for_each_replace_ref(each_ref_fn fn, void *cb_data)
 {
-	return do_for_each_ref(&ref_cache, git_replace_ref_base, fn,
+	return do_for_each_ref(NULL, git_replace_ref_base, fn,
 			       strlen(git_replace_ref_base), 0, cb_data);
 }
 
@@ -2202,7 +2451,7 @@ int for_each_namespaced_ref(each_ref_fn fn, void *cb_data)
 	struct strbuf buf = STRBUF_INIT;
 	int ret;
 	strbuf_addf(&buf, "%srefs/", get_git_namespace());
-	ret = do_for_each_ref(&ref_cache, buf.buf, fn, 0, 0, cb_data);
+	ret = do_for_each_ref(NULL, buf.buf, fn, 0, 0, cb_data);
 	strbuf_release(&buf);
 	return ret;
 }
@@ -2244,7 +2493,7 @@ int for_each_glob_ref(each_ref_fn fn, const char *pattern, void *cb_data)
 
 int for_each_rawref(each_ref_fn fn, void *cb_data)
 {
-	return do_for_each_ref(&ref_cache, "", fn, 0,
+	return do_for_each_ref(NULL, "", fn, 0,
 			       DO_FOR_EACH_INCLUDE_BROKEN, cb_data);
 }
 
@@ -2267,6 +2516,15 @@ static const char *ref_rev_parse_rules[] = {
 	NULL
 };
 
+void expand_ref_prefix(struct string_list *prefixes, const char *prefix)
+{
+	const char **p;
+	int len = strlen(prefix);
+
+	for (p = ref_rev_parse_rules; *p; p++)
+		string_list_append(prefixes, mkpath(*p, len, prefix));
+}
+
 int refname_match(const char *abbrev_name, const char *full_name)
 {
 	const char **p;
@@ -2705,7 +2963,7 @@ static int pack_if_possible_fn(struct ref_entry *entry, void *cb_data)
 		return 0;
 
 	/* Do not pack symbolic or broken refs: */
-	if ((entry->flag & REF_ISSYMREF) || !ref_resolves_to_object(entry))
+	if ((entry->flag & REF_ISSYMREF) || !entry_resolves_to_object(entry))
 		return 0;
 
 	/* Add a packed ref cache entry equivalent to the loose entry. */
@@ -2800,7 +3058,7 @@ static void prune_refs(struct ref_to_prune *r)
 	}
 }
 
-int pack_refs(unsigned int flags)
+static int files_pack_refs(unsigned int flags)
 {
 	struct pack_refs_cb_data cbdata;
 
@@ -2837,7 +3095,7 @@ static int repack_without_refs(struct string_list *refnames, struct strbuf *err)
 
 	/* Look for a packed ref */
 	for_each_string_list_item(refname, refnames) {
-		if (get_packed_ref(refname->string)) {
+		if (get_packed_ref(&ref_cache, refname->string)) {
 			needs_repacking = 1;
 			break;
 		}
@@ -3019,7 +3277,7 @@ int delete_ref(const char *refname, const unsigned char *old_sha1,
 	return 0;
 }
 
-int delete_refs(struct string_list *refnames)
+static int files_delete_refs(struct string_list *refnames)
 {
 	struct strbuf err = STRBUF_INIT;
 	int i, result = 0;
@@ -3143,7 +3401,8 @@ static int commit_ref_update(struct ref_lock *lock,
 			     const unsigned char *sha1, const char *logmsg,
 			     int flags, struct strbuf *err);
 
-int rename_ref(const char *oldrefname, const char *newrefname, const char *logmsg)
+static int files_rename_ref(const char *oldrefname, const char *newrefname,
+			    const char *logmsg)
 {
 	unsigned char sha1[20], orig_sha1[20];
 	int flag = 0, logmoved = 0;
@@ -3287,7 +3546,17 @@ static int copy_msg(char *buf, const char *msg)
 	return cp - buf;
 }
 
-static int should_autocreate_reflog(const char *refname)
+void strbuf_add_reflog_msg(struct strbuf *sb, const char *msg)
+{
+	size_t len = sb->len;
+
+	strbuf_grow(sb, strlen(msg) + 2);
+	strbuf_setlen(sb, len + copy_msg(sb->buf + len, msg));
+	/* copy_msg() starts with the TAB that separates it in the log */
+	strbuf_remove(sb, len, 1);
+}
+
+int should_autocreate_reflog(const char *refname)
 {
 	if (!log_all_ref_updates)
 		return 0;
@@ -3344,7 +3613,8 @@ static int log_ref_setup(const char *refname, struct strbuf *logfile, struct str
 }
 
 
-int safe_create_reflog(const char *refname, int force_create, struct strbuf *err)
+static int files_create_reflog(const char *refname, int force_create,
+			       struct strbuf *err)
 {
 	int ret;
 	struct strbuf sb = STRBUF_INIT;
@@ -3527,8 +3797,9 @@ static int commit_ref_update(struct ref_lock *lock,
 	return 0;
 }
 
-int create_symref(const char *ref_target, const char *refs_heads_master,
-		  const char *logmsg)
+static int files_create_symref(const char *ref_target,
+			       const char *refs_heads_master,
+			       const char *logmsg)
 {
 	char *lockpath = NULL;
 	char ref[1000];
@@ -3714,7 +3985,7 @@ int read_ref_at(const char *refname, unsigned int flags, unsigned long at_time,
 	return 1;
 }
 
-int reflog_exists(const char *refname)
+static int files_reflog_exists(const char *refname)
 {
 	struct stat st;
 
@@ -3722,7 +3993,7 @@ int reflog_exists(const char *refname)
 		S_ISREG(st.st_mode);
 }
 
-int delete_reflog(const char *refname)
+static int files_delete_reflog(const char *refname)
 {
 	return remove_path(git_path("logs/%s", refname));
 }
@@ -3766,7 +4037,9 @@ static char *find_beginning_of_line(char *bob, char *scan)
 	return scan;
 }
 
-int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn, void *cb_data)
+static int files_for_each_reflog_ent_reverse(const char *refname,
+					     each_reflog_ent_fn fn,
+					     void *cb_data)
 {
 	struct strbuf sb = STRBUF_INIT;
 	FILE *logfp;
@@ -3868,7 +4141,8 @@ int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn, void
 	return ret;
 }
 
-int for_each_reflog_ent(const char *refname, each_reflog_ent_fn fn, void *cb_data)
+static int files_for_each_reflog_ent(const char *refname,
+				     each_reflog_ent_fn fn, void *cb_data)
 {
 	FILE *logfp;
 	struct strbuf sb = STRBUF_INIT;
@@ -3930,7 +4204,7 @@ static int do_for_each_reflog(struct strbuf *name, each_ref_fn fn, void *cb_data
 	return retval;
 }
 
-int for_each_reflog(each_ref_fn fn, void *cb_data)
+static int files_for_each_reflog(each_ref_fn fn, void *cb_data)
 {
 	int retval;
 	struct strbuf name;
@@ -3940,61 +4214,6 @@ int for_each_reflog(each_ref_fn fn, void *cb_data)
 	return retval;
 }
 
-/**
- * Information needed for a single ref update. Set new_sha1 to the new
- * value or to null_sha1 to delete the ref. To check the old value
- * while the ref is locked, set (flags & REF_HAVE_OLD) and set
- * old_sha1 to the old value, or to null_sha1 to ensure the ref does
- * not exist before update.
- */
-struct ref_update {
-	/*
-	 * If (flags & REF_HAVE_NEW), set the reference to this value:
-	 */
-	unsigned char new_sha1[20];
-	/*
-	 * If (flags & REF_HAVE_OLD), check that the reference
-	 * previously had this value:
-	 */
-	unsigned char old_sha1[20];
-	/*
-	 * One or more of REF_HAVE_NEW, REF_HAVE_OLD, REF_NODEREF,
-	 * REF_DELETING, and REF_ISPRUNING:
-	 */
-	unsigned int flags;
-	struct ref_lock *lock;
-	int type;
-	char *msg;
-	const char refname[FLEX_ARRAY];
-};
-
-/*
- * Transaction states.
- * OPEN:   The transaction is in a valid state and can accept new updates.
- *         An OPEN transaction can be committed.
- * CLOSED: A closed transaction is no longer active and no other operations
- *         than free can be used on it in this state.
- *         A transaction can either become closed by successfully committing
- *         an active transaction or if there is a failure while building
- *         the transaction thus rendering it failed/inactive.
- */
-enum ref_transaction_state {
-	REF_TRANSACTION_OPEN   = 0,
-	REF_TRANSACTION_CLOSED = 1
-};
-
-/*
- * Data structure for holding a reference transaction, which can
- * consist of checks and updates to multiple references, carried out
- * as atomically as possible.  This structure is opaque to callers.
- */
-struct ref_transaction {
-	struct ref_update **updates;
-	size_t alloc;
-	size_t nr;
-	enum ref_transaction_state state;
-};
-
 struct ref_transaction *ref_transaction_begin(struct strbuf *err)
 {
 	assert(err);
@@ -4145,8 +4364,8 @@ int update_ref(const char *msg, const char *refname,
 	return 0;
 }
 
-static int ref_update_reject_duplicates(struct string_list *refnames,
-					struct strbuf *err)
+int ref_update_reject_duplicates(struct string_list *refnames,
+				 struct strbuf *err)
 {
 	int i, n = refnames->nr;
 
@@ -4162,8 +4381,8 @@ static int ref_update_reject_duplicates(struct string_list *refnames,
 	return 0;
 }
 
-int ref_transaction_commit(struct ref_transaction *transaction,
-			   struct strbuf *err)
+static int files_transaction_commit(struct ref_transaction *transaction,
+				    struct strbuf *err)
 {
 	int ret = 0, i;
 	int n = transaction->nr;
@@ -4329,8 +4548,8 @@ static int ref_present(const char *refname,
 	return string_list_has_string(affected_refnames, refname);
 }
 
-int initial_ref_transaction_commit(struct ref_transaction *transaction,
-				   struct strbuf *err)
+static int files_initial_transaction_commit(struct ref_transaction *transaction,
+					    struct strbuf *err)
 {
 	struct ref_dir *loose_refs = get_loose_refs(&ref_cache);
 	struct ref_dir *packed_refs = get_packed_refs(&ref_cache);
@@ -4594,12 +4813,12 @@ static int expire_reflog_ent(unsigned char *osha1, unsigned char *nsha1,
 	return 0;
 }
 
-int reflog_expire(const char *refname, const unsigned char *sha1,
-		 unsigned int flags,
-		 reflog_expiry_prepare_fn prepare_fn,
-		 reflog_expiry_should_prune_fn should_prune_fn,
-		 reflog_expiry_cleanup_fn cleanup_fn,
-		 void *policy_cb_data)
+static int files_reflog_expire(const char *refname, const unsigned char *sha1,
+			       unsigned int flags,
+			       reflog_expiry_prepare_fn prepare_fn,
+			       reflog_expiry_should_prune_fn should_prune_fn,
+			       reflog_expiry_cleanup_fn cleanup_fn,
+			       void *policy_cb_data)
 {
 	static struct lock_file reflog_lock;
 	struct expire_reflog_cb cb;
@@ -4698,3 +4917,204 @@ int reflog_expire(const char *refname, const unsigned char *sha1,
 	unlock_ref(lock);
 	return -1;
 }
+
+static int files_init_db(struct strbuf *err)
+{
+	/*
+	 * $GIT_DIR/refs/{heads,tags} are created by init_db() for
+	 * every backend, so that the repository is recognized as one.
+	 */
+	return 0;
+}
+
+struct ref_storage_be refs_be_files = {
+	"files",
+	files_init_db,
+
+	files_resolve_ref_unsafe,
+	files_peel_ref,
+	files_resolve_gitlink_ref,
+	files_do_for_each_ref,
+
+	files_transaction_commit,
+	files_initial_transaction_commit,
+	files_create_symref,
+	files_rename_ref,
+	files_delete_refs,
+	files_pack_refs,
+
+	files_reflog_exists,
+	files_create_reflog,
+	files_delete_reflog,
+	files_for_each_reflog_ent,
+	files_for_each_reflog_ent_reverse,
+	files_for_each_reflog,
+	files_reflog_expire
+};
+
+static struct ref_storage_be *ref_storage_backends[] = {
+	&refs_be_files,
+	&refs_be_reftable,
+	NULL
+};
+
+static struct ref_storage_be *the_refs_backend = &refs_be_files;
+
+static struct ref_storage_be *find_ref_storage_backend(const char *name)
+{
+	struct ref_storage_be **be;
+
+	for (be = ref_storage_backends; *be; be++)
+		if (!strcmp((*be)->name, name))
+			return *be;
+	return NULL;
+}
+
+int ref_storage_backend_exists(const char *name)
+{
+	return !!find_ref_storage_backend(name);
+}
+
+int set_ref_storage_backend(const char *name)
+{
+	struct ref_storage_be *be = find_ref_storage_backend(name);
+
+	if (!be)
+		return -1;
+	the_refs_backend = be;
+	return 0;
+}
+
+const char *ref_storage_backend(void)
+{
+	return the_refs_backend->name;
+}
+
+/*
+ * The backend of a submodule is not recorded anywhere we read; tell
+ * it by what is in its repository.
+ */
+static struct ref_storage_be *submodule_ref_storage(const char *submodule)
+{
+	struct ref_storage_be *be = &refs_be_files;
+	char *path;
+
+	if (!submodule || !*submodule)
+		return the_refs_backend;
+	path = git_pathdup_submodule(submodule, "reftable");
+	if (is_directory(path))
+		be = &refs_be_reftable;
+	free(path);
+	return be;
+}
+
+int refs_init_db(struct strbuf *err)
+{
+	return the_refs_backend->init_db(err);
+}
+
+const char *resolve_ref_unsafe(const char *refname, int resolve_flags,
+			       unsigned char *sha1, int *flags)
+{
+	return the_refs_backend->resolve_ref_unsafe(refname, resolve_flags,
+						    sha1, flags);
+}
+
+int peel_ref(const char *refname, unsigned char *sha1)
+{
+	return the_refs_backend->peel_ref(refname, sha1);
+}
+
+int resolve_gitlink_ref(const char *path, const char *refname, unsigned char *sha1)
+{
+	int len = strlen(path), retval;
+	char *submodule;
+
+	while (len && path[len-1] == '/')
+		len--;
+	if (!len)
+		return -1;
+	submodule = xstrndup(path, len);
+	retval = submodule_ref_storage(submodule)->resolve_gitlink_ref(submodule,
+							refname, sha1);
+	free(submodule);
+	return retval;
+}
+
+int ref_transaction_commit(struct ref_transaction *transaction,
+			   struct strbuf *err)
+{
+	return the_refs_backend->transaction_commit(transaction, err);
+}
+
+int initial_ref_transaction_commit(struct ref_transaction *transaction,
+				   struct strbuf *err)
+{
+	return the_refs_backend->initial_transaction_commit(transaction, err);
+}
+
+int create_symref(const char *ref_target, const char *refs_heads_master,
+		  const char *logmsg)
+{
+	return the_refs_backend->create_symref(ref_target, refs_heads_master,
+					       logmsg);
+}
+
+int rename_ref(const char *oldref, const char *newref, const char *logmsg)
+{
+	return the_refs_backend->rename_ref(oldref, newref, logmsg);
+}
+
+int delete_refs(struct string_list *refnames)
+{
+	return the_refs_backend->delete_refs(refnames);
+}
+
+int pack_refs(unsigned int flags)
+{
+	return the_refs_backend->pack_refs(flags);
+}
+
+int reflog_exists(const char *refname)
+{
+	return the_refs_backend->reflog_exists(refname);
+}
+
+int safe_create_reflog(const char *refname, int force_create, struct strbuf *err)
+{
+	return the_refs_backend->create_reflog(refname, force_create, err);
+}
+
+int delete_reflog(const char *refname)
+{
+	return the_refs_backend->delete_reflog(refname);
+}
+
+int for_each_reflog_ent(const char *refname, each_reflog_ent_fn fn, void *cb_data)
+{
+	return the_refs_backend->for_each_reflog_ent(refname, fn, cb_data);
+}
+
+int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn,
+				void *cb_data)
+{
+	return the_refs_backend->for_each_reflog_ent_reverse(refname, fn,
+							     cb_data);
+}
+
+int for_each_reflog(each_ref_fn fn, void *cb_data)
+{
+	return the_refs_backend->for_each_reflog(fn, cb_data);
+}
+
+int reflog_expire(const char *refname, const unsigned char *sha1,
+		  unsigned int flags,
+		  reflog_expiry_prepare_fn prepare_fn,
+		  reflog_expiry_should_prune_fn should_prune_fn,
+		  reflog_expiry_cleanup_fn cleanup_fn,
+		  void *policy_cb_data)
+{
+	return the_refs_backend->reflog_expire(refname, sha1, flags,
+					       prepare_fn, should_prune_fn,
+					       cleanup_fn, policy_cb_data);
+}
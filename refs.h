@@ -90,6 +90,13 @@ extern int resolve_gitlink_ref(const char *path, const char *refname, unsigned c
  */
 extern int refname_match(const char *abbrev_name, const char *full_name);
 
+/*
+ * Append to prefixes (which must duplicate its strings) every full
+ * refname that prefix can be an abbreviation of, according to the
+ * same rules.
+ */
+extern void expand_ref_prefix(struct string_list *prefixes, const char *prefix);
+
 extern int dwim_ref(const char *str, int len, unsigned char *sha1, char **ref);
 extern int dwim_log(const char *str, int len, unsigned char *sha1, char **ref);
 
@@ -500,4 +507,18 @@ extern int reflog_expire(const char *refname, const unsigned char *sha1,
 			 reflog_expiry_cleanup_fn cleanup_fn,
 			 void *policy_cb_data);
 
+/*
+ * The refs of a repository are kept by a ref storage backend: "files"
+ * (loose ref files and packed-refs, the default) or "reftable" (a
+ * stack of block-based tables, see Documentation/technical/reftable.txt).
+ * The backend is selected by the "extensions.refStorage" configuration
+ * of the repository.
+ */
+extern int ref_storage_backend_exists(const char *name);
+extern int set_ref_storage_backend(const char *name);
+extern const char *ref_storage_backend(void);
+
+/* Create the ref storage of a new repository, with no refs in it. */
+extern int refs_init_db(struct strbuf *err);
+
 #endif /* REFS_H */
@@ -0,0 +1,228 @@
+#ifndef REFS_REFS_INTERNAL_H
+#define REFS_REFS_INTERNAL_H
+
+/*
+ * Data structures and functions for the internal use of the refs
+ * module and its storage backends.  Code outside of the refs module
+ * should use only the functions declared in refs.h.
+ */
+
+/*
+ * Flag passed to lock_ref_sha1_basic() telling it to tolerate broken
+ * refs (i.e., because the reference is about to be deleted anyway).
+ */
+#define REF_DELETING	0x02
+
+/*
+ * Used as a flag in ref_update::flags when a loose ref is being
+ * pruned.
+ */
+#define REF_ISPRUNING	0x04
+
+/*
+ * Used as a flag in ref_update::flags when the reference should be
+ * updated to new_sha1.
+ */
+#define REF_HAVE_NEW	0x08
+
+/*
+ * Used as a flag in ref_update::flags when old_sha1 should be
+ * checked.
+ */
+#define REF_HAVE_OLD	0x10
+
+/*
+ * Used as a flag in ref_update::flags when the lockfile needs to be
+ * committed.
+ */
+#define REF_NEEDS_COMMIT 0x20
+
+/*
+ * 0x40 is REF_FORCE_CREATE_REFLOG, so skip it if you're adding a
+ * value to ref_update::flags
+ */
+
+/* Include broken references in a do_for_each_ref*() iteration: */
+#define DO_FOR_EACH_INCLUDE_BROKEN 0x01
+
+/* How many symbolic references are followed before giving up: */
+#define SYMREF_MAXDEPTH 5
+
+/*
+ * Information needed for a single ref update. Set new_sha1 to the new
+ * value or to null_sha1 to delete the ref. To check the old value
+ * while the ref is locked, set (flags & REF_HAVE_OLD) and set
+ * old_sha1 to the old value, or to null_sha1 to ensure the ref does
+ * not exist before update.
+ */
+struct ref_update {
+	/*
+	 * If (flags & REF_HAVE_NEW), set the reference to this value:
+	 */
+	unsigned char new_sha1[20];
+	/*
+	 * If (flags & REF_HAVE_OLD), check that the reference
+	 * previously had this value:
+	 */
+	unsigned char old_sha1[20];
+	/*
+	 * One or more of REF_HAVE_NEW, REF_HAVE_OLD, REF_NODEREF,
+	 * REF_DELETING, and REF_ISPRUNING:
+	 */
+	unsigned int flags;
+	struct ref_lock *lock;
+	int type;
+	char *msg;
+	const char refname[FLEX_ARRAY];
+};
+
+/*
+ * Transaction states.
+ * OPEN:   The transaction is in a valid state and can accept new updates.
+ *         An OPEN transaction can be committed.
+ * CLOSED: A closed transaction is no longer active and no other operations
+ *         than free can be used on it in this state.
+ *         A transaction can either become closed by successfully committing
+ *         an active transaction or if there is a failure while building
+ *         the transaction thus rendering it failed/inactive.
+ */
+enum ref_transaction_state {
+	REF_TRANSACTION_OPEN   = 0,
+	REF_TRANSACTION_CLOSED = 1
+};
+
+/*
+ * Data structure for holding a reference transaction, which can
+ * consist of checks and updates to multiple references, carried out
+ * as atomically as possible.  This structure is opaque to callers.
+ */
+struct ref_transaction {
+	struct ref_update **updates;
+	size_t alloc;
+	size_t nr;
+	enum ref_transaction_state state;
+};
+
+/*
+ * Return true if refname, which has the specified oid and flags, can
+ * be resolved to an object in the database.  If the referred-to
+ * object does not exist, emit a warning and return false.
+ */
+int ref_resolves_to_object(const char *refname,
+			   const struct object_id *oid,
+			   unsigned int flags);
+
+/*
+ * Return true iff refname is safe to use even though it does not
+ * follow check_refname_format() (e.g., when deleting a broken ref).
+ */
+int refname_is_safe(const char *refname);
+
+/*
+ * Fail (returning non-zero and writing a message to err) if a refname
+ * appears more than once in the sorted list refnames.
+ */
+int ref_update_reject_duplicates(struct string_list *refnames,
+				 struct strbuf *err);
+
+/* Whether a reflog is created for refname without being asked to: */
+int should_autocreate_reflog(const char *refname);
+
+/*
+ * Append msg to sb the way it is stored in a reflog entry: on a
+ * single line with whitespace squashed, terminated by LF.
+ */
+void strbuf_add_reflog_msg(struct strbuf *sb, const char *msg);
+
+enum peel_status {
+	/* object was peeled successfully: */
+	PEEL_PEELED = 0,
+
+	/*
+	 * object cannot be peeled because the named object (or an
+	 * object referred to by a tag in the peel chain), does not
+	 * exist.
+	 */
+	PEEL_INVALID = -1,
+
+	/* object cannot be peeled because it is not a tag: */
+	PEEL_NON_TAG = -2,
+
+	/* ref_entry contains no peeled value because it is a symref: */
+	PEEL_IS_SYMREF = -3,
+
+	/*
+	 * ref_entry cannot be peeled because it is broken (i.e., the
+	 * symbolic reference cannot even be resolved to an object
+	 * name):
+	 */
+	PEEL_BROKEN = -4
+};
+
+/*
+ * Peel the named object; i.e., if the object is a tag, resolve the
+ * tag recursively until a non-tag is found.  If successful, store the
+ * result to sha1 and return PEEL_PEELED.  If the object is not a tag
+ * or is not valid, return PEEL_NON_TAG or PEEL_INVALID, respectively,
+ * and leave sha1 unchanged.
+ */
+enum peel_status peel_object(const unsigned char *name, unsigned char *sha1);
+
+/*
+ * A ref storage backend.  The main repository uses the one named by
+ * the "extensions.refStorage" configuration ("files" by default).
+ *
+ * The functions that take a submodule argument read the refs of the
+ * main repository if it is NULL; for the others see the functions of
+ * the same name in refs.h.
+ */
+struct ref_storage_be {
+	const char *name;
+
+	/* Create the storage of a new repository. */
+	int (*init_db)(struct strbuf *err);
+
+	const char *(*resolve_ref_unsafe)(const char *refname,
+					  int resolve_flags,
+					  unsigned char *sha1, int *flags);
+	int (*peel_ref)(const char *refname, unsigned char *sha1);
+	int (*resolve_gitlink_ref)(const char *submodule, const char *refname,
+				   unsigned char *sha1);
+	int (*do_for_each_ref)(const char *submodule, const char *base,
+			       each_ref_fn fn, int trim, int flags,
+			       void *cb_data);
+
+	int (*transaction_commit)(struct ref_transaction *transaction,
+				  struct strbuf *err);
+	int (*initial_transaction_commit)(struct ref_transaction *transaction,
+					  struct strbuf *err);
+	int (*create_symref)(const char *ref_target,
+			     const char *refs_heads_master,
+			     const char *logmsg);
+	int (*rename_ref)(const char *oldref, const char *newref,
+			  const char *logmsg);
+	int (*delete_refs)(struct string_list *refnames);
+	int (*pack_refs)(unsigned int flags);
+
+	int (*reflog_exists)(const char *refname);
+	int (*create_reflog)(const char *refname, int force_create,
+			     struct strbuf *err);
+	int (*delete_reflog)(const char *refname);
+	int (*for_each_reflog_ent)(const char *refname,
+				   each_reflog_ent_fn fn, void *cb_data);
+	int (*for_each_reflog_ent_reverse)(const char *refname,
+					   each_reflog_ent_fn fn,
+					   void *cb_data);
+	int (*for_each_reflog)(each_ref_fn fn, void *cb_data);
+	int (*reflog_expire)(const char *refname, const unsigned char *sha1,
+			     unsigned int flags,
+			     reflog_expiry_prepare_fn prepare_fn,
+			     reflog_expiry_should_prune_fn should_prune_fn,
+			     reflog_expiry_cleanup_fn cleanup_fn,
+			     void *policy_cb_data);
+};
+
+extern struct ref_storage_be refs_be_files;
+extern struct ref_storage_be refs_be_reftable;
+
+#endif /* REFS_REFS_INTERNAL_H */
@@ -0,0 +1,1259 @@
+#include "../cache.h"
+#include "../refs.h"
+#include "../object.h"
+#include "../string-list.h"
+#include "refs-internal.h"
+#include "reftable.h"
+
+/*
+ * The reftable ref storage backend keeps HEAD and the refs under
+ * refs/, together with their reflogs, in the stack of tables in
+ * $GIT_COMMON_DIR/reftable/.  Pseudorefs like ORIG_HEAD and
+ * FETCH_HEAD are not refs in the proper sense; they stay files, and
+ * are read and written by the files backend.
+ */
+
+static struct reftable_stack main_stack;
+static struct lock_file tables_list_lock;
+
+struct submodule_stack {
+	struct submodule_stack *next;
+	struct reftable_stack stack;
+	char name[FLEX_ARRAY];
+};
+
+static struct submodule_stack *submodule_stacks;
+
+/*
+ * Return the stack of the main repository (if submodule is NULL or
+ * empty) or of the named submodule, brought up to date.
+ */
+static struct reftable_stack *get_stack(const char *submodule)
+{
+	struct submodule_stack *sub;
+
+	if (!submodule || !*submodule) {
+		if (!main_stack.dir)
+			reftable_stack_open(&main_stack,
+					    xstrfmt("%s/reftable",
+						    get_git_common_dir()));
+		else
+			reftable_stack_reload(&main_stack);
+		return &main_stack;
+	}
+
+	for (sub = submodule_stacks; sub; sub = sub->next)
+		if (!strcmp(sub->name, submodule)) {
+			reftable_stack_reload(&sub->stack);
+			return &sub->stack;
+		}
+	sub = xcalloc(1, sizeof(*sub) + strlen(submodule) + 1);
+	strcpy(sub->name, submodule);
+	reftable_stack_open(&sub->stack,
+			    git_pathdup_submodule(submodule, "reftable"));
+	sub->next = submodule_stacks;
+	submodule_stacks = sub;
+	return &sub->stack;
+}
+
+/* Whether refname is stored in the tables rather than as a file. */
+static int is_table_ref(const char *refname)
+{
+	return ref_type(refname) != REF_TYPE_PSEUDOREF;
+}
+
+static void fill_ref_value(struct reftable_ref *ref, const unsigned char *sha1)
+{
+	hashcpy(ref->value, sha1);
+	if (peel_object(sha1, ref->peeled) == PEEL_PEELED)
+		ref->value_type = REFTABLE_VAL2;
+	else
+		ref->value_type = REFTABLE_VAL1;
+}
+
+/*
+ * Resolve refname within st like resolve_ref_unsafe() does; the name
+ * returned is either refname or points into a static buffer.
+ */
+static const char *resolve_in_stack(struct reftable_stack *st,
+				    const char *refname, int resolve_flags,
+				    unsigned char *sha1, int *flags)
+{
+	static struct strbuf resolved = STRBUF_INIT;
+	struct reftable_ref ref = REFTABLE_REF_INIT;
+	const char *name = refname;
+	int depth = SYMREF_MAXDEPTH;
+	int bad_name = 0;
+
+	if (flags)
+		*flags = 0;
+
+	if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+		if (flags)
+			*flags |= REF_BAD_NAME;
+
+		if (!(resolve_flags & RESOLVE_REF_ALLOW_BAD_NAME) ||
+		    !refname_is_safe(refname)) {
+			errno = EINVAL;
+			return NULL;
+		}
+		bad_name = 1;
+	}
+
+	for (;;) {
+		int ret;
+
+		if (--depth < 0) {
+			errno = ELOOP;
+			name = NULL;
+			break;
+		}
+
+		ret = reftable_stack_read_ref(st, name, &ref);
+		if (ret < 0) {
+			errno = EIO;
+			name = NULL;
+			break;
+		}
+		if (ret > 0 || ref.value_type == REFTABLE_DELETION) {
+			if (resolve_flags & RESOLVE_REF_READING) {
+				errno = ENOENT;
+				name = NULL;
+				break;
+			}
+			hashclr(sha1);
+			if (bad_name && flags)
+				*flags |= REF_ISBROKEN;
+			break;
+		}
+		if (ref.value_type != REFTABLE_SYMREF) {
+			hashcpy(sha1, ref.value);
+			if (bad_name) {
+				hashclr(sha1);
+				if (flags)
+					*flags |= REF_ISBROKEN;
+			}
+			break;
+		}
+
+		if (flags)
+			*flags |= REF_ISSYMREF;
+		strbuf_reset(&resolved);
+		strbuf_addbuf(&resolved, &ref.target);
+		name = resolved.buf;
+		if (resolve_flags & RESOLVE_REF_NO_RECURSE) {
+			hashclr(sha1);
+			break;
+		}
+		if (check_refname_format(name, REFNAME_ALLOW_ONELEVEL)) {
+			if (flags)
+				*flags |= REF_ISBROKEN;
+
+			if (!(resolve_flags & RESOLVE_REF_ALLOW_BAD_NAME) ||
+			    !refname_is_safe(name)) {
+				errno = EINVAL;
+				name = NULL;
+				break;
+			}
+			bad_name = 1;
+		}
+	}
+	reftable_ref_release(&ref);
+	return name;
+}
+
+static const char *reftable_resolve_ref_unsafe(const char *refname,
+					       int resolve_flags,
+					       unsigned char *sha1, int *flags)
+{
+	if (!is_table_ref(refname))
+		return refs_be_files.resolve_ref_unsafe(refname, resolve_flags,
+							sha1, flags);
+	return resolve_in_stack(get_stack(NULL), refname, resolve_flags,
+				sha1, flags);
+}
+
+static int reftable_peel_ref(const char *refname, unsigned char *sha1)
+{
+	struct reftable_ref ref = REFTABLE_REF_INIT;
+	unsigned char base[20];
+	const char *name;
+	int flag, ret;
+
+	name = reftable_resolve_ref_unsafe(refname, RESOLVE_REF_READING,
+					   base, &flag);
+	if (!name)
+		return -1;
+	if (!is_table_ref(name))
+		return peel_object(base, sha1);
+
+	/* the peeled value was recorded when the ref was written */
+	ret = reftable_stack_read_ref(get_stack(NULL), name, &ref);
+	if (!ret && hashcmp(ref.value, base))
+		ret = 1;
+	if (!ret && ref.value_type == REFTABLE_VAL2)
+		hashcpy(sha1, ref.peeled);
+	else if (!ret && ref.value_type == REFTABLE_VAL1)
+		ret = PEEL_NON_TAG;
+	else
+		ret = peel_object(base, sha1);
+	reftable_ref_release(&ref);
+	return ret;
+}
+
+static int reftable_resolve_gitlink_ref(const char *submodule,
+					const char *refname,
+					unsigned char *sha1)
+{
+	return resolve_in_stack(get_stack(submodule), refname,
+				RESOLVE_REF_READING, sha1, NULL) ? 0 : -1;
+}
+
+static int reftable_do_for_each_ref(const char *submodule, const char *base,
+				    each_ref_fn fn, int trim, int flags,
+				    void *cb_data)
+{
+	struct reftable_stack *st = get_stack(submodule);
+	struct reftable_ref ref = REFTABLE_REF_INIT;
+	struct reftable_merged_iter *it;
+	/* the names passed to fn stay valid during the iteration */
+	struct string_list names = STRING_LIST_INIT_DUP;
+	int ret = 0, status;
+
+	it = reftable_stack_seek_ref(st, base, 0);
+	while (!(status = reftable_merged_iter_next_ref(it, &ref))) {
+		struct object_id oid;
+		const char *refname;
+		int flag = 0;
+
+		if (!starts_with(ref.refname.buf, base))
+			break;
+		if (!starts_with(ref.refname.buf, "refs/"))
+			continue;
+
+		if (ref.value_type == REFTABLE_SYMREF) {
+			if (!resolve_in_stack(st, ref.refname.buf,
+					      RESOLVE_REF_READING,
+					      oid.hash, &flag)) {
+				oidclr(&oid);
+				flag |= REF_ISBROKEN;
+			}
+			flag |= REF_ISSYMREF;
+		} else {
+			hashcpy(oid.hash, ref.value);
+		}
+		if (check_refname_format(ref.refname.buf,
+					 REFNAME_ALLOW_ONELEVEL)) {
+			oidclr(&oid);
+			flag |= REF_BAD_NAME | REF_ISBROKEN;
+		}
+
+		if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(ref.refname.buf, &oid, flag))
+			continue;
+
+		refname = string_list_append(&names, ref.refname.buf)->string;
+		ret = fn(refname + trim, &oid, flag, cb_data);
+		if (ret)
+			break;
+	}
+	reftable_merged_iter_free(it);
+	reftable_ref_release(&ref);
+	string_list_clear(&names, 0);
+	if (status < 0)
+		return error("unable to read the refs in %s", st->dir);
+	return ret;
+}
+
+/*
+ * The records that an update writes to the new table.  They are
+ * collected first and sorted, as the table wants them in order.
+ */
+struct table_records {
+	struct reftable_ref *refs;
+	int ref_nr, ref_alloc;
+	struct reftable_log *logs;
+	int log_nr, log_alloc;
+	/* the refs whose reflogs got a new entry */
+	struct string_list logged;
+};
+
+#define TABLE_RECORDS_INIT { NULL, 0, 0, NULL, 0, 0, STRING_LIST_INIT_DUP }
+
+static struct reftable_ref *add_ref_record(struct table_records *rec,
+					   const char *refname,
+					   uint64_t update_index)
+{
+	static const struct reftable_ref blank = REFTABLE_REF_INIT;
+	struct reftable_ref *ref;
+
+	ALLOC_GROW(rec->refs, rec->ref_nr + 1, rec->ref_alloc);
+	ref = &rec->refs[rec->ref_nr++];
+	memcpy(ref, &blank, sizeof(*ref));
+	strbuf_addstr(&ref->refname, refname);
+	ref->update_index = update_index;
+	return ref;
+}
+
+static struct reftable_log *add_log_record(struct table_records *rec,
+					   const char *refname,
+					   uint64_t update_index)
+{
+	static const struct reftable_log blank = REFTABLE_LOG_INIT;
+	struct reftable_log *log;
+
+	ALLOC_GROW(rec->logs, rec->log_nr + 1, rec->log_alloc);
+	log = &rec->logs[rec->log_nr++];
+	memcpy(log, &blank, sizeof(*log));
+	strbuf_addstr(&log->refname, refname);
+	log->update_index = update_index;
+	return log;
+}
+
+static void copy_log_record(struct reftable_log *dst,
+			    const struct reftable_log *src)
+{
+	hashcpy(dst->old_sha1, src->old_sha1);
+	hashcpy(dst->new_sha1, src->new_sha1);
+	strbuf_addbuf(&dst->ident, &src->ident);
+	dst->timestamp = src->timestamp;
+	dst->tz = src->tz;
+	strbuf_addbuf(&dst->message, &src->message);
+}
+
+static void table_records_release(struct table_records *rec)
+{
+	int i;
+
+	for (i = 0; i < rec->ref_nr; i++)
+		reftable_ref_release(&rec->refs[i]);
+	free(rec->refs);
+	for (i = 0; i < rec->log_nr; i++)
+		reftable_log_release(&rec->logs[i]);
+	free(rec->logs);
+	string_list_clear(&rec->logged, 0);
+}
+
+static int ref_record_cmp(const void *a_, const void *b_)
+{
+	const struct reftable_ref *a = a_, *b = b_;
+
+	return strcmp(a->refname.buf, b->refname.buf);
+}
+
+static int log_record_cmp(const void *a_, const void *b_)
+{
+	const struct reftable_log *a = a_, *b = b_;
+	int cmp = strcmp(a->refname.buf, b->refname.buf);
+
+	if (cmp)
+		return cmp;
+	/* newest first */
+	return a->update_index < b->update_index ? 1 :
+		a->update_index > b->update_index ? -1 : 0;
+}
+
+static int write_table_records(struct reftable_writer *w,
+			       uint64_t update_index, void *cb_data)
+{
+	struct table_records *rec = cb_data;
+	int i;
+
+	qsort(rec->refs, rec->ref_nr, sizeof(*rec->refs), ref_record_cmp);
+	qsort(rec->logs, rec->log_nr, sizeof(*rec->logs), log_record_cmp);
+	for (i = 0; i < rec->ref_nr; i++)
+		reftable_writer_add_ref(w, &rec->refs[i]);
+	for (i = 0; i < rec->log_nr; i++)
+		reftable_writer_add_log(w, &rec->logs[i]);
+	return 0;
+}
+
+/*
+ * Write the records to a new table and make it part of the stack.
+ * Nothing is written if there are no records.
+ */
+static int commit_table_records(struct reftable_addition *add,
+				struct table_records *rec, struct strbuf *err)
+{
+	if (!rec->ref_nr && !rec->log_nr) {
+		reftable_addition_rollback(add);
+		return 0;
+	}
+	if (reftable_addition_add(add, write_table_records, rec, err)) {
+		reftable_addition_rollback(add);
+		return -1;
+	}
+	return reftable_addition_commit(add, err);
+}
+
+/*
+ * An existing reflog without entries is represented by an entry with
+ * null old and new values, which the readers skip.
+ */
+static int is_reflog_marker(const struct reftable_log *log)
+{
+	return is_null_sha1(log->old_sha1) && is_null_sha1(log->new_sha1);
+}
+
+static int stack_reflog_exists(struct reftable_stack *st, const char *refname)
+{
+	struct reftable_log log = REFTABLE_LOG_INIT;
+	struct reftable_merged_iter *it = reftable_stack_seek_log(st, refname, 0);
+	int exists = !reftable_merged_iter_next_log(it, &log) &&
+		!strcmp(log.refname.buf, refname);
+
+	reftable_merged_iter_free(it);
+	reftable_log_release(&log);
+	return exists;
+}
+
+/* Fill the committer identity and the time of a new reflog entry. */
+static void fill_log_ident(struct reftable_log *log)
+{
+	const char *info = git_committer_info(0);
+	const char *email_end = strrchr(info, '>');
+	char *end;
+
+	if (!email_end)
+		die("BUG: malformed committer info '%s'", info);
+	strbuf_add(&log->ident, info, email_end + 1 - info);
+	log->timestamp = strtoul(email_end + 2, &end, 10);
+	log->tz = strtol(end, NULL, 10);
+}
+
+/*
+ * Add a reflog entry for refname, if it has a reflog or should get
+ * one, and it did not get an entry from this update already.
+ */
+static void log_ref_update(struct reftable_stack *st, struct table_records *rec,
+			   const char *refname, uint64_t update_index,
+			   const unsigned char *old_sha1,
+			   const unsigned char *new_sha1,
+			   const char *msg, int flags)
+{
+	struct reftable_log *log;
+
+	if (log_all_ref_updates < 0)
+		log_all_ref_updates = !is_bare_repository();
+	if (!(flags & REF_FORCE_CREATE_REFLOG) &&
+	    !should_autocreate_reflog(refname) &&
+	    !stack_reflog_exists(st, refname))
+		return;
+	if (string_list_has_string(&rec->logged, refname))
+		return;
+	string_list_insert(&rec->logged, refname);
+
+	log = add_log_record(rec, refname, update_index);
+	hashcpy(log->old_sha1, old_sha1);
+	hashcpy(log->new_sha1, new_sha1);
+	fill_log_ident(log);
+	strbuf_add_reflog_msg(&log->message, msg ? msg : "");
+}
+
+/* Add deletions of all the reflog entries of refname. */
+static void delete_log_records(struct reftable_stack *st,
+			       struct table_records *rec, const char *refname)
+{
+	struct reftable_log log = REFTABLE_LOG_INIT;
+	struct reftable_merged_iter *it = reftable_stack_seek_log(st, refname, 0);
+
+	while (!reftable_merged_iter_next_log(it, &log) &&
+	       !strcmp(log.refname.buf, refname))
+		add_log_record(rec, refname, log.update_index)->deletion = 1;
+	reftable_merged_iter_free(it);
+	reftable_log_release(&log);
+}
+
+/*
+ * Return 0 if refname can be created without conflicting with an
+ * existing ref or with one of the refs in extras, ignoring those in
+ * skip; see verify_refname_available() of the files backend.
+ * Otherwise write an explanation to err and return -1.
+ */
+static int verify_refname_available(struct reftable_stack *st,
+				    const char *refname,
+				    const struct string_list *extras,
+				    const struct string_list *skip,
+				    struct strbuf *err)
+{
+	struct reftable_ref ref = REFTABLE_REF_INIT;
+	struct reftable_merged_iter *it;
+	struct strbuf dirname = STRBUF_INIT;
+	const char *slash;
+	int ret = -1;
+
+	for (slash = strchr(refname, '/'); slash; slash = strchr(slash + 1, '/')) {
+		strbuf_reset(&dirname);
+		strbuf_add(&dirname, refname, slash - refname);
+		if (skip && string_list_has_string(skip, dirname.buf))
+			continue;
+		if (!reftable_stack_read_ref(st, dirname.buf, &ref) &&
+		    ref.value_type != REFTABLE_DELETION) {
+			strbuf_addf(err, "'%s' exists; cannot create '%s'",
+				    dirname.buf, refname);
+			goto cleanup;
+		}
+		if (extras && string_list_has_string(extras, dirname.buf)) {
+			strbuf_addf(err, "cannot process '%s' and '%s' at the same time",
+				    refname, dirname.buf);
+			goto cleanup;
+		}
+	}
+
+	strbuf_reset(&dirname);
+	strbuf_addf(&dirname, "%s/", refname);
+	it = reftable_stack_seek_ref(st, dirname.buf, 0);
+	while (!reftable_merged_iter_next_ref(it, &ref) &&
+	       starts_with(ref.refname.buf, dirname.buf)) {
+		if (skip && string_list_has_string(skip, ref.refname.buf))
+			continue;
+		strbuf_addf(err, "'%s' exists; cannot create '%s'",
+			    ref.refname.buf, refname);
+		reftable_merged_iter_free(it);
+		goto cleanup;
+	}
+	reftable_merged_iter_free(it);
+
+	if (extras) {
+		int pos = string_list_find_insert_index(extras, dirname.buf, 0);
+
+		for (; pos < extras->nr; pos++) {
+			const char *extra = extras->items[pos].string;
+
+			if (!starts_with(extra, dirname.buf))
+				break;
+			if (!skip || !string_list_has_string(skip, extra)) {
+				strbuf_addf(err, "cannot process '%s' and '%s' at the same time",
+					    refname, extra);
+				goto cleanup;
+			}
+		}
+	}
+	ret = 0;
+
+cleanup:
+	reftable_ref_release(&ref);
+	strbuf_release(&dirname);
+	return ret;
+}
+
+static int write_ref_check_object(const char *refname, const unsigned char *sha1,
+				  struct strbuf *err)
+{
+	struct object *o = parse_object(sha1);
+
+	if (!o) {
+		strbuf_addf(err,
+			    "Trying to write ref %s with nonexistent object %s",
+			    refname, sha1_to_hex(sha1));
+		return -1;
+	}
+	if (o->type != OBJ_COMMIT && is_branch(refname)) {
+		strbuf_addf(err,
+			    "Trying to write non-commit object %s to branch %s",
+			    sha1_to_hex(sha1), refname);
+		return -1;
+	}
+	return 0;
+}
+
+static int reftable_transaction_commit(struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct reftable_stack *st = get_stack(NULL);
+	struct reftable_addition add;
+	struct table_records rec = TABLE_RECORDS_INIT;
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	struct string_list written = STRING_LIST_INIT_DUP;
+	struct ref_update **updates = transaction->updates;
+	const char *head_ref;
+	int head_flag;
+	unsigned char head_sha1[20];
+	int ret = 0, i, n = transaction->nr;
+
+	assert(err);
+
+	if (transaction->state != REF_TRANSACTION_OPEN)
+		die("BUG: commit called for transaction that is not open");
+
+	if (!n) {
+		transaction->state = REF_TRANSACTION_CLOSED;
+		return 0;
+	}
+
+	/* Fail if a refname appears more than once in the transaction: */
+	for (i = 0; i < n; i++)
+		string_list_append(&affected_refnames, updates[i]->refname);
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	for (i = 0; i < n; i++)
+		if (!is_table_ref(updates[i]->refname)) {
+			strbuf_addf(err, "cannot update pseudoref '%s' in a transaction",
+				    updates[i]->refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+
+	if (reftable_addition_begin(&add, st, &tables_list_lock, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/* an update of the branch HEAD is on is logged to HEAD, too */
+	head_ref = resolve_in_stack(st, "HEAD", 0, head_sha1, &head_flag);
+	if (head_ref && !(head_flag & REF_ISSYMREF))
+		head_ref = NULL;
+	head_ref = xstrdup_or_null(head_ref);
+
+	for (i = 0; i < n; i++) {
+		struct ref_update *update = updates[i];
+		unsigned char old_sha1[20];
+		const char *resolved;
+		char *refname;
+		int resolve_flags = 0, type;
+
+		if ((update->flags & REF_HAVE_NEW) &&
+		    is_null_sha1(update->new_sha1))
+			update->flags |= REF_DELETING;
+
+		if (update->flags & REF_DELETING) {
+			resolve_flags |= RESOLVE_REF_ALLOW_BAD_NAME;
+			if (update->flags & REF_NODEREF)
+				resolve_flags |= RESOLVE_REF_NO_RECURSE;
+		}
+		resolved = resolve_in_stack(st, update->refname, resolve_flags,
+					    old_sha1, &type);
+		if (!resolved) {
+			strbuf_addf(err, "cannot lock ref '%s': unable to resolve reference %s: %s",
+				    update->refname, update->refname,
+				    strerror(errno));
+			ret = TRANSACTION_GENERIC_ERROR;
+			break;
+		}
+		update->type = type;
+		refname = xstrdup((update->flags & REF_NODEREF) ?
+				  update->refname : resolved);
+		if (strcmp(refname, update->refname) &&
+		    string_list_has_string(&written, refname)) {
+			strbuf_addf(err, "Multiple updates for ref '%s' not allowed.",
+				    refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			free(refname);
+			break;
+		}
+		string_list_insert(&written, refname);
+
+		if ((update->flags & REF_HAVE_OLD) &&
+		    hashcmp(old_sha1, update->old_sha1)) {
+			if (is_null_sha1(old_sha1))
+				strbuf_addf(err, "cannot lock ref '%s': unable to resolve reference %s",
+					    update->refname, refname);
+			else
+				strbuf_addf(err, "cannot lock ref '%s': ref %s is at %s but expected %s",
+					    update->refname, refname,
+					    sha1_to_hex(old_sha1),
+					    sha1_to_hex(update->old_sha1));
+			ret = TRANSACTION_GENERIC_ERROR;
+			free(refname);
+			break;
+		}
+
+		if (update->flags & REF_DELETING) {
+			struct reftable_ref ref = REFTABLE_REF_INIT;
+
+			if (!reftable_stack_read_ref(st, refname, &ref) &&
+			    ref.value_type != REFTABLE_DELETION)
+				add_ref_record(&rec, refname, add.update_index);
+			reftable_ref_release(&ref);
+			delete_log_records(st, &rec, refname);
+		} else if (update->flags & REF_HAVE_NEW) {
+			int overwriting_symref = (type & REF_ISSYMREF) &&
+				(update->flags & REF_NODEREF);
+
+			if (is_null_sha1(old_sha1) &&
+			    verify_refname_available(st, refname,
+						     &affected_refnames, NULL,
+						     err)) {
+				struct strbuf msg = STRBUF_INIT;
+
+				strbuf_addf(&msg, "cannot lock ref '%s': %s",
+					    update->refname, err->buf);
+				strbuf_swap(&msg, err);
+				strbuf_release(&msg);
+				ret = TRANSACTION_NAME_CONFLICT;
+				free(refname);
+				break;
+			}
+
+			if (!overwriting_symref &&
+			    !hashcmp(old_sha1, update->new_sha1)) {
+				/* the ref already has the desired value */
+				free(refname);
+				continue;
+			}
+			if (write_ref_check_object(refname, update->new_sha1,
+						   err)) {
+				ret = TRANSACTION_GENERIC_ERROR;
+				free(refname);
+				break;
+			}
+			fill_ref_value(add_ref_record(&rec, refname,
+						      add.update_index),
+				       update->new_sha1);
+
+			log_ref_update(st, &rec, refname, add.update_index,
+				       old_sha1, update->new_sha1,
+				       update->msg, update->flags);
+			if (strcmp(refname, update->refname))
+				log_ref_update(st, &rec, update->refname,
+					       add.update_index, old_sha1,
+					       update->new_sha1, update->msg, 0);
+			if (head_ref && !strcmp(head_ref, refname) &&
+			    strcmp(update->refname, "HEAD"))
+				log_ref_update(st, &rec, "HEAD",
+					       add.update_index, old_sha1,
+					       update->new_sha1, update->msg, 0);
+		}
+		free(refname);
+	}
+	free((char *)head_ref);
+
+	if (ret)
+		reftable_addition_rollback(&add);
+	else if (commit_table_records(&add, &rec, err))
+		ret = TRANSACTION_GENERIC_ERROR;
+
+cleanup:
+	transaction->state = REF_TRANSACTION_CLOSED;
+	table_records_release(&rec);
+	string_list_clear(&affected_refnames, 0);
+	string_list_clear(&written, 0);
+	return ret;
+}
+
+static int reftable_initial_transaction_commit(struct ref_transaction *transaction,
+					       struct strbuf *err)
+{
+	/* there is nothing to be gained by treating this one specially */
+	return reftable_transaction_commit(transaction, err);
+}
+
+static int reftable_create_symref(const char *ref_target,
+				  const char *refs_heads_master,
+				  const char *logmsg)
+{
+	struct reftable_stack *st;
+	struct reftable_addition add;
+	struct table_records rec = TABLE_RECORDS_INIT;
+	struct reftable_ref *ref;
+	struct strbuf err = STRBUF_INIT;
+	unsigned char old_sha1[20], new_sha1[20];
+	int ret = 0;
+
+	if (!is_table_ref(ref_target))
+		return refs_be_files.create_symref(ref_target,
+						   refs_heads_master, logmsg);
+
+	st = get_stack(NULL);
+	if (reftable_addition_begin(&add, st, &tables_list_lock, &err)) {
+		ret = error("%s", err.buf);
+		goto cleanup;
+	}
+
+	ref = add_ref_record(&rec, ref_target, add.update_index);
+	ref->value_type = REFTABLE_SYMREF;
+	strbuf_addstr(&ref->target, refs_heads_master);
+
+	if (logmsg &&
+	    resolve_in_stack(st, refs_heads_master, RESOLVE_REF_READING,
+			     new_sha1, NULL)) {
+		if (!resolve_in_stack(st, ref_target, 0, old_sha1, NULL))
+			hashclr(old_sha1);
+		log_ref_update(st, &rec, ref_target, add.update_index,
+			       old_sha1, new_sha1, logmsg, 0);
+	}
+
+	if (commit_table_records(&add, &rec, &err))
+		ret = error("%s", err.buf);
+
+cleanup:
+	table_records_release(&rec);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_rename_ref(const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	struct reftable_stack *st = get_stack(NULL);
+	struct reftable_addition add;
+	struct table_records rec = TABLE_RECORDS_INIT;
+	struct reftable_ref ref = REFTABLE_REF_INIT;
+	struct reftable_log log = REFTABLE_LOG_INIT;
+	struct reftable_merged_iter *it;
+	struct string_list skip = STRING_LIST_INIT_NODUP;
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (!is_table_ref(oldrefname) || !is_table_ref(newrefname))
+		return error("unable to rename '%s' to '%s': not a ref",
+			     oldrefname, newrefname);
+
+	if (reftable_addition_begin(&add, st, &tables_list_lock, &err)) {
+		ret = error("%s", err.buf);
+		goto cleanup;
+	}
+
+	if (reftable_stack_read_ref(st, oldrefname, &ref) ||
+	    ref.value_type == REFTABLE_DELETION) {
+		ret = error("refname %s not found", oldrefname);
+		goto rollback;
+	}
+	if (ref.value_type == REFTABLE_SYMREF) {
+		ret = error("refname %s is a symbolic ref, renaming it is not supported",
+			    oldrefname);
+		goto rollback;
+	}
+
+	string_list_insert(&skip, oldrefname);
+	if (verify_refname_available(st, newrefname, NULL, &skip, &err)) {
+		ret = error("%s", err.buf);
+		goto rollback;
+	}
+
+	/* the new ref and its reflog replace the old ones */
+	add_ref_record(&rec, oldrefname, add.update_index);
+	fill_ref_value(add_ref_record(&rec, newrefname, add.update_index),
+		       ref.value);
+	delete_log_records(st, &rec, newrefname);
+	it = reftable_stack_seek_log(st, oldrefname, 0);
+	while (!reftable_merged_iter_next_log(it, &log) &&
+	       !strcmp(log.refname.buf, oldrefname)) {
+		add_log_record(&rec, oldrefname, log.update_index)->deletion = 1;
+		copy_log_record(add_log_record(&rec, newrefname,
+					       log.update_index), &log);
+	}
+	reftable_merged_iter_free(it);
+	log_ref_update(st, &rec, newrefname, add.update_index,
+		       ref.value, ref.value, logmsg, 0);
+
+	if (commit_table_records(&add, &rec, &err))
+		ret = error("unable to rename '%s' to '%s': %s",
+			    oldrefname, newrefname, err.buf);
+	goto cleanup;
+
+rollback:
+	reftable_addition_rollback(&add);
+cleanup:
+	table_records_release(&rec);
+	reftable_ref_release(&ref);
+	reftable_log_release(&log);
+	string_list_clear(&skip, 0);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_delete_refs(struct string_list *refnames)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	int i, result = 0;
+
+	if (!refnames->nr)
+		return 0;
+
+	transaction = ref_transaction_begin(&err);
+	if (!transaction)
+		goto error;
+	for (i = 0; i < refnames->nr; i++)
+		if (ref_transaction_delete(transaction, refnames->items[i].string,
+					   NULL, REF_NODEREF, NULL, &err))
+			goto error;
+	if (ref_transaction_commit(transaction, &err))
+		goto error;
+	goto cleanup;
+
+error:
+	if (refnames->nr == 1)
+		result = error(_("could not delete reference %s: %s"),
+			       refnames->items[0].string, err.buf);
+	else
+		result = error(_("could not delete references: %s"), err.buf);
+
+cleanup:
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return result;
+}
+
+static int reftable_pack_refs(unsigned int flags)
+{
+	struct reftable_addition add;
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (reftable_addition_begin(&add, get_stack(NULL), &tables_list_lock,
+				    &err) ||
+	    reftable_addition_compact_all(&add, &err) ||
+	    reftable_addition_commit(&add, &err))
+		ret = error("%s", err.buf);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_reflog_exists(const char *refname)
+{
+	if (!is_table_ref(refname))
+		return refs_be_files.reflog_exists(refname);
+	return stack_reflog_exists(get_stack(NULL), refname);
+}
+
+static int reftable_create_reflog(const char *refname, int force_create,
+				  struct strbuf *err)
+{
+	struct reftable_stack *st;
+	struct reftable_addition add;
+	struct table_records rec = TABLE_RECORDS_INIT;
+	struct reftable_log *log;
+	int ret;
+
+	if (!is_table_ref(refname))
+		return refs_be_files.create_reflog(refname, force_create, err);
+
+	if (log_all_ref_updates < 0)
+		log_all_ref_updates = !is_bare_repository();
+	if (!force_create && !should_autocreate_reflog(refname))
+		return 0;
+
+	st = get_stack(NULL);
+	if (reftable_addition_begin(&add, st, &tables_list_lock, err))
+		return -1;
+	if (stack_reflog_exists(st, refname)) {
+		reftable_addition_rollback(&add);
+		return 0;
+	}
+	log = add_log_record(&rec, refname, add.update_index);
+	fill_log_ident(log);
+	strbuf_addch(&log->message, '\n');
+	ret = commit_table_records(&add, &rec, err);
+	table_records_release(&rec);
+	return ret;
+}
+
+static int reftable_delete_reflog(const char *refname)
+{
+	struct reftable_stack *st;
+	struct reftable_addition add;
+	struct table_records rec = TABLE_RECORDS_INIT;
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (!is_table_ref(refname))
+		return refs_be_files.delete_reflog(refname);
+
+	st = get_stack(NULL);
+	if (reftable_addition_begin(&add, st, &tables_list_lock, &err)) {
+		ret = error("%s", err.buf);
+	} else {
+		delete_log_records(st, &rec, refname);
+		if (commit_table_records(&add, &rec, &err))
+			ret = error("%s", err.buf);
+	}
+	table_records_release(&rec);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_for_each_reflog_ent_reverse(const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct reftable_log log = REFTABLE_LOG_INIT;
+	struct reftable_merged_iter *it;
+	int ret = 0, status;
+
+	if (!is_table_ref(refname))
+		return refs_be_files.for_each_reflog_ent_reverse(refname, fn,
+								 cb_data);
+
+	it = reftable_stack_seek_log(get_stack(NULL), refname, 0);
+	while (!(status = reftable_merged_iter_next_log(it, &log))) {
+		if (strcmp(log.refname.buf, refname))
+			break;
+		if (is_reflog_marker(&log))
+			continue;
+		ret = fn(log.old_sha1, log.new_sha1, log.ident.buf,
+			 log.timestamp, log.tz, log.message.buf, cb_data);
+		if (ret)
+			break;
+	}
+	reftable_merged_iter_free(it);
+	reftable_log_release(&log);
+	return status < 0 ? -1 : ret;
+}
+
+struct collect_reflog_cb {
+	struct reftable_log *logs;
+	int nr, alloc;
+};
+
+static int collect_reflog_ent(unsigned char *osha1, unsigned char *nsha1,
+			      const char *email, unsigned long timestamp,
+			      int tz, const char *message, void *cb_data)
+{
+	static const struct reftable_log blank = REFTABLE_LOG_INIT;
+	struct collect_reflog_cb *cb = cb_data;
+	struct reftable_log *log;
+
+	ALLOC_GROW(cb->logs, cb->nr + 1, cb->alloc);
+	log = &cb->logs[cb->nr++];
+	memcpy(log, &blank, sizeof(*log));
+	hashcpy(log->old_sha1, osha1);
+	hashcpy(log->new_sha1, nsha1);
+	strbuf_addstr(&log->ident, email);
+	log->timestamp = timestamp;
+	log->tz = tz;
+	strbuf_addstr(&log->message, message);
+	return 0;
+}
+
+static int reftable_for_each_reflog_ent(const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	struct collect_reflog_cb cb = { NULL, 0, 0 };
+	int i, ret;
+
+	if (!is_table_ref(refname))
+		return refs_be_files.for_each_reflog_ent(refname, fn, cb_data);
+
+	/* the tables have the newest entries first */
+	ret = reftable_for_each_reflog_ent_reverse(refname, collect_reflog_ent,
+						   &cb);
+	for (i = cb.nr - 1; !ret && i >= 0; i--) {
+		struct reftable_log *log = &cb.logs[i];
+
+		ret = fn(log->old_sha1, log->new_sha1, log->ident.buf,
+			 log->timestamp, log->tz, log->message.buf, cb_data);
+	}
+	for (i = 0; i < cb.nr; i++)
+		reftable_log_release(&cb.logs[i]);
+	free(cb.logs);
+	return ret;
+}
+
+static int reftable_for_each_reflog(each_ref_fn fn, void *cb_data)
+{
+	struct reftable_stack *st = get_stack(NULL);
+	struct reftable_log log = REFTABLE_LOG_INIT;
+	struct reftable_merged_iter *it;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	const char *last = NULL;
+	int ret = 0, status;
+
+	it = reftable_stack_seek_log(st, "", 0);
+	while (!(status = reftable_merged_iter_next_log(it, &log))) {
+		struct object_id oid;
+
+		if (last && !strcmp(last, log.refname.buf))
+			continue;
+		last = string_list_append(&names, log.refname.buf)->string;
+
+		if (read_ref_full(last, 0, oid.hash, NULL))
+			ret = error("bad ref for %s", last);
+		else
+			ret = fn(last, &oid, 0, cb_data);
+		if (ret)
+			break;
+	}
+	reftable_merged_iter_free(it);
+	reftable_log_release(&log);
+	string_list_clear(&names, 0);
+	if (status < 0)
+		return error("unable to read the reflogs in %s", st->dir);
+	return ret;
+}
+
+static int reftable_reflog_expire(const char *refname, const unsigned char *sha1,
+				  unsigned int flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_stack *st;
+	struct reftable_addition add;
+	struct table_records rec = TABLE_RECORDS_INIT;
+	struct reftable_log log = REFTABLE_LOG_INIT;
+	struct reftable_log *logs = NULL;
+	struct reftable_merged_iter *it;
+	struct strbuf err = STRBUF_INIT;
+	unsigned char cur_sha1[20], last_kept_sha1[20];
+	int i, nr = 0, alloc = 0, kept = 0, type, status = 0;
+
+	if (!is_table_ref(refname))
+		return refs_be_files.reflog_expire(refname, sha1, flags,
+						   prepare_fn, should_prune_fn,
+						   cleanup_fn, policy_cb_data);
+
+	st = get_stack(NULL);
+	if (reftable_addition_begin(&add, st, &tables_list_lock, &err)) {
+		error("cannot lock ref '%s': %s", refname, err.buf);
+		strbuf_release(&err);
+		return -1;
+	}
+	if (!resolve_in_stack(st, refname, 0, cur_sha1, &type) ||
+	    (sha1 && !is_null_sha1(sha1) && hashcmp(cur_sha1, sha1))) {
+		error("cannot lock ref '%s': ref %s is at %s but expected %s",
+		      refname, refname, sha1_to_hex(cur_sha1),
+		      sha1_to_hex(sha1));
+		reftable_addition_rollback(&add);
+		return -1;
+	}
+
+	/* the entries, oldest first */
+	it = reftable_stack_seek_log(st, refname, 0);
+	while (!reftable_merged_iter_next_log(it, &log) &&
+	       !strcmp(log.refname.buf, refname)) {
+		if (is_reflog_marker(&log))
+			continue;
+		ALLOC_GROW(logs, nr + 1, alloc);
+		memcpy(&logs[nr++], &log, sizeof(log));
+		strbuf_init(&log.refname, 0);
+		strbuf_init(&log.ident, 0);
+		strbuf_init(&log.message, 0);
+	}
+	reftable_merged_iter_free(it);
+	if (!nr && !stack_reflog_exists(st, refname)) {
+		reftable_addition_rollback(&add);
+		goto cleanup;
+	}
+
+	hashclr(last_kept_sha1);
+	(*prepare_fn)(refname, sha1, policy_cb_data);
+	for (i = nr - 1; i >= 0; i--) {
+		struct reftable_log *entry = &logs[i];
+		unsigned char *osha1 = entry->old_sha1;
+
+		if (flags & EXPIRE_REFLOGS_REWRITE)
+			osha1 = last_kept_sha1;
+
+		if ((*should_prune_fn)(osha1, entry->new_sha1, entry->ident.buf,
+				       entry->timestamp, entry->tz,
+				       entry->message.buf, policy_cb_data)) {
+			if (flags & EXPIRE_REFLOGS_DRY_RUN)
+				printf("would prune %s", entry->message.buf);
+			else if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("prune %s", entry->message.buf);
+			add_log_record(&rec, refname,
+				       entry->update_index)->deletion = 1;
+		} else {
+			if (!(flags & EXPIRE_REFLOGS_DRY_RUN)) {
+				if (hashcmp(osha1, entry->old_sha1)) {
+					struct reftable_log *rewritten =
+						add_log_record(&rec, refname,
+							       entry->update_index);
+					copy_log_record(rewritten, entry);
+					hashcpy(rewritten->old_sha1, osha1);
+				}
+				hashcpy(last_kept_sha1, entry->new_sha1);
+			}
+			kept++;
+			if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("keep %s", entry->message.buf);
+		}
+	}
+	(*cleanup_fn)(policy_cb_data);
+
+	if (flags & EXPIRE_REFLOGS_DRY_RUN) {
+		reftable_addition_rollback(&add);
+	} else {
+		/*
+		 * It doesn't make sense to adjust a reference pointed
+		 * to by a symbolic ref based on expiring entries in
+		 * the symbolic reference's reflog. Nor can we update
+		 * a reference if there are no remaining reflog
+		 * entries.
+		 */
+		if ((flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+		    !(type & REF_ISSYMREF) &&
+		    !is_null_sha1(last_kept_sha1))
+			fill_ref_value(add_ref_record(&rec, refname,
+						      add.update_index),
+				       last_kept_sha1);
+		/* an emptied reflog still exists */
+		if (!kept && nr) {
+			struct reftable_log *marker =
+				add_log_record(&rec, refname, add.update_index);
+			fill_log_ident(marker);
+			strbuf_addch(&marker->message, '\n');
+		}
+		if (commit_table_records(&add, &rec, &err))
+			status = error("unable to commit reflog '%s' (%s)",
+				       refname, err.buf);
+	}
+
+cleanup:
+	for (i = 0; i < nr; i++)
+		reftable_log_release(&logs[i]);
+	free(logs);
+	reftable_log_release(&log);
+	table_records_release(&rec);
+	strbuf_release(&err);
+	return status;
+}
+
+static int reftable_init_db(struct strbuf *err)
+{
+	char *dir = xstrfmt("%s/reftable", get_git_common_dir());
+	int ret = 0;
+
+	if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+		strbuf_addf(err, "unable to create %s: %s", dir,
+			    strerror(errno));
+		ret = -1;
+	} else if (adjust_shared_perm(dir)) {
+		strbuf_addf(err, "unable to set permissions of %s", dir);
+		ret = -1;
+	}
+	/*
+	 * Older versions of git recognize a repository by its HEAD and
+	 * refs/; give them something that points nowhere.
+	 */
+	if (!ret && access(git_path("HEAD"), F_OK) &&
+	    write_file_gently(git_path("HEAD"), "ref: refs/heads/.invalid")) {
+		strbuf_addf(err, "unable to write %s: %s", git_path("HEAD"),
+			    strerror(errno));
+		ret = -1;
+	}
+	free(dir);
+	return ret;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	"reftable",
+	reftable_init_db,
+
+	reftable_resolve_ref_unsafe,
+	reftable_peel_ref,
+	reftable_resolve_gitlink_ref,
+	reftable_do_for_each_ref,
+
+	reftable_transaction_commit,
+	reftable_initial_transaction_commit,
+	reftable_create_symref,
+	reftable_rename_ref,
+	reftable_delete_refs,
+	reftable_pack_refs,
+
+	reftable_reflog_exists,
+	reftable_create_reflog,
+	reftable_delete_reflog,
+	reftable_for_each_reflog_ent,
+	reftable_for_each_reflog_ent_reverse,
+	reftable_for_each_reflog,
+	reftable_reflog_expire
+};
@@ -0,0 +1,1458 @@
+#include "../cache.h"
+#include "../csum-file.h"
+#include "../string-list.h"
+#include "../varint.h"
+#include "reftable.h"
+
+#define REFTABLE_SIGNATURE "REFT"
+#define REFTABLE_VERSION 1
+#define REFTABLE_BLOCK_SIZE 4096
+#define REFTABLE_RESTART_INTERVAL 16
+
+#define HEADER_SIZE 24
+#define FOOTER_SIZE (HEADER_SIZE + 3 * 8)
+#define BLOCK_HEADER_SIZE 4
+#define MAX_BLOCK_LEN 0xffffff
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_LOG 'g'
+#define BLOCK_TYPE_INDEX 'i'
+
+#define TABLES_LIST "tables.list"
+
+static uint32_t get_be24(const unsigned char *p)
+{
+	return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static void put_be24(unsigned char *p, uint32_t v)
+{
+	p[0] = (v >> 16) & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = v & 0xff;
+}
+
+static void strbuf_add_varint(struct strbuf *sb, uintmax_t value)
+{
+	unsigned char buf[16];
+
+	strbuf_add(sb, buf, encode_varint(value, buf));
+}
+
+void reftable_ref_release(struct reftable_ref *ref)
+{
+	strbuf_release(&ref->refname);
+	strbuf_release(&ref->target);
+}
+
+void reftable_log_release(struct reftable_log *log)
+{
+	strbuf_release(&log->refname);
+	strbuf_release(&log->ident);
+	strbuf_release(&log->message);
+}
+
+/*
+ * Logs are keyed by refname, a NUL and the bitwise complement of the
+ * update index, so that the newest entries of a ref come first.
+ */
+static void log_key(struct strbuf *key, const char *refname, size_t len,
+		    uint64_t update_index)
+{
+	unsigned char buf[8];
+
+	strbuf_reset(key);
+	strbuf_add(key, refname, len);
+	strbuf_addch(key, '\0');
+	put_be64(buf, ~update_index);
+	strbuf_add(key, buf, sizeof(buf));
+}
+
+static int key_cmp(const struct strbuf *a, const struct strbuf *b)
+{
+	size_t len = a->len < b->len ? a->len : b->len;
+	int cmp = memcmp(a->buf, b->buf, len);
+
+	if (cmp)
+		return cmp;
+	return a->len < b->len ? -1 : a->len != b->len;
+}
+
+/*
+ * Writing.
+ */
+
+struct block_writer {
+	char type;
+	struct strbuf buf;
+	struct strbuf last_key;
+	int entries;
+	uint32_t *restarts;
+	int restart_nr, restart_alloc;
+};
+
+static void block_writer_init(struct block_writer *bw, char type)
+{
+	bw->type = type;
+	strbuf_reset(&bw->buf);
+	strbuf_addch(&bw->buf, type);
+	strbuf_addchars(&bw->buf, 0, 3); /* length, fixed up when done */
+	strbuf_reset(&bw->last_key);
+	bw->entries = 0;
+	bw->restart_nr = 0;
+}
+
+static void block_writer_release(struct block_writer *bw)
+{
+	strbuf_release(&bw->buf);
+	strbuf_release(&bw->last_key);
+	free(bw->restarts);
+}
+
+/*
+ * Append a record, prefix-compressing its key against the previous
+ * one.  Returns -1 without adding anything if the record does not fit
+ * into a block of "limit" bytes, unless the block is still empty; a
+ * limit of 0 means no limit.
+ */
+static int block_writer_add(struct block_writer *bw,
+			    const struct strbuf *key, unsigned value_type,
+			    const struct strbuf *value, size_t limit)
+{
+	size_t prefix = 0, start = bw->buf.len;
+	int restart = !(bw->entries % REFTABLE_RESTART_INTERVAL);
+
+	if (!restart)
+		while (prefix < key->len && prefix < bw->last_key.len &&
+		       key->buf[prefix] == bw->last_key.buf[prefix])
+			prefix++;
+
+	strbuf_add_varint(&bw->buf, prefix);
+	strbuf_add_varint(&bw->buf, ((key->len - prefix) << 3) | value_type);
+	strbuf_add(&bw->buf, key->buf + prefix, key->len - prefix);
+	strbuf_addbuf(&bw->buf, value);
+
+	if (limit && bw->entries &&
+	    bw->buf.len + 3 * (bw->restart_nr + restart) + 2 > limit) {
+		strbuf_setlen(&bw->buf, start);
+		return -1;
+	}
+
+	if (restart) {
+		ALLOC_GROW(bw->restarts, bw->restart_nr + 1, bw->restart_alloc);
+		bw->restarts[bw->restart_nr++] = start;
+	}
+	strbuf_reset(&bw->last_key);
+	strbuf_addbuf(&bw->last_key, key);
+	bw->entries++;
+	return 0;
+}
+
+static void block_writer_finish(struct block_writer *bw)
+{
+	unsigned char buf[3];
+	int i;
+
+	for (i = 0; i < bw->restart_nr; i++) {
+		put_be24(buf, bw->restarts[i]);
+		strbuf_add(&bw->buf, buf, 3);
+	}
+	buf[0] = (bw->restart_nr >> 8) & 0xff;
+	buf[1] = bw->restart_nr & 0xff;
+	strbuf_add(&bw->buf, buf, 2);
+
+	if (bw->buf.len > MAX_BLOCK_LEN)
+		die("reftable block too large (%"PRIuMAX" bytes)",
+		    (uintmax_t)bw->buf.len);
+	put_be24((unsigned char *)bw->buf.buf + 1, bw->buf.len);
+}
+
+struct reftable_writer {
+	struct sha1file *f;
+	uint64_t min_update_index, max_update_index;
+
+	struct block_writer block;
+	char section;
+
+	/* the last key and the position of each block of the section */
+	struct strbuf *index_keys;
+	uint64_t *index_pos;
+	int index_nr, index_alloc;
+
+	uint64_t ref_index_pos, log_pos, log_index_pos;
+
+	struct strbuf key, value;
+};
+
+static uint64_t writer_pos(struct reftable_writer *w)
+{
+	return w->f->total + w->f->offset;
+}
+
+static void write_header(unsigned char *buf, uint64_t min_update_index,
+			 uint64_t max_update_index)
+{
+	memcpy(buf, REFTABLE_SIGNATURE, 4);
+	buf[4] = REFTABLE_VERSION;
+	put_be24(buf + 5, REFTABLE_BLOCK_SIZE);
+	put_be64(buf + 8, min_update_index);
+	put_be64(buf + 16, max_update_index);
+}
+
+struct reftable_writer *reftable_writer_new(int fd, const char *name,
+					    uint64_t min_update_index,
+					    uint64_t max_update_index)
+{
+	struct reftable_writer *w = xcalloc(1, sizeof(*w));
+	unsigned char header[HEADER_SIZE];
+
+	w->f = sha1fd(fd, name);
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+	strbuf_init(&w->block.buf, REFTABLE_BLOCK_SIZE);
+	strbuf_init(&w->block.last_key, 0);
+	strbuf_init(&w->key, 0);
+	strbuf_init(&w->value, 0);
+
+	write_header(header, min_update_index, max_update_index);
+	sha1write(w->f, header, sizeof(header));
+	return w;
+}
+
+static void flush_block(struct reftable_writer *w)
+{
+	if (!w->section || !w->block.entries)
+		return;
+
+	ALLOC_GROW(w->index_keys, w->index_nr + 1, w->index_alloc);
+	REALLOC_ARRAY(w->index_pos, w->index_alloc);
+	strbuf_init(&w->index_keys[w->index_nr], 0);
+	strbuf_addbuf(&w->index_keys[w->index_nr], &w->block.last_key);
+	w->index_pos[w->index_nr++] = writer_pos(w);
+
+	block_writer_finish(&w->block);
+	sha1write(w->f, w->block.buf.buf, w->block.buf.len);
+	block_writer_init(&w->block, w->section);
+}
+
+/*
+ * Finish the current section; if it has more than one block, write
+ * an index of them and return its position.
+ */
+static uint64_t finish_section(struct reftable_writer *w)
+{
+	/* not w->value, which may hold the record that started a new section */
+	struct strbuf value = STRBUF_INIT;
+	uint64_t index_pos = 0;
+	int i;
+
+	flush_block(w);
+	if (w->index_nr > 1) {
+		index_pos = writer_pos(w);
+		block_writer_init(&w->block, BLOCK_TYPE_INDEX);
+		for (i = 0; i < w->index_nr; i++) {
+			strbuf_reset(&value);
+			strbuf_add_varint(&value, w->index_pos[i]);
+			block_writer_add(&w->block, &w->index_keys[i], 0,
+					 &value, 0);
+		}
+		block_writer_finish(&w->block);
+		sha1write(w->f, w->block.buf.buf, w->block.buf.len);
+	}
+	strbuf_release(&value);
+	for (i = 0; i < w->index_nr; i++)
+		strbuf_release(&w->index_keys[i]);
+	w->index_nr = 0;
+	w->section = 0;
+	return index_pos;
+}
+
+static void writer_add(struct reftable_writer *w, char section,
+		       unsigned value_type)
+{
+	if (w->section != section) {
+		if (w->section == BLOCK_TYPE_REF)
+			w->ref_index_pos = finish_section(w);
+		if (section == BLOCK_TYPE_REF && (w->log_pos || w->ref_index_pos))
+			die("BUG: reftable refs must be written before logs");
+		if (section == BLOCK_TYPE_LOG)
+			w->log_pos = writer_pos(w);
+		w->section = section;
+		block_writer_init(&w->block, section);
+	} else if (key_cmp(&w->block.last_key, &w->key) >= 0 &&
+		   w->block.entries) {
+		die("BUG: reftable records added out of order");
+	}
+
+	if (block_writer_add(&w->block, &w->key, value_type, &w->value,
+			     REFTABLE_BLOCK_SIZE)) {
+		flush_block(w);
+		block_writer_add(&w->block, &w->key, value_type, &w->value,
+				 REFTABLE_BLOCK_SIZE);
+	}
+}
+
+void reftable_writer_add_ref(struct reftable_writer *w,
+			     const struct reftable_ref *ref)
+{
+	if (ref->update_index < w->min_update_index ||
+	    ref->update_index > w->max_update_index)
+		die("BUG: update index of %s out of the range of the table",
+		    ref->refname.buf);
+
+	strbuf_reset(&w->key);
+	strbuf_addbuf(&w->key, &ref->refname);
+	strbuf_reset(&w->value);
+	strbuf_add_varint(&w->value, ref->update_index - w->min_update_index);
+	switch (ref->value_type) {
+	case REFTABLE_DELETION:
+		break;
+	case REFTABLE_VAL2:
+		strbuf_add(&w->value, ref->value, 20);
+		strbuf_add(&w->value, ref->peeled, 20);
+		break;
+	case REFTABLE_VAL1:
+		strbuf_add(&w->value, ref->value, 20);
+		break;
+	case REFTABLE_SYMREF:
+		strbuf_add_varint(&w->value, ref->target.len);
+		strbuf_addbuf(&w->value, &ref->target);
+		break;
+	}
+	writer_add(w, BLOCK_TYPE_REF, ref->value_type);
+}
+
+void reftable_writer_add_log(struct reftable_writer *w,
+			     const struct reftable_log *log)
+{
+	unsigned char buf[2];
+
+	log_key(&w->key, log->refname.buf, log->refname.len,
+		log->update_index);
+	strbuf_reset(&w->value);
+	if (!log->deletion) {
+		strbuf_add(&w->value, log->old_sha1, 20);
+		strbuf_add(&w->value, log->new_sha1, 20);
+		strbuf_add_varint(&w->value, log->ident.len);
+		strbuf_addbuf(&w->value, &log->ident);
+		strbuf_add_varint(&w->value, log->timestamp);
+		buf[0] = ((uint16_t)log->tz >> 8) & 0xff;
+		buf[1] = (uint16_t)log->tz & 0xff;
+		strbuf_add(&w->value, buf, 2);
+		strbuf_add_varint(&w->value, log->message.len);
+		strbuf_addbuf(&w->value, &log->message);
+	}
+	writer_add(w, BLOCK_TYPE_LOG, !log->deletion);
+}
+
+int reftable_writer_finish(struct reftable_writer *w)
+{
+	unsigned char footer[FOOTER_SIZE];
+
+	if (w->section == BLOCK_TYPE_REF)
+		w->ref_index_pos = finish_section(w);
+	else if (w->section == BLOCK_TYPE_LOG)
+		w->log_index_pos = finish_section(w);
+
+	write_header(footer, w->min_update_index, w->max_update_index);
+	put_be64(footer + HEADER_SIZE, w->ref_index_pos);
+	put_be64(footer + HEADER_SIZE + 8, w->log_pos);
+	put_be64(footer + HEADER_SIZE + 16, w->log_index_pos);
+	sha1write(w->f, footer, sizeof(footer));
+	sha1close(w->f, NULL, CSUM_CLOSE | CSUM_FSYNC);
+
+	block_writer_release(&w->block);
+	free(w->index_keys);
+	free(w->index_pos);
+	strbuf_release(&w->key);
+	strbuf_release(&w->value);
+	free(w);
+	return 0;
+}
+
+/*
+ * Reading.
+ */
+
+struct reftable {
+	char *name;
+	const unsigned char *map;
+	size_t size;
+	uint64_t min_update_index, max_update_index;
+
+	/* the sections are [start, end), with end == start if empty */
+	size_t ref_start, ref_end, ref_index;
+	size_t log_start, log_end, log_index;
+
+	/*
+	 * The stack and every iterator over the table hold a reference,
+	 * so that a table that is compacted away or dropped by a reload
+	 * stays mapped while it is being read.
+	 */
+	int refcount;
+};
+
+static void reftable_close(struct reftable *t)
+{
+	if (--t->refcount)
+		return;
+	munmap((void *)t->map, t->size);
+	free(t->name);
+	free(t);
+}
+
+static struct reftable *reftable_open(const char *dir, const char *name)
+{
+	struct reftable *t;
+	const unsigned char *footer;
+	uint64_t ref_index, log_start, log_index;
+	size_t footer_pos;
+	struct stat st;
+	char *path = xstrfmt("%s/%s", dir, name);
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		free(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		free(path);
+		return NULL;
+	}
+	if (xsize_t(st.st_size) < HEADER_SIZE + FOOTER_SIZE + 20) {
+		close(fd);
+		error("reftable %s is too short", path);
+		free(path);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	t = xcalloc(1, sizeof(*t));
+	t->name = xstrdup(name);
+	t->refcount = 1;
+	t->size = xsize_t(st.st_size);
+	t->map = xmmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	footer_pos = t->size - 20 - FOOTER_SIZE;
+	footer = t->map + footer_pos;
+	if (memcmp(t->map, REFTABLE_SIGNATURE, 4) ||
+	    t->map[4] != REFTABLE_VERSION ||
+	    memcmp(t->map, footer, HEADER_SIZE))
+		goto corrupt;
+
+	t->min_update_index = get_be64(t->map + 8);
+	t->max_update_index = get_be64(t->map + 16);
+	ref_index = get_be64(footer + HEADER_SIZE);
+	log_start = get_be64(footer + HEADER_SIZE + 8);
+	log_index = get_be64(footer + HEADER_SIZE + 16);
+	if (ref_index > footer_pos || log_start > footer_pos ||
+	    log_index > footer_pos)
+		goto corrupt;
+
+	t->ref_start = HEADER_SIZE;
+	t->ref_end = ref_index ? ref_index : log_start ? log_start : footer_pos;
+	t->ref_index = ref_index;
+	t->log_start = log_start ? log_start : footer_pos;
+	t->log_end = log_index ? log_index : footer_pos;
+	t->log_index = log_index;
+	if (t->ref_end < t->ref_start || t->log_end < t->log_start)
+		goto corrupt;
+
+	free(path);
+	return t;
+
+corrupt:
+	error("reftable %s is corrupt", path);
+	free(path);
+	reftable_close(t);
+	errno = EINVAL;
+	return NULL;
+}
+
+/*
+ * Iterating over the records of one block.
+ */
+struct block_iter {
+	const unsigned char *block;
+	size_t len;
+	size_t next;		/* offset of the next record */
+	size_t records_end;
+	int restart_nr;
+	struct strbuf key;
+};
+
+static int block_iter_init(struct block_iter *bi, const unsigned char *block,
+			   size_t avail, char type)
+{
+	size_t len;
+
+	if (avail < BLOCK_HEADER_SIZE + 2 || block[0] != type)
+		return -1;
+	len = get_be24(block + 1);
+	if (len > avail || len < BLOCK_HEADER_SIZE + 2)
+		return -1;
+	bi->block = block;
+	bi->len = len;
+	bi->restart_nr = get_be16(block + len - 2);
+	if (BLOCK_HEADER_SIZE + 2 + 3 * bi->restart_nr > len)
+		return -1;
+	bi->records_end = len - 2 - 3 * bi->restart_nr;
+	bi->next = BLOCK_HEADER_SIZE;
+	strbuf_reset(&bi->key);
+	return 0;
+}
+
+static size_t block_restart(struct block_iter *bi, int i)
+{
+	return get_be24(bi->block + bi->records_end + 3 * i);
+}
+
+/*
+ * Decode the key of the record at bi->next into bi->key, and return
+ * a pointer to its value, or NULL if the block is corrupt.  The
+ * decoders of the values move bi->next past the record.
+ */
+static const unsigned char *block_iter_decode_key(struct block_iter *bi,
+						  unsigned *value_type)
+{
+	const unsigned char *p = bi->block + bi->next;
+	const unsigned char *end = bi->block + bi->records_end;
+	uintmax_t prefix, suffix;
+
+	prefix = decode_varint(&p);
+	suffix = decode_varint(&p);
+	*value_type = suffix & 7;
+	suffix >>= 3;
+	if (p > end || prefix > bi->key.len || suffix > end - p)
+		return NULL;
+	strbuf_setlen(&bi->key, prefix);
+	strbuf_add(&bi->key, p, suffix);
+	return p + suffix;
+}
+
+/*
+ * Position bi at the first record whose key is not less than key:
+ * binary search over the restart points, whose keys are stored in
+ * full, then scan forward.  Returns a pointer to the value of that
+ * record, whose key is left in bi->key, or NULL with *status set to 1
+ * if there is no such record in the block and to -1 on corruption.
+ */
+static const unsigned char *block_iter_seek(struct block_iter *bi,
+					    const struct strbuf *key,
+					    const unsigned char *(*skip)(struct block_iter *,
+									 const unsigned char *,
+									 unsigned),
+					    unsigned *value_type, int *status)
+{
+	int lo = 0, hi = bi->restart_nr;
+	const unsigned char *p;
+
+	*status = -1;
+	if (!bi->restart_nr) {
+		*status = 1;
+		return NULL;
+	}
+
+	/* find the last restart point whose key is not greater */
+	while (hi - lo > 1) {
+		int mi = lo + (hi - lo) / 2;
+
+		bi->next = block_restart(bi, mi);
+		strbuf_reset(&bi->key);
+		if (bi->next >= bi->records_end ||
+		    !block_iter_decode_key(bi, value_type))
+			return NULL;
+		if (key_cmp(&bi->key, key) > 0)
+			hi = mi;
+		else
+			lo = mi;
+	}
+
+	bi->next = block_restart(bi, lo);
+	strbuf_reset(&bi->key);
+	while (bi->next < bi->records_end) {
+		p = block_iter_decode_key(bi, value_type);
+		if (!p)
+			return NULL;
+		if (key_cmp(&bi->key, key) >= 0)
+			return p;
+		p = skip(bi, p, *value_type);
+		if (!p)
+			return NULL;
+		bi->next = p - bi->block;
+	}
+	*status = 1;
+	return NULL;
+}
+
+static const unsigned char *skip_ref_value(struct block_iter *bi,
+					   const unsigned char *p,
+					   unsigned value_type)
+{
+	decode_varint(&p);
+	switch (value_type) {
+	case REFTABLE_DELETION:
+		break;
+	case REFTABLE_VAL1:
+		p += 20;
+		break;
+	case REFTABLE_VAL2:
+		p += 40;
+		break;
+	case REFTABLE_SYMREF:
+		p += decode_varint(&p);
+		break;
+	default:
+		return NULL;
+	}
+	return p > bi->block + bi->records_end ? NULL : p;
+}
+
+static const unsigned char *skip_log_value(struct block_iter *bi,
+					   const unsigned char *p,
+					   unsigned value_type)
+{
+	if (value_type) {
+		p += 40;
+		p += decode_varint(&p);
+		decode_varint(&p);
+		p += 2;
+		p += decode_varint(&p);
+	}
+	return p > bi->block + bi->records_end ? NULL : p;
+}
+
+static const unsigned char *skip_index_value(struct block_iter *bi,
+					     const unsigned char *p,
+					     unsigned value_type)
+{
+	decode_varint(&p);
+	return p > bi->block + bi->records_end ? NULL : p;
+}
+
+/*
+ * Iterating over one section of a table.
+ */
+struct table_iter {
+	struct reftable *table;
+	char type;
+	size_t end;		/* of the section */
+	size_t block_pos;
+	struct block_iter bi;
+	int finished;
+
+	/* the current record */
+	unsigned value_type;
+	struct reftable_ref ref;
+	struct reftable_log log;
+};
+
+static void table_iter_init(struct table_iter *ti, struct reftable *t, char type)
+{
+	memset(ti, 0, sizeof(*ti));
+	ti->table = t;
+	ti->type = type;
+	strbuf_init(&ti->bi.key, 0);
+	strbuf_init(&ti->ref.refname, 0);
+	strbuf_init(&ti->ref.target, 0);
+	strbuf_init(&ti->log.refname, 0);
+	strbuf_init(&ti->log.ident, 0);
+	strbuf_init(&ti->log.message, 0);
+}
+
+static void table_iter_release(struct table_iter *ti)
+{
+	strbuf_release(&ti->bi.key);
+	reftable_ref_release(&ti->ref);
+	reftable_log_release(&ti->log);
+}
+
+static int table_iter_corrupt(struct table_iter *ti)
+{
+	ti->finished = 1;
+	return error("reftable %s is corrupt", ti->table->name);
+}
+
+static int table_iter_start_block(struct table_iter *ti, size_t pos)
+{
+	ti->block_pos = pos;
+	if (pos >= ti->end) {
+		ti->finished = 1;
+		return 1;
+	}
+	if (block_iter_init(&ti->bi, ti->table->map + pos, ti->end - pos,
+			    ti->type))
+		return table_iter_corrupt(ti);
+	return 0;
+}
+
+static int decode_ref(struct table_iter *ti, const unsigned char *p)
+{
+	struct reftable_ref *ref = &ti->ref;
+	const unsigned char *end = ti->bi.block + ti->bi.records_end;
+	uintmax_t len;
+
+	strbuf_reset(&ref->refname);
+	strbuf_addbuf(&ref->refname, &ti->bi.key);
+	ref->update_index = ti->table->min_update_index + decode_varint(&p);
+	ref->value_type = ti->value_type;
+	strbuf_reset(&ref->target);
+	switch (ti->value_type) {
+	case REFTABLE_DELETION:
+		break;
+	case REFTABLE_VAL2:
+		if (end - p < 40)
+			return -1;
+		hashcpy(ref->value, p);
+		hashcpy(ref->peeled, p + 20);
+		p += 40;
+		break;
+	case REFTABLE_VAL1:
+		if (end - p < 20)
+			return -1;
+		hashcpy(ref->value, p);
+		hashclr(ref->peeled);
+		p += 20;
+		break;
+	case REFTABLE_SYMREF:
+		len = decode_varint(&p);
+		if (p > end || len > end - p)
+			return -1;
+		strbuf_add(&ref->target, p, len);
+		p += len;
+		break;
+	default:
+		return -1;
+	}
+	if (p > end)
+		return -1;
+	ti->bi.next = p - ti->bi.block;
+	return 0;
+}
+
+static int decode_log(struct table_iter *ti, const unsigned char *p)
+{
+	struct reftable_log *log = &ti->log;
+	const unsigned char *end = ti->bi.block + ti->bi.records_end;
+	const struct strbuf *key = &ti->bi.key;
+	uintmax_t len;
+
+	if (key->len < 9 || key->buf[key->len - 9])
+		return -1;
+	strbuf_reset(&log->refname);
+	strbuf_add(&log->refname, key->buf, key->len - 9);
+	log->update_index = ~get_be64(key->buf + key->len - 8);
+	log->deletion = !ti->value_type;
+	strbuf_reset(&log->ident);
+	strbuf_reset(&log->message);
+	if (!log->deletion) {
+		if (end - p < 40)
+			return -1;
+		hashcpy(log->old_sha1, p);
+		hashcpy(log->new_sha1, p + 20);
+		p += 40;
+		len = decode_varint(&p);
+		if (p > end || len > end - p)
+			return -1;
+		strbuf_add(&log->ident, p, len);
+		p += len;
+		log->timestamp = decode_varint(&p);
+		if (p > end || end - p < 2)
+			return -1;
+		log->tz = (int16_t)get_be16(p);
+		p += 2;
+		len = decode_varint(&p);
+		if (p > end || len > end - p)
+			return -1;
+		strbuf_add(&log->message, p, len);
+		p += len;
+	}
+	ti->bi.next = p - ti->bi.block;
+	return 0;
+}
+
+static int table_iter_decode(struct table_iter *ti, const unsigned char *p)
+{
+	if (!p ||
+	    (ti->type == BLOCK_TYPE_REF ? decode_ref(ti, p) : decode_log(ti, p)))
+		return table_iter_corrupt(ti);
+	return 0;
+}
+
+/* Returns 0 for a record, 1 at the end and -1 on error */
+static int table_iter_next(struct table_iter *ti)
+{
+	if (ti->finished)
+		return 1;
+	while (ti->bi.next >= ti->bi.records_end) {
+		int ret = table_iter_start_block(ti, ti->block_pos + ti->bi.len);
+		if (ret)
+			return ret;
+	}
+	return table_iter_decode(ti, block_iter_decode_key(&ti->bi,
+							   &ti->value_type));
+}
+
+/*
+ * Position the iterator on the first record whose key is not less
+ * than key.  Returns like table_iter_next().
+ */
+static int table_iter_seek(struct table_iter *ti, const struct strbuf *key)
+{
+	struct reftable *t = ti->table;
+	size_t start, pos, index;
+	const unsigned char *p;
+	int status;
+
+	if (ti->type == BLOCK_TYPE_REF) {
+		start = t->ref_start;
+		ti->end = t->ref_end;
+		index = t->ref_index;
+	} else {
+		start = t->log_start;
+		ti->end = t->log_end;
+		index = t->log_index;
+	}
+	ti->finished = 0;
+	pos = start;
+
+	if (index) {
+		/* the first block whose last key is not less than key */
+		struct block_iter ib;
+		unsigned value_type;
+
+		strbuf_init(&ib.key, 0);
+		if (block_iter_init(&ib, t->map + index,
+				    t->size - 20 - FOOTER_SIZE - index,
+				    BLOCK_TYPE_INDEX)) {
+			strbuf_release(&ib.key);
+			return table_iter_corrupt(ti);
+		}
+		p = block_iter_seek(&ib, key, skip_index_value,
+				    &value_type, &status);
+		strbuf_release(&ib.key);
+		if (!p) {
+			if (status < 0)
+				return table_iter_corrupt(ti);
+			ti->finished = 1;
+			return 1;
+		}
+		pos = decode_varint(&p);
+		if (pos < start || pos >= ti->end)
+			return table_iter_corrupt(ti);
+	}
+
+	status = table_iter_start_block(ti, pos);
+	if (status)
+		return status;
+	p = block_iter_seek(&ti->bi, key,
+			    ti->type == BLOCK_TYPE_REF ?
+			    skip_ref_value : skip_log_value,
+			    &ti->value_type, &status);
+	if (p)
+		return table_iter_decode(ti, p);
+	if (status < 0)
+		return table_iter_corrupt(ti);
+	/* everything in this block sorts before key */
+	ti->bi.next = ti->bi.records_end;
+	return table_iter_next(ti);
+}
+
+/*
+ * Iterating over the merged records of several tables.  A record in a
+ * later table overrides records with the same key in earlier ones.
+ */
+struct reftable_merged_iter {
+	struct table_iter *subs;
+	int *has_record;
+	int nr;
+	int include_deletions;
+	int error;
+};
+
+static void merged_iter_advance(struct reftable_merged_iter *it, int i)
+{
+	int ret = table_iter_next(&it->subs[i]);
+
+	it->has_record[i] = !ret;
+	if (ret < 0)
+		it->error = 1;
+}
+
+static struct reftable_merged_iter *merged_iter_new(struct reftable **tables,
+						    int nr, char type,
+						    const struct strbuf *key,
+						    int include_deletions)
+{
+	struct reftable_merged_iter *it = xcalloc(1, sizeof(*it));
+	int i;
+
+	it->nr = nr;
+	it->include_deletions = include_deletions;
+	it->subs = xcalloc(nr, sizeof(*it->subs));
+	it->has_record = xcalloc(nr, sizeof(*it->has_record));
+	for (i = 0; i < nr; i++) {
+		int ret;
+
+		tables[i]->refcount++;
+		table_iter_init(&it->subs[i], tables[i], type);
+		ret = table_iter_seek(&it->subs[i], key);
+		it->has_record[i] = !ret;
+		if (ret < 0)
+			it->error = 1;
+	}
+	return it;
+}
+
+void reftable_merged_iter_free(struct reftable_merged_iter *it)
+{
+	int i;
+
+	if (!it)
+		return;
+	for (i = 0; i < it->nr; i++) {
+		table_iter_release(&it->subs[i]);
+		reftable_close(it->subs[i].table);
+	}
+	free(it->subs);
+	free(it->has_record);
+	free(it);
+}
+
+/*
+ * Return the index of the table holding the next record and advance
+ * all the others past its key, or -1 at the end.
+ */
+static int merged_iter_next(struct reftable_merged_iter *it)
+{
+	for (;;) {
+		int i, best = -1;
+		struct table_iter *ti;
+
+		for (i = 0; i < it->nr; i++) {
+			if (!it->has_record[i])
+				continue;
+			/* a later table wins a tie */
+			if (best < 0 ||
+			    key_cmp(&it->subs[i].bi.key, &it->subs[best].bi.key) <= 0)
+				best = i;
+		}
+		if (best < 0)
+			return -1;
+
+		for (i = 0; i < it->nr; i++)
+			if (i != best && it->has_record[i] &&
+			    !key_cmp(&it->subs[i].bi.key, &it->subs[best].bi.key))
+				merged_iter_advance(it, i);
+
+		ti = &it->subs[best];
+		if (it->include_deletions ||
+		    (ti->type == BLOCK_TYPE_REF ?
+		     ti->ref.value_type != REFTABLE_DELETION :
+		     !ti->log.deletion))
+			return best;
+		merged_iter_advance(it, best);
+	}
+}
+
+int reftable_merged_iter_next_ref(struct reftable_merged_iter *it,
+				  struct reftable_ref *ref)
+{
+	struct table_iter *ti;
+	int i = merged_iter_next(it);
+
+	if (i < 0)
+		return it->error ? -1 : 1;
+	ti = &it->subs[i];
+	strbuf_reset(&ref->refname);
+	strbuf_addbuf(&ref->refname, &ti->ref.refname);
+	ref->update_index = ti->ref.update_index;
+	ref->value_type = ti->ref.value_type;
+	hashcpy(ref->value, ti->ref.value);
+	hashcpy(ref->peeled, ti->ref.peeled);
+	strbuf_reset(&ref->target);
+	strbuf_addbuf(&ref->target, &ti->ref.target);
+	merged_iter_advance(it, i);
+	return 0;
+}
+
+int reftable_merged_iter_next_log(struct reftable_merged_iter *it,
+				  struct reftable_log *log)
+{
+	struct table_iter *ti;
+	int i = merged_iter_next(it);
+
+	if (i < 0)
+		return it->error ? -1 : 1;
+	ti = &it->subs[i];
+	strbuf_reset(&log->refname);
+	strbuf_addbuf(&log->refname, &ti->log.refname);
+	log->update_index = ti->log.update_index;
+	log->deletion = ti->log.deletion;
+	hashcpy(log->old_sha1, ti->log.old_sha1);
+	hashcpy(log->new_sha1, ti->log.new_sha1);
+	strbuf_reset(&log->ident);
+	strbuf_addbuf(&log->ident, &ti->log.ident);
+	log->timestamp = ti->log.timestamp;
+	log->tz = ti->log.tz;
+	strbuf_reset(&log->message);
+	strbuf_addbuf(&log->message, &ti->log.message);
+	merged_iter_advance(it, i);
+	return 0;
+}
+
+/*
+ * The stack.
+ */
+
+int reftable_stack_open(struct reftable_stack *st, char *dir)
+{
+	memset(st, 0, sizeof(*st));
+	st->dir = dir;
+	return reftable_stack_reload(st);
+}
+
+static void close_tables(struct reftable **tables, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		reftable_close(tables[i]);
+}
+
+void reftable_stack_release(struct reftable_stack *st)
+{
+	close_tables(st->tables, st->nr);
+	free(st->tables);
+	stat_validity_clear(&st->list_validity);
+	free(st->dir);
+	memset(st, 0, sizeof(*st));
+}
+
+static int read_tables_list(struct reftable_stack *st, struct string_list *names)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char *path = xstrfmt("%s/%s", st->dir, TABLES_LIST);
+	int fd = open(path, O_RDONLY);
+
+	free(path);
+	if (fd < 0) {
+		stat_validity_clear(&st->list_validity);
+		return errno == ENOENT ? 0 : -1;
+	}
+	stat_validity_update(&st->list_validity, fd);
+	if (strbuf_read(&buf, fd, 0) < 0) {
+		close(fd);
+		strbuf_release(&buf);
+		return -1;
+	}
+	close(fd);
+	string_list_split(names, buf.buf, '\n', -1);
+	if (names->nr && !*names->items[names->nr - 1].string)
+		names->nr--; /* the empty string after the final LF */
+	strbuf_release(&buf);
+	return 0;
+}
+
+int reftable_stack_reload(struct reftable_stack *st)
+{
+	char *path = xstrfmt("%s/%s", st->dir, TABLES_LIST);
+	int tries;
+
+	if (st->list_validity.sd && stat_validity_check(&st->list_validity, path)) {
+		free(path);
+		return 0;
+	}
+	free(path);
+
+	/*
+	 * A table we are about to open may have been compacted away
+	 * after we read the list; read it again in that case.
+	 */
+	for (tries = 0; tries < 5; tries++) {
+		struct string_list names = STRING_LIST_INIT_DUP;
+		struct reftable **tables;
+		int *reused, *opened;
+		int i, j, missing = 0;
+
+		if (read_tables_list(st, &names)) {
+			string_list_clear(&names, 0);
+			return error("unable to read %s/%s: %s", st->dir,
+				     TABLES_LIST, strerror(errno));
+		}
+		tables = xcalloc(names.nr + 1, sizeof(*tables));
+		opened = xcalloc(names.nr + 1, sizeof(*opened));
+		reused = xcalloc(st->nr + 1, sizeof(*reused));
+		for (i = 0; i < names.nr; i++) {
+			const char *name = names.items[i].string;
+
+			/* reuse the tables we have open already */
+			for (j = 0; j < st->nr; j++)
+				if (!reused[j] && !strcmp(st->tables[j]->name, name))
+					break;
+			if (j < st->nr) {
+				reused[j] = 1;
+				tables[i] = st->tables[j];
+				continue;
+			}
+			tables[i] = reftable_open(st->dir, name);
+			if (!tables[i]) {
+				missing = errno == ENOENT;
+				break;
+			}
+			opened[i] = 1;
+		}
+
+		if (i < names.nr) {
+			for (j = 0; j < i; j++)
+				if (opened[j])
+					reftable_close(tables[j]);
+		} else {
+			for (j = 0; j < st->nr; j++)
+				if (!reused[j])
+					reftable_close(st->tables[j]);
+			free(st->tables);
+			st->tables = tables;
+			st->nr = names.nr;
+			st->alloc = names.nr + 1;
+			tables = NULL;
+		}
+		free(tables);
+		free(opened);
+		free(reused);
+		if (i == names.nr) {
+			string_list_clear(&names, 0);
+			return 0;
+		}
+		string_list_clear(&names, 0);
+		stat_validity_clear(&st->list_validity);
+		if (!missing)
+			return -1;
+	}
+	return error("reftables in %s keep changing", st->dir);
+}
+
+struct reftable_merged_iter *reftable_stack_seek_ref(struct reftable_stack *st,
+						     const char *refname,
+						     int include_deletions)
+{
+	struct reftable_merged_iter *it;
+	struct strbuf key = STRBUF_INIT;
+
+	strbuf_addstr(&key, refname);
+	it = merged_iter_new(st->tables, st->nr, BLOCK_TYPE_REF, &key,
+			     include_deletions);
+	strbuf_release(&key);
+	return it;
+}
+
+struct reftable_merged_iter *reftable_stack_seek_log(struct reftable_stack *st,
+						     const char *refname,
+						     int include_deletions)
+{
+	struct reftable_merged_iter *it;
+	struct strbuf key = STRBUF_INIT;
+
+	if (*refname)
+		log_key(&key, refname, strlen(refname), UINT64_MAX);
+	it = merged_iter_new(st->tables, st->nr, BLOCK_TYPE_LOG, &key,
+			     include_deletions);
+	strbuf_release(&key);
+	return it;
+}
+
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref *ref)
+{
+	struct reftable_merged_iter *it = reftable_stack_seek_ref(st, refname, 1);
+	int ret = reftable_merged_iter_next_ref(it, ref);
+
+	reftable_merged_iter_free(it);
+	if (!ret && strcmp(ref->refname.buf, refname))
+		ret = 1;
+	return ret;
+}
+
+/*
+ * Adding to the stack.
+ */
+
+static int open_new_table(struct reftable_addition *add,
+			  uint64_t min_update_index, uint64_t max_update_index,
+			  struct strbuf *path, struct strbuf *err)
+{
+	int fd;
+
+	strbuf_reset(path);
+	strbuf_addf(path, "%s/%012"PRIx64"-%012"PRIx64"-XXXXXX",
+		    add->stack->dir, min_update_index, max_update_index);
+	fd = git_mkstemp_mode(path->buf, 0444);
+	if (fd < 0)
+		strbuf_addf(err, "unable to create temporary reftable in %s: %s",
+			    add->stack->dir, strerror(errno));
+	return fd;
+}
+
+/*
+ * Give the table that was written to path its final name and open
+ * it; it becomes part of the stack when the addition is committed.
+ */
+static struct reftable *install_new_table(struct reftable_addition *add,
+					  struct strbuf *path,
+					  struct strbuf *err)
+{
+	struct reftable *t;
+	size_t tmp_len = path->len;
+	char *tmp = xstrdup(path->buf);
+
+	adjust_shared_perm(tmp);
+	strbuf_addstr(path, ".ref");
+	if (rename(tmp, path->buf)) {
+		strbuf_addf(err, "unable to rename %s: %s", tmp, strerror(errno));
+		unlink_or_warn(tmp);
+		free(tmp);
+		return NULL;
+	}
+	free(tmp);
+
+	string_list_append(&add->new_tables, path->buf + strlen(add->stack->dir) + 1);
+	t = reftable_open(add->stack->dir, path->buf + strlen(add->stack->dir) + 1);
+	if (!t)
+		strbuf_addf(err, "unable to read back %s", path->buf);
+	strbuf_setlen(path, tmp_len);
+	return t;
+}
+
+int reftable_addition_begin(struct reftable_addition *add,
+			    struct reftable_stack *st,
+			    struct lock_file *lock,
+			    struct strbuf *err)
+{
+	char *path = xstrfmt("%s/%s", st->dir, TABLES_LIST);
+
+	memset(add, 0, sizeof(*add));
+	add->stack = st;
+	add->lock = lock;
+	string_list_init(&add->new_tables, 1);
+	string_list_init(&add->obsolete_tables, 1);
+
+	if (hold_lock_file_for_update_timeout(lock, path, 0, 1000) < 0) {
+		unable_to_lock_message(path, errno, err);
+		free(path);
+		return -1;
+	}
+	free(path);
+
+	/* the stack cannot change under us from now on */
+	if (reftable_stack_reload(st)) {
+		rollback_lock_file(lock);
+		strbuf_addf(err, "unable to read the reftables in %s", st->dir);
+		return -1;
+	}
+	add->update_index = st->nr ?
+		st->tables[st->nr - 1]->max_update_index + 1 : 1;
+	return 0;
+}
+
+int reftable_addition_add(struct reftable_addition *add,
+			  reftable_write_fn *fn, void *cb_data,
+			  struct strbuf *err)
+{
+	struct reftable_stack *st = add->stack;
+	struct reftable_writer *w;
+	struct reftable *t;
+	struct strbuf path = STRBUF_INIT;
+	int fd, ret;
+
+	fd = open_new_table(add, add->update_index, add->update_index,
+			    &path, err);
+	if (fd < 0) {
+		strbuf_release(&path);
+		return -1;
+	}
+	w = reftable_writer_new(fd, path.buf, add->update_index,
+				add->update_index);
+	ret = fn(w, add->update_index, cb_data);
+	reftable_writer_finish(w);
+	if (ret) {
+		unlink_or_warn(path.buf);
+		strbuf_release(&path);
+		return ret;
+	}
+
+	t = install_new_table(add, &path, err);
+	strbuf_release(&path);
+	if (!t)
+		return -1;
+	ALLOC_GROW(st->tables, st->nr + 1, st->alloc);
+	st->tables[st->nr++] = t;
+	add->update_index++;
+	return 0;
+}
+
+/*
+ * Replace the tables [first, st->nr) of the stack with a single one.
+ * Deletions can only be dropped if there is no older table in which
+ * they would uncover a record.
+ */
+static int compact_tables(struct reftable_addition *add, int first,
+			  struct strbuf *err)
+{
+	struct reftable_stack *st = add->stack;
+	struct reftable_ref ref = REFTABLE_REF_INIT;
+	struct reftable_log log = REFTABLE_LOG_INIT;
+	struct reftable_merged_iter *it;
+	struct reftable_writer *w;
+	struct reftable *t;
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf key = STRBUF_INIT;
+	int i, fd, ret;
+
+	fd = open_new_table(add, st->tables[first]->min_update_index,
+			    st->tables[st->nr - 1]->max_update_index,
+			    &path, err);
+	if (fd < 0) {
+		strbuf_release(&path);
+		return -1;
+	}
+	w = reftable_writer_new(fd, path.buf,
+				st->tables[first]->min_update_index,
+				st->tables[st->nr - 1]->max_update_index);
+
+	it = merged_iter_new(st->tables + first, st->nr - first,
+			     BLOCK_TYPE_REF, &key, first > 0);
+	while (!(ret = reftable_merged_iter_next_ref(it, &ref)))
+		reftable_writer_add_ref(w, &ref);
+	reftable_merged_iter_free(it);
+	if (ret > 0) {
+		it = merged_iter_new(st->tables + first, st->nr - first,
+				     BLOCK_TYPE_LOG, &key, first > 0);
+		while (!(ret = reftable_merged_iter_next_log(it, &log)))
+			reftable_writer_add_log(w, &log);
+		reftable_merged_iter_free(it);
+	}
+	reftable_writer_finish(w);
+	reftable_ref_release(&ref);
+	reftable_log_release(&log);
+	strbuf_release(&key);
+
+	if (ret < 0) {
+		strbuf_addf(err, "unable to compact the reftables in %s",
+			    st->dir);
+		unlink_or_warn(path.buf);
+		strbuf_release(&path);
+		return -1;
+	}
+
+	t = install_new_table(add, &path, err);
+	strbuf_release(&path);
+	if (!t)
+		return -1;
+	for (i = first; i < st->nr; i++) {
+		string_list_append(&add->obsolete_tables, st->tables[i]->name);
+		reftable_close(st->tables[i]);
+	}
+	st->tables[first] = t;
+	st->nr = first + 1;
+	return 0;
+}
+
+/*
+ * Keep the stack geometric: compact the top tables for as long as
+ * the one below them is not at least twice as large as they are
+ * together.  The number of tables thus stays logarithmic in the
+ * number of refs and updates, and each record is rewritten only a
+ * logarithmic number of times.
+ */
+static int auto_compact(struct reftable_addition *add, struct strbuf *err)
+{
+	struct reftable_stack *st = add->stack;
+	int first = st->nr - 1;
+	size_t total;
+
+	if (st->nr < 2)
+		return 0;
+	total = st->tables[first]->size;
+	while (first > 0 && st->tables[first - 1]->size <= 2 * total)
+		total += st->tables[--first]->size;
+	if (first == st->nr - 1)
+		return 0;
+	return compact_tables(add, first, err);
+}
+
+int reftable_addition_compact_all(struct reftable_addition *add,
+				  struct strbuf *err)
+{
+	if (!add->stack->nr)
+		return 0;
+	return compact_tables(add, 0, err);
+}
+
+int reftable_addition_commit(struct reftable_addition *add,
+			     struct strbuf *err)
+{
+	struct reftable_stack *st = add->stack;
+	struct strbuf list = STRBUF_INIT;
+	struct string_list_item *item;
+	char *path;
+	int i, fd;
+
+	if (auto_compact(add, err)) {
+		/* not fatal; the next update will try again */
+		warning("%s", err->buf);
+		strbuf_reset(err);
+	}
+
+	for (i = 0; i < st->nr; i++)
+		strbuf_addf(&list, "%s\n", st->tables[i]->name);
+	if (write_in_full(get_lock_file_fd(add->lock), list.buf, list.len) != list.len ||
+	    commit_lock_file(add->lock)) {
+		strbuf_addf(err, "unable to write %s/%s: %s",
+			    st->dir, TABLES_LIST, strerror(errno));
+		strbuf_release(&list);
+		reftable_addition_rollback(add);
+		return -1;
+	}
+	strbuf_release(&list);
+
+	for_each_string_list_item(item, &add->obsolete_tables) {
+		char *table = xstrfmt("%s/%s", st->dir, item->string);
+		unlink_or_warn(table);
+		free(table);
+	}
+	string_list_clear(&add->new_tables, 0);
+	string_list_clear(&add->obsolete_tables, 0);
+
+	/* what we have in memory is what we just wrote */
+	path = xstrfmt("%s/%s", st->dir, TABLES_LIST);
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0) {
+		stat_validity_clear(&st->list_validity);
+	} else {
+		stat_validity_update(&st->list_validity, fd);
+		close(fd);
+	}
+	return 0;
+}
+
+void reftable_addition_rollback(struct reftable_addition *add)
+{
+	struct reftable_stack *st = add->stack;
+	struct string_list_item *item;
+
+	rollback_lock_file(add->lock);
+	for_each_string_list_item(item, &add->new_tables) {
+		char *table = xstrfmt("%s/%s", st->dir, item->string);
+		unlink_or_warn(table);
+		free(table);
+	}
+	string_list_clear(&add->new_tables, 0);
+	string_list_clear(&add->obsolete_tables, 0);
+
+	/* forget the tables that were never committed */
+	stat_validity_clear(&st->list_validity);
+	reftable_stack_reload(st);
+}
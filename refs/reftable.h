@@ -0,0 +1,160 @@
+#ifndef REFTABLE_H
+#define REFTABLE_H
+
+#include "../lockfile.h"
+#include "../string-list.h"
+
+/*
+ * Reading and writing of the block-based "reftable" files that the
+ * reftable ref storage backend keeps in $GIT_DIR/reftable/.  See
+ * Documentation/technical/reftable.txt for the file format.
+ *
+ * A table holds ref records sorted by refname and reflog records
+ * sorted by refname and (descending) update index.  A repository has
+ * a stack of tables, listed oldest first in "tables.list"; a record in
+ * a newer table overrides the record for the same key in the older
+ * ones.  Every update appends a new, small table to the stack, and
+ * the stack is compacted to keep the number of tables logarithmic in
+ * the number of updates.
+ */
+
+enum reftable_value_type {
+	REFTABLE_DELETION = 0,
+	REFTABLE_VAL1 = 1,	/* an object name */
+	REFTABLE_VAL2 = 2,	/* an object name and its peeled value */
+	REFTABLE_SYMREF = 3
+};
+
+struct reftable_ref {
+	struct strbuf refname;
+	uint64_t update_index;
+	enum reftable_value_type value_type;
+	unsigned char value[20];
+	unsigned char peeled[20];
+	struct strbuf target;
+};
+
+#define REFTABLE_REF_INIT { STRBUF_INIT, 0, REFTABLE_DELETION, { 0 }, { 0 }, STRBUF_INIT }
+
+struct reftable_log {
+	struct strbuf refname;
+	uint64_t update_index;
+	int deletion;
+	unsigned char old_sha1[20];
+	unsigned char new_sha1[20];
+	struct strbuf ident;	/* "Name <email>" */
+	unsigned long timestamp;
+	int tz;
+	struct strbuf message;	/* including the terminating LF */
+};
+
+#define REFTABLE_LOG_INIT { STRBUF_INIT, 0, 0, { 0 }, { 0 }, STRBUF_INIT, 0, 0, STRBUF_INIT }
+
+extern void reftable_ref_release(struct reftable_ref *ref);
+extern void reftable_log_release(struct reftable_log *log);
+
+/*
+ * Writing a table.  Refs and then logs have to be added in the order
+ * in which they are stored; reftable_writer_finish() writes out the
+ * indexes and the footer and closes the file descriptor.
+ */
+struct reftable_writer;
+
+extern struct reftable_writer *reftable_writer_new(int fd, const char *name,
+						   uint64_t min_update_index,
+						   uint64_t max_update_index);
+extern void reftable_writer_add_ref(struct reftable_writer *w,
+				    const struct reftable_ref *ref);
+extern void reftable_writer_add_log(struct reftable_writer *w,
+				    const struct reftable_log *log);
+extern int reftable_writer_finish(struct reftable_writer *w);
+
+/*
+ * A stack of tables, as listed in "tables.list" in its directory.
+ */
+struct reftable_stack {
+	char *dir;
+	struct reftable **tables;
+	int nr, alloc;
+	struct stat_validity list_validity;
+};
+
+/*
+ * Open the stack in "dir" (taking ownership of the string); an empty
+ * stack if there is no "tables.list" yet.
+ */
+extern int reftable_stack_open(struct reftable_stack *st, char *dir);
+extern void reftable_stack_release(struct reftable_stack *st);
+
+/* Re-read "tables.list" if it changed since we read it. */
+extern int reftable_stack_reload(struct reftable_stack *st);
+
+/*
+ * Look up refname.  Returns 0 and fills ref if there is a record for
+ * it (which may be a deletion), 1 if there is none and -1 on error.
+ */
+extern int reftable_stack_read_ref(struct reftable_stack *st,
+				   const char *refname,
+				   struct reftable_ref *ref);
+
+/*
+ * Iteration over the merged records of a stack, starting at the first
+ * key at or after the one that was sought.  Deletions are skipped,
+ * unless include_deletions is set.  The iterator returns 0 for a
+ * record, 1 at the end and -1 on error.
+ */
+struct reftable_merged_iter;
+
+extern struct reftable_merged_iter *reftable_stack_seek_ref(struct reftable_stack *st,
+							    const char *refname,
+							    int include_deletions);
+extern int reftable_merged_iter_next_ref(struct reftable_merged_iter *it,
+					 struct reftable_ref *ref);
+
+/*
+ * Seek to the newest log record of refname (or the first log record
+ * of all if refname is empty).
+ */
+extern struct reftable_merged_iter *reftable_stack_seek_log(struct reftable_stack *st,
+							    const char *refname,
+							    int include_deletions);
+extern int reftable_merged_iter_next_log(struct reftable_merged_iter *it,
+					 struct reftable_log *log);
+extern void reftable_merged_iter_free(struct reftable_merged_iter *it);
+
+/*
+ * Adding a table to the stack.  reftable_addition_begin() locks
+ * "tables.list" and brings the stack up to date, so that the caller
+ * can check the current values before writing.  The records are
+ * written by a callback, using the update index given to it.
+ */
+struct reftable_addition {
+	struct reftable_stack *stack;
+	struct lock_file *lock;
+	uint64_t update_index;
+	struct string_list new_tables;
+	struct string_list obsolete_tables;
+};
+
+typedef int reftable_write_fn(struct reftable_writer *w,
+			      uint64_t update_index, void *cb_data);
+
+extern int reftable_addition_begin(struct reftable_addition *add,
+				   struct reftable_stack *st,
+				   struct lock_file *lock,
+				   struct strbuf *err);
+extern int reftable_addition_add(struct reftable_addition *add,
+				 reftable_write_fn *fn, void *cb_data,
+				 struct strbuf *err);
+extern int reftable_addition_commit(struct reftable_addition *add,
+				    struct strbuf *err);
+extern void reftable_addition_rollback(struct reftable_addition *add);
+
+/*
+ * Merge all tables of the stack into one, dropping deletions.  The
+ * caller must hold the lock on "tables.list", as for an addition.
+ */
+extern int reftable_addition_compact_all(struct reftable_addition *add,
+					 struct strbuf *err);
+
+#endif /* REFTABLE_H */
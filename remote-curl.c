@@ -12,6 +12,7 @@
 #include "credential.h"
 #include "sha1-array.h"
 #include "send-pack.h"
+#include "trace-event.h"
 
 static struct remote *remote;
 /* always ends with a trailing slash */
@@ -970,6 +971,7 @@ int main(int argc, const char **argv)
 	git_setup_gettext();
 
 	git_extract_argv0_path(argv[0]);
+	trace_event_start(argv);
 	setup_git_directory_gently(&nongit);
 	if (argc < 2) {
 		error("remote-curl: usage: git remote-curl <remote> [<url>]");
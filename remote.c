@@ -678,6 +678,25 @@ void free_refspec(int nr_refspec, struct refspec *refspec)
 	free(refspec);
 }
 
+int refspec_ref_prefixes(int nr_refspec, const struct refspec *refspec,
+			 struct string_list *prefixes)
+{
+	int i;
+
+	for (i = 0; i < nr_refspec; i++) {
+		const struct refspec *rs = &refspec[i];
+
+		if (rs->exact_sha1 || rs->matching)
+			return -1;
+		if (rs->pattern)
+			string_list_append_nodup(prefixes,
+				xstrndup(rs->src, strcspn(rs->src, "*")));
+		else
+			expand_ref_prefix(prefixes, *rs->src ? rs->src : "HEAD");
+	}
+	return 0;
+}
+
 static int valid_remote_nick(const char *name)
 {
 	if (!name[0] || is_dot_or_dotdot(name))
@@ -166,6 +166,15 @@ struct refspec *parse_fetch_refspec(int nr_refspec, const char **refspec);
 
 void free_refspec(int nr_refspec, struct refspec *refspec);
 
+/*
+ * Append to prefixes (which must duplicate its strings) the prefixes
+ * of the remote refnames the fetch refspecs can match.  Return -1 if
+ * a refspec can match something that is not described by a prefix,
+ * like an object name.
+ */
+int refspec_ref_prefixes(int nr_refspec, const struct refspec *refspec,
+			 struct string_list *prefixes);
+
 extern int query_refspecs(struct refspec *specs, int nr, struct refspec *query);
 char *apply_refspecs(struct refspec *refspecs, int nr_refspec,
 		     const char *name);
@@ -19,6 +19,7 @@
 #include "dir.h"
 #include "cache-tree.h"
 #include "bisect.h"
+#include "commit-graph.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -482,6 +483,74 @@ static void file_change(struct diff_options *options,
 	DIFF_OPT_SET(options, HAS_CHANGES);
 }
 
+/*
+ * Use the changed-path Bloom filters of the commit-graph if every
+ * pathspec item is a literal path: then "does this commit touch the
+ * pathspec" is "does the filter contain one of these paths", as the
+ * filters also hold the leading directories of each changed path.
+ */
+static void prepare_to_use_bloom_filter(struct rev_info *revs)
+{
+	const struct bloom_filter_settings *settings;
+	struct pathspec *pathspec = &revs->prune_data;
+	int i;
+
+	if (!revs->prune || !pathspec->nr ||
+	    DIFF_OPT_TST(&revs->diffopt, FOLLOW_RENAMES) ||
+	    (pathspec->magic & ~(PATHSPEC_FROMTOP | PATHSPEC_LITERAL)))
+		return;
+
+	for (i = 0; i < pathspec->nr; i++) {
+		struct pathspec_item *item = &pathspec->items[i];
+		int len = item->len;
+
+		if (item->magic & ~(PATHSPEC_FROMTOP | PATHSPEC_LITERAL))
+			return;
+		if (!(item->magic & PATHSPEC_LITERAL) &&
+		    item->nowildcard_len < item->len)
+			return;
+		while (len && item->match[len - 1] == '/')
+			len--;
+		if (!len)
+			return;
+	}
+
+	settings = commit_graph_bloom_settings();
+	if (!settings)
+		return;
+
+	revs->bloom_keys = xcalloc(pathspec->nr, sizeof(*revs->bloom_keys));
+	for (i = 0; i < pathspec->nr; i++) {
+		struct pathspec_item *item = &pathspec->items[i];
+		int len = item->len;
+
+		while (item->match[len - 1] == '/')
+			len--;
+		fill_bloom_key(item->match, len, &revs->bloom_keys[i], settings);
+	}
+	revs->bloom_keys_nr = pathspec->nr;
+}
+
+/*
+ * Return 0 if the filter of "commit" proves that it does not change
+ * anything in the pathspec compared to "parent", 1 otherwise.
+ */
+static int maybe_changed_in_bloom_filter(struct rev_info *revs,
+					 struct commit *parent,
+					 struct commit *commit)
+{
+	struct bloom_filter filter;
+	int i;
+
+	if (!get_commit_bloom_filter(commit, parent, &filter))
+		return 1;
+	for (i = 0; i < revs->bloom_keys_nr; i++)
+		if (bloom_filter_contains(&filter, &revs->bloom_keys[i],
+					  commit_graph_bloom_settings()))
+			return 1;
+	return 0;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
 			    struct commit *parent, struct commit *commit)
 {
@@ -511,6 +580,10 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
+	if (revs->bloom_keys_nr &&
+	    !maybe_changed_in_bloom_filter(revs, parent, commit))
+		return REV_TREE_SAME;
+
 	tree_difference = REV_TREE_SAME;
 	DIFF_OPT_CLR(&revs->pruning, HAS_CHANGES);
 	if (diff_tree_sha1(t1->object.sha1, t2->object.sha1, "",
@@ -527,6 +600,10 @@ static int rev_same_tree_as_empty(struct rev_info *revs, struct commit *commit)
 	if (!t1)
 		return 0;
 
+	if (revs->bloom_keys_nr &&
+	    !maybe_changed_in_bloom_filter(revs, NULL, commit))
+		return 1;
+
 	tree_difference = REV_TREE_SAME;
 	DIFF_OPT_CLR(&revs->pruning, HAS_CHANGES);
 	retval = diff_tree_sha1(NULL, t1->object.sha1, "", &revs->pruning);
@@ -2807,6 +2884,7 @@ int prepare_revision_walk(struct rev_info *revs)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
 		return 0;
+	prepare_to_use_bloom_filter(revs);
 	if (revs->limited)
 		if (limit_list(revs) < 0)
 			return -1;
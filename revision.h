@@ -29,6 +29,7 @@ struct rev_info;
 struct log_info;
 struct string_list;
 struct saved_parents;
+struct bloom_key;
 
 struct rev_cmdline_info {
 	unsigned int nr;
@@ -189,6 +190,10 @@ struct rev_info {
 	struct diff_options diffopt;
 	struct diff_options pruning;
 
+	/* changed-path Bloom filter keys of the pathspec, if usable */
+	struct bloom_key *bloom_keys;
+	int bloom_keys_nr;
+
 	struct reflog_walk_info *reflog_info;
 	struct decoration children;
 	struct decoration merge_simplification;
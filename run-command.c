@@ -3,6 +3,7 @@
 #include "exec_cmd.h"
 #include "sigchain.h"
 #include "argv-array.h"
+#include "trace-event.h"
 
 void child_process_init(struct child_process *child)
 {
@@ -333,6 +334,7 @@ fail_pipe:
 	}
 
 	trace_argv_printf(cmd->argv, "trace: run_command:");
+	trace_event_child_start(cmd);
 	fflush(NULL);
 
 #ifndef GIT_WINDOWS_NATIVE
@@ -498,6 +500,7 @@ fail_pipe:
 #endif
 
 	if (cmd->pid < 0) {
+		trace_event_child_exit(cmd, -1);
 		if (need_in)
 			close_pair(fdin);
 		else if (cmd->in)
@@ -537,6 +540,7 @@ fail_pipe:
 int finish_command(struct child_process *cmd)
 {
 	int ret = wait_or_whine(cmd->pid, cmd->argv[0]);
+	trace_event_child_exit(cmd, ret);
 	argv_array_clear(&cmd->args);
 	argv_array_clear(&cmd->env_array);
 	return ret;
@@ -35,6 +35,9 @@ struct child_process {
 	int err;
 	const char *dir;
 	const char *const *env;
+	/* for GIT_TRACE_EVENT */
+	int trace_event_id;
+	uint64_t trace_event_start;
 	unsigned no_stdin:1;
 	unsigned no_stdout:1;
 	unsigned no_stderr:1;
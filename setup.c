@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "dir.h"
 #include "string-list.h"
+#include "refs.h"
 
 static int inside_git_dir = -1;
 static int inside_work_tree = -1;
@@ -350,12 +351,39 @@ void setup_work_tree(void)
 	initialized = 1;
 }
 
+/*
+ * The "extensions.*" of the repository; they only take effect with
+ * core.repositoryformatversion >= 1, and a version we do not know
+ * with an extension we do not know is an error.
+ */
+static struct string_list unknown_extensions = STRING_LIST_INIT_DUP;
+static char *ref_storage_extension;
+static char *partial_clone_extension;
+
 static int check_repo_format(const char *var, const char *value, void *cb)
 {
+	const char *ext;
+
 	if (strcmp(var, "core.repositoryformatversion") == 0)
 		repository_format_version = git_config_int(var, value);
 	else if (strcmp(var, "core.sharedrepository") == 0)
 		shared_repository = git_config_perm(var, value);
+	else if (skip_prefix(var, "extensions.", &ext)) {
+		/*
+		 * record any known extensions here; otherwise,
+		 * we fall through to recording it as unknown, and
+		 * check_repository_format will complain
+		 */
+		if (!strcmp(ext, "refstorage") && value &&
+		    ref_storage_backend_exists(value)) {
+			free(ref_storage_extension);
+			ref_storage_extension = xstrdup(value);
+		} else if (!strcmp(ext, "partialclone") && value && *value) {
+			free(partial_clone_extension);
+			partial_clone_extension = xstrdup(value);
+		} else
+			string_list_append(&unknown_extensions, ext);
+	}
 	return 0;
 }
 
@@ -382,16 +410,41 @@ static int check_repository_format_gently(const char *gitdir, int *nongit_ok)
 	 * Use a gentler version of git_config() to check if this repo
 	 * is a good one.
 	 */
+	string_list_clear(&unknown_extensions, 0);
+	free(ref_storage_extension);
+	ref_storage_extension = NULL;
+	free(partial_clone_extension);
+	partial_clone_extension = NULL;
 	git_config_early(fn, NULL, repo_config);
-	if (GIT_REPO_VERSION < repository_format_version) {
+	if (GIT_REPO_VERSION_READ < repository_format_version) {
 		if (!nongit_ok)
 			die ("Expected git repo version <= %d, found %d",
-			     GIT_REPO_VERSION, repository_format_version);
+			     GIT_REPO_VERSION_READ, repository_format_version);
 		warning("Expected git repo version <= %d, found %d",
-			GIT_REPO_VERSION, repository_format_version);
+			GIT_REPO_VERSION_READ, repository_format_version);
 		warning("Please upgrade Git");
 		*nongit_ok = -1;
 		ret = -1;
+	} else if (repository_format_version >= 1 && unknown_extensions.nr) {
+		int i;
+
+		if (!nongit_ok)
+			die("unknown repository extension found: %s",
+			    unknown_extensions.items[0].string);
+		for (i = 0; i < unknown_extensions.nr; i++)
+			warning("unknown repository extension found: %s",
+				unknown_extensions.items[i].string);
+		warning("Please upgrade Git");
+		*nongit_ok = -1;
+		ret = -1;
+	} else if (repository_format_version >= 1) {
+		if (ref_storage_extension)
+			set_ref_storage_backend(ref_storage_extension);
+		if (partial_clone_extension) {
+			free(repository_format_partial_clone);
+			repository_format_partial_clone = partial_clone_extension;
+			partial_clone_extension = NULL;
+		}
 	}
 	strbuf_release(&sb);
 	return ret;
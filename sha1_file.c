@@ -23,6 +23,11 @@
 #include "bulk-checkin.h"
 #include "streaming.h"
 #include "dir.h"
+#include "midx.h"
+#include "remote.h"
+#include "sha1-array.h"
+#include "khash.h"
+#include "thread-utils.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -293,6 +298,7 @@ static int link_alt_odb_entry(const char *entry, const char *relative_base,
 
 	entlen = pfxlen + 43; /* '/' + 2 hex + '/' + 38 hex + NUL */
 	ent = xmalloc(sizeof(*ent) + entlen);
+	ent->loose_cache = NULL;
 	memcpy(ent->base, pathbuf.buf, pfxlen);
 	strbuf_release(&pathbuf);
 
@@ -497,6 +503,89 @@ static int check_and_freshen_file(const char *fn, int freshen)
 	return 1;
 }
 
+/*
+ * With core.looseObjectCache, the names of the loose objects in each
+ * fan-out directory of an object directory are read once and kept in
+ * memory, so that asking for objects we do not have costs no system
+ * calls.  Loose objects we write ourselves are added to the cache;
+ * those that other processes write meanwhile are not seen.
+ */
+struct loose_object_cache {
+	unsigned char subdir_seen[256];
+	struct sha1_array subdir[256];
+};
+
+static struct loose_object_cache *local_loose_cache;
+
+static int for_each_file_in_obj_subdir(int subdir_nr,
+				       struct strbuf *path,
+				       each_loose_object_fn obj_cb,
+				       each_loose_cruft_fn cruft_cb,
+				       each_loose_subdir_fn subdir_cb,
+				       void *data);
+
+static int add_loose_object_to_cache(const unsigned char *sha1,
+				     const char *path, void *data)
+{
+	sha1_array_append(data, sha1);
+	return 0;
+}
+
+struct sha1_array *loose_object_cache_subdir(struct alternate_object_database *alt,
+					     int subdir_nr)
+{
+	struct loose_object_cache **cachep;
+	struct loose_object_cache *cache;
+	struct strbuf path = STRBUF_INIT;
+
+	if (!core_loose_object_cache)
+		return NULL;
+
+	cachep = alt ? &alt->loose_cache : &local_loose_cache;
+	if (!*cachep)
+		*cachep = xcalloc(1, sizeof(**cachep));
+	cache = *cachep;
+	if (cache->subdir_seen[subdir_nr])
+		return &cache->subdir[subdir_nr];
+
+	if (alt)
+		strbuf_add(&path, alt->base, alt->name - alt->base - 1);
+	else
+		strbuf_addstr(&path, get_object_directory());
+	strbuf_addf(&path, "/%02x", subdir_nr);
+	for_each_file_in_obj_subdir(subdir_nr, &path, add_loose_object_to_cache,
+				    NULL, NULL, &cache->subdir[subdir_nr]);
+	strbuf_release(&path);
+	cache->subdir_seen[subdir_nr] = 1;
+	return &cache->subdir[subdir_nr];
+}
+
+void loose_object_cache_add(const unsigned char *sha1)
+{
+	if (local_loose_cache && local_loose_cache->subdir_seen[sha1[0]])
+		sha1_array_append(&local_loose_cache->subdir[sha1[0]], sha1);
+}
+
+/*
+ * Return true if the loose object cache is enabled and has no object
+ * called sha1 in any object directory, so that there is no need to
+ * look for its file.
+ */
+static int loose_object_known_missing(const unsigned char *sha1)
+{
+	struct alternate_object_database *alt;
+
+	if (!core_loose_object_cache)
+		return 0;
+	if (sha1_array_lookup(loose_object_cache_subdir(NULL, sha1[0]), sha1) >= 0)
+		return 0;
+	prepare_alt_odb();
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		if (sha1_array_lookup(loose_object_cache_subdir(alt, sha1[0]), sha1) >= 0)
+			return 0;
+	return 1;
+}
+
 static int check_and_freshen_local(const unsigned char *sha1, int freshen)
 {
 	return check_and_freshen_file(sha1_file_name(sha1), freshen);
@@ -516,12 +605,16 @@ static int check_and_freshen_nonlocal(const unsigned char *sha1, int freshen)
 
 static int check_and_freshen(const unsigned char *sha1, int freshen)
 {
+	if (!freshen && loose_object_known_missing(sha1))
+		return 0;
 	return check_and_freshen_local(sha1, freshen) ||
 	       check_and_freshen_nonlocal(sha1, freshen);
 }
 
 int has_loose_object_nonlocal(const unsigned char *sha1)
 {
+	if (loose_object_known_missing(sha1))
+		return 0;
 	return check_and_freshen_nonlocal(sha1, 0);
 }
 
@@ -874,6 +967,7 @@ void unuse_pack(struct pack_window **w_cursor)
 
 void close_pack_index(struct packed_git *p)
 {
+	close_pack_revindex(p);
 	if (p->index_data) {
 		munmap((void *)p->index_data, p->index_size);
 		p->index_data = NULL;
@@ -1141,9 +1235,67 @@ static struct packed_git *alloc_packed_git(int extra)
 	return p;
 }
 
+#ifndef NO_PTHREADS
+/*
+ * Serializes object reading once several threads may read objects.
+ * It is recursive, as reading an object can take us back to the
+ * object store, and it is dropped while inflating, so that threads
+ * can decompress their objects at the same time; all that inflating
+ * needs is the pack window, which cannot go away while it is in use.
+ */
+static int obj_read_use_lock;
+static pthread_mutex_t obj_read_mutex;
+
+void enable_obj_read_lock(void)
+{
+	if (obj_read_use_lock++)
+		return;
+	init_recursive_mutex(&obj_read_mutex);
+}
+
+void disable_obj_read_lock(void)
+{
+	if (!obj_read_use_lock)
+		die("BUG: disabling the object read lock that is not enabled");
+	if (--obj_read_use_lock)
+		return;
+	pthread_mutex_destroy(&obj_read_mutex);
+}
+
+void obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+}
+
+void obj_read_unlock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+}
+#else
+void enable_obj_read_lock(void)
+{
+}
+
+void disable_obj_read_lock(void)
+{
+}
+
+void obj_read_lock(void)
+{
+}
+
+void obj_read_unlock(void)
+{
+}
+#endif
+
 static void try_to_free_pack_memory(size_t size)
 {
+	obj_read_lock();
 	release_pack_memory(size);
+	obj_read_unlock();
 }
 
 struct packed_git *add_packed_git(const char *path, int path_len, int local)
@@ -1325,8 +1477,11 @@ static void prepare_packed_git_one(char *objdir, int local)
 		if (ends_with(de->d_name, ".idx") ||
 		    ends_with(de->d_name, ".pack") ||
 		    ends_with(de->d_name, ".bitmap") ||
+		    ends_with(de->d_name, ".rev") ||
 		    ends_with(de->d_name, ".keep"))
 			string_list_append(&garbage, path.buf);
+		else if (!strcmp(de->d_name, "multi-pack-index"))
+			; /* not tied to any single pack */
 		else
 			report_garbage("garbage found", path.buf);
 	}
@@ -1398,6 +1553,7 @@ void prepare_packed_git(void)
 	if (prepare_packed_git_run_once)
 		return;
 	prepare_packed_git_one(get_object_directory(), 1);
+	prepare_multi_pack_index();
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
 		alt->name[-1] = 0;
@@ -1512,6 +1668,10 @@ static int stat_sha1_file(const unsigned char *sha1, struct stat *st)
 {
 	struct alternate_object_database *alt;
 
+	if (loose_object_known_missing(sha1)) {
+		errno = ENOENT;
+		return -1;
+	}
 	if (!lstat(sha1_file_name(sha1), st))
 		return 0;
 
@@ -1532,6 +1692,10 @@ static int open_sha1_file(const unsigned char *sha1)
 	struct alternate_object_database *alt;
 	int most_interesting_errno;
 
+	if (loose_object_known_missing(sha1)) {
+		errno = ENOENT;
+		return -1;
+	}
 	fd = git_open_noatime(sha1_file_name(sha1));
 	if (fd >= 0)
 		return fd;
@@ -1872,18 +2036,17 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 		unsigned char *base = use_pack(p, w_curs, curpos, NULL);
 		return base;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		uint32_t base_pos;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return NULL;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &base_pos) < 0)
 			return NULL;
 
-		return nth_packed_object_sha1(p, revidx->nr);
+		return nth_packed_object_sha1(p, pack_pos_to_index(p, base_pos));
 	} else
 		return NULL;
 }
@@ -1917,12 +2080,11 @@ int unpack_object_header(struct packed_git *p,
 static int retry_bad_packed_offset(struct packed_git *p, off_t obj_offset)
 {
 	int type;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	const unsigned char *sha1;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
 		return OBJ_BAD;
-	sha1 = nth_packed_object_sha1(p, revidx->nr);
+	sha1 = nth_packed_object_sha1(p, pack_pos_to_index(p, pos));
 	mark_bad_packed_object(p, sha1);
 	type = sha1_object_info(sha1, NULL);
 	if (type <= OBJ_NONE)
@@ -2033,8 +2195,12 @@ static int packed_object_info(struct packed_git *p, off_t obj_offset,
 	}
 
 	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+		uint32_t pos;
+		if (offset_to_pack_pos(p, obj_offset, &pos) < 0) {
+			type = OBJ_BAD;
+			goto out;
+		}
+		*oi->disk_sizep = pack_pos_to_offset(p, pos + 1) - obj_offset;
 	}
 
 	if (oi->typep) {
@@ -2086,7 +2252,9 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -2100,8 +2268,12 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
-#define MAX_DELTA_CACHE (256)
-
+/*
+ * Inflated bases of deltas, keyed by pack and offset, and kept in a
+ * list from the least to the most recently used.  The data of all the
+ * entries adds up to at most core.deltaBaseCacheLimit bytes.
+ */
+static struct hashmap delta_base_cache;
 static size_t delta_base_cached;
 
 static struct delta_base_cache_lru_list {
@@ -2109,50 +2281,105 @@ static struct delta_base_cache_lru_list {
 	struct delta_base_cache_lru_list *next;
 } delta_base_cache_lru = { &delta_base_cache_lru, &delta_base_cache_lru };
 
-static struct delta_base_cache_entry {
-	struct delta_base_cache_lru_list lru;
-	void *data;
+struct delta_base_cache_key {
 	struct packed_git *p;
 	off_t base_offset;
+};
+
+struct delta_base_cache_entry {
+	struct hashmap_entry ent;
+	struct delta_base_cache_key key;
+	struct delta_base_cache_lru_list lru;
+	void *data;
 	unsigned long size;
 	enum object_type type;
-} delta_base_cache[MAX_DELTA_CACHE];
+};
+
+/* Reported to GIT_TRACE_PERFORMANCE at exit. */
+static struct {
+	uintmax_t hits, misses, evictions;
+	size_t peak;
+} delta_base_cache_stats;
+
+static struct trace_key trace_delta_base_cache = TRACE_KEY_INIT(PERFORMANCE);
+
+static void trace_delta_base_cache_stats(void)
+{
+	trace_printf_key(&trace_delta_base_cache,
+			 "delta base cache: %"PRIuMAX" hits, %"PRIuMAX" misses, "
+			 "%"PRIuMAX" evictions, %"PRIuMAX" bytes at most "
+			 "(limit %"PRIuMAX")",
+			 delta_base_cache_stats.hits,
+			 delta_base_cache_stats.misses,
+			 delta_base_cache_stats.evictions,
+			 (uintmax_t)delta_base_cache_stats.peak,
+			 (uintmax_t)delta_base_cache_limit);
+}
 
-static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
+static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
-	unsigned long hash;
+	unsigned int hash;
 
-	hash = (unsigned long)p + (unsigned long)base_offset;
+	hash = (unsigned int)(intptr_t)p + (unsigned int)base_offset;
 	hash += (hash >> 8) + (hash >> 16);
-	return hash % MAX_DELTA_CACHE;
+	return hash;
+}
+
+static int delta_base_cache_cmp(const struct delta_base_cache_entry *a,
+				const struct delta_base_cache_entry *b,
+				const void *keydata)
+{
+	const struct delta_base_cache_key *key = keydata ? keydata : &b->key;
+
+	return a->key.p != key->p || a->key.base_offset != key->base_offset;
 }
 
 static struct delta_base_cache_entry *
 get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	return delta_base_cache + hash;
+	struct delta_base_cache_key key;
+
+	if (!delta_base_cache.tablesize)
+		return NULL;
+	key.p = p;
+	key.base_offset = base_offset;
+	return hashmap_get_from_hash(&delta_base_cache,
+				     pack_entry_hash(p, base_offset), &key);
 }
 
-static int eq_delta_base_cache_entry(struct delta_base_cache_entry *ent,
-				     struct packed_git *p, off_t base_offset)
+static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	return (ent->data && ent->p == p && ent->base_offset == base_offset);
+	return !!get_delta_base_cache_entry(p, base_offset);
 }
 
-static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
+static inline struct delta_base_cache_entry *
+delta_base_cache_lru_entry(struct delta_base_cache_lru_list *lru)
 {
-	struct delta_base_cache_entry *ent;
-	ent = get_delta_base_cache_entry(p, base_offset);
-	return eq_delta_base_cache_entry(ent, p, base_offset);
+	return (struct delta_base_cache_entry *)
+		((char *)lru - offsetof(struct delta_base_cache_entry, lru));
 }
 
-static void clear_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+static void lru_unlink(struct delta_base_cache_entry *ent)
 {
-	ent->data = NULL;
 	ent->lru.next->prev = ent->lru.prev;
 	ent->lru.prev->next = ent->lru.next;
+}
+
+static void lru_append(struct delta_base_cache_entry *ent)
+{
+	ent->lru.next = &delta_base_cache_lru;
+	ent->lru.prev = delta_base_cache_lru.prev;
+	delta_base_cache_lru.prev->next = &ent->lru;
+	delta_base_cache_lru.prev = &ent->lru;
+}
+
+/* Drop the entry from the cache; the caller takes over its data. */
+static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+{
+	hashmap_remove(&delta_base_cache, ent, &ent->key);
+	lru_unlink(ent);
 	delta_base_cached -= ent->size;
+	free(ent);
 }
 
 static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
@@ -2163,73 +2390,87 @@ static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 
 	ent = get_delta_base_cache_entry(p, base_offset);
 
-	if (!eq_delta_base_cache_entry(ent, p, base_offset))
+	if (!ent)
 		return unpack_entry(p, base_offset, type, base_size);
 
-	ret = ent->data;
-
-	if (!keep_cache)
-		clear_delta_base_cache_entry(ent);
-	else
-		ret = xmemdupz(ent->data, ent->size);
+	delta_base_cache_stats.hits++;
 	*type = ent->type;
 	*base_size = ent->size;
+	if (!keep_cache) {
+		ret = ent->data;
+		detach_delta_base_cache_entry(ent);
+	} else {
+		ret = xmemdupz(ent->data, ent->size);
+		lru_unlink(ent);
+		lru_append(ent);
+	}
 	return ret;
 }
 
 static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
 {
-	if (ent->data) {
-		free(ent->data);
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
-	}
+	free(ent->data);
+	detach_delta_base_cache_entry(ent);
 }
 
 void clear_delta_base_cache(void)
 {
-	unsigned long p;
-	for (p = 0; p < MAX_DELTA_CACHE; p++)
-		release_delta_base_cache(&delta_base_cache[p]);
+	while (delta_base_cache_lru.next != &delta_base_cache_lru)
+		release_delta_base_cache(
+			delta_base_cache_lru_entry(delta_base_cache_lru.next));
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	struct delta_base_cache_lru_list *lru;
+	struct delta_base_cache_entry *ent;
+	struct delta_base_cache_lru_list *lru, *next;
+
+	if (!delta_base_cache.tablesize) {
+		hashmap_init(&delta_base_cache,
+			     (hashmap_cmp_fn)delta_base_cache_cmp, 0);
+		if (trace_want(&trace_delta_base_cache))
+			atexit(trace_delta_base_cache_stats);
+	}
 
-	release_delta_base_cache(ent);
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (ent)
+		release_delta_base_cache(ent);
 	delta_base_cached += base_size;
 
+	/* evict blobs first, as they are never bases of trees */
 	for (lru = delta_base_cache_lru.next;
 	     delta_base_cached > delta_base_cache_limit
 	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		if (f->type == OBJ_BLOB)
+	     lru = next) {
+		struct delta_base_cache_entry *f = delta_base_cache_lru_entry(lru);
+		next = lru->next;
+		if (f->type == OBJ_BLOB) {
 			release_delta_base_cache(f);
+			delta_base_cache_stats.evictions++;
+		}
 	}
 	for (lru = delta_base_cache_lru.next;
 	     delta_base_cached > delta_base_cache_limit
 	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
+	     lru = next) {
+		struct delta_base_cache_entry *f = delta_base_cache_lru_entry(lru);
+		next = lru->next;
 		release_delta_base_cache(f);
+		delta_base_cache_stats.evictions++;
 	}
 
-	ent->p = p;
-	ent->base_offset = base_offset;
+	ent = xmalloc(sizeof(*ent));
+	hashmap_entry_init(ent, pack_entry_hash(p, base_offset));
+	ent->key.p = p;
+	ent->key.base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	ent->lru.next = &delta_base_cache_lru;
-	ent->lru.prev = delta_base_cache_lru.prev;
-	delta_base_cache_lru.prev->next = &ent->lru;
-	delta_base_cache_lru.prev = &ent->lru;
+	hashmap_add(&delta_base_cache, ent);
+	lru_append(ent);
+	if (delta_base_cache_stats.peak < delta_base_cached)
+		delta_base_cache_stats.peak = delta_base_cached;
 }
 
 static void *read_object(const unsigned char *sha1, enum object_type *type,
@@ -2273,21 +2514,30 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		struct delta_base_cache_entry *ent;
 
 		ent = get_delta_base_cache_entry(p, curpos);
-		if (eq_delta_base_cache_entry(ent, p, curpos)) {
+		if (ent) {
+			delta_base_cache_stats.hits++;
 			type = ent->type;
 			data = ent->data;
 			size = ent->size;
-			clear_delta_base_cache_entry(ent);
+			detach_delta_base_cache_entry(ent);
 			base_from_cache = 1;
 			break;
 		}
+		delta_base_cache_stats.misses++;
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			unsigned long len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			uint32_t pos, index_pos;
+			unsigned long len;
+
+			if (offset_to_pack_pos(p, obj_offset, &pos) < 0) {
+				unuse_pack(&w_curs);
+				return NULL;
+			}
+			len = pack_pos_to_offset(p, pos + 1) - obj_offset;
+			index_pos = pack_pos_to_index(p, pos);
+			if (check_pack_crc(p, &w_curs, obj_offset, len, index_pos)) {
 				const unsigned char *sha1 =
-					nth_packed_object_sha1(p, revidx->nr);
+					nth_packed_object_sha1(p, index_pos);
 				error("bad packed object CRC for %s",
 				      sha1_to_hex(sha1));
 				mark_bad_packed_object(p, sha1);
@@ -2357,13 +2607,12 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		void *delta_data;
 		void *base = data;
 		unsigned long delta_size, base_size = size;
+		off_t base_offset = obj_offset;
+		int cache_base = !!base;
 		int i;
 
 		data = NULL;
 
-		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
-
 		if (!base) {
 			/*
 			 * We're probably in deep shit, but let's try to fetch
@@ -2371,11 +2620,11 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			uint32_t pos;
 			const unsigned char *base_sha1;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+			if (!offset_to_pack_pos(p, obj_offset, &pos)) {
+				base_sha1 = nth_packed_object_sha1(p,
+						pack_pos_to_index(p, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      sha1_to_hex(base_sha1), (uintmax_t)obj_offset,
@@ -2400,25 +2649,35 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			      "at offset %"PRIuMAX" from %s",
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
-			continue;
-		}
+		} else {
+			data = patch_delta(base, base_size,
+					   delta_data, delta_size,
+					   &size);
+
+			/*
+			 * We could not apply the delta; warn the user, but
+			 * keep going.  Our failure will be noticed either in
+			 * the next iteration of the loop, or if this is the
+			 * final delta, in the caller when we return NULL.
+			 * Those code paths will take care of making a more
+			 * explicit warning and retrying with another copy of
+			 * the object.
+			 */
+			if (!data)
+				error("failed to apply delta");
 
-		data = patch_delta(base, base_size,
-				   delta_data, delta_size,
-				   &size);
+			free(delta_data);
+		}
 
 		/*
-		 * We could not apply the delta; warn the user, but keep going.
-		 * Our failure will be noticed either in the next iteration of
-		 * the loop, or if this is the final delta, in the caller when
-		 * we return NULL. Those code paths will take care of making
-		 * a more explicit warning and retrying with another copy of
-		 * the object.
+		 * Only hand the base over to the cache once we are done
+		 * with it: unpack_compressed_entry() lets other threads
+		 * in, and they may evict it from the cache.
 		 */
-		if (!data)
-			error("failed to apply delta");
-
-		free(delta_data);
+		if (cache_base)
+			add_delta_base_cache(p, base_offset, base, base_size, type);
+		else
+			free(base);
 	}
 
 	*final_type = type;
@@ -2593,17 +2852,32 @@ static int fill_pack_entry(const unsigned char *sha1,
 static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
 	struct packed_git *p;
+	int use_midx;
 
 	prepare_packed_git();
 	if (!packed_git)
 		return 0;
 
-	if (last_found_pack && fill_pack_entry(sha1, e, last_found_pack))
+	if (last_found_pack && !last_found_pack->multi_pack_index &&
+	    fill_pack_entry(sha1, e, last_found_pack))
+		return 1;
+
+	/*
+	 * The multi-pack-index answers for all the packs it covers at
+	 * once; only if it points at a pack we cannot use do we fall
+	 * back to asking each of them.
+	 */
+	use_midx = fill_midx_entry(sha1, e);
+	if (use_midx > 0) {
+		last_found_pack = e->p;
 		return 1;
+	}
 
 	for (p = packed_git; p; p = p->next) {
-		if (p == last_found_pack)
+		if (p == last_found_pack && !p->multi_pack_index)
 			continue; /* we already checked this one */
+		if (p->multi_pack_index && !use_midx)
+			continue; /* the multi-pack-index said it is not there */
 
 		if (fill_pack_entry(sha1, e, p)) {
 			last_found_pack = p;
@@ -2685,7 +2959,90 @@ static int sha1_loose_object_info(const unsigned char *sha1,
 	return 0;
 }
 
-int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi, unsigned flags)
+int fetch_if_missing = 1;
+
+/*
+ * The objects we asked the promisor remote for, so that we do not ask
+ * for an object it does not have again and again.
+ */
+static khash_sha1 *promisor_requested;
+
+int fetch_promisor_objects(const struct sha1_array *sha1s)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+	struct strbuf input = STRBUF_INIT;
+	struct remote *remote;
+	int i, ret;
+
+	if (!repository_format_partial_clone || !fetch_if_missing ||
+	    git_env_bool(NO_LAZY_FETCH_ENVIRONMENT, 0))
+		return -1;
+
+	if (!promisor_requested)
+		promisor_requested = kh_init_sha1();
+	for (i = 0; i < sha1s->nr; i++) {
+		unsigned char *sha1;
+		const char *hex = sha1_to_hex(sha1s->sha1[i]);
+
+		if (is_null_sha1(sha1s->sha1[i]))
+			continue;
+		sha1 = xmalloc(20);
+		hashcpy(sha1, sha1s->sha1[i]);
+		kh_put_sha1(promisor_requested, sha1, &ret);
+		if (!ret) {
+			free(sha1);
+			continue;
+		}
+		/* fetch-pack takes "<sha1> <name>"; name the object by itself */
+		strbuf_addf(&input, "%s %s\n", hex, hex);
+	}
+	if (!input.len)
+		return -1;
+
+	remote = remote_get(repository_format_partial_clone);
+	if (!remote || !remote->url_nr) {
+		strbuf_release(&input);
+		return error("partial clone remote '%s' has no url",
+			     repository_format_partial_clone);
+	}
+
+	argv_array_pushl(&cp.args, "fetch-pack", "--stdin", "-q",
+			 "--no-progress", "--no-haves", NULL);
+	if (remote->uploadpack)
+		argv_array_pushf(&cp.args, "--upload-pack=%s", remote->uploadpack);
+	argv_array_push(&cp.args, remote->url[0]);
+	argv_array_pushf(&cp.env_array, "%s=1", NO_LAZY_FETCH_ENVIRONMENT);
+	cp.git_cmd = 1;
+	cp.in = -1;
+	cp.no_stdout = 1;
+
+	if (start_command(&cp)) {
+		strbuf_release(&input);
+		return error("unable to start fetch-pack for missing objects");
+	}
+	ret = write_in_full(cp.in, input.buf, input.len) < 0;
+	close(cp.in);
+	strbuf_release(&input);
+	if (finish_command(&cp) || ret)
+		return error("unable to fetch missing objects from '%s'",
+			     repository_format_partial_clone);
+
+	reprepare_packed_git();
+	return 0;
+}
+
+static int fetch_promisor_object(const unsigned char *sha1)
+{
+	struct sha1_array to_fetch = SHA1_ARRAY_INIT;
+	int ret;
+
+	sha1_array_append(&to_fetch, sha1);
+	ret = fetch_promisor_objects(&to_fetch);
+	sha1_array_clear(&to_fetch);
+	return ret;
+}
+
+static int do_sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi, unsigned flags)
 {
 	struct cached_object *co;
 	struct pack_entry e;
@@ -2718,8 +3075,12 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 
 		/* Not a loose object; someone else may have just packed it. */
 		reprepare_packed_git();
-		if (!find_pack_entry(real, &e))
+		if (!find_pack_entry(real, &e)) {
+			/* or a partial clone may have to fetch it */
+			if (!fetch_promisor_object(real))
+				return sha1_object_info_extended(real, oi, 0);
 			return -1;
+		}
 	}
 
 	/*
@@ -2752,6 +3113,16 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 	return 0;
 }
 
+int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi, unsigned flags)
+{
+	int ret;
+
+	obj_read_lock();
+	ret = do_sha1_object_info_extended(sha1, oi, flags);
+	obj_read_unlock();
+	return ret;
+}
+
 /* returns enum object_type or negative */
 int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
 {
@@ -2826,12 +3197,18 @@ static void *read_object(const unsigned char *sha1, enum object_type *type,
 		return buf;
 	map = map_sha1_file(sha1, &mapsize);
 	if (map) {
+		/* the mapping is ours alone */
+		obj_read_unlock();
 		buf = unpack_sha1_file(map, mapsize, type, size, sha1);
 		munmap(map, mapsize);
+		obj_read_lock();
 		return buf;
 	}
 	reprepare_packed_git();
-	return read_packed_sha1(sha1, type, size);
+	buf = read_packed_sha1(sha1, type, size);
+	if (!buf && !fetch_promisor_object(sha1))
+		return read_object(sha1, type, size);
+	return buf;
 }
 
 /*
@@ -2846,10 +3223,14 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 {
 	void *data;
 	const struct packed_git *p;
-	const unsigned char *repl = lookup_replace_object_extended(sha1, flag);
+	const unsigned char *repl;
 
 	errno = 0;
+	obj_read_lock();
+	/* the replace objects are read on first use */
+	repl = lookup_replace_object_extended(sha1, flag);
 	data = read_object(repl, type, size);
+	obj_read_unlock();
 	if (data)
 		return data;
 
@@ -3115,7 +3496,10 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 				tmp_file, strerror(errno));
 	}
 
-	return finalize_object_file(tmp_file, filename);
+	if (finalize_object_file(tmp_file, filename))
+		return -1;
+	loose_object_cache_add(sha1);
+	return 0;
 }
 
 static int freshen_loose_object(const unsigned char *sha1)
@@ -7,6 +7,7 @@
 #include "refs.h"
 #include "remote.h"
 #include "dir.h"
+#include "sha1-array.h"
 
 static int get_sha1_oneline(const char *, unsigned char *, struct commit_list *);
 
@@ -72,12 +73,50 @@ static void update_candidates(struct disambiguate_state *ds, const unsigned char
 	/* otherwise, current can be discarded and candidate is still good */
 }
 
-static void find_short_object_filename(int len, const char *hex_pfx, struct disambiguate_state *ds)
+static int match_sha(unsigned len, const unsigned char *a, const unsigned char *b)
+{
+	do {
+		if (*a != *b)
+			return 0;
+		a++;
+		b++;
+		len -= 2;
+	} while (len > 1);
+	if (len)
+		if ((*a ^ *b) & 0xf0)
+			return 0;
+	return 1;
+}
+
+static void find_short_cached_loose_object(int len, const unsigned char *bin_pfx,
+					   struct disambiguate_state *ds)
+{
+	struct alternate_object_database *alt = NULL;
+
+	do {
+		struct sha1_array *loose = loose_object_cache_subdir(alt, bin_pfx[0]);
+		int i;
+
+		for (i = 0; i < loose->nr && !ds->ambiguous; i++)
+			if (match_sha(len, bin_pfx, loose->sha1[i]))
+				update_candidates(ds, loose->sha1[i]);
+		alt = alt ? alt->next : alt_odb_list;
+	} while (alt && !ds->ambiguous);
+}
+
+static void find_short_object_filename(int len, const char *hex_pfx,
+				       const unsigned char *bin_pfx,
+				       struct disambiguate_state *ds)
 {
 	struct alternate_object_database *alt;
 	char hex[40];
 	static struct alternate_object_database *fakeent;
 
+	if (core_loose_object_cache) {
+		find_short_cached_loose_object(len, bin_pfx, ds);
+		return;
+	}
+
 	if (!fakeent) {
 		/*
 		 * Create a "fake" alternate object database that
@@ -120,21 +159,6 @@ static void find_short_object_filename(int len, const char *hex_pfx, struct disa
 	}
 }
 
-static int match_sha(unsigned len, const unsigned char *a, const unsigned char *b)
-{
-	do {
-		if (*a != *b)
-			return 0;
-		a++;
-		b++;
-		len -= 2;
-	} while (len > 1);
-	if (len)
-		if ((*a ^ *b) & 0xf0)
-			return 0;
-	return 1;
-}
-
 static void unique_in_pack(int len,
 			  const unsigned char *bin_pfx,
 			   struct packed_git *p,
@@ -335,7 +359,7 @@ static int get_short_sha1(const char *name, int len, unsigned char *sha1,
 	else if (flags & GET_SHA1_BLOB)
 		ds.fn = disambiguate_blob_only;
 
-	find_short_object_filename(len, hex_pfx, &ds);
+	find_short_object_filename(len, hex_pfx, bin_pfx, &ds);
 	find_short_packed_object(len, bin_pfx, &ds);
 	status = finish_object_disambiguation(&ds, sha1);
 
@@ -363,7 +387,7 @@ int for_each_abbrev(const char *prefix, each_abbrev_fn fn, void *cb_data)
 	ds.cb_data = cb_data;
 	ds.fn = fn;
 
-	find_short_object_filename(len, hex_pfx, &ds);
+	find_short_object_filename(len, hex_pfx, bin_pfx, &ds);
 	find_short_packed_object(len, bin_pfx, &ds);
 	return ds.ambiguous;
 }
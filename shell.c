@@ -10,19 +10,26 @@
 
 static int do_generic_cmd(const char *me, char *arg)
 {
-	const char *my_argv[4];
+	struct argv_array args = ARGV_ARRAY_INIT;
+	int i;
 
 	setup_path();
-	if (!arg || !(arg = sq_dequote(arg)))
-		die("bad argument");
 	if (!starts_with(me, "git-"))
 		die("bad command");
+	argv_array_push(&args, me + 4);
+	if (!arg || sq_dequote_to_argv_array(arg, &args) || args.argc < 2)
+		die("bad argument");
 
-	my_argv[0] = me + 4;
-	my_argv[1] = arg;
-	my_argv[2] = NULL;
+	/*
+	 * The only options we pass on are the ref prefixes fetch
+	 * asks upload-pack to limit its advertisement to.
+	 */
+	for (i = 1; i < args.argc - 1; i++)
+		if (strcmp(me, "git-upload-pack") ||
+		    !starts_with(args.argv[i], "--ref-prefix="))
+			die("bad argument");
 
-	return execv_git_cmd(my_argv);
+	return execv_git_cmd(args.argv);
 }
 
 static int do_cvs_cmd(const char *me, char *arg)
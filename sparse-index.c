@@ -0,0 +1,216 @@
+#include "cache.h"
+#include "cache-tree.h"
+#include "pathspec.h"
+#include "sparse-index.h"
+#include "tree.h"
+
+static struct cache_entry *construct_sparse_dir_entry(const char *path,
+						      size_t pathlen,
+						      const unsigned char *sha1)
+{
+	struct cache_entry *ce = xcalloc(1, cache_entry_size(pathlen));
+
+	ce->ce_mode = S_IFDIR;
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = pathlen;
+	hashcpy(ce->sha1, sha1);
+	memcpy(ce->name, path, pathlen);
+	return ce;
+}
+
+/*
+ * Collapse the entries [start, end) of the directory "ct_path"
+ * (described by "ct") into istate->cache[num_converted...], and return
+ * how many entries they became.  The range is written over in place,
+ * which is fine as it never grows.
+ */
+static int convert_to_sparse_rec(struct index_state *istate,
+				 int num_converted, int start, int end,
+				 const char *ct_path, size_t ct_pathlen,
+				 struct cache_tree *ct)
+{
+	struct strbuf child_path = STRBUF_INIT;
+	int i, can_convert = 1;
+	int start_converted = num_converted;
+
+	/* the top-level directory is never collapsed */
+	if (!ct_pathlen)
+		can_convert = 0;
+	for (i = start; can_convert && i < end; i++)
+		if (!ce_skip_worktree(istate->cache[i]))
+			can_convert = 0;
+
+	if (can_convert) {
+		for (i = start; i < end; i++)
+			free(istate->cache[i]);
+		istate->cache[num_converted] =
+			construct_sparse_dir_entry(ct_path, ct_pathlen, ct->sha1);
+		return 1;
+	}
+
+	for (i = start; i < end; ) {
+		struct cache_entry *ce = istate->cache[i];
+		const char *base = ce->name + ct_pathlen;
+		const char *slash = strchr(base, '/');
+		struct cache_tree_sub *sub;
+		int span;
+
+		if (!slash) {
+			istate->cache[num_converted++] = ce;
+			i++;
+			continue;
+		}
+
+		strbuf_reset(&child_path);
+		strbuf_add(&child_path, base, slash - base);
+		sub = cache_tree_sub(ct, child_path.buf);
+		if (!sub->cache_tree || sub->cache_tree->entry_count <= 0)
+			die("BUG: no valid cache-tree for '%.*s'",
+			    (int)(slash - ce->name), ce->name);
+		span = sub->cache_tree->entry_count;
+
+		strbuf_reset(&child_path);
+		strbuf_add(&child_path, ce->name, slash - ce->name + 1);
+		num_converted += convert_to_sparse_rec(istate, num_converted,
+						       i, i + span,
+						       child_path.buf,
+						       child_path.len,
+						       sub->cache_tree);
+		i += span;
+	}
+
+	strbuf_release(&child_path);
+	return num_converted - start_converted;
+}
+
+static int sparse_index_allowed(struct index_state *istate)
+{
+	int sparse = 0;
+
+	if (!core_apply_sparse_checkout || istate->split_index)
+		return 0;
+	return !git_config_get_bool("index.sparse", &sparse) && sparse;
+}
+
+int convert_to_sparse(struct index_state *istate)
+{
+	int i;
+
+	if (istate->sparse_index || !istate->cache_nr ||
+	    !sparse_index_allowed(istate))
+		return 0;
+
+	/*
+	 * Conflicts and entries about to be dropped cannot be described
+	 * by a tree; keep the full index until they are gone.
+	 */
+	for (i = 0; i < istate->cache_nr; i++)
+		if (ce_stage(istate->cache[i]) ||
+		    (istate->cache[i]->ce_flags & CE_REMOVE))
+			return 0;
+
+	/*
+	 * The cache-tree tells us where each directory ends and gives
+	 * us its tree, which has to exist as the sparse directory entry
+	 * refers to it.
+	 */
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT) ||
+	    !cache_tree_fully_valid(istate->cache_tree))
+		return 0;
+
+	free_name_hash(istate);
+	istate->cache_nr = convert_to_sparse_rec(istate, 0, 0, istate->cache_nr,
+						 "", 0, istate->cache_tree);
+	istate->sparse_index = 1;
+
+	/* collapsed directories are leaves of the cache-tree now */
+	cache_tree_free(&istate->cache_tree);
+	istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT))
+		die("BUG: cannot update the cache-tree of a sparse index");
+	return 0;
+}
+
+static int add_path_to_index(const unsigned char *sha1, struct strbuf *base,
+			     const char *path, unsigned int mode, int stage,
+			     void *context)
+{
+	struct index_state *istate = context;
+	struct cache_entry *ce;
+	size_t len = base->len + strlen(path);
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	ce = xcalloc(1, cache_entry_size(len));
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = create_ce_flags(stage) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = len;
+	hashcpy(ce->sha1, sha1);
+	memcpy(ce->name, base->buf, base->len);
+	memcpy(ce->name + base->len, path, len - base->len);
+
+	/* trees are walked in index order, so appending keeps it sorted */
+	ALLOC_GROW(istate->cache, istate->cache_nr + 1, istate->cache_alloc);
+	istate->cache[istate->cache_nr++] = ce;
+	return 0;
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct cache_entry **old_cache;
+	unsigned int i, old_nr;
+	struct pathspec ps;
+
+	if (!istate->sparse_index)
+		return;
+
+	old_cache = istate->cache;
+	old_nr = istate->cache_nr;
+	istate->cache = NULL;
+	istate->cache_nr = istate->cache_alloc = 0;
+	ALLOC_GROW(istate->cache, old_nr, istate->cache_alloc);
+	free_name_hash(istate);
+	memset(&ps, 0, sizeof(ps));
+
+	for (i = 0; i < old_nr; i++) {
+		struct cache_entry *ce = old_cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			ALLOC_GROW(istate->cache, istate->cache_nr + 1,
+				   istate->cache_alloc);
+			istate->cache[istate->cache_nr++] = ce;
+			continue;
+		}
+
+		tree = parse_tree_indirect(ce->sha1);
+		if (!tree ||
+		    read_tree_recursive(tree, ce->name, ce_namelen(ce), 0,
+					&ps, add_path_to_index, istate))
+			die(_("unable to expand sparse directory '%s' (%s)"),
+			    ce->name, sha1_to_hex(ce->sha1));
+		if (istate->cache_tree)
+			cache_tree_expand_sparse_dir(istate->cache_tree,
+						     ce->name, tree);
+		free(ce);
+	}
+
+	free(old_cache);
+	istate->sparse_index = 0;
+}
+
+void tweak_sparse_index(struct index_state *istate)
+{
+	if (!istate->sparse_index)
+		return;
+	if (!sparse_index_allowed(istate)) {
+		ensure_full_index(istate);
+		/* and write it out in full the next time */
+		istate->cache_changed |= SOMETHING_CHANGED;
+	} else if (command_requires_full_index) {
+		ensure_full_index(istate);
+	}
+}
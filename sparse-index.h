@@ -0,0 +1,40 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+/*
+ * A sparse index replaces every directory whose entries are all
+ * outside of the sparse checkout (i.e. marked skip-worktree) with a
+ * single "sparse directory" entry naming the tree, so that commands
+ * working on the checked out part of a huge repository do not have to
+ * read, sort and write an entry for every file in it.
+ *
+ * The index is written in this form when "index.sparse" is set and
+ * sparse checkout is enabled.  Commands that have not been taught
+ * about sparse directory entries expand it again right after reading
+ * it (see command_requires_full_index), and so does any lookup of a
+ * path hidden in a sparse directory.
+ */
+
+struct index_state;
+
+/*
+ * Collapse the index into its sparse form, if "index.sparse" asks
+ * for it and the index allows it.  Returns 0 on success, including
+ * when nothing was done.
+ */
+extern int convert_to_sparse(struct index_state *istate);
+
+/*
+ * Replace every sparse directory entry with the entries of its tree,
+ * all marked skip-worktree.  Does nothing if the index is not sparse.
+ */
+extern void ensure_full_index(struct index_state *istate);
+
+/*
+ * Called after reading the index: expand it, unless the command can
+ * work with sparse directory entries and "index.sparse" still asks
+ * for them.
+ */
+extern void tweak_sparse_index(struct index_state *istate);
+
+#endif
@@ -0,0 +1,28 @@
+#!/bin/sh
+
+test_description="git-grep -F performance with one and many patterns"
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+test_checkout_worktree
+
+test_expect_success 'setup patterns' '
+	for n in 1 10 500
+	do
+		test_seq 1 $n | sed "s/^/some_nonexistent_string_/" >patterns.$n ||
+		return 1
+	done
+'
+
+for n in 1 10 500
+do
+	test_perf "grep -F, $n patterns" "
+		git grep -F -f patterns.$n || :
+	"
+	test_perf "grep -F -i, $n patterns" "
+		git grep -F -i -f patterns.$n || :
+	"
+done
+
+test_done
@@ -0,0 +1,56 @@
+#!/bin/sh
+
+test_description='SHA-1 backends and the multi-buffer API'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test-sha1 --backends >backends &&
+	test -s backends &&
+	# the portable one, or "default" when they cannot be selected
+	reference=$(tail -n 1 backends) &&
+	for n in 0 1 55 56 63 64 65 119 120 128 1000 4097 100000
+	do
+		test-genrandom seed $n >file.$n || return 1
+	done &&
+	ls file.* >files &&
+	for f in $(cat files)
+	do
+		test-sha1 --backend=$reference <$f || return 1
+	done >expect
+'
+
+test_expect_success 'all backends agree' '
+	for backend in $(cat backends)
+	do
+		for f in $(cat files)
+		do
+			test-sha1 --backend=$backend <$f || return 1
+		done >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'multi-buffer hashing agrees with hashing one at a time' '
+	for backend in $(cat backends)
+	do
+		test-sha1 --backend=$backend --multi $(cat files) >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'the hashes of known strings' '
+	printf abc >abc &&
+	echo a9993e364706816aba3e25717850c26c9cd0d89d >expect &&
+	for backend in $(cat backends)
+	do
+		test-sha1 --backend=$backend <abc >actual &&
+		test_cmp expect actual &&
+		test-sha1 --backend=$backend --multi abc abc >actual &&
+		test_line_count = 2 actual &&
+		uniq actual >actual.uniq &&
+		test_cmp expect actual.uniq || return 1
+	done
+'
+
+test_done
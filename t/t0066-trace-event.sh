@@ -0,0 +1,63 @@
+#!/bin/sh
+
+test_description='GIT_TRACE_EVENT structured events'
+
+. ./test-lib.sh
+
+event () {
+	sed -n "s/^{\"event\":\"\([a-z_]*\)\".*/\1/p" "$@"
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two
+'
+
+test_expect_success 'a command reports start and exit with its code' '
+	GIT_TRACE_EVENT="$(pwd)/trace" git rev-parse HEAD >/dev/null &&
+	event trace >actual &&
+	printf "start\nexit\n" >expect &&
+	test_cmp expect actual &&
+	grep "\"argv\":\[\"[^\"]*git\",\"rev-parse\",\"HEAD\"\]" trace &&
+	grep "\"event\":\"exit\".*\"code\":0}" trace &&
+	rm trace &&
+	test_must_fail env GIT_TRACE_EVENT="$(pwd)/trace" \
+		git rev-parse --verify no-such-ref &&
+	grep "\"event\":\"exit\".*\"code\":128}" trace
+'
+
+test_expect_success 'child processes are reported and nest their session ids' '
+	rm -f trace &&
+	GIT_TRACE_EVENT="$(pwd)/trace" git gc --quiet &&
+	grep "\"event\":\"child_start\".*\"argv\":\[\"repack\"" trace &&
+	sid=$(sed -n "1s/.*\"sid\":\"\([0-9]*\)\".*/\1/p" trace) &&
+	grep "\"sid\":\"$sid/[0-9]*\",\"thread\":\"main\".*\"argv\":\[\"git\",\"repack\"" trace &&
+	grep "\"sid\":\"$sid/[0-9]*/[0-9]*\".*\"argv\":\[\"git\",\"pack-objects\"" trace &&
+	test $(event trace | grep -c "^child_start") = \
+	     $(event trace | grep -c "^child_exit")
+'
+
+test_expect_success 'regions, threads and data' '
+	rm -f trace &&
+	git rev-parse HEAD >revs &&
+	GIT_TRACE_EVENT="$(pwd)/trace" \
+		git pack-objects --threads=2 --revs --stdout <revs >pack &&
+	grep "\"event\":\"region_enter\".*\"nesting\":1,\"category\":\"pack-objects\",\"label\":\"write pack\"}" trace &&
+	grep "\"event\":\"region_leave\".*\"label\":\"write pack\",\"t_rel\":[0-9]*\.[0-9]*}" trace &&
+	grep "\"event\":\"data\".*\"key\":\"written\",\"value\":6}" trace &&
+	grep "\"event\":\"thread_start\",\"sid\":\"[0-9]*\",\"thread\":\"th[0-9]*:pack-objects/deflate\"" trace &&
+	test $(event trace | grep -c "^thread_start") = \
+	     $(event trace | grep -c "^thread_exit")
+'
+
+test_expect_success 'strings are quoted' '
+	rm -f trace &&
+	GIT_TRACE_EVENT="$(pwd)/trace" git rev-parse --sq-quote \
+		"quote\" backslash\\ tab	." >/dev/null &&
+	cat >expect <<-\EOF &&
+	"quote\" backslash\\ tab\t."]
+	EOF
+	grep -F -f expect trace
+'
+
+test_done
@@ -0,0 +1,48 @@
+#!/bin/sh
+
+test_description='core.looseObjectCache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git init --bare alt.git &&
+	echo "from alternate" >alt-file &&
+	alt_blob=$(git --git-dir=alt.git hash-object -w alt-file) &&
+	echo "$(pwd)/alt.git/objects" >.git/objects/info/alternates &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	echo $alt_blob >>objects &&
+	echo 0000000000000000000000000000000000000001 >>objects
+'
+
+test_expect_success 'cat-file --batch-check answers the same with the cache' '
+	git cat-file --batch-check <objects >expect &&
+	git -c core.looseObjectCache=true cat-file --batch-check <objects >actual &&
+	test_cmp expect actual &&
+	grep "^0000000000000000000000000000000000000001 missing" actual
+'
+
+test_expect_success 'short names are found in the cache and alternates' '
+	blob=$(git rev-parse one:one.t) &&
+	short=$(echo $blob | cut -c1-7) &&
+	test "$(git -c core.looseObjectCache=true rev-parse $short)" = $blob &&
+	short=$(echo $alt_blob | cut -c1-7) &&
+	test "$(git -c core.looseObjectCache=true rev-parse $short)" = $alt_blob
+'
+
+test_expect_success 'objects written by the same process are seen' '
+	for i in $(test_seq 1 64)
+	do
+		mkdir dir$i &&
+		for j in 1 2 3 4
+		do
+			echo "$i $j" >dir$i/file$j || return 1
+		done
+	done &&
+	git add dir* &&
+	git -c core.looseObjectCache=true commit -m many &&
+	git -c core.looseObjectCache=true fsck
+'
+
+test_done
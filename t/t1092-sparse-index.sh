@@ -0,0 +1,132 @@
+#!/bin/sh
+
+test_description='sparse index
+
+Compare the behaviour of a sparse checkout using a full index with
+one that collapses the directories outside of it into sparse
+directory entries.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p deep/deeper1/deepest folder1/0 folder2 x &&
+	for f in a deep/a deep/deeper1/a deep/deeper1/deepest/a \
+		 folder1/a folder1/0/a folder2/a x/a e
+	do
+		echo "$f" >"$f" || return 1
+	done &&
+	git add . &&
+	git commit -m initial &&
+	git checkout -b update-folder1 &&
+	echo changed >folder1/a &&
+	echo new >folder1/0/b &&
+	git add folder1 &&
+	git commit -m "update folder1" &&
+	git checkout master &&
+
+	for repo in full-index sparse-index
+	do
+		git clone -q . $repo &&
+		(
+			cd $repo &&
+			git config core.sparseCheckout true &&
+			cat >.git/info/sparse-checkout <<-\EOF &&
+			/*
+			!/*/
+			/deep/
+			EOF
+			git read-tree -m -u HEAD
+		) || return 1
+	done &&
+	git -C sparse-index config index.sparse true &&
+	git -C sparse-index read-tree -m -u HEAD
+'
+
+# run the same command in both repositories and compare the results
+test_all_match () {
+	(cd full-index && "$@") >full-out 2>full-err &&
+	(cd sparse-index && "$@") >sparse-out 2>sparse-err &&
+	test_cmp full-out sparse-out &&
+	test_cmp full-err sparse-err
+}
+
+test_expect_success 'directories outside the checkout are collapsed' '
+	(cd sparse-index && test-dump-sparse-index) >actual &&
+	sed -e "s/ [0-9a-f]* 0	/ 0	/" actual >actual.names &&
+	cat >expect <<-\EOF &&
+	sparse index
+	100644 0	a
+	100644 0	deep/a
+	100644 0	deep/deeper1/a
+	100644 0	deep/deeper1/deepest/a
+	100644 0	e
+	040000 0	folder1/
+	040000 0	folder2/
+	040000 0	x/
+	EOF
+	test_cmp expect actual.names &&
+	(cd full-index && test-dump-sparse-index) >actual &&
+	test_line_count = 10 actual
+'
+
+test_expect_success 'sparse directories refer to the trees of HEAD' '
+	(cd sparse-index && test-dump-sparse-index) >actual &&
+	git rev-parse HEAD:folder1 >expect &&
+	sed -n -e "s/^040000 \([0-9a-f]*\) 0	folder1\/$/\1/p" actual >actual.tree &&
+	test_cmp expect actual.tree
+'
+
+test_expect_success 'commands that need the full index still see it' '
+	test_all_match git ls-files -s -t &&
+	test_all_match git ls-files -- folder1 &&
+	test_all_match git diff-index HEAD &&
+	test_all_match git write-tree
+'
+
+test_expect_success 'status' '
+	test_all_match git status --porcelain &&
+	test_all_match git status --porcelain --untracked-files=all &&
+	for repo in full-index sparse-index
+	do
+		echo changed >>$repo/deep/a &&
+		echo new >$repo/deep/new || return 1
+	done &&
+	test_all_match git status --porcelain &&
+	test_all_match git status --porcelain -- deep/deeper1 folder1
+'
+
+test_expect_success 'add keeps the index sparse' '
+	test_all_match git add deep &&
+	test_all_match git status --porcelain &&
+	test_all_match git diff --cached --stat HEAD &&
+	(cd sparse-index && test-dump-sparse-index) >actual &&
+	test_i18ngrep "^sparse index" actual &&
+	test_i18ngrep "	folder1/$" actual
+'
+
+test_expect_success 'add of paths hidden in sparse directories' '
+	test_all_match test_must_fail git add folder1/does-not-exist &&
+	test_all_match git add --refresh folder1/a
+'
+
+test_expect_success 'status sees staged changes in sparse directories' '
+	test_all_match git commit -q -m "change deep" &&
+	test_all_match git reset --soft origin/update-folder1 &&
+	test_all_match git status --porcelain &&
+	test_all_match git status --porcelain -- folder1/0 &&
+	(cd sparse-index && test-dump-sparse-index) >actual &&
+	test_i18ngrep "^sparse index" actual
+'
+
+test_expect_success 'the index is written in full without index.sparse' '
+	git -C sparse-index config index.sparse false &&
+	git -C sparse-index update-index --force-write-index &&
+	(cd sparse-index && test-dump-sparse-index) >actual &&
+	test_i18ngrep "^full index" actual &&
+	git -C sparse-index config index.sparse true &&
+	git -C sparse-index update-index --force-write-index &&
+	(cd sparse-index && test-dump-sparse-index) >actual &&
+	test_i18ngrep "^sparse index" actual
+'
+
+test_done
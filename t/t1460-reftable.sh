@@ -0,0 +1,238 @@
+#!/bin/sh
+
+test_description='the reftable ref storage backend'
+
+. ./test-lib.sh
+
+INVALID_SHA1=aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
+
+test_expect_success 'init with an unknown ref storage fails' '
+	test_must_fail git init --ref-storage=nonsense unknown &&
+	test_path_is_missing unknown
+'
+
+test_expect_success 'init --ref-storage=reftable' '
+	git init --ref-storage=reftable repo &&
+	test_path_is_dir repo/.git/reftable &&
+	test "$(git -C repo config core.repositoryformatversion)" = 1 &&
+	test "$(git -C repo config extensions.refstorage)" = reftable &&
+	test "$(git -C repo symbolic-ref HEAD)" = refs/heads/master
+'
+
+test_expect_success 'reinit keeps the backend and refuses to change it' '
+	git init repo &&
+	test "$(git -C repo config extensions.refstorage)" = reftable &&
+	test_must_fail git init --ref-storage=files repo
+'
+
+test_expect_success 'a repository with an unknown extension is refused' '
+	git init unknown-ext &&
+	git -C unknown-ext config core.repositoryformatversion 1 &&
+	git -C unknown-ext config extensions.nonsense true &&
+	test_must_fail git -C unknown-ext rev-parse HEAD &&
+	git -C unknown-ext config core.repositoryformatversion 0 &&
+	git -C unknown-ext rev-parse --git-dir
+'
+
+test_expect_success 'commit, branch and tag' '
+	(
+		cd repo &&
+		test_commit one &&
+		git branch side &&
+		git tag -a -m annotated v1 &&
+		test "$(git rev-parse master)" = "$(git rev-parse one)" &&
+		test "$(git rev-parse side)" = "$(git rev-parse one)" &&
+		test "$(git rev-parse v1^{})" = "$(git rev-parse one)" &&
+		git for-each-ref --format="%(refname)" >actual &&
+		cat >expect <<-\EOF &&
+		refs/heads/master
+		refs/heads/side
+		refs/tags/one
+		refs/tags/v1
+		EOF
+		test_cmp expect actual &&
+		test_path_is_missing .git/refs/heads/master &&
+		test_path_is_missing .git/packed-refs
+	)
+'
+
+test_expect_success 'show-ref -d uses the recorded peeled values' '
+	(
+		cd repo &&
+		git show-ref -d v1 >actual &&
+		cat >expect <<-EOF &&
+		$(git rev-parse v1) refs/tags/v1
+		$(git rev-parse one) refs/tags/v1^{}
+		EOF
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'update-ref checks the old value' '
+	(
+		cd repo &&
+		test_commit two &&
+		test_must_fail git update-ref refs/heads/side HEAD $INVALID_SHA1 &&
+		git update-ref refs/heads/side HEAD one &&
+		test "$(git rev-parse side)" = "$(git rev-parse two)" &&
+		git update-ref -d refs/heads/side &&
+		test_must_fail git rev-parse --verify -q side
+	)
+'
+
+test_expect_success 'directory/file conflicts are detected' '
+	(
+		cd repo &&
+		test_must_fail git update-ref refs/heads/master/sub HEAD &&
+		test_must_fail git update-ref refs/tags HEAD &&
+		git update-ref refs/heads/d/e HEAD &&
+		test_must_fail git update-ref refs/heads/d HEAD &&
+		git update-ref -d refs/heads/d/e &&
+		git update-ref refs/heads/d HEAD
+	)
+'
+
+test_expect_success 'update-ref --stdin transaction is atomic' '
+	(
+		cd repo &&
+		cat >stdin <<-EOF &&
+		create refs/heads/t1 $(git rev-parse one)
+		create refs/heads/t2 $(git rev-parse two)
+		EOF
+		git update-ref --stdin <stdin &&
+		test "$(git rev-parse t1)" = "$(git rev-parse one)" &&
+		test "$(git rev-parse t2)" = "$(git rev-parse two)" &&
+		cat >stdin <<-EOF &&
+		update refs/heads/t1 $(git rev-parse two)
+		verify refs/heads/t2 $(git rev-parse one)
+		EOF
+		test_must_fail git update-ref --stdin <stdin &&
+		test "$(git rev-parse t1)" = "$(git rev-parse one)"
+	)
+'
+
+test_expect_success 'symbolic refs' '
+	(
+		cd repo &&
+		git symbolic-ref refs/heads/alias refs/heads/t1 &&
+		test "$(git symbolic-ref refs/heads/alias)" = refs/heads/t1 &&
+		test "$(git rev-parse alias)" = "$(git rev-parse t1)" &&
+		git update-ref refs/heads/alias two &&
+		test "$(git rev-parse t1)" = "$(git rev-parse two)" &&
+		git update-ref --no-deref -d refs/heads/alias &&
+		git rev-parse --verify t1
+	)
+'
+
+test_expect_success 'pseudorefs stay files' '
+	(
+		cd repo &&
+		git update-ref ORIG_HEAD one &&
+		test "$(cat .git/ORIG_HEAD)" = "$(git rev-parse one)" &&
+		test "$(git rev-parse ORIG_HEAD)" = "$(git rev-parse one)"
+	)
+'
+
+test_expect_success 'reflogs' '
+	(
+		cd repo &&
+		git checkout -b topic &&
+		test_commit three &&
+		git log -g --format=%gs topic >actual &&
+		cat >expect <<-\EOF &&
+		commit: three
+		branch: Created from HEAD
+		EOF
+		test_cmp expect actual &&
+		git log -g --format=%gs -3 HEAD >actual &&
+		cat >expect <<-\EOF &&
+		commit: three
+		checkout: moving from master to topic
+		commit: two
+		EOF
+		test_cmp expect actual &&
+		test "$(git rev-parse topic@{1})" = "$(git rev-parse two)" &&
+		git reflog exists refs/heads/topic &&
+		test_must_fail git reflog exists refs/heads/nonexistent
+	)
+'
+
+test_expect_success 'reflog expire' '
+	(
+		cd repo &&
+		git reflog expire --expire=all refs/heads/topic &&
+		git log -g --format=%gs topic >actual &&
+		test_must_be_empty actual &&
+		git reflog exists refs/heads/topic
+	)
+'
+
+test_expect_success 'rename a branch with its reflog' '
+	(
+		cd repo &&
+		git checkout master &&
+		git branch renamed-from t1 &&
+		git branch -m renamed-from renamed-to &&
+		test_must_fail git rev-parse --verify -q renamed-from &&
+		test "$(git rev-parse renamed-to)" = "$(git rev-parse t1)" &&
+		git log -g --format=%gs renamed-to >actual &&
+		cat >expect <<-\EOF &&
+		Branch: renamed refs/heads/renamed-from to refs/heads/renamed-to
+		branch: Created from t1
+		EOF
+		test_cmp expect actual &&
+		test_must_fail git reflog exists refs/heads/renamed-from
+	)
+'
+
+test_expect_success 'deleting a branch deletes its reflog' '
+	(
+		cd repo &&
+		git branch -D renamed-to &&
+		test_must_fail git reflog exists refs/heads/renamed-to
+	)
+'
+
+test_expect_success 'many refs and compaction' '
+	(
+		cd repo &&
+		for i in $(test_seq 1 500)
+		do
+			echo "create refs/tags/many/$i HEAD" || return 1
+		done >stdin &&
+		git update-ref --stdin <stdin &&
+		for i in $(test_seq 1 20)
+		do
+			git update-ref refs/heads/counter-$i HEAD || return 1
+		done &&
+		test $(wc -l <.git/reftable/tables.list) -lt 10 &&
+		test $(git for-each-ref refs/tags/many | wc -l) = 500 &&
+		git rev-parse --verify refs/tags/many/250 &&
+		git pack-refs --all &&
+		test_line_count = 1 .git/reftable/tables.list &&
+		test $(ls .git/reftable/*.ref | wc -l) = 1 &&
+		test $(git for-each-ref refs/tags/many | wc -l) = 500 &&
+		git rev-parse --verify refs/heads/counter-20 &&
+		test "$(git symbolic-ref HEAD)" = refs/heads/master
+	)
+'
+
+test_expect_success 'fsck, gc and clone' '
+	(
+		cd repo &&
+		git fsck &&
+		git gc &&
+		git rev-parse --verify refs/tags/many/1
+	) &&
+	git clone repo clone &&
+	test "$(git -C clone rev-parse HEAD)" = "$(git -C repo rev-parse HEAD)"
+'
+
+test_expect_success 'push into a reftable repository' '
+	git init --bare --ref-storage=reftable bare.git &&
+	git -C repo push ../bare.git master topic &&
+	test "$(git -C bare.git rev-parse master)" = "$(git -C repo rev-parse master)" &&
+	test "$(git -C bare.git rev-parse topic)" = "$(git -C repo rev-parse topic)"
+'
+
+test_done
@@ -0,0 +1,103 @@
+#!/bin/sh
+
+test_description='loading the index with multiple threads
+
+GIT_TEST_INDEX_THREADS forces the entry offset table (IEOT) and the
+end of index entries (EOIE) extensions to be written even for small
+indexes, and the index to be loaded with that many threads.'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_INDEX_THREADS
+
+test_expect_success 'setup' '
+	mkdir -p dir/sub other &&
+	for i in $(test_seq 40)
+	do
+		echo $i >file$i &&
+		echo $i >dir/file$i &&
+		echo $i >dir/sub/a-rather-long-file-name-$i &&
+		echo $i >other/file$i || return 1
+	done &&
+	git add . &&
+	git commit -m initial
+'
+
+# compare the index read with threads against a serial read
+ls_files_two_modes () {
+	git -c index.threads=false ls-files --stage --debug >expect &&
+	GIT_TEST_INDEX_THREADS=3 git ls-files --stage --debug >actual &&
+	test_cmp expect actual &&
+	git -c index.threads=false status --porcelain >expect &&
+	GIT_TEST_INDEX_THREADS=3 git status --porcelain >actual &&
+	test_cmp expect actual
+}
+
+for version in 2 3 4
+do
+	test_expect_success "write offset table (index v$version)" '
+		git update-index --index-version $version &&
+		GIT_TEST_INDEX_THREADS=4 git update-index --force-remove nonexistent &&
+		grep IEOT .git/index >/dev/null &&
+		grep EOIE .git/index >/dev/null
+	'
+
+	test_expect_success "threaded load matches serial load (index v$version)" '
+		ls_files_two_modes
+	'
+done
+
+test_expect_success 'small index written without the environment has no table' '
+	git update-index --force-remove nonexistent &&
+	! grep IEOT .git/index &&
+	! grep EOIE .git/index
+'
+
+test_expect_success 'extensions are loaded alongside the entries' '
+	git checkout -b side &&
+	echo side >file1 &&
+	git commit -a -m side &&
+	git checkout master &&
+	echo master >file1 &&
+	git commit -a -m master &&
+	test_must_fail git merge side &&
+	echo resolved >file1 &&
+	git add file1 &&
+	GIT_TEST_INDEX_THREADS=4 git update-index --force-remove nonexistent &&
+	ls_files_two_modes &&
+	git -c index.threads=false ls-files --resolve-undo >expect &&
+	GIT_TEST_INDEX_THREADS=3 git ls-files --resolve-undo >actual &&
+	test_cmp expect actual &&
+	test-dump-cache-tree >expect &&
+	GIT_TEST_INDEX_THREADS=3 test-dump-cache-tree >actual &&
+	test_cmp expect actual &&
+	git commit -m merged
+'
+
+test_expect_success 'unmerged entries and more threads than blocks' '
+	git checkout -b conflict HEAD~1 &&
+	echo conflict >file1 &&
+	git commit -a -m conflict &&
+	test_must_fail git merge master &&
+	GIT_TEST_INDEX_THREADS=2 git update-index --force-remove nonexistent &&
+	git -c index.threads=false ls-files --stage --debug >expect &&
+	GIT_TEST_INDEX_THREADS=16 git ls-files --stage --debug >actual &&
+	test_cmp expect actual &&
+	git reset --hard
+'
+
+test_expect_success 'split index' '
+	git update-index --split-index &&
+	echo changed >dir/file7 &&
+	GIT_TEST_INDEX_THREADS=4 git add dir/file7 &&
+	ls_files_two_modes &&
+	git update-index --no-split-index
+'
+
+test_expect_success 'serial readers skip the extensions silently' '
+	GIT_TEST_INDEX_THREADS=4 git update-index --force-remove nonexistent &&
+	git -c index.threads=1 ls-files >/dev/null 2>err &&
+	test_must_be_empty err
+'
+
+test_done
@@ -0,0 +1,133 @@
+#!/bin/sh
+
+test_description='parallel checkout'
+
+. ./test-lib.sh
+
+# Check out with several workers even for a handful of entries.
+parallel="-c checkout.workers=4 -c checkout.thresholdForParallelism=0"
+
+test_expect_success 'setup' '
+	for d in . a a/b c
+	do
+		mkdir -p $d &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			echo "$d/file$i" >$d/file$i || return 1
+		done
+	done &&
+	printf "one\ntwo\n" >lf.txt &&
+	echo "\$Id\$" >ident.txt &&
+	echo "#!/bin/sh" >script.sh &&
+	chmod +x script.sh &&
+	cat >.gitattributes <<-\EOF &&
+	*.txt text eol=crlf
+	ident.txt ident
+	EOF
+	git add . &&
+	git commit -m initial &&
+	git tag initial &&
+	git rm -r c &&
+	for i in 1 2 3 4 5
+	do
+		echo changed >a/b/file$i &&
+		echo new >a/new$i || return 1
+	done &&
+	mkdir c &&
+	echo file-turned-dir >c/x &&
+	git add . &&
+	git commit -m second &&
+	git tag second
+'
+
+test_expect_success SYMLINKS 'setup symlink' '
+	git checkout second &&
+	ln -s a/file1 link &&
+	git add link &&
+	git commit -m symlink &&
+	git tag symlink &&
+	git checkout master
+'
+
+test_checkout_matches () {
+	git -C serial ls-files -s >expect &&
+	git -C parallel ls-files -s >actual &&
+	test_cmp expect actual &&
+	(cd serial && find . -path ./.git -prune -o -print | sort) >expect &&
+	(cd parallel && find . -path ./.git -prune -o -print | sort) >actual &&
+	test_cmp expect actual &&
+	for f in $(git -C serial ls-files)
+	do
+		test_cmp serial/$f parallel/$f || return 1
+	done &&
+	test_cmp serial/script.sh parallel/script.sh &&
+	test -x parallel/script.sh &&
+	git -C parallel diff-files --exit-code &&
+	git -C parallel status --porcelain >actual &&
+	test_must_be_empty actual
+}
+
+test_expect_success 'clone checks out the same tree' '
+	git clone -q . serial &&
+	git $parallel clone -q . parallel &&
+	test_checkout_matches
+'
+
+test_expect_success 'conversions are applied by the workers' '
+	printf "one\r\ntwo\r\n" >expect &&
+	test_cmp expect parallel/lf.txt &&
+	grep "\\\$Id: [0-9a-f]* \\\$" parallel/ident.txt
+'
+
+test_expect_success 'switching branches' '
+	for rev in second initial second
+	do
+		git -C serial checkout -q $rev &&
+		git -C parallel $parallel checkout -q $rev &&
+		test_checkout_matches || return 1
+	done
+'
+
+test_expect_success SYMLINKS 'symlinks are written alongside' '
+	git -C serial checkout -q symlink &&
+	git -C parallel $parallel checkout -q symlink &&
+	test_checkout_matches &&
+	test -h parallel/link
+'
+
+test_expect_success 'smudge filters are still run' '
+	git clone -q -n . smudge &&
+	echo "a/* filter=rot13" >smudge/.git/info/attributes &&
+	git -C smudge config filter.rot13.smudge "tr a-zA-Z n-za-mA-Z" &&
+	git -C smudge $parallel checkout -q second &&
+	echo "n/svyr2" >expect &&
+	test_cmp expect smudge/a/file2 &&
+	echo "./file2" >expect &&
+	test_cmp expect smudge/file2
+'
+
+test_expect_success 'an unchanged tree is not rewritten' '
+	git -C parallel checkout -q -f second &&
+	test-chmtime =-60 parallel/a/file3 &&
+	test-chmtime -v +0 parallel/a/file3 >expect &&
+	git -C parallel $parallel checkout -q initial &&
+	test-chmtime -v +0 parallel/a/file3 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'colliding paths are checked out' '
+	git init collide &&
+	(
+		cd collide &&
+		blob_a=$(echo a | git hash-object -w --stdin) &&
+		blob_b=$(echo b | git hash-object -w --stdin) &&
+		printf "100644 blob %s\tFILE\n100644 blob %s\tfile\n" \
+			$blob_a $blob_b | git update-index --index-info &&
+		git commit -m collide &&
+		rm -f FILE file &&
+		git $parallel reset --hard &&
+		test_path_is_file file
+	)
+'
+
+test_done
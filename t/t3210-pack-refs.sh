@@ -211,4 +211,68 @@ test_expect_success 'retry acquiring packed-refs.lock' '
 	git -c core.packedrefstimeout=3000 pack-refs --all --prune
 '
 
+test_expect_success 'packed-refs records that they are sorted' '
+	git pack-refs --all &&
+	head -n 1 .git/packed-refs >header &&
+	grep " sorted " header
+'
+
+test_expect_success 'look up refs in a sorted packed-refs file' '
+	git tag -a -m annotated packed-annotated &&
+	for i in 1 2 3 4 5 6 7 8 9
+	do
+		git branch lookup/b$i &&
+		git branch lookup/b$i-x &&
+		git branch lookup/b$i.d/y || return 1
+	done &&
+	git pack-refs --all --prune &&
+	for i in 1 5 9
+	do
+		git rev-parse --verify lookup/b$i &&
+		git rev-parse --verify lookup/b$i-x &&
+		git rev-parse --verify lookup/b$i.d/y || return 1
+	done &&
+	test_must_fail git rev-parse --verify refs/heads/lookup/b0 &&
+	test_must_fail git rev-parse --verify refs/heads/lookup/b &&
+	test_must_fail git rev-parse --verify refs/heads/lookup/b9-y &&
+	git rev-parse packed-annotated^{commit} >expect &&
+	git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git show-ref --tags -d packed-annotated >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'iterate over a directory of a sorted packed-refs file' '
+	git for-each-ref --format="%(refname)" refs/heads/lookup/ >actual &&
+	test_line_count = 27 actual &&
+	git for-each-ref --format="%(refname)" refs/heads/lookup/b4.d/ >actual &&
+	echo refs/heads/lookup/b4.d/y >expect &&
+	test_cmp expect actual &&
+	git for-each-ref --format="%(refname)" >all &&
+	grep refs/heads/lookup/ all >expect &&
+	git for-each-ref --format="%(refname)" refs/heads/lookup/ >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'iterate over the same directories more than once' '
+	git for-each-ref --format="%(objectname)" refs/heads/ >heads &&
+	git for-each-ref --format="%(objectname)" refs/tags/ >tags &&
+	cat heads tags heads >expect &&
+	git rev-parse --branches --tags --branches >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'read packed-refs written without the sorted trait' '
+	test_when_finished "git pack-refs --all" &&
+	{
+		echo "# pack-refs with: peeled fully-peeled " &&
+		grep -v "^#" .git/packed-refs | grep -v "^\\^" | sort -r
+	} >unsorted &&
+	mv unsorted .git/packed-refs &&
+	git rev-parse --verify lookup/b5-x &&
+	git rev-parse --verify lookup/b1.d/y &&
+	git for-each-ref --format="%(refname)" refs/heads/lookup/ >actual &&
+	test_line_count = 27 actual
+'
+
 test_done
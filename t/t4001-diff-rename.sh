@@ -156,4 +156,96 @@ test_expect_success 'rename pretty print common prefix and suffix overlap' '
 	test_i18ngrep " d/f/{ => f}/e " output
 '
 
+test_expect_success 'threaded rename detection finds the same renames' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 1 40)
+		do
+			test_seq $i $(($i + 50)) >file$i || return 1
+		done &&
+		git add . &&
+		git commit -m before &&
+		for i in $(test_seq 1 40)
+		do
+			git mv file$i moved$i &&
+			echo change >>moved$i || return 1
+		done &&
+		echo new >new &&
+		git add . &&
+		git commit -m after &&
+		git -c diff.renameThreads=1 diff -M --raw HEAD^ HEAD >expect &&
+		git -c diff.renameThreads=4 diff -M --raw HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		test $(grep -c "	file[0-9]*	moved" actual) = 40 &&
+		git -c diff.renameThreads=1 diff -C -C --raw HEAD^ HEAD >expect &&
+		git -c diff.renameThreads=4 diff -C -C --raw HEAD^ HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success SYMLINKS 'threaded rename detection with --no-index and symlinks' '
+	mkdir no-index no-index/a no-index/b &&
+	(
+		cd no-index &&
+		for i in $(test_seq 1 40)
+		do
+			test_seq $i $(($i + 50)) >a/file$i &&
+			ln -s file$i a/link$i &&
+			test_seq $i $(($i + 50)) >b/moved$i &&
+			echo change >>b/moved$i || return 1
+		done &&
+		test_expect_code 1 git -c diff.renameThreads=1 \
+			diff --no-index -M --raw a b >expect &&
+		test_expect_code 1 git -c diff.renameThreads=8 \
+			diff --no-index -M --raw a b >actual &&
+		test_cmp expect actual &&
+		test $(grep -c "	a/file[0-9]*	b/moved" actual) = 40
+	)
+'
+
+test_expect_success 'files that keep their basename are paired first' '
+	git init basenames &&
+	(
+		cd basenames &&
+		mkdir old &&
+		for i in $(test_seq 1 5)
+		do
+			test_seq $i $(($i + 20)) >old/file$i || return 1
+		done &&
+		git add . &&
+		git commit -m before &&
+		git mv old new &&
+		for i in $(test_seq 1 5)
+		do
+			echo change >>new/file$i || return 1
+		done &&
+		git add . &&
+		git commit -m after &&
+		git diff -M --name-status HEAD^ HEAD >expect &&
+		test $(grep -c "^R[0-9]*	old/file[0-9]	new/file" expect) = 5 &&
+		GIT_TRACE_EVENT="$(pwd)/trace" git diff -M --name-status \
+			HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		grep "basename rename detection" trace &&
+		! grep "inexact rename detection" trace &&
+		git diff -M --no-rename-basenames --name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'basename pairing keeps renames under the rename limit' '
+	(
+		cd basenames &&
+		git diff -M -l1 --name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		git -c diff.renameBasenames=false diff -M -l1 --name-status \
+			HEAD^ HEAD >actual &&
+		! grep "^R" actual &&
+		git -c diff.renameBasenames=false diff -M -l1 --rename-basenames \
+			--name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -0,0 +1,133 @@
+#!/bin/sh
+
+test_description='git log for a path with changed-path Bloom filters'
+. ./test-lib.sh
+
+test_expect_success 'setup test - repo, commits, commit graph, log outputs' '
+	mkdir A A/B A/B/C &&
+	test_commit c1 A/file1 &&
+	test_commit c2 A/B/file2 &&
+	test_commit c3 A/B/C/file3 &&
+	test_commit c4 A/file1 &&
+	test_commit c5 A/B/file2 &&
+	test_commit c6 A/B/C/file3 &&
+	test_commit c7 A/file1 &&
+	test_commit c8 A/B/file2 &&
+	test_commit c9 A/B/C/file3 &&
+	test_commit c10 file_to_be_deleted &&
+	git checkout -b side HEAD~4 &&
+	test_commit side-1 file4 &&
+	git checkout master &&
+	git merge side &&
+	test_commit c11 file5 &&
+	mv file5 file5_renamed &&
+	git add file5_renamed &&
+	git commit -m "rename" &&
+	rm file_to_be_deleted &&
+	git add . &&
+	git commit -m "file removed" &&
+	git commit-graph write --reachable --changed-paths
+'
+
+graph_read_expect () {
+	cat >expect <<-EOF
+	header: 43475048 1 1 $1 0
+	num_commits: $2
+	chunks: oid_fanout oid_lookup commit_metadata$3
+	EOF
+	git commit-graph read >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'commit-graph has Bloom filter chunks' '
+	graph_read_expect 5 15 " bloom_indexes bloom_data"
+'
+
+log_with_and_without_filters () {
+	git -c core.commitGraph=false log --pretty="format:%s" $1 >expect &&
+	git -c core.commitGraph=true log --pretty="format:%s" $1 >actual &&
+	test_cmp expect actual
+}
+
+for path in A A/ A/B A/B/ A/B/C A/file1 A/B/file2 A/B/C/file3 file4 file5 \
+	    file5_renamed file_to_be_deleted nonexistent
+do
+	for option in "" \
+		      "--full-history" \
+		      "--full-history --simplify-merges" \
+		      "--simplify-merges" \
+		      "--simplify-by-decoration" \
+		      "--topo-order" \
+		      "--first-parent" \
+		      "--raw"
+	do
+		test_expect_success "git log option: $option for path: $path" "
+			log_with_and_without_filters \"$option -- $path\"
+		"
+	done
+done
+
+test_expect_success 'git log with multiple paths' '
+	log_with_and_without_filters "-- A/file1 file4" &&
+	log_with_and_without_filters "-- file4 nonexistent"
+'
+
+test_expect_success 'git log with wildcards and pathspec magic' '
+	log_with_and_without_filters "-- A/*" &&
+	log_with_and_without_filters "-- *file2" &&
+	log_with_and_without_filters "-- :(icase)a/FILE1" &&
+	log_with_and_without_filters "-- A :(exclude)A/B" &&
+	log_with_and_without_filters "-- :(literal)A/file1"
+'
+
+test_expect_success 'git log --follow with filters' '
+	log_with_and_without_filters "--follow -- file5_renamed"
+'
+
+test_expect_success 'git log from a subdirectory' '
+	(
+		cd A &&
+		git -c core.commitGraph=false log --pretty="format:%s" -- B >expect &&
+		git -c core.commitGraph=true log --pretty="format:%s" -- B >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'commits not in the graph are diffed as usual' '
+	test_commit c12 A/B/file2 &&
+	log_with_and_without_filters "-- A/B" &&
+	log_with_and_without_filters "-- A/file1"
+'
+
+test_expect_success 'rewriting the graph keeps the filters' '
+	git commit-graph write --reachable &&
+	graph_read_expect 5 16 " bloom_indexes bloom_data" &&
+	log_with_and_without_filters "-- A/B/file2"
+'
+
+test_expect_success 'commit changing many paths gets a filter matching all' '
+	mkdir many &&
+	for i in $(test_seq 600)
+	do
+		echo $i >many/$i || return 1
+	done &&
+	git add many &&
+	git commit -m many &&
+	git commit-graph write --reachable &&
+	log_with_and_without_filters "-- many/17" &&
+	log_with_and_without_filters "-- A"
+'
+
+test_expect_success 'grafts disable the filters' '
+	test_when_finished "rm -f .git/info/grafts" &&
+	echo "$(git rev-parse HEAD) $(git rev-parse c1)" >.git/info/grafts &&
+	log_with_and_without_filters "-- A/B"
+'
+
+test_expect_success '--no-changed-paths drops the filters' '
+	git commit-graph write --reachable --no-changed-paths &&
+	graph_read_expect 3 17 &&
+	log_with_and_without_filters "-- A/B"
+'
+
+test_done
@@ -400,6 +400,28 @@ test_expect_success 'verify resulting packs' '
 	git verify-pack test-11-*.pack
 '
 
+test_expect_success 'deflating in threads writes the same pack' '
+	for window in 0 10
+	do
+		git -c pack.packSizeLimit=0 pack-objects --stdout --no-reuse-object \
+			--window=$window --threads=1 <obj-list >serial.pack &&
+		git -c pack.packSizeLimit=0 pack-objects --stdout --no-reuse-object \
+			--window=$window --threads=4 <obj-list >threaded.pack &&
+		test_cmp serial.pack threaded.pack || return 1
+	done
+'
+
+test_expect_success 'checking objects in threads writes the same index' '
+	for pack in test-1-$packname_1 test-2-$packname_2 test-3-$packname_3
+	do
+		git index-pack --strict --threads=1 -o serial.idx $pack.pack &&
+		git -c core.deltaBaseCacheLimit=1k index-pack --strict \
+			--threads=4 -o threaded.idx $pack.pack &&
+		test_cmp serial.idx threaded.idx &&
+		test_cmp $pack.idx threaded.idx || return 1
+	done
+'
+
 #
 # WARNING!
 #
@@ -418,6 +440,11 @@ test_expect_success \
     'test_must_fail git index-pack -o bad.idx test-3.pack 2>msg &&
      test_i18ngrep "SHA1 COLLISION FOUND" msg'
 
+test_expect_success 'index-pack detects the SHA1 collision in threads' '
+	test_must_fail git index-pack --threads=4 -o bad.idx test-3.pack 2>msg &&
+	test_i18ngrep "SHA1 COLLISION FOUND" msg
+'
+
 test_expect_success \
     'make sure index-pack detects the SHA1 collision (large blobs)' \
     'test_must_fail git -c core.bigfilethreshold=1 index-pack -o bad.idx test-3.pack 2>msg &&
@@ -57,4 +57,26 @@ test_expect_success \
      git config --unset core.packedGitLimit &&
      git verify-pack -v "$pack2"'
 
+test_expect_success 'delta base cache gives the same objects at any size' '
+	rm -rf cache &&
+	git init cache &&
+	(
+		cd cache &&
+		test_seq 1 2000 >file &&
+		for i in 1 2 3 4 5 6 7 8
+		do
+			echo "change $i" >>file &&
+			git add file &&
+			git commit -q -m "change $i" || return 1
+		done &&
+		git repack -a -d --depth=50 &&
+		git rev-list --objects --all | cut -d" " -f1 >objects &&
+		git cat-file --batch <objects >expect &&
+		git -c core.deltaBaseCacheLimit=1 cat-file --batch <objects >actual &&
+		test_cmp expect actual &&
+		GIT_TRACE_PERFORMANCE="$(pwd)/trace" git log -p >/dev/null &&
+		grep "delta base cache: [0-9]* hits, [0-9]* misses" trace
+	)
+'
+
 test_done
@@ -185,4 +185,47 @@ test_expect_success 'splitting packs does not generate bogus bitmaps' '
 	git -C no-bitmaps.git fetch .. HEAD
 '
 
+bitmap_options () {
+	od -An -tx1 -j6 -N2 .git/objects/pack/pack-*.bitmap | tr -d " "
+}
+
+test_expect_success 'setup bitmaps without a lookup table' '
+	git repack -adb &&
+	test "$(bitmap_options)" = 0005 &&
+	for rev in HEAD HEAD~3 other other~2 "HEAD ^other" "--all"
+	do
+		git rev-list --use-bitmap-index --objects $rev >objects &&
+		sort objects || return 1
+	done >expect &&
+	git rev-list --use-bitmap-index --count --all >expect.count
+'
+
+test_expect_success 'repack writes a lookup table when asked' '
+	git -c pack.writeBitmapLookupTable=true repack -adb &&
+	test "$(bitmap_options)" = 0015 &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --test-bitmap other
+'
+
+test_expect_success 'bitmaps found through the lookup table' '
+	for rev in HEAD HEAD~3 other other~2 "HEAD ^other" "--all"
+	do
+		git rev-list --use-bitmap-index --objects $rev >objects &&
+		sort objects || return 1
+	done >actual &&
+	test_cmp expect actual &&
+	git rev-list --use-bitmap-index --count --all >actual.count &&
+	test_cmp expect.count actual.count
+'
+
+test_expect_success 'bitmaps are reused through the lookup table' '
+	test_commit after-lookup-table &&
+	git -c pack.writeBitmapLookupTable=true repack -adb &&
+	test "$(bitmap_options)" = 0015 &&
+	git rev-list --test-bitmap HEAD &&
+	git -c pack.writeBitmapLookupTable=false repack -adb &&
+	test "$(bitmap_options)" = 0005 &&
+	git rev-list --test-bitmap HEAD
+'
+
 test_done
@@ -0,0 +1,134 @@
+#!/bin/sh
+
+test_description='rev-list and pack-objects with object filters'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir dir dir/sub &&
+	for n in 1 2 3
+	do
+		echo "small $n" >small.$n &&
+		printf "%0100d\n" $n >large.$n &&
+		echo "sub $n" >dir/sub/file.$n &&
+		echo "dir $n" >dir/file.$n || return 1
+	done &&
+	git add . &&
+	test_commit one &&
+	echo more >>small.1 &&
+	echo more >>dir/sub/file.1 &&
+	git add . &&
+	test_commit two
+'
+
+list_objects () {
+	git rev-list --objects "$@" >objects &&
+	while read sha1 path
+	do
+		echo "$(git cat-file -t $sha1) $path" || return 1
+	done <objects | sort
+}
+
+test_expect_success 'invalid filters are refused' '
+	test_must_fail git rev-list --objects --filter=blob:nothing HEAD &&
+	test_must_fail git rev-list --objects --filter=tree:x HEAD &&
+	test_must_fail git rev-list --objects --filter=blob:limit=big HEAD &&
+	test_must_fail git rev-list --objects \
+		--filter=blob:none --filter=tree:1 HEAD
+'
+
+test_expect_success 'rev-list --filter=blob:none omits all blobs' '
+	list_objects --filter=blob:none HEAD >actual &&
+	! grep "^blob" actual &&
+	test $(grep -c "^tree" actual) = $(list_objects HEAD | grep -c "^tree")
+'
+
+test_expect_success 'rev-list --filter=blob:limit omits large blobs' '
+	list_objects --filter=blob:limit=50 HEAD >actual &&
+	! grep "^blob large" actual &&
+	grep "^blob small.1" actual &&
+	grep "^blob dir/sub/file.1" actual &&
+	list_objects --filter=blob:limit=1k HEAD >actual &&
+	grep "^blob large.1" actual
+'
+
+test_expect_success 'rev-list --filter=tree:<depth>' '
+	list_objects --filter=tree:0 HEAD >actual &&
+	! grep "^tree" actual &&
+	! grep "^blob" actual &&
+	list_objects --filter=tree:1 HEAD >actual &&
+	grep "^tree $" actual &&
+	! grep "^tree dir" actual &&
+	! grep "^blob" actual &&
+	list_objects --filter=tree:2 HEAD >actual &&
+	grep "^blob small.1" actual &&
+	grep "^tree dir$" actual &&
+	! grep "^tree dir/sub" actual &&
+	! grep "^blob dir/" actual
+'
+
+test_expect_success 'a tree seen deeper is walked again when seen shallower' '
+	git checkout -b nested &&
+	git read-tree --prefix=sub/ HEAD:dir/sub &&
+	git commit -m nested &&
+	test $(git rev-parse HEAD:sub) = $(git rev-parse HEAD:dir/sub) &&
+	list_objects --filter=tree:3 HEAD >actual &&
+	grep "^blob sub/file.1" actual &&
+	! grep "^blob dir/sub/" actual &&
+	git checkout master
+'
+
+test_expect_success 'explicitly named objects are not filtered' '
+	blob=$(git rev-parse HEAD:large.1) &&
+	git rev-list --objects --filter=blob:none HEAD $blob >actual &&
+	grep "^$blob" actual &&
+	tree=$(git rev-parse HEAD:dir) &&
+	git rev-list --objects --filter=tree:0 HEAD $tree >actual &&
+	grep "^$tree" actual &&
+	grep "^$(git rev-parse HEAD:dir/file.1)" actual
+'
+
+test_expect_success 'pack-objects --filter=blob:none' '
+	git rev-parse HEAD >revs &&
+	git pack-objects --revs --stdout --filter=blob:none <revs >filtered.pack &&
+	git index-pack -o filtered.idx filtered.pack &&
+	git verify-pack -v filtered.idx >verify &&
+	! grep " blob " verify &&
+	git rev-list --objects --filter=blob:none HEAD >expect.objects &&
+	cut -d" " -f1 expect.objects | sort >expect &&
+	grep -E "^[0-9a-f]{40} (commit|tree|blob|tag) " verify |
+	cut -d" " -f1 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects --filter needs --stdout' '
+	git rev-parse HEAD >revs &&
+	test_must_fail git pack-objects --revs --filter=blob:none pack <revs
+'
+
+test_expect_success 'pack-objects with bitmaps omits the same blobs' '
+	git repack -adb &&
+	git rev-parse HEAD >revs &&
+	for filter in blob:none blob:limit=50
+	do
+		git pack-objects --revs --stdout --filter=$filter \
+			<revs >bitmap.pack &&
+		git index-pack -o bitmap.idx bitmap.pack &&
+		git verify-pack -v bitmap.idx |
+		grep -E "^[0-9a-f]{40} (commit|tree|blob|tag) " |
+		cut -d" " -f1 | sort >actual &&
+		git rev-list --objects --filter=$filter HEAD |
+		cut -d" " -f1 | sort >expect &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'rev-list --use-bitmap-index --filter' '
+	git rev-list --use-bitmap-index --objects --filter=blob:none HEAD |
+	cut -d" " -f1 | sort >actual &&
+	git rev-list --objects --filter=blob:none HEAD |
+	cut -d" " -f1 | sort >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,237 @@
+#!/bin/sh
+
+test_description='commit graph'
+. ./test-lib.sh
+
+test_expect_success 'setup full repo' '
+	mkdir full &&
+	cd "$TRASH_DIRECTORY/full" &&
+	git init &&
+	objdir=".git/objects"
+'
+
+test_expect_success 'write graph with no packs' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write &&
+	test_path_is_file $objdir/info/commit-graph
+'
+
+test_expect_success 'create commits and repack' '
+	cd "$TRASH_DIRECTORY/full" &&
+	for i in $(test_seq 3)
+	do
+		test_commit $i &&
+		git branch commits/$i
+	done &&
+	git repack
+'
+
+graph_git_two_modes() {
+	git -c core.commitGraph=true $1 >output &&
+	git -c core.commitGraph=false $1 >expect &&
+	test_cmp expect output
+}
+
+graph_git_behavior() {
+	MSG=$1
+	DIR=$2
+	BRANCH=$3
+	COMPARE=$4
+	test_expect_success "check normal git operations: $MSG" '
+		cd "$TRASH_DIRECTORY/$DIR" &&
+		graph_git_two_modes "log --oneline $BRANCH" &&
+		graph_git_two_modes "log --topo-order $BRANCH" &&
+		graph_git_two_modes "log --graph $COMPARE..$BRANCH" &&
+		graph_git_two_modes "branch -vv" &&
+		graph_git_two_modes "merge-base -a $BRANCH $COMPARE" &&
+		graph_git_two_modes "branch --contains $COMPARE" &&
+		graph_git_two_modes "tag --contains $COMPARE" &&
+		graph_git_two_modes "merge-base --independent $BRANCH $COMPARE"
+	'
+}
+
+graph_read_expect() {
+	OPTIONAL=""
+	NUM_CHUNKS=3
+	if test ! -z $2
+	then
+		OPTIONAL=" $2"
+		NUM_CHUNKS=$((3 + $(echo "$2" | wc -w)))
+	fi
+	cat >expect <<- EOF
+	header: 43475048 1 1 $NUM_CHUNKS 0
+	num_commits: $1
+	chunks: oid_fanout oid_lookup commit_metadata$OPTIONAL
+	EOF
+	git commit-graph read >output &&
+	test_cmp expect output
+}
+
+test_expect_success 'write graph' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write &&
+	test_path_is_file $objdir/info/commit-graph &&
+	graph_read_expect "3"
+'
+
+graph_git_behavior 'graph exists' full commits/3 commits/1
+
+test_expect_success 'Add more commits' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git reset --hard commits/1 &&
+	for i in $(test_seq 4 5)
+	do
+		test_commit $i &&
+		git branch commits/$i
+	done &&
+	git reset --hard commits/2 &&
+	for i in $(test_seq 6 7)
+	do
+		test_commit $i &&
+		git branch commits/$i
+	done &&
+	git reset --hard commits/2 &&
+	git merge commits/4 &&
+	git branch merge/1 &&
+	git reset --hard commits/4 &&
+	git merge commits/6 &&
+	git branch merge/2 &&
+	git reset --hard commits/3 &&
+	git merge commits/5 commits/7 &&
+	git branch merge/3 &&
+	git repack
+'
+
+# Current graph structure:
+#
+#   __M3___
+#  /   |   \
+# 3 M1 5 M2 7
+# |/  \|/  \|
+# 2    4    6
+# |___/____/
+# 1
+
+test_expect_success 'write graph with merges' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write &&
+	test_path_is_file $objdir/info/commit-graph &&
+	graph_read_expect "10" "extra_edges"
+'
+
+graph_git_behavior 'merge 1 vs 2' full merge/1 merge/2
+graph_git_behavior 'merge 1 vs 3' full merge/1 merge/3
+graph_git_behavior 'merge 2 vs 3' full merge/2 merge/3
+
+test_expect_success 'Add one more commit' '
+	cd "$TRASH_DIRECTORY/full" &&
+	test_commit 8 &&
+	git branch commits/8
+'
+
+graph_git_behavior 'commit not in graph' full commits/8 merge/1
+
+test_expect_success 'write graph with loose commit' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write &&
+	graph_read_expect "11" "extra_edges"
+'
+
+graph_git_behavior 'loose commit in graph' full commits/8 merge/1
+
+test_expect_success 'write graph from refs only' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git rev-parse commits/1 | git hash-object --stdin -w >/dev/null &&
+	git commit --allow-empty -m dangling &&
+	git reset --hard HEAD^ &&
+	git commit-graph write --reachable &&
+	graph_read_expect "11" "extra_edges"
+'
+
+test_expect_success 'grafted commits are parsed from the object' '
+	cd "$TRASH_DIRECTORY/full" &&
+	echo "$(git rev-parse merge/3) $(git rev-parse commits/3)" >.git/info/grafts &&
+	git -c core.commitGraph=false log --oneline merge/3 >expect &&
+	git -c core.commitGraph=true log --oneline merge/3 >output &&
+	test_cmp expect output &&
+	test_line_count = 4 output &&
+	rm .git/info/grafts
+'
+
+test_expect_success 'replaced commits are parsed from the object' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git replace merge/1 commits/5 &&
+	git -c core.commitGraph=false log --oneline merge/1 >expect &&
+	git -c core.commitGraph=true log --oneline merge/1 >output &&
+	test_cmp expect output &&
+	git replace -d $(git rev-parse merge/1)
+'
+
+test_expect_success 'corrupt graph is ignored' '
+	cd "$TRASH_DIRECTORY/full" &&
+	cp $objdir/info/commit-graph commit-graph-backup &&
+	test_when_finished "mv commit-graph-backup $objdir/info/commit-graph" &&
+	printf "XXXX" | dd of=$objdir/info/commit-graph bs=1 conv=notrunc &&
+	git -c core.commitGraph=true log --oneline merge/3 >output 2>err &&
+	git -c core.commitGraph=false log --oneline merge/3 >expect &&
+	test_cmp expect output &&
+	test_i18ngrep "signature" err
+'
+
+test_expect_success 'gc.writeCommitGraph writes the graph' '
+	cd "$TRASH_DIRECTORY/full" &&
+	rm -f $objdir/info/commit-graph &&
+	git -c gc.writeCommitGraph=true gc --quiet &&
+	graph_read_expect "12" "extra_edges"
+'
+
+graph_git_behavior 'after gc' full commits/8 merge/3
+
+test_expect_success 'setup history with clock skew' '
+	cd "$TRASH_DIRECTORY" &&
+	git init skew &&
+	cd skew &&
+	test_tick &&
+	test_commit base &&
+	for i in $(test_seq 1 10)
+	do
+		test_commit left-$i || return 1
+	done &&
+	git checkout -b right base &&
+	GIT_COMMITTER_DATE="@0 +0000" &&
+	export GIT_COMMITTER_DATE &&
+	test_commit skewed &&
+	sane_unset GIT_COMMITTER_DATE &&
+	test_commit right-tip &&
+	git checkout master &&
+	git merge -m merge right &&
+	git tag merge-tag &&
+	git repack -adq &&
+	git commit-graph write
+'
+
+test_expect_success 'generation numbers cut off walks despite clock skew' '
+	cd "$TRASH_DIRECTORY/skew" &&
+	graph_git_two_modes "tag --contains skewed" &&
+	graph_git_two_modes "branch --contains skewed" &&
+	graph_git_two_modes "merge-base master right" &&
+	graph_git_two_modes "merge-base --is-ancestor skewed master" &&
+	graph_git_two_modes "merge-base --independent left-10 skewed right-tip" &&
+	git -c core.commitGraph=true tag --contains skewed >actual &&
+	cat >expect <<-\EOF &&
+	merge-tag
+	right-tip
+	skewed
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'shallow repository is not written' '
+	cd "$TRASH_DIRECTORY" &&
+	git clone --no-local --depth=1 "$TRASH_DIRECTORY/full" shallow &&
+	cd "$TRASH_DIRECTORY/shallow" &&
+	git commit-graph write 2>err &&
+	test_path_is_missing .git/objects/info/commit-graph
+'
+
+test_done
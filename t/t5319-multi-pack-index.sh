@@ -0,0 +1,153 @@
+#!/bin/sh
+
+test_description='multi-pack-index'
+. ./test-lib.sh
+
+objdir=.git/objects
+
+midx_read_expect() {
+	NUM_PACKS=$1
+	NUM_OBJECTS=$2
+	cat >expect <<-EOF &&
+	header: 4d494458 1 1 4 0
+	num_packs: $NUM_PACKS
+	num_objects: $NUM_OBJECTS
+	chunks: pack_names oid_fanout oid_lookup object_offsets
+	packs:
+	EOF
+	(cd $objdir/pack && ls *.idx | LC_ALL=C sort) >>expect &&
+	git multi-pack-index read >actual &&
+	test_cmp expect actual
+}
+
+midx_git_two_modes() {
+	git -c core.multiPackIndex=false $1 >expect &&
+	git -c core.multiPackIndex=true $1 >actual &&
+	test_cmp expect actual
+}
+
+compare_results_with_midx() {
+	MSG=$1
+	test_expect_success "check normal git operations: $MSG" '
+		midx_git_two_modes "rev-list --objects --all" &&
+		midx_git_two_modes "log --raw" &&
+		midx_git_two_modes "count-objects --verbose" &&
+		midx_git_two_modes "cat-file --batch-all-objects --batch-check"
+	'
+}
+
+test_expect_success 'write midx with no packs' '
+	git multi-pack-index write &&
+	midx_read_expect 0 0
+'
+
+generate_objects () {
+	i=$1
+	iii=$(printf '%03i' $i)
+	{
+		test-genrandom "bar" 200 &&
+		test-genrandom "baz $iii" 50
+	} >wide_delta_$iii &&
+	{
+		test-genrandom "foo"$i 100 &&
+		test-genrandom "foo"$(( $i + 1 )) 100 &&
+		test-genrandom "foo"$(( $i + 2 )) 100
+	} >deep_delta_$iii &&
+	echo $iii >file_$iii &&
+	git add file_$iii deep_delta_$iii wide_delta_$iii
+}
+
+commit_and_list_objects () {
+	{
+		echo 101 &&
+		test_tick &&
+		git commit -m "test commit $i" &&
+		echo 102
+	} >/dev/null &&
+	git rev-list --objects HEAD^..HEAD | cut -d" " -f1 >obj-list
+}
+
+test_expect_success 'create objects' '
+	for i in $(test_seq 3)
+	do
+		generate_objects $i
+	done &&
+	git commit -m "initial commit" &&
+	git rev-list --objects HEAD | cut -d" " -f1 >obj-list &&
+	git pack-objects $objdir/pack/test <obj-list &&
+	git prune-packed
+'
+
+test_expect_success 'write midx with one pack' '
+	git multi-pack-index write &&
+	midx_read_expect 1 $(wc -l <obj-list)
+'
+
+compare_results_with_midx "one pack"
+
+test_expect_success 'add more packs' '
+	for j in $(test_seq 4 8)
+	do
+		generate_objects $j &&
+		commit_and_list_objects &&
+		git pack-objects $objdir/pack/test <obj-list
+	done &&
+	git prune-packed
+'
+
+compare_results_with_midx "stale midx"
+
+test_expect_success 'write midx with many packs' '
+	git multi-pack-index write &&
+	midx_read_expect 6 $(git rev-list --objects --all | wc -l)
+'
+
+compare_results_with_midx "many packs"
+
+test_expect_success 'duplicate objects are listed once' '
+	git rev-list --objects HEAD | cut -d" " -f1 >all-objects &&
+	git pack-objects $objdir/pack/all <all-objects &&
+	git multi-pack-index write &&
+	midx_read_expect 7 $(wc -l <all-objects)
+'
+
+compare_results_with_midx "duplicate objects"
+
+test_expect_success 'midx is ignored when a pack disappears' '
+	test_when_finished "git multi-pack-index write" &&
+	pack=$(ls $objdir/pack/all-*.pack) &&
+	mv "$pack" pack.tmp &&
+	mv "${pack%.pack}.idx" idx.tmp &&
+	test_when_finished "mv pack.tmp \"$pack\" && mv idx.tmp \"${pack%.pack}.idx\"" &&
+	midx_git_two_modes "rev-list --objects --all"
+'
+
+test_expect_success 'repack -d rewrites the midx' '
+	git -c core.multiPackIndex=true repack -a -d &&
+	midx_read_expect 1 $(git rev-list --objects --all | wc -l)
+'
+
+compare_results_with_midx "after repack"
+
+test_expect_success 'repack removes the midx when disabled' '
+	test_commit extra &&
+	git repack -d &&
+	test_path_is_missing $objdir/pack/multi-pack-index
+'
+
+test_expect_success 'count-objects does not report the midx as garbage' '
+	git multi-pack-index write &&
+	git count-objects -v >output &&
+	grep "^garbage: 0" output
+'
+
+test_expect_success 'corrupt midx is rejected' '
+	cp $objdir/pack/multi-pack-index midx.bak &&
+	test_when_finished "mv midx.bak $objdir/pack/multi-pack-index" &&
+	printf "XXXX" | dd of=$objdir/pack/multi-pack-index bs=1 count=4 conv=notrunc &&
+	test_must_fail git multi-pack-index read 2>err &&
+	test_i18ngrep "signature" err &&
+	midx_git_two_modes "rev-list --objects --all"
+'
+
+test_done
@@ -0,0 +1,107 @@
+#!/bin/sh
+
+test_description='on-disk reverse index (.rev) of packs'
+. ./test-lib.sh
+
+disk_sizes () {
+	git "$@" cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objectsize:disk)"
+}
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5
+	do
+		test_seq 1 $((i * 100)) >file &&
+		test-genrandom "$i" 1000 >random.$i &&
+		git add file random.$i &&
+		test_commit "commit-$i" || return 1
+	done &&
+	git repack -adq &&
+	pack=$(ls .git/objects/pack/pack-*.pack) &&
+	disk_sizes >expect
+'
+
+test_expect_success 'no .rev is written by default' '
+	! ls .git/objects/pack/*.rev
+'
+
+test_expect_success 'index-pack --rev-index writes a .rev' '
+	cp "$pack" test.pack &&
+	git index-pack --rev-index test.pack &&
+	test -f test.rev &&
+	git index-pack --rev-index -o other.idx test.pack &&
+	test -f other.rev &&
+	cmp test.rev other.rev
+'
+
+test_expect_success 'index-pack --no-rev-index overrides the config' '
+	rm -f test.rev &&
+	git -c pack.writeReverseIndex=true index-pack --no-rev-index test.pack &&
+	! test -f test.rev &&
+	git -c pack.writeReverseIndex=true index-pack test.pack &&
+	test -f test.rev
+'
+
+test_expect_success 'index-pack -o without .idx' '
+	test_must_fail git index-pack --rev-index -o test.index test.pack &&
+	git -c pack.writeReverseIndex=true index-pack -o test.index \
+		test.pack 2>err &&
+	test -f test.index &&
+	test_i18ngrep "not writing a reverse index" err
+'
+
+test_expect_success 'index-pack --verify does not write a .rev' '
+	rm -f test.rev &&
+	git index-pack --rev-index --verify test.pack &&
+	! test -f test.rev
+'
+
+test_expect_success 'repack writes a .rev with pack.writeReverseIndex' '
+	git -c pack.writeReverseIndex=true repack -adf &&
+	rev=$(ls .git/objects/pack/pack-*.rev) &&
+	test "${rev%.rev}.pack" = "$(ls .git/objects/pack/pack-*.pack)" &&
+	git count-objects -v >count &&
+	grep "^garbage: 0" count
+'
+
+test_expect_success 'objects are read the same with and without the .rev' '
+	disk_sizes >actual &&
+	test_cmp expect actual &&
+	disk_sizes -c pack.readReverseIndex=false >actual &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success 'pack-objects reuses data with the .rev' '
+	git rev-list --objects --all >objects &&
+	git pack-objects --stdout <objects >reused.pack &&
+	git -c pack.readReverseIndex=false pack-objects --stdout \
+		<objects >expect.pack &&
+	cmp expect.pack reused.pack
+'
+
+test_expect_success 'a bad .rev is reported and not used' '
+	rev=$(ls .git/objects/pack/pack-*.rev) &&
+	mv "$rev" rev.good &&
+	cp rev.good "$rev" &&
+	chmod +w "$rev" &&
+	printf "XXXX" | dd of="$rev" bs=1 conv=notrunc 2>/dev/null &&
+	disk_sizes >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "bad signature" err &&
+	cp rev.good "$rev" &&
+	chmod +w "$rev" &&
+	echo >>"$rev" &&
+	disk_sizes >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "wrong size" err &&
+	mv rev.good "$rev"
+'
+
+test_expect_success 'repack without pack.writeReverseIndex drops the .rev' '
+	test_commit another &&
+	git repack -adq &&
+	! ls .git/objects/pack/*.rev
+'
+
+test_done
@@ -0,0 +1,48 @@
+#!/bin/sh
+
+test_description='SIMD and portable backends of the bitmap operations'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 40)
+	do
+		for j in 1 2 3 4 5 6 7 8 9
+		do
+			echo "$i $j" >file.$j || return 1
+		done &&
+		git add file.* &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git repack -adb &&
+	bitmap=$(ls .git/objects/pack/pack-*.bitmap) &&
+	test-bitmap-ops --backends >backends &&
+	grep "^c$" backends
+'
+
+test_expect_success 'the bitmaps cover every object of the pack' '
+	git count-objects -v | sed -n "s/^in-pack: //p" >objects &&
+	test-bitmap-ops --backend=c "$bitmap" >expect &&
+	echo "objects $(cat objects)" >expect.objects &&
+	echo "or-ewah $(cat objects)" >>expect.objects &&
+	head -n 2 expect >actual &&
+	test_cmp expect.objects actual &&
+	echo "type-count tag 0" >expect.tags &&
+	grep "^type-count tag" expect >actual &&
+	test_cmp expect.tags actual
+'
+
+test_expect_success 'all backends agree' '
+	for backend in $(cat backends)
+	do
+		test-bitmap-ops --backend=$backend "$bitmap" >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'an unknown backend is refused' '
+	test_must_fail test-bitmap-ops --backend=none "$bitmap"
+'
+
+test_done
@@ -0,0 +1,114 @@
+#!/bin/sh
+
+test_description='fetch asks upload-pack to advertise only the refs it needs'
+
+. ./test-lib.sh
+
+# Write the refnames upload-pack advertised during "git fetch $@"
+# to "advertised".
+fetch_advertised () {
+	GIT_TRACE_PACKET="$(pwd)/trace" git fetch "$@" &&
+	sed -n "s/^.*fetch< [0-9a-f]\{40\} \(refs\/[^ ]*\)$/\1/p" <trace >advertised &&
+	rm -f trace
+}
+
+# Print the refnames in the advertisement of upload-pack on stdin.
+advertised_refs () {
+	tr "\000" " " |
+	sed -n "s/^[0-9a-f]\{44\} \(refs\/[^ ]*\).*/\1/p"
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	git branch side &&
+	git tag -a -m annotated v1 &&
+	git update-ref refs/other/one HEAD &&
+	git init client &&
+	git -C client remote add origin .. &&
+	git -C client config --unset-all remote.origin.fetch &&
+	git -C client config remote.origin.fetch "+refs/heads/*:refs/remotes/origin/*"
+'
+
+test_expect_success 'upload-pack advertises only refs under --ref-prefix' '
+	git upload-pack --advertise-refs --ref-prefix=refs/tags/ \
+		--ref-prefix=refs/tags/v --ref-prefix=nonsense . >out &&
+	grep " ref-prefix" out &&
+	advertised_refs <out >actual &&
+	cat >expect <<-\EOF &&
+	refs/tags/one
+	refs/tags/v1
+	refs/tags/v1^{}
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'upload-pack honors the namespace with --ref-prefix' '
+	git update-ref refs/namespaces/ns/refs/heads/master HEAD &&
+	git update-ref refs/namespaces/ns/refs/other/two HEAD &&
+	GIT_NAMESPACE=ns git upload-pack --advertise-refs \
+		--ref-prefix=refs/heads/ . >out &&
+	advertised_refs <out >actual &&
+	echo refs/heads/master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fetching a single branch' '
+	(
+		cd client &&
+		fetch_advertised origin side &&
+		echo refs/heads/side >expect &&
+		test_cmp expect advertised &&
+		test "$(git rev-parse FETCH_HEAD)" = "$(git -C .. rev-parse side)"
+	)
+'
+
+test_expect_success 'fetching with the configured refspec follows tags' '
+	(
+		cd client &&
+		fetch_advertised origin &&
+		cat >expect <<-\EOF &&
+		refs/heads/master
+		refs/heads/side
+		refs/tags/one
+		refs/tags/v1
+		refs/tags/v1^{}
+		EOF
+		test_cmp expect advertised &&
+		git rev-parse --verify refs/remotes/origin/side &&
+		git rev-parse --verify refs/tags/v1
+	)
+'
+
+test_expect_success 'fetching with --no-tags' '
+	(
+		cd client &&
+		fetch_advertised --no-tags origin &&
+		cat >expect <<-\EOF &&
+		refs/heads/master
+		refs/heads/side
+		EOF
+		test_cmp expect advertised
+	)
+'
+
+test_expect_success 'fetching with fetch.refPrefixes=false' '
+	test_config -C client fetch.refPrefixes false &&
+	(
+		cd client &&
+		fetch_advertised origin side &&
+		grep refs/other/one advertised
+	)
+'
+
+test_expect_success 'git-shell passes --ref-prefix to upload-pack' '
+	printf 0000 >flush &&
+	git shell -c "git-upload-pack '\''--ref-prefix=refs/other/'\'' '\''.'\''" \
+		<flush >out &&
+	advertised_refs <out >actual &&
+	echo refs/other/one >expect &&
+	test_cmp expect actual &&
+	test_must_fail git shell -c "git-upload-pack '\''--strict'\'' '\''.'\''" \
+		<flush
+'
+
+test_done
@@ -36,6 +36,17 @@ test_expect_success 'fetch changes via git protocol' '
 	test_cmp file clone/file
 '
 
+test_expect_success 'fetch asks git-daemon for the refs it needs' '
+	git push public master:refs/other/one &&
+	(
+		cd clone &&
+		GIT_TRACE_PACKET="$(pwd)/trace" git fetch origin master &&
+		grep "fetch> git-upload-pack .*ref-prefix=refs/heads/master" trace &&
+		grep "fetch< .* refs/heads/master" trace &&
+		! grep refs/other/one trace
+	)
+'
+
 test_expect_success 'remote detects correct HEAD' '
 	git push public master:other &&
 	(cd clone &&
@@ -0,0 +1,141 @@
+#!/bin/sh
+
+test_description='partial clone with object filters and lazy fetches'
+
+. ./test-lib.sh
+
+test_expect_success 'setup server' '
+	git init server &&
+	(
+		cd server &&
+		mkdir dir &&
+		for n in 1 2 3
+		do
+			echo "file $n" >file.$n &&
+			echo "dir $n" >dir/file.$n || return 1
+		done &&
+		git add . &&
+		test_commit one &&
+		echo two >>file.1 &&
+		git add . &&
+		test_commit two &&
+		git config uploadpack.allowfilter true &&
+		git config uploadpack.allowanysha1inwant true
+	)
+'
+
+missing_blobs () {
+	git -C "$1" rev-list --objects --all >objects &&
+	cut -d" " -f1 objects |
+	while read sha1
+	do
+		test "$(git -C server cat-file -t $sha1)" = blob &&
+		! GIT_NO_LAZY_FETCH=1 git -C "$1" cat-file -e $sha1 &&
+		echo $sha1
+	done
+	return 0
+}
+
+test_expect_success 'upload-pack advertises filter only when allowed' '
+	git -C server upload-pack --advertise-refs . </dev/null >advertised &&
+	tr "\000" " " <advertised | grep " filter" &&
+	git -C server -c uploadpack.allowfilter=false \
+		upload-pack --advertise-refs . </dev/null >advertised &&
+	! tr "\000" " " <advertised | grep " filter"
+'
+
+test_expect_success 'clone --filter=blob:none --no-checkout' '
+	git clone --no-checkout --filter=blob:none \
+		"file://$(pwd)/server" pc1 &&
+	test "$(git -C pc1 config core.repositoryformatversion)" = 1 &&
+	test "$(git -C pc1 config extensions.partialclone)" = origin &&
+	test "$(git -C pc1 config remote.origin.partialclonefilter)" = blob:none &&
+	missing_blobs pc1 >missing &&
+	test_line_count = 9 missing
+'
+
+test_expect_success 'fsck and rev-list accept the missing blobs' '
+	git -C pc1 fsck &&
+	git -C pc1 rev-list --objects --all >objects &&
+	test -s objects
+'
+
+test_expect_success 'checkout fetches the blobs it needs in one go' '
+	GIT_TRACE="$(pwd)/trace" git -C pc1 checkout -f master &&
+	test "$(cat pc1/file.1)" = "$(git -C server show HEAD:file.1)" &&
+	grep "run_command: .fetch-pack. .--stdin" trace >fetches &&
+	test_line_count = 1 fetches &&
+	missing_blobs pc1 >missing &&
+	test_line_count = 1 missing
+'
+
+test_expect_success 'reading a missing blob fetches it' '
+	blob=$(git -C server rev-parse one:file.1) &&
+	test_must_fail env GIT_NO_LAZY_FETCH=1 git -C pc1 cat-file -e $blob &&
+	git -C pc1 cat-file blob $blob >actual &&
+	echo "file 1" >expect &&
+	test_cmp expect actual &&
+	git -C pc1 cat-file -e $blob
+'
+
+test_expect_success 'GIT_NO_LAZY_FETCH disables the lazy fetch' '
+	git clone --no-checkout --filter=blob:none \
+		"file://$(pwd)/server" pc2 &&
+	blob=$(git -C server rev-parse HEAD:file.2) &&
+	test_must_fail env GIT_NO_LAZY_FETCH=1 git -C pc2 cat-file blob $blob &&
+	git -C pc2 cat-file blob $blob
+'
+
+test_expect_success 'fetch uses the filter of the clone' '
+	(
+		cd server &&
+		echo three >>file.2 &&
+		git add file.2 &&
+		test_commit three
+	) &&
+	git -C pc2 fetch origin &&
+	test "$(git -C pc2 rev-parse origin/master)" = "$(git -C server rev-parse master)" &&
+	test_must_fail env GIT_NO_LAZY_FETCH=1 \
+		git -C pc2 cat-file -e origin/master:file.2
+'
+
+test_expect_success 'fetch --filter needs the partial clone remote' '
+	git init plain &&
+	test_must_fail git -C plain fetch --filter=blob:none "file://$(pwd)/server"
+'
+
+test_expect_success 'clone --filter=blob:limit' '
+	test_seq 1 1000 >server/large.t &&
+	git -C server add large.t &&
+	git -C server commit -m "large file" &&
+	git clone --filter=blob:limit=1k "file://$(pwd)/server" pc3 &&
+	test_cmp server/large.t pc3/large.t &&
+	missing_blobs pc3 >missing &&
+	test_line_count = 0 missing
+'
+
+test_expect_success 'clone --filter=tree:0 fetches trees on demand' '
+	git clone --no-checkout --filter=tree:0 "file://$(pwd)/server" pc4 &&
+	git -C pc4 ls-tree HEAD dir/ >actual &&
+	git -C server ls-tree HEAD dir/ >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'gc keeps a partial clone working' '
+	git -C pc1 gc &&
+	git -C pc1 fsck &&
+	git -C pc1 cat-file blob $(git -C server rev-parse one:dir/file.3) >actual &&
+	echo "dir 3" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'filter requests are refused unless allowed' '
+	git -C server config uploadpack.allowfilter false &&
+	git clone --no-checkout --filter=blob:none \
+		"file://$(pwd)/server" pc5 2>err &&
+	test_i18ngrep "filtering not recognized by server" err &&
+	missing_blobs pc5 >missing &&
+	test_line_count = 0 missing
+'
+
+test_done
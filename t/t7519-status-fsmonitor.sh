@@ -0,0 +1,166 @@
+#!/bin/sh
+
+test_description='git status with a file system monitor'
+
+. ./test-lib.sh
+
+# The fake monitor reports the paths listed in .git/fsmonitor-changed,
+# one per line, and logs its arguments to .git/fsmonitor-args.
+write_fake_monitor () {
+	write_script .git/fsmonitor-test <<-\EOF
+	echo "$*" >>.git/fsmonitor-args
+	test "$1" = 1 || exit 1
+	if test -f .git/fsmonitor-changed
+	then
+		tr "\n" "\0" <.git/fsmonitor-changed
+	fi
+	EOF
+}
+
+report_changed () {
+	printf "%s\n" "$@" >.git/fsmonitor-changed
+}
+
+test_expect_success 'setup' '
+	mkdir dir1 dir2 &&
+	for f in a b dir1/c dir1/d dir2/e
+	do
+		echo $f >$f || return 1
+	done &&
+	git add . &&
+	git commit -m initial &&
+	printf "%s\n" actual expect dump trace >.git/info/exclude &&
+	write_fake_monitor &&
+	git config core.fsmonitor .git/fsmonitor-test
+'
+
+test_expect_success 'no extension until the monitor has been asked' '
+	echo "no fsmonitor" >expect &&
+	test-dump-fsmonitor >actual &&
+	test_cmp expect actual &&
+	git status &&
+	test_path_is_missing .git/fsmonitor-args
+'
+
+test_expect_success 'a refresh marks clean entries valid' '
+	git update-index --refresh &&
+	test-dump-fsmonitor >dump &&
+	grep "^fsmonitor last update [0-9][0-9]*$" dump &&
+	cat >expect <<-\EOF &&
+	+ a
+	+ b
+	+ dir1/c
+	+ dir1/d
+	+ dir2/e
+	EOF
+	grep -v "^fsmonitor" dump >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the hook gets the version and the last update' '
+	token=$(sed -n "s/^fsmonitor last update //p" dump) &&
+	rm -f .git/fsmonitor-args &&
+	git status &&
+	echo "1 $token" >expect &&
+	test_cmp expect .git/fsmonitor-args
+'
+
+test_expect_success 'changes the monitor does not report are not seen' '
+	echo modified >dir1/c &&
+	test-chmtime =+60 dir1/c &&
+	git status --porcelain --untracked-files=no >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'changes the monitor reports are seen' '
+	report_changed dir1/c &&
+	echo " M dir1/c" >expect &&
+	git status --porcelain --untracked-files=no >actual &&
+	test_cmp expect actual &&
+	test-dump-fsmonitor >dump &&
+	grep "^- dir1/c" dump &&
+	grep "^+ dir1/d" dump &&
+	git checkout dir1/c &&
+	git update-index --refresh
+'
+
+test_expect_success 'a reported directory invalidates everything below it' '
+	echo modified >dir1/d &&
+	test-chmtime =+120 dir1/d &&
+	report_changed dir1/ &&
+	echo " M dir1/d" >expect &&
+	git status --porcelain --untracked-files=no >actual &&
+	test_cmp expect actual &&
+	git checkout dir1/d &&
+	git update-index --refresh
+'
+
+test_expect_success 'a failing hook makes everything checked' '
+	rm -f .git/fsmonitor-changed &&
+	echo modified >b &&
+	test-chmtime =+180 b &&
+	git status --porcelain --untracked-files=no >actual &&
+	test_must_be_empty actual &&
+	write_script .git/fsmonitor-test <<-\EOF &&
+	exit 1
+	EOF
+	echo " M b" >expect &&
+	git status --porcelain --untracked-files=no >actual &&
+	test_cmp expect actual &&
+	write_fake_monitor &&
+	git checkout b &&
+	git update-index --refresh
+'
+
+test_expect_success 'a hook reporting "/" makes everything checked' '
+	echo modified >a &&
+	test-chmtime =+240 a &&
+	report_changed / &&
+	echo " M a" >expect &&
+	git status --porcelain --untracked-files=no >actual &&
+	test_cmp expect actual &&
+	git checkout a &&
+	rm .git/fsmonitor-changed &&
+	git update-index --refresh
+'
+
+test_expect_success 'update-index --really-refresh ignores the monitor' '
+	echo modified >dir2/e &&
+	test-chmtime =+300 dir2/e &&
+	test_must_fail git update-index --really-refresh &&
+	git checkout dir2/e &&
+	git update-index --refresh
+'
+
+test_lazy_prereq UNTRACKED_CACHE '
+	{ git update-index --untracked-cache; ret=$?; } &&
+	test $ret -ne 1
+'
+
+test_expect_success UNTRACKED_CACHE 'untracked cache directories are not opened' '
+	git update-index --untracked-cache &&
+	git status --porcelain >actual &&
+	git status --porcelain >actual &&
+	: >trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+	git status --porcelain >actual &&
+	grep "opendir: 0" trace
+'
+
+test_expect_success UNTRACKED_CACHE 'reported directories are read again' '
+	echo new >dir2/untracked &&
+	report_changed dir2/untracked &&
+	git status --porcelain >actual &&
+	grep "^?? dir2/untracked$" actual &&
+	rm -f .git/fsmonitor-changed &&
+	rm dir2/untracked
+'
+
+test_expect_success 'disabling the monitor drops the extension' '
+	git -c core.fsmonitor= status &&
+	echo "no fsmonitor" >expect &&
+	test-dump-fsmonitor >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -1296,4 +1296,64 @@ test_expect_success 'grep --color -e A --and -e B -p with context' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep with threads gives the same output' '
+	for opts in "-n -e mmap" "-C1 -e foo" "-c -e o" "-l -e world"
+	do
+		for where in "" --cached HEAD "HEAD HEAD^"
+		do
+			git grep --threads=1 $opts $where >expected &&
+			git grep --threads=4 $opts $where >actual &&
+			test_cmp expected actual &&
+			git -c grep.threads=4 grep $opts $where >actual &&
+			test_cmp expected actual || return 1
+		done
+	done
+'
+
+test_expect_success 'grep with threads reads replaced objects' '
+	git init replace &&
+	(
+		cd replace &&
+		for i in $(test_seq 1 20)
+		do
+			echo "original $i" >file$i || return 1
+		done &&
+		git add . &&
+		git commit -m files &&
+		blob=$(echo "replaced 7" | git hash-object -w --stdin) &&
+		git replace $(git rev-parse HEAD:file7) $blob &&
+		echo HEAD:file7 >expected &&
+		git grep --threads=4 -l -e replaced HEAD >actual &&
+		test_cmp expected actual &&
+		git grep --threads=4 -c -e original HEAD >actual &&
+		test_line_count = 19 actual &&
+		git --no-replace-objects grep --threads=4 -c -e original \
+			HEAD >actual &&
+		test_line_count = 20 actual
+	)
+'
+
+test_expect_success 'grep refuses a negative number of threads' '
+	test_must_fail git grep --threads=-1 -e mmap &&
+	test_must_fail git -c grep.threads=-1 grep -e mmap
+'
+
+test_expect_success 'grep -F with several patterns matches like a regex' '
+	echo "mmap Mmap main foo.* HELLO" >patterns &&
+	echo "mmap mmat mmav wmap file hello int char" >>patterns &&
+	test_seq 1000 1030 >>patterns &&
+	for words in "mmap main" "mmap mmat mmav wmap" "mmap Mmap main foo.* HELLO" \
+		"$(cat patterns)"
+	do
+		for w in $words; do echo "$w"; done >fixed &&
+		sed -e "s/[.*]/\\\\&/g" -e "s/\([A-Za-z0-9]\)$/[\1]/" fixed >regex &&
+		for opts in "-n" "-c" "-i -n" "-v -c" "--cached -l"
+		do
+			git grep $opts -F -f fixed >actual &&
+			git grep $opts -f regex >expected &&
+			test_cmp expected actual || return 1
+		done
+	done
+'
+
 test_done
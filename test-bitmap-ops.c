@@ -0,0 +1,235 @@
+#include "cache.h"
+#include "cpu-features.h"
+#include "revision.h"
+#include "pack.h"
+#include "pack-bitmap.h"
+
+static const char usage_str[] =
+"test-bitmap-ops [--backend=<name>] <file.bitmap>\n"
+"   or: test-bitmap-ops --backends\n"
+"   or: test-bitmap-ops --bench <file.bitmap> [<rounds>]";
+
+static const char *type_names[] = { "commit", "tree", "blob", "tag" };
+
+/* The bitmaps of a .bitmap file, with the xor'ed ones resolved. */
+struct bitmap_file {
+	struct ewah_bitmap *types[4];
+	struct ewah_bitmap **commits;
+	struct bitmap **raw;
+	uint32_t nr;
+	/* every object of the pack */
+	struct bitmap *all;
+};
+
+static struct ewah_bitmap *read_ewah(const unsigned char *map, size_t size,
+				     size_t *pos)
+{
+	struct ewah_bitmap *b = ewah_new();
+	int ret;
+
+	if (size - *pos < 12 ||
+	    (size - *pos - 12) / 8 < get_be32(map + *pos + 4))
+		die("truncated bitmap at offset %"PRIuMAX, (uintmax_t)*pos);
+	ret = ewah_read_mmap(b, map + *pos, size - *pos);
+	if (ret < 0)
+		die("cannot read bitmap at offset %"PRIuMAX, (uintmax_t)*pos);
+	*pos += ret;
+	return b;
+}
+
+static void read_bitmap_file(const char *path, struct bitmap_file *bf)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const unsigned char *map;
+	struct bitmap_disk_header header;
+	size_t pos = sizeof(header);
+	uint32_t i;
+	int t;
+
+	if (strbuf_read_file(&buf, path, 0) < 0)
+		die_errno("cannot read '%s'", path);
+	if (buf.len < sizeof(header) + 20)
+		die("'%s' is too small to be a bitmap index", path);
+	map = (const unsigned char *)buf.buf;
+	memcpy(&header, map, sizeof(header));
+	if (memcmp(header.magic, BITMAP_IDX_SIGNATURE,
+		   sizeof(BITMAP_IDX_SIGNATURE)))
+		die("'%s' is not a bitmap index", path);
+
+	for (t = 0; t < 4; t++)
+		bf->types[t] = read_ewah(map, buf.len, &pos);
+
+	bf->nr = ntohl(header.entry_count);
+	bf->commits = xcalloc(bf->nr, sizeof(*bf->commits));
+	bf->raw = xcalloc(bf->nr, sizeof(*bf->raw));
+	for (i = 0; i < bf->nr; i++) {
+		struct ewah_bitmap *b;
+		int xor_offset;
+
+		if (buf.len - pos < 6)
+			die("truncated bitmap entry %"PRIu32, i);
+		xor_offset = map[pos + 4];
+		pos += 6;
+		b = read_ewah(map, buf.len, &pos);
+		if (xor_offset) {
+			struct ewah_bitmap *composed = ewah_new();
+
+			if (xor_offset > i)
+				die("bad xor offset in bitmap entry %"PRIu32, i);
+			ewah_xor(b, bf->commits[i - xor_offset], composed);
+			ewah_free(b);
+			b = composed;
+		}
+		bf->commits[i] = b;
+		bf->raw[i] = ewah_to_bitmap(b);
+	}
+
+	bf->all = bitmap_new();
+	for (t = 0; t < 4; t++)
+		bitmap_or_ewah(bf->all, bf->types[t]);
+	strbuf_release(&buf);
+}
+
+/*
+ * Print the results of each operation over all the bitmaps of the
+ * file, which must be the same with every backend.
+ */
+static void show_results(struct bitmap_file *bf)
+{
+	struct bitmap *result = bitmap_new();
+	size_t and_not = 0, popcount = 0, types[4] = { 0 };
+	uint32_t i;
+	int t;
+
+	for (i = 0; i < bf->nr; i++) {
+		bitmap_reset(result);
+		bitmap_or_ewah(result, bf->types[0]);
+		bitmap_or_ewah(result, bf->commits[i]);
+		bitmap_and_not(result, bf->raw[i ? i - 1 : bf->nr - 1]);
+		and_not += bitmap_popcount(result);
+
+		popcount += bitmap_popcount(bf->raw[i]);
+		for (t = 0; t < 4; t++)
+			types[t] += bitmap_popcount_and_ewah(bf->raw[i],
+							     bf->types[t]);
+	}
+
+	bitmap_reset(result);
+	for (i = 0; i < bf->nr; i++)
+		bitmap_or_ewah(result, bf->commits[i]);
+
+	printf("objects %"PRIuMAX"\n", (uintmax_t)bitmap_popcount(bf->all));
+	printf("or-ewah %"PRIuMAX"\n", (uintmax_t)bitmap_popcount(result));
+	printf("and-not %"PRIuMAX"\n", (uintmax_t)and_not);
+	printf("popcount %"PRIuMAX"\n", (uintmax_t)popcount);
+	for (t = 0; t < 4; t++)
+		printf("type-count %s %"PRIuMAX"\n", type_names[t],
+		       (uintmax_t)types[t]);
+	bitmap_free(result);
+}
+
+static double ms_per_round(uint64_t nanos, int rounds)
+{
+	return nanos / 1e6 / rounds;
+}
+
+/*
+ * Time the operations pack-bitmap.c does on the bitmaps of the file,
+ * with each backend the CPU supports: OR-ing the commit bitmaps into a
+ * result, AND-NOT-ing them out of it, and counting their bits, alone
+ * and per object type.
+ */
+static void bench(struct bitmap_file *bf, int rounds)
+{
+	struct bitmap *result = bitmap_new();
+	const char *name;
+	size_t sink = 0;
+	int n;
+
+	printf("%-8s %10s %10s %10s %10s  (ms per round)\n", "backend",
+	       "or-ewah", "and-not", "popcount", "type-count");
+	for (n = 0; (name = cpu_backend_name(&bitmap_backends, n)); n++) {
+		uint64_t start, or_ewah, and_not, popcount, types;
+		uint32_t i;
+		int r, t;
+
+		if (cpu_backend_set(&bitmap_backends, name))
+			continue;
+
+		start = getnanotime();
+		for (r = 0; r < rounds; r++) {
+			bitmap_reset(result);
+			for (i = 0; i < bf->nr; i++)
+				bitmap_or_ewah(result, bf->commits[i]);
+		}
+		or_ewah = getnanotime() - start;
+
+		start = getnanotime();
+		for (r = 0; r < rounds; r++)
+			for (i = 0; i < bf->nr; i++)
+				bitmap_and_not(result, bf->raw[i]);
+		and_not = getnanotime() - start;
+
+		start = getnanotime();
+		for (r = 0; r < rounds; r++)
+			for (i = 0; i < bf->nr; i++)
+				sink += bitmap_popcount(bf->raw[i]);
+		popcount = getnanotime() - start;
+
+		start = getnanotime();
+		for (r = 0; r < rounds; r++)
+			for (i = 0; i < bf->nr; i++)
+				for (t = 0; t < 4; t++)
+					sink += bitmap_popcount_and_ewah(
+						bf->raw[i], bf->types[t]);
+		types = getnanotime() - start;
+
+		printf("%-8s %10.3f %10.3f %10.3f %10.3f\n", name,
+		       ms_per_round(or_ewah, rounds),
+		       ms_per_round(and_not, rounds),
+		       ms_per_round(popcount, rounds),
+		       ms_per_round(types, rounds));
+	}
+	/* keep the counts from being optimized away */
+	if (!sink)
+		fprintf(stderr, "no bits set\n");
+	bitmap_free(result);
+}
+
+int main(int ac, const char **av)
+{
+	struct bitmap_file bf;
+	const char *arg;
+
+	if (ac >= 2 && skip_prefix(av[1], "--backend=", &arg)) {
+		if (cpu_backend_set(&bitmap_backends, arg))
+			die("bitmap backend '%s' is not supported", arg);
+		ac--;
+		av++;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "--backends")) {
+		const char *name;
+		int n;
+
+		for (n = 0; (name = cpu_backend_name(&bitmap_backends, n)); n++)
+			if (cpu_backend_supported(&bitmap_backends, name))
+				puts(name);
+		return 0;
+	}
+
+	memset(&bf, 0, sizeof(bf));
+	if ((ac == 3 || ac == 4) && !strcmp(av[1], "--bench")) {
+		int rounds = ac == 4 ? atoi(av[3]) : 100;
+
+		read_bitmap_file(av[2], &bf);
+		bench(&bf, rounds > 0 ? rounds : 1);
+		return 0;
+	}
+	if (ac != 2)
+		usage(usage_str);
+
+	read_bitmap_file(av[1], &bf);
+	show_results(&bf);
+	return 0;
+}
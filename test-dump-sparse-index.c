@@ -0,0 +1,22 @@
+#include "cache.h"
+
+int main(int ac, char **av)
+{
+	struct index_state *istate = &the_index;
+	int i;
+
+	setup_git_directory();
+	git_config(git_default_config, NULL);
+	/* show the index as it is on disk */
+	command_requires_full_index = 0;
+	if (read_index_from(istate, get_index_file()) < 0)
+		die("unable to read index file");
+	printf(istate->sparse_index ? "sparse index\n" : "full index\n");
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		printf("%06o %s %d\t%s\n", ce->ce_mode,
+		       sha1_to_hex(ce->sha1), ce_stage(ce), ce->name);
+	}
+	return 0;
+}
@@ -1,19 +1,175 @@
 #include "cache.h"
+#include "cpu-features.h"
 
-int main(int ac, char **av)
+static const char usage_str[] =
+"test-sha1 [--backend=<name>] [-b | <bufsz>]\n"
+"   or: test-sha1 [--backend=<name>] --multi <file>...\n"
+"   or: test-sha1 --backends\n"
+"   or: test-sha1 --bench [<size> [<count>]]";
+
+static void set_backend(const char *name)
+{
+#ifdef BLK_SHA1_BACKENDS
+	if (cpu_backend_set(&blk_SHA1_backends, name))
+		die("SHA-1 backend '%s' is not supported", name);
+#else
+	/* the only one list_backends() shows */
+	if (strcmp(name, "default"))
+		die("SHA-1 backends are not selectable in this build");
+#endif
+}
+
+static void list_backends(void)
+{
+#ifdef BLK_SHA1_BACKENDS
+	const char *name;
+	int i;
+
+	for (i = 0; (name = cpu_backend_name(&blk_SHA1_backends, i)); i++)
+		if (cpu_backend_supported(&blk_SHA1_backends, name))
+			puts(name);
+#else
+	puts("default");
+#endif
+}
+
+static void hash_files(int ac, const char **av)
+{
+	struct git_SHA1_multi_job *jobs = xcalloc(ac, sizeof(*jobs));
+	git_SHA_CTX *ctx = xcalloc(ac, sizeof(*ctx));
+	unsigned char (*sha1)[20] = xcalloc(ac, sizeof(*sha1));
+	struct strbuf *buf = xcalloc(ac, sizeof(*buf));
+	int i;
+
+	for (i = 0; i < ac; i++) {
+		if (strbuf_read_file(&buf[i], av[i], 0) < 0)
+			die_errno("cannot read '%s'", av[i]);
+		git_SHA1_Init(&ctx[i]);
+		jobs[i].ctx = &ctx[i];
+		jobs[i].data = buf[i].buf;
+		jobs[i].len = buf[i].len;
+		jobs[i].hash = sha1[i];
+	}
+	git_SHA1_Multi(jobs, ac);
+	for (i = 0; i < ac; i++) {
+		puts(sha1_to_hex(sha1[i]));
+		strbuf_release(&buf[i]);
+	}
+	free(buf);
+	free(sha1);
+	free(ctx);
+	free(jobs);
+}
+
+static double mb_per_sec(uint64_t bytes, uint64_t nanos)
+{
+	return nanos ? bytes / 1048576.0 / (nanos / 1e9) : 0;
+}
+
+/*
+ * Hash count buffers of size bytes one after the other and with the
+ * multi-buffer API, with each backend the CPU supports.
+ */
+static void bench(unsigned long size, int count)
+{
+	struct git_SHA1_multi_job *jobs = xcalloc(count, sizeof(*jobs));
+	git_SHA_CTX *ctx = xcalloc(count, sizeof(*ctx));
+	unsigned char (*sha1)[20] = xcalloc(count, sizeof(*sha1));
+	unsigned char *data = xmalloc(size * count);
+	uint64_t total = (uint64_t)size * count;
+	const char *name;
+	int i, n;
+
+	for (i = 0; i < size * count; i++)
+		data[i] = i * 7 + (i >> 11);
+
+	printf("%-8s %12s %12s\n", "backend", "serial MB/s", "multi MB/s");
+	for (n = 0; ; n++) {
+		uint64_t start, serial, multi;
+		int rounds, r;
+
+#ifdef BLK_SHA1_BACKENDS
+		name = cpu_backend_name(&blk_SHA1_backends, n);
+		if (!name)
+			break;
+		if (cpu_backend_set(&blk_SHA1_backends, name))
+			continue;
+#else
+		if (n)
+			break;
+		name = "default";
+#endif
+		/* hash at least 256MB in each mode */
+		rounds = (256 * 1048576) / (total ? total : 1) + 1;
+
+		start = getnanotime();
+		for (r = 0; r < rounds; r++)
+			for (i = 0; i < count; i++) {
+				git_SHA1_Init(&ctx[i]);
+				git_SHA1_Update(&ctx[i], data + i * size, size);
+				git_SHA1_Final(sha1[i], &ctx[i]);
+			}
+		serial = getnanotime() - start;
+
+		start = getnanotime();
+		for (r = 0; r < rounds; r++) {
+			for (i = 0; i < count; i++) {
+				git_SHA1_Init(&ctx[i]);
+				jobs[i].ctx = &ctx[i];
+				jobs[i].data = data + i * size;
+				jobs[i].len = size;
+				jobs[i].hash = sha1[i];
+			}
+			git_SHA1_Multi(jobs, count);
+		}
+		multi = getnanotime() - start;
+
+		printf("%-8s %12.1f %12.1f\n", name,
+		       mb_per_sec(total * rounds, serial),
+		       mb_per_sec(total * rounds, multi));
+	}
+	free(data);
+	free(sha1);
+	free(ctx);
+	free(jobs);
+}
+
+int main(int ac, const char **av)
 {
 	git_SHA_CTX ctx;
 	unsigned char sha1[20];
 	unsigned bufsz = 8192;
 	int binary = 0;
 	char *buffer;
+	const char *arg;
+
+	if (ac >= 2 && skip_prefix(av[1], "--backend=", &arg)) {
+		set_backend(arg);
+		ac--;
+		av++;
+	}
+
+	if (ac >= 2 && !strcmp(av[1], "--backends")) {
+		list_backends();
+		return 0;
+	}
+	if (ac >= 2 && !strcmp(av[1], "--multi")) {
+		hash_files(ac - 2, av + 2);
+		return 0;
+	}
+	if (ac >= 2 && !strcmp(av[1], "--bench")) {
+		bench(ac >= 3 ? strtoul(av[2], NULL, 10) : 1024,
+		      ac >= 4 ? atoi(av[3]) : 64);
+		return 0;
+	}
 
 	if (ac == 2) {
 		if (!strcmp(av[1], "-b"))
 			binary = 1;
 		else
 			bufsz = strtoul(av[1], NULL, 10) * 1024 * 1024;
-	}
+	} else if (ac > 2)
+		usage(usage_str);
 
 	if (!bufsz)
 		bufsz = 8192;
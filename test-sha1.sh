@@ -3,26 +3,28 @@
 dd if=/dev/zero bs=1048576 count=100 2>/dev/null |
 /usr/bin/time ./test-sha1 >/dev/null
 
-while read expect cnt pfx
+for backend in $(./test-sha1 --backends)
 do
-	case "$expect" in '#'*) continue ;; esac
-	actual=`
-		{
-			test -z "$pfx" || echo "$pfx"
-			dd if=/dev/zero bs=1048576 count=$cnt 2>/dev/null |
-			perl -pe 'y/\000/g/'
-		} | ./test-sha1 $cnt
-	`
-	if test "$expect" = "$actual"
-	then
-		echo "OK: $expect $cnt $pfx"
-	else
-		echo >&2 "OOPS: $cnt"
-		echo >&2 "expect: $expect"
-		echo >&2 "actual: $actual"
-		exit 1
-	fi
-done <<EOF
+	while read expect cnt pfx
+	do
+		case "$expect" in '#'*) continue ;; esac
+		actual=`
+			{
+				test -z "$pfx" || echo "$pfx"
+				dd if=/dev/zero bs=1048576 count=$cnt 2>/dev/null |
+				perl -pe 'y/\000/g/'
+			} | ./test-sha1 --backend=$backend $cnt
+		`
+		if test "$expect" = "$actual"
+		then
+			echo "OK: $backend $expect $cnt $pfx"
+		else
+			echo >&2 "OOPS: $backend $cnt"
+			echo >&2 "expect: $expect"
+			echo >&2 "actual: $actual"
+			exit 1
+		fi
+	done <<EOF
 da39a3ee5e6b4b0d3255bfef95601890afd80709 0
 3f786850e387550fdab836ed7e6dc881de23001b 0 a
 5277cbb45a15902137d332d97e89cf8136545485 0 ab
@@ -43,6 +45,7 @@ b095bd837a371593048136e429e9ac4b476e1bb3 512 frotz
 e33a291f42c30a159733dd98b8b3e4ff34158ca0 4090 4G
 #a3bf783bc20caa958f6cb24dd140a7b21984838d 9999 nitfol
 EOF
+done
 
 exit
 
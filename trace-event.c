@@ -0,0 +1,288 @@
+#include "cache.h"
+#include "run-command.h"
+#include "thread-utils.h"
+#include "trace-event.h"
+
+static struct trace_key trace_event_key = TRACE_KEY_INIT(EVENT);
+
+/* Passes the session id of a process on to its children. */
+#define TRACE_EVENT_PARENT_SID_ENVIRONMENT "GIT_TRACE_EVENT_PARENT_SID"
+
+struct trace_event_thread {
+	char name[32];
+	uint64_t start;
+	/* start times of the regions the thread is in, outermost first */
+	uint64_t *region_start;
+	int nesting, alloc;
+};
+
+static int enabled;
+static struct strbuf sid = STRBUF_INIT;
+static uint64_t process_start;
+static int exit_code, have_exit_code;
+static struct trace_event_thread main_thread = { "main" };
+static int thread_counter, child_counter;
+
+#ifndef NO_PTHREADS
+static pthread_key_t thread_key;
+static pthread_mutex_t counter_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define lock_counters()		pthread_mutex_lock(&counter_mutex)
+#define unlock_counters()	pthread_mutex_unlock(&counter_mutex)
+#else
+#define lock_counters()		(void)0
+#define unlock_counters()	(void)0
+#endif
+
+static struct trace_event_thread *current_thread(void)
+{
+#ifndef NO_PTHREADS
+	struct trace_event_thread *t = pthread_getspecific(thread_key);
+	if (t)
+		return t;
+#endif
+	return &main_thread;
+}
+
+static void json_quote(struct strbuf *sb, const char *s)
+{
+	strbuf_addch(sb, '"');
+	for (; *s; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			strbuf_addf(sb, "\\%c", c);
+		else if (c == '\n')
+			strbuf_addstr(sb, "\\n");
+		else if (c == '\t')
+			strbuf_addstr(sb, "\\t");
+		else if (c < 0x20 || c == 0x7f)
+			strbuf_addf(sb, "\\u%04x", c);
+		else
+			strbuf_addch(sb, c);
+	}
+	strbuf_addch(sb, '"');
+}
+
+static void add_string(struct strbuf *sb, const char *key, const char *value)
+{
+	strbuf_addf(sb, ",\"%s\":", key);
+	json_quote(sb, value);
+}
+
+static void add_seconds(struct strbuf *sb, const char *key, uint64_t nanos)
+{
+	strbuf_addf(sb, ",\"%s\":%"PRIuMAX".%06u", key,
+		    (uintmax_t)(nanos / 1000000000),
+		    (unsigned)(nanos % 1000000000 / 1000));
+}
+
+static void add_argv(struct strbuf *sb, const char **argv)
+{
+	strbuf_addstr(sb, ",\"argv\":[");
+	for (; *argv; argv++) {
+		json_quote(sb, *argv);
+		if (argv[1])
+			strbuf_addch(sb, ',');
+	}
+	strbuf_addch(sb, ']');
+}
+
+/*
+ * Start an event of the calling thread in sb; the caller adds its
+ * fields and hands sb to emit().
+ */
+static void event_begin(struct strbuf *sb, const char *event,
+			struct trace_event_thread *t)
+{
+	strbuf_addf(sb, "{\"event\":\"%s\"", event);
+	add_string(sb, "sid", sid.buf);
+	add_string(sb, "thread", t->name);
+	add_seconds(sb, "time", getnanotime());
+}
+
+static void emit(struct strbuf *sb)
+{
+	/* a single write keeps the lines of different threads apart */
+	strbuf_addstr(sb, "}\n");
+	trace_verbatim(&trace_event_key, sb->buf, sb->len);
+	strbuf_release(sb);
+}
+
+static void trace_event_atexit(void)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	event_begin(&sb, "exit", current_thread());
+	add_seconds(&sb, "t_abs", getnanotime() - process_start);
+	if (have_exit_code)
+		strbuf_addf(&sb, ",\"code\":%d", exit_code);
+	emit(&sb);
+}
+
+void trace_event_start(const char **argv)
+{
+	struct strbuf sb = STRBUF_INIT;
+	const char *parent;
+
+	if (enabled || !trace_want(&trace_event_key))
+		return;
+	enabled = 1;
+
+	process_start = getnanotime();
+	main_thread.start = process_start;
+#ifndef NO_PTHREADS
+	pthread_key_create(&thread_key, NULL);
+#endif
+
+	parent = getenv(TRACE_EVENT_PARENT_SID_ENVIRONMENT);
+	if (parent && *parent)
+		strbuf_addf(&sid, "%s/", parent);
+	strbuf_addf(&sid, "%"PRIuMAX, (uintmax_t)getpid());
+	setenv(TRACE_EVENT_PARENT_SID_ENVIRONMENT, sid.buf, 1);
+
+	event_begin(&sb, "start", &main_thread);
+	add_argv(&sb, argv);
+	emit(&sb);
+
+	atexit(trace_event_atexit);
+}
+
+int trace_event_exit(int code)
+{
+	exit_code = code;
+	have_exit_code = 1;
+	return code;
+}
+
+void trace_event_child_start(struct child_process *cmd)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!enabled)
+		return;
+
+	lock_counters();
+	cmd->trace_event_id = ++child_counter;
+	unlock_counters();
+	cmd->trace_event_start = getnanotime();
+
+	event_begin(&sb, "child_start", current_thread());
+	strbuf_addf(&sb, ",\"child_id\":%d,\"git_cmd\":%s",
+		    cmd->trace_event_id, cmd->git_cmd ? "true" : "false");
+	add_argv(&sb, cmd->argv);
+	emit(&sb);
+}
+
+void trace_event_child_exit(struct child_process *cmd, int code)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!enabled || !cmd->trace_event_id)
+		return;
+
+	event_begin(&sb, "child_exit", current_thread());
+	strbuf_addf(&sb, ",\"child_id\":%d,\"pid\":%"PRIuMAX",\"code\":%d",
+		    cmd->trace_event_id, (uintmax_t)cmd->pid, code);
+	add_seconds(&sb, "t_rel", getnanotime() - cmd->trace_event_start);
+	emit(&sb);
+	cmd->trace_event_id = 0;
+}
+
+void trace_event_thread_start(const char *name)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct trace_event_thread *t;
+	int id;
+
+	if (!enabled)
+		return;
+
+	lock_counters();
+	id = ++thread_counter;
+	unlock_counters();
+
+	t = xcalloc(1, sizeof(*t));
+	snprintf(t->name, sizeof(t->name), "th%02d:%s", id, name);
+	t->start = getnanotime();
+#ifndef NO_PTHREADS
+	pthread_setspecific(thread_key, t);
+#endif
+
+	event_begin(&sb, "thread_start", t);
+	emit(&sb);
+}
+
+void trace_event_thread_exit(void)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct trace_event_thread *t;
+
+	if (!enabled)
+		return;
+	t = current_thread();
+	if (t == &main_thread)
+		return;
+
+	event_begin(&sb, "thread_exit", t);
+	add_seconds(&sb, "t_rel", getnanotime() - t->start);
+	emit(&sb);
+
+#ifndef NO_PTHREADS
+	pthread_setspecific(thread_key, NULL);
+#endif
+	free(t->region_start);
+	free(t);
+}
+
+void trace_event_region_enter(const char *category, const char *label)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct trace_event_thread *t;
+
+	if (!enabled)
+		return;
+	t = current_thread();
+
+	ALLOC_GROW(t->region_start, t->nesting + 1, t->alloc);
+	t->region_start[t->nesting++] = getnanotime();
+
+	event_begin(&sb, "region_enter", t);
+	strbuf_addf(&sb, ",\"nesting\":%d", t->nesting);
+	add_string(&sb, "category", category);
+	add_string(&sb, "label", label);
+	emit(&sb);
+}
+
+void trace_event_region_leave(const char *category, const char *label)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct trace_event_thread *t;
+
+	if (!enabled)
+		return;
+	t = current_thread();
+	if (!t->nesting)
+		die("BUG: leaving region '%s' without entering it", label);
+
+	event_begin(&sb, "region_leave", t);
+	strbuf_addf(&sb, ",\"nesting\":%d", t->nesting);
+	add_string(&sb, "category", category);
+	add_string(&sb, "label", label);
+	add_seconds(&sb, "t_rel", getnanotime() - t->region_start[--t->nesting]);
+	emit(&sb);
+}
+
+void trace_event_data(const char *category, const char *key, intmax_t value)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!enabled)
+		return;
+
+	event_begin(&sb, "data", current_thread());
+	strbuf_addf(&sb, ",\"nesting\":%d", current_thread()->nesting);
+	add_string(&sb, "category", category);
+	add_string(&sb, "key", key);
+	strbuf_addf(&sb, ",\"value\":%"PRIdMAX, value);
+	emit(&sb);
+}
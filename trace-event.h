@@ -0,0 +1,41 @@
+#ifndef TRACE_EVENT_H
+#define TRACE_EVENT_H
+
+struct child_process;
+
+/*
+ * Structured performance events, written as one JSON object per line
+ * to the target of GIT_TRACE_EVENT (see Documentation/technical/api-trace.txt
+ * for the format).  All functions do nothing unless GIT_TRACE_EVENT is
+ * set, and may be called from any thread.
+ */
+
+/* Start tracing the process: emit "start" and "exit" (at exit). */
+void trace_event_start(const char **argv);
+
+/* Record the exit code for the "exit" event, and return it. */
+int trace_event_exit(int code);
+
+/* Emit "child_start" and "child_exit" for a child process. */
+void trace_event_child_start(struct child_process *cmd);
+void trace_event_child_exit(struct child_process *cmd, int code);
+
+/*
+ * Name the calling thread, and emit "thread_start"; call
+ * trace_event_thread_exit() before the thread returns.  Threads that
+ * do not call trace_event_thread_start() are reported as "main".
+ */
+void trace_event_thread_start(const char *name);
+void trace_event_thread_exit(void);
+
+/*
+ * Enter and leave a named region of the calling thread; regions nest,
+ * and "region_leave" reports the time spent in the region.
+ */
+void trace_event_region_enter(const char *category, const char *label);
+void trace_event_region_leave(const char *category, const char *label);
+
+/* Emit a "data" event with a counter. */
+void trace_event_data(const char *category, const char *key, intmax_t value);
+
+#endif /* TRACE_EVENT_H */
@@ -476,6 +476,12 @@ static int set_git_option(struct git_transport_options *opts,
 				die("transport: invalid depth option '%s'", value);
 		}
 		return 0;
+	} else if (!strcmp(name, TRANS_OPT_LIST_OBJECTS_FILTER)) {
+		list_objects_filter_release(&opts->filter_options);
+		if (value &&
+		    parse_list_objects_filter(&opts->filter_options, value))
+			die("transport: invalid filter option '%s'", value);
+		return 0;
 	}
 	return 1;
 }
@@ -483,14 +489,18 @@ static int set_git_option(struct git_transport_options *opts,
 static int connect_setup(struct transport *transport, int for_push, int verbose)
 {
 	struct git_transport_data *data = transport->data;
+	int flags = verbose ? CONNECT_VERBOSE : 0;
 
 	if (data->conn)
 		return 0;
 
+	if (transport->ssh_ref_prefixes)
+		flags |= CONNECT_SSH_REF_PREFIXES;
 	data->conn = git_connect(data->fd, transport->url,
 				 for_push ? data->options.receivepack :
 				 data->options.uploadpack,
-				 verbose ? CONNECT_VERBOSE : 0);
+				 flags,
+				 for_push ? NULL : transport->ref_prefixes);
 
 	return 0;
 }
@@ -533,6 +543,7 @@ static int fetch_refs_via_pack(struct transport *transport,
 		data->options.check_self_contained_and_connected;
 	args.cloning = transport->cloning;
 	args.update_shallow = data->options.update_shallow;
+	args.filter_options = data->options.filter_options;
 
 	if (!data->got_remote_heads) {
 		connect_setup(transport, 0, 0);
@@ -853,7 +864,7 @@ static int connect_git(struct transport *transport, const char *name,
 {
 	struct git_transport_data *data = transport->data;
 	data->conn = git_connect(data->fd, transport->url,
-				 executable, 0);
+				 executable, 0, NULL);
 	fd[0] = data->fd[0];
 	fd[1] = data->fd[1];
 	return 0;
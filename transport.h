@@ -4,6 +4,7 @@
 #include "cache.h"
 #include "run-command.h"
 #include "remote.h"
+#include "list-objects-filter.h"
 
 struct git_transport_options {
 	unsigned thin : 1;
@@ -13,6 +14,7 @@ struct git_transport_options {
 	unsigned self_contained_and_connected : 1;
 	unsigned update_shallow : 1;
 	int depth;
+	struct list_objects_filter_options filter_options;
 	const char *uploadpack;
 	const char *receivepack;
 	struct push_cas_option *cas;
@@ -42,6 +44,16 @@ struct transport {
 	 */
 	unsigned cloning : 1;
 
+	/*
+	 * Ref prefixes the caller is interested in when fetching, or
+	 * NULL.  Smart transports ask the remote to advertise only the
+	 * refs under these prefixes (and HEAD); over ssh only if
+	 * ssh_ref_prefixes is set, as a restricted remote shell may
+	 * reject the extra arguments.  The remote may advertise more.
+	 */
+	const struct string_list *ref_prefixes;
+	unsigned ssh_ref_prefixes : 1;
+
 	/**
 	 * Returns 0 if successful, positive if the option is not
 	 * recognized or is inapplicable, and negative if the option
@@ -180,6 +192,9 @@ int transport_restrict_protocols(void);
 /* Send push certificates */
 #define TRANS_OPT_PUSH_CERT "pushcert"
 
+/* Ask the other side to omit the objects the filter-spec omits */
+#define TRANS_OPT_LIST_OBJECTS_FILTER "filter"
+
 /**
  * Returns 0 if the option was used, non-zero otherwise. Prints a
  * message to stderr if the option is not used.
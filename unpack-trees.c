@@ -9,7 +9,10 @@
 #include "refs.h"
 #include "attr.h"
 #include "split-index.h"
+#include "parallel-checkout.h"
+#include "sparse-index.h"
 #include "dir.h"
+#include "sha1-array.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -187,7 +190,7 @@ static void unlink_entry(const struct cache_entry *ce)
 static struct checkout state;
 static int check_updates(struct unpack_trees_options *o)
 {
-	unsigned cnt = 0, total = 0;
+	unsigned cnt = 0, total = 0, nr_updates = 0;
 	struct progress *progress = NULL;
 	struct index_state *index = &o->result;
 	int i;
@@ -220,6 +223,29 @@ static int check_updates(struct unpack_trees_options *o)
 	remove_marked_cache_entries(&o->result);
 	remove_scheduled_dirs();
 
+	if (o->update && !o->dry_run) {
+		struct sha1_array to_fetch = SHA1_ARRAY_INIT;
+
+		for (i = 0; i < index->cache_nr; i++) {
+			const struct cache_entry *ce = index->cache[i];
+
+			if (!(ce->ce_flags & CE_UPDATE))
+				continue;
+			nr_updates++;
+			/*
+			 * Fetch the blobs a partial clone does not have
+			 * in one go, instead of one at a time below.
+			 */
+			if (repository_format_partial_clone &&
+			    !S_ISGITLINK(ce->ce_mode) && !has_sha1_file(ce->sha1))
+				sha1_array_append(&to_fetch, ce->sha1);
+		}
+		if (to_fetch.nr)
+			fetch_promisor_objects(&to_fetch);
+		sha1_array_clear(&to_fetch);
+		init_parallel_checkout(nr_updates);
+	}
+
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
@@ -234,6 +260,7 @@ static int check_updates(struct unpack_trees_options *o)
 			}
 		}
 	}
+	errs |= run_parallel_checkout(&state);
 	stop_progress(&progress);
 	if (o->update)
 		git_attr_set_direction(GIT_ATTR_CHECKIN, NULL);
@@ -528,6 +555,14 @@ static int compare_entry(const struct cache_entry *ce, const struct traverse_inf
 	if (cmp)
 		return cmp;
 
+	/*
+	 * A sparse directory entry is the directory itself, though its
+	 * name has the trailing slash.
+	 */
+	if (S_ISSPARSEDIR(ce->ce_mode) && S_ISDIR(n->mode) &&
+	    ce_namelen(ce) == traverse_path_len(info, n) + 1)
+		return 0;
+
 	/*
 	 * Even if the beginning compared identically, the ce should
 	 * compare as bigger than a directory leading up to it!
@@ -620,6 +655,40 @@ static int unpack_nondirectories(int n, unsigned long mask,
 	return 0;
 }
 
+/*
+ * The index entry src[0] is a sparse directory matching the trees in
+ * "dirmask": hand the trees to the merge function as sparse directory
+ * entries, too, instead of descending into them.
+ */
+static int unpack_sparse_directory(int n, unsigned long mask,
+				   unsigned long dirmask,
+				   struct cache_entry **src,
+				   const struct name_entry *names,
+				   const struct traverse_info *info)
+{
+	struct unpack_trees_options *o = info->data;
+	int i, rc;
+
+	for (i = 0; i < n; i++) {
+		struct cache_entry *ce;
+
+		if (!(dirmask & (1ul << i)))
+			continue;
+		ce = create_ce_entry(info, names + i, 0);
+		ce = xrealloc(ce, cache_entry_size(ce_namelen(ce) + 1));
+		ce->name[ce->ce_namelen++] = '/';
+		ce->name[ce->ce_namelen] = '\0';
+		ce->ce_mode = S_IFDIR;
+		src[i + o->merge] = ce;
+	}
+
+	rc = call_unpack_fn((const struct cache_entry * const *)src, o);
+	for (i = 0; i < n; i++)
+		free(src[i + o->merge]);
+	mark_ce_used(src[0], o);
+	return rc < 0 ? -1 : mask;
+}
+
 static int unpack_failed(struct unpack_trees_options *o, const char *message)
 {
 	discard_index(&o->result);
@@ -787,6 +856,9 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 		}
 	}
 
+	if (src[0] && S_ISSPARSEDIR(src[0]->ce_mode))
+		return unpack_sparse_directory(n, mask, dirmask, src, names, info);
+
 	if (unpack_nondirectories(n, mask, dirmask, src, names, info) < 0)
 		return -1;
 
@@ -1037,11 +1109,20 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		free(sparse);
 	}
 
+	/*
+	 * Only a caller that merges a single tree into nothing knows
+	 * what to do with sparse directory entries.
+	 */
+	if (!o->sparse_directories || len != 1 || o->dst_index)
+		ensure_full_index(o->src_index);
+
 	memset(&o->result, 0, sizeof(o->result));
 	o->result.initialized = 1;
 	o->result.timestamp.sec = o->src_index->timestamp.sec;
 	o->result.timestamp.nsec = o->src_index->timestamp.nsec;
 	o->result.version = o->src_index->version;
+	o->result.fsmonitor_last_update = o->src_index->fsmonitor_last_update;
+	o->result.fsmonitor_has_run_once = o->src_index->fsmonitor_has_run_once;
 	o->result.split_index = o->src_index->split_index;
 	if (o->result.split_index)
 		o->result.split_index->refcount++;
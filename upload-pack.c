@@ -9,13 +9,14 @@
 #include "diff.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "list-objects-filter.h"
 #include "run-command.h"
 #include "connect.h"
 #include "sigchain.h"
 #include "version.h"
 #include "string-list.h"
 
-static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=<n>] <dir>";
+static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=<n>] [--ref-prefix=<prefix>...] <dir>";
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
@@ -39,6 +40,8 @@ static int no_progress, daemon_mode;
 #define ALLOW_TIP_SHA1	01
 /* Allow request of a sha1 if it is reachable from a ref (possibly hidden ref). */
 #define ALLOW_REACHABLE_SHA1	02
+/* Allow request of any sha1. Implies ALLOW_TIP_SHA1 and ALLOW_REACHABLE_SHA1. */
+#define ALLOW_ANY_SHA1	07
 static unsigned int allow_unadvertised_object_request;
 static int shallow_nr;
 static struct object_array have_obj;
@@ -52,6 +55,15 @@ static int keepalive = 5;
 static int use_sideband;
 static int advertise_refs;
 static int stateless_rpc;
+/*
+ * With limit_refs, only HEAD and the refs under ref_prefixes are
+ * advertised (and can be asked for).
+ */
+static int limit_refs;
+static struct string_list ref_prefixes = STRING_LIST_INIT_NODUP;
+/* With allow_filter, the client can ask for a partial pack. */
+static int allow_filter;
+static struct list_objects_filter_options filter_options;
 
 static void reset_timeout(void)
 {
@@ -112,6 +124,8 @@ static void create_pack_file(void)
 		argv[arg++] = "--delta-base-offset";
 	if (use_include_tag)
 		argv[arg++] = "--include-tag";
+	if (filter_options.choice)
+		argv[arg++] = xstrfmt("--filter=%s", filter_options.filter_spec);
 	argv[arg++] = NULL;
 
 	pack_objects.in = -1;
@@ -549,7 +563,7 @@ static void receive_needs(void)
 	shallow_nr = 0;
 	for (;;) {
 		struct object *o;
-		const char *features;
+		const char *features, *arg;
 		unsigned char sha1_buf[20];
 		char *line = packet_read_line(0, NULL);
 		reset_timeout();
@@ -579,6 +593,13 @@ static void receive_needs(void)
 				die("Invalid deepen: %s", line);
 			continue;
 		}
+		if (skip_prefix(line, "filter ", &arg)) {
+			if (!allow_filter)
+				die("git upload-pack: filtering capability not negotiated");
+			if (parse_list_objects_filter(&filter_options, arg))
+				die("git upload-pack: invalid filter: %s", line);
+			continue;
+		}
 		if (!starts_with(line, "want ") ||
 		    get_sha1_hex(line+5, sha1_buf))
 			die("git upload-pack: protocol error, "
@@ -624,7 +645,8 @@ static void receive_needs(void)
 	 * have been based on the set of older refs advertised
 	 * by another process that handled the initial request.
 	 */
-	if (has_non_tip)
+	if (has_non_tip &&
+	    (allow_unadvertised_object_request & ALLOW_ANY_SHA1) != ALLOW_ANY_SHA1)
 		check_non_tip();
 
 	if (!use_sideband && daemon_mode)
@@ -724,7 +746,7 @@ static int send_ref(const char *refname, const struct object_id *oid,
 {
 	static const char *capabilities = "multi_ack thin-pack side-band"
 		" side-band-64k ofs-delta shallow no-progress"
-		" include-tag multi_ack_detailed";
+		" include-tag multi_ack_detailed ref-prefix";
 	const char *refname_nons = strip_namespace(refname);
 	struct object_id peeled;
 
@@ -735,7 +757,7 @@ static int send_ref(const char *refname, const struct object_id *oid,
 		struct strbuf symref_info = STRBUF_INIT;
 
 		format_symref_info(&symref_info, cb_data);
-		packet_write(1, "%s %s%c%s%s%s%s%s agent=%s\n",
+		packet_write(1, "%s %s%c%s%s%s%s%s%s agent=%s\n",
 			     oid_to_hex(oid), refname_nons,
 			     0, capabilities,
 			     (allow_unadvertised_object_request & ALLOW_TIP_SHA1) ?
@@ -743,6 +765,7 @@ static int send_ref(const char *refname, const struct object_id *oid,
 			     (allow_unadvertised_object_request & ALLOW_REACHABLE_SHA1) ?
 				     " allow-reachable-sha1-in-want" : "",
 			     stateless_rpc ? " no-done" : "",
+			     allow_filter ? " filter" : "",
 			     symref_info.buf,
 			     git_user_agent_sanitized());
 		strbuf_release(&symref_info);
@@ -772,6 +795,52 @@ static int find_symref(const char *refname, const struct object_id *oid,
 	return 0;
 }
 
+/*
+ * Sort the requested prefixes and drop those that are covered by
+ * another one, so that each ref is visited once and in order.  All
+ * refs are under "refs/", so a prefix of "refs/" asks for all of them
+ * and a prefix that does not start with "refs/" for none.
+ */
+static void prepare_ref_prefixes(void)
+{
+	struct string_list_item *item;
+	const char *last = NULL;
+	int i, nr = 0;
+
+	for_each_string_list_item(item, &ref_prefixes)
+		if (starts_with("refs/", item->string))
+			item->string = "refs/";
+	string_list_sort(&ref_prefixes);
+
+	for (i = 0; i < ref_prefixes.nr; i++) {
+		const char *prefix = ref_prefixes.items[i].string;
+
+		if (!starts_with(prefix, "refs/") ||
+		    (last && starts_with(prefix, last)))
+			continue;
+		ref_prefixes.items[nr++].string = (char *)prefix;
+		last = prefix;
+	}
+	ref_prefixes.nr = nr;
+}
+
+static void for_each_advertised_ref(each_ref_fn fn, void *cb_data)
+{
+	struct strbuf prefix = STRBUF_INIT;
+	struct string_list_item *item;
+
+	if (!limit_refs) {
+		for_each_namespaced_ref(fn, cb_data);
+		return;
+	}
+	for_each_string_list_item(item, &ref_prefixes) {
+		strbuf_reset(&prefix);
+		strbuf_addf(&prefix, "%s%s", get_git_namespace(), item->string);
+		for_each_fullref_in(prefix.buf, fn, cb_data, 0);
+	}
+	strbuf_release(&prefix);
+}
+
 static void upload_pack(void)
 {
 	struct string_list symref = STRING_LIST_INIT_DUP;
@@ -781,12 +850,12 @@ static void upload_pack(void)
 	if (advertise_refs || !stateless_rpc) {
 		reset_timeout();
 		head_ref_namespaced(send_ref, &symref);
-		for_each_namespaced_ref(send_ref, &symref);
+		for_each_advertised_ref(send_ref, &symref);
 		advertise_shallow_grafts(1);
 		packet_flush(1);
 	} else {
 		head_ref_namespaced(check_ref, NULL);
-		for_each_namespaced_ref(check_ref, NULL);
+		for_each_advertised_ref(check_ref, NULL);
 	}
 	string_list_clear(&symref, 1);
 	if (advertise_refs)
@@ -811,6 +880,13 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 			allow_unadvertised_object_request |= ALLOW_REACHABLE_SHA1;
 		else
 			allow_unadvertised_object_request &= ~ALLOW_REACHABLE_SHA1;
+	} else if (!strcmp("uploadpack.allowanysha1inwant", var)) {
+		if (git_config_bool(var, value))
+			allow_unadvertised_object_request |= ALLOW_ANY_SHA1;
+		else
+			allow_unadvertised_object_request &= ~ALLOW_ANY_SHA1;
+	} else if (!strcmp("uploadpack.allowfilter", var)) {
+		allow_filter = git_config_bool(var, value);
 	} else if (!strcmp("uploadpack.keepalive", var)) {
 		keepalive = git_config_int(var, value);
 		if (!keepalive)
@@ -822,6 +898,7 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 int main(int argc, char **argv)
 {
 	char *dir;
+	const char *prefix;
 	int i;
 	int strict = 0;
 
@@ -853,6 +930,11 @@ int main(int argc, char **argv)
 			daemon_mode = 1;
 			continue;
 		}
+		if (skip_prefix(arg, "--ref-prefix=", &prefix)) {
+			string_list_append(&ref_prefixes, prefix);
+			limit_refs = 1;
+			continue;
+		}
 		if (!strcmp(arg, "--")) {
 			i++;
 			break;
@@ -870,6 +952,7 @@ int main(int argc, char **argv)
 		die("'%s' does not appear to be a git repository", dir);
 
 	git_config(upload_pack_config, NULL);
+	prepare_ref_prefixes();
 	upload_pack();
 	return 0;
 }
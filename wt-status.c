@@ -15,6 +15,7 @@
 #include "column.h"
 #include "strbuf.h"
 #include "utf8.h"
+#include "sparse-index.h"
 
 static const char cut_line[] =
 "------------------------ >8 ------------------------\n";
@@ -547,6 +548,9 @@ static void wt_status_collect_changes_initial(struct wt_status *s)
 {
 	int i;
 
+	/* everything is new, even what is in sparse directories */
+	ensure_full_index(&the_index);
+
 	for (i = 0; i < active_nr; i++) {
 		struct string_list_item *it;
 		struct wt_status_change_data *d;